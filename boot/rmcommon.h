@@ -41,12 +41,33 @@
  * @RCODE_SECTOR_LBA: Disk logical block address to read from
  * @RCODE_FIRST_CALL: Mark the first call (to print a message)
  * @RCODE_DRIVE_NUMBER: The BIOS-passed EDD Drive Number
- * @RCODE_BUFFER: Temporary buffer to hold the just-read sector
+ * @RCODE_SECTORS_CNT: Number of sectors to read, up to BOUNCE_SECTORS
+ * @RCODE_LAST_CALL: Mark the last call (to print the load time)
+ * @RCODE_START_TICKS: BIOS timer ticks count at the first call
  */
 #define RCODE_SECTOR_LBA	(RCODE_PARAMS_BASE)	/* long */
 #define RCODE_FIRST_CALL	(RCODE_PARAMS_BASE + 4)	/* long */
 #define RCODE_DRIVE_NUMBER	(RCODE_PARAMS_BASE + 8)	/* long */
-#define RCODE_BUFFER		(RCODE_PARAMS_BASE +12)	/* 512-bytes */
+#define RCODE_SECTORS_CNT	(RCODE_PARAMS_BASE +12)	/* long */
+#define RCODE_LAST_CALL		(RCODE_PARAMS_BASE +16)	/* long */
+#define RCODE_START_TICKS	(RCODE_PARAMS_BASE +20)	/* long */
+
+/*
+ * Bounce buffer for the just-read sectors, in the free low memory
+ * left behind by the bootsector's kernel copy (now above 1-MB).
+ *
+ * EDD reads are limited to 127 sectors each, and some BIOSes fail
+ * transfers crossing a 64-KB physical boundary. The buffer thus
+ * starts 127 sectors below such a boundary: two maximum-sized reads,
+ * one on each side of it, fill the buffer contiguously.
+ *
+ * @EDD_SECTORS_MAX: Max number of sectors per extended read
+ * @RCODE_BOUNCE: Bounce buffer start; 16-byte aligned
+ * @BOUNCE_SECTORS: Bounce buffer size, in 512-byte sectors
+ */
+#define EDD_SECTORS_MAX		127
+#define RCODE_BOUNCE		(0x30000 - EDD_SECTORS_MAX * 512)
+#define BOUNCE_SECTORS		(2 * EDD_SECTORS_MAX)
 
 /*
  * Check for Enhanced Disk Drive (EDD) BIOS support. Jump
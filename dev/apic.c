@@ -13,73 +13,46 @@
 #include <msr.h>
 #include <apic.h>
 #include <vectors.h>
-#include <pit.h>
 #include <tsc.h>
+#include <ktime.h>
+#include <x86.h>
+#include <percpu.h>
 
-static union apic_id bootstrap_apic_id;
+static uint32_t bootstrap_apic_id;
 static bool bootstrap_apic_id_saved;
 
 /*
- * Internal and external clock frequencies
- * @cpu_clock: CPU internal clock (speed)
- * @apic_clock: CPU external bus clock (APIC timer, ..)
+ * Set once by the BSC, before any core enables its APIC: all
+ * local APICs must be in the same mode.
  */
-static uint64_t cpu_clock;
-static uint64_t apic_clock;
+bool apic_x2mode;
 
 /*
- * Where the APIC registers are virtually mapped
+ * Can the timer fire at absolute TSC values? Set once by
+ * the BSC, from CPUID.01H:ECX[24].
  */
-static void *apic_virt_base;
+bool apic_tsc_deadline;
 
 /*
- * Clock calibrations
+ * CPU external bus clock (APIC timer, ..) frequency. The
+ * CPU internal clock is the TSC rate: check ktime.c
  */
+static uint64_t apic_clock;
 
 /*
- * Calculate the processor clock using the PIT and the time-
- * stamp counter: it's increased by one for each clock cycle.
- *
- * There's a possibility of being hit by a massive SMI, we
- * repeat the calibration to hope this wasn't the case. Some
- * SMI handlers can take many milliseconds to complete!
- *
- * FIXME: For Intel core2duo cpus and up, ask the architect-
- * ural event monitoring interface to calculate cpu clock.
- *
- * Return cpu clock ticks per second.
+ * Where the APIC registers are virtually mapped
  */
-static uint64_t pit_calibrate_cpu(int repeat)
-{
-	int ms_delay;
-	uint64_t tsc1, tsc2, diff, diff_min, cpu_clock;
-
-	ms_delay = 5;
-	diff_min = UINT64_MAX;
-	for (int i = 0; i < repeat; i ++) {
-		tsc1 = read_tsc();
-		pit_mdelay(ms_delay);
-		tsc2 = read_tsc();
-
-		diff = tsc2 - tsc1;
-		if (diff < diff_min)
-			diff_min = diff;
-	}
-
-	/* ticks per second = ticks / delay-in-seconds
-	 *                  = ticks / (delay / 1000)
-	 *                  = ticks * (1000 / delay)
-	 * We use last form to avoid float arithmetic */
-	cpu_clock = diff_min * (1000 / ms_delay);
+static void *apic_virt_base;
 
-	return cpu_clock;
-}
+/*
+ * Clock calibrations
+ */
 
 /*
  * Calibrate CPU external bus clock, which is the time
  * base of the APIC timer.
  */
-static uint64_t pit_calibrate_apic_timer(void)
+static uint64_t calibrate_apic_timer(void)
 {
 	int ms_delay;
 	uint32_t counter1, counter2, ticks, ticks_min;
@@ -99,7 +72,7 @@ static uint64_t pit_calibrate_apic_timer(void)
 
 	for (int i = 0; i < 5; i++) {
 		apic_write(APIC_TIMER_INIT_CNT, counter1);
-		pit_mdelay(ms_delay);
+		mdelay(ms_delay);
 		counter2 = apic_read(APIC_TIMER_CUR_CNT);
 
 		assert(counter1 > counter2);
@@ -117,6 +90,41 @@ static uint64_t pit_calibrate_apic_timer(void)
 	return apic_clock;
 }
 
+/*
+ * x2APIC
+ */
+
+#define CPUID_X2APIC	(1U << 21)	/* Leaf 1, %ecx */
+
+/*
+ * x2APIC mode saves us the ICR two MMIO writes and delivery
+ * status polling on each IPI. Without interrupt remapping,
+ * though, an I/O APIC logical broadcast (dest 0xff) reaches
+ * only x2APIC cluster 0 cores 0-7. Fall back to xAPIC if any
+ * core would be missed, unless the firmware already handed
+ * us the x2APIC mode: there's no going back then.
+ */
+static bool x2apic_usable(void)
+{
+	int max_id = 0;
+
+	if ((cpuid(1).ecx & CPUID_X2APIC) == 0)
+		return false;
+
+	if (msr_apicbase_x2enabled())
+		return true;
+
+	for (int i = 0; i < mptables_get_nr_cpus(); i++)
+		max_id = max(max_id, cpus[i]->apic_id);
+	if (max_id >= 8) {
+		printk("APIC: apic_id=%d unreachable by x2APIC broadcasts; "
+		       "using xAPIC mode\n", max_id);
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Local APIC
  */
@@ -139,6 +147,8 @@ void apic_local_regs_init(void)
 	union apic_lvt_lint lint1 = { .value = APIC_LVT_RESET };
 
 	msr_apicbase_setaddr(APIC_PHBASE);
+	if (apic_x2mode)
+		msr_apicbase_x2enable();
 
 	tpr.subclass = APIC_TPR_DISABLE_IRQ_BALANCE;
 	tpr.priority = APIC_TPR_DISABLE_IRQ_BALANCE;
@@ -156,14 +166,19 @@ void apic_local_regs_init(void)
 	 * To support broadcasting interrupts even in the case of
 	 * more than 8 cores, we set all cores logical IDs to all 1s
 	 * (0xff). By this, we lose the unique identification feature
-	 * while gaining the ability to broadcast messages to all. */
-	ldr.logical_id = 0xff;
-	apic_write(APIC_LDR, ldr.value);
-
-	/* "All processors that have their APIC software enabled
-	 * must have their DFRs programmed identically." --Intel */
-	dfr.apic_model = APIC_MODEL_FLAT;
-	apic_write(APIC_DFR, dfr.value);
+	 * while gaining the ability to broadcast messages to all.
+	 *
+	 * In x2APIC mode, the LDR is read-only and set by hardware to
+	 * the cluster model; x2apic_usable() handles the rest. */
+	if (!apic_x2mode) {
+		ldr.logical_id = 0xff;
+		apic_write(APIC_LDR, ldr.value);
+
+		/* "All processors that have their APIC software enabled
+		 * must have their DFRs programmed identically." --Intel */
+		dfr.apic_model = APIC_MODEL_FLAT;
+		apic_write(APIC_DFR, dfr.value);
+	}
 
 	timer.vector = APIC_TIMER_VECTOR;
 	timer.mask = APIC_MASK;
@@ -207,7 +222,6 @@ void apic_init(void)
 	 * - Before doing any apic operation, assure the APIC
 	 *   registers base address is set where we expect it
 	 * - Map the MMIO registers region before accessing it
-	 * - Find CPU's internal clock frequency: calibrate TSC
 	 * - Find APIC timer frequency: calibrate CPU's bus clock
 	 * - Initialize the APIC's full set of registers
 	 */
@@ -215,22 +229,25 @@ void apic_init(void)
 	msr_apicbase_setaddr(APIC_PHBASE);
 
 	apic_virt_base = vm_kmap(APIC_PHBASE, APIC_MMIO_SPACE);
+	apic_x2mode = x2apic_usable();
+	if (apic_x2mode)
+		msr_apicbase_x2enable();
 
-	cpu_clock = pit_calibrate_cpu(10);
-	printk("APIC: Detected %d.%d MHz processor\n",
-	       cpu_clock / 1000000, (uint8_t)(cpu_clock % 1000000));
-
-	apic_clock = pit_calibrate_apic_timer();
+	apic_clock = calibrate_apic_timer();
 	printk("APIC: Detected %d.%d MHz bus clock\n",
 	       apic_clock / 1000000, (uint8_t)(apic_clock % 1000000));
 
+	apic_tsc_deadline = (cpuid(1).ecx & (1U << 24)) != 0;
+	printk("APIC: %s one-shot timer\n", apic_tsc_deadline ?
+	       "TSC-deadline" : "Bus clock");
+
 	apic_local_regs_init();
 
-	bootstrap_apic_id.raw = apic_read(APIC_ID);
+	bootstrap_apic_id = apic_get_id();
 	bootstrap_apic_id_saved = true;
 
-	printk("APIC: bootstrap core lapic enabled, apic_id=0x%x\n",
-	       bootstrap_apic_id.id);
+	printk("APIC: bootstrap core %s enabled, apic_id=0x%x\n",
+	       apic_x2mode ? "x2apic" : "lapic", bootstrap_apic_id);
 }
 
 /*
@@ -264,10 +281,22 @@ static void apic_set_counter_us(uint64_t us)
 
 /*
  * µ-second delay
+ *
+ * With a TSC-deadline timer, the TSC is our timer base: just
+ * watch it. No bus clock calibration error, nor any divide
+ * configuration granularity.
  */
 void apic_udelay(uint64_t us)
 {
 	union apic_lvt_timer lvt_timer;
+	uint64_t deadline;
+
+	if (apic_tsc_deadline) {
+		deadline = read_tsc() + us * tsc_hz / 1000000;
+		while (read_tsc() < deadline)
+			cpu_pause();
+		return;
+	}
 
 	/* Before setting up the counter */
 	lvt_timer.value = 0;
@@ -308,13 +337,64 @@ void apic_monotonic(int ms, uint8_t vector)
 	apic_set_counter_us(ms * 1000);
 }
 
+/*
+ * Setup the timer to trigger @vector once for each
+ * apic_set_deadline(). Changing modes disarms it.
+ */
+void apic_oneshot(uint8_t vector)
+{
+	union apic_lvt_timer lvt_timer;
+
+	apic_write(APIC_TIMER_INIT_CNT, 0);
+
+	lvt_timer.value = 0;
+	lvt_timer.vector = vector;
+	lvt_timer.mask = APIC_UNMASK;
+	lvt_timer.timer_mode = apic_tsc_deadline ?
+		APIC_TIMER_TSC_DEADLINE : APIC_TIMER_ONESHOT;
+	apic_write(APIC_LVTT, lvt_timer.value);
+
+	/* MMIO writes are not ordered against the WRMSR: if the
+	 * deadline MSR got written before the mode switch landed,
+	 * it'd be ignored, and the timer would never fire. --SDM */
+	if (apic_tsc_deadline && !apic_x2mode)
+		mb();
+
+	if (!apic_tsc_deadline)
+		apic_write(APIC_DCR, APIC_DCR_1);
+}
+
+/*
+ * Arm the one-shot timer to fire at TSC value @deadline; a
+ * past deadline fires right away. In TSC-deadline mode, it's
+ * a single MSR write. Otherwise, the remaining cycles get
+ * converted to bus clock ticks, capped to the 32-bit count.
+ */
+void apic_set_deadline(uint64_t deadline)
+{
+	uint64_t now, delta, counter;
+
+	if (apic_tsc_deadline) {
+		write_msr(MSR_TSC_DEADLINE, deadline);
+		return;
+	}
+
+	now = read_tsc();
+	delta = (deadline > now) ? deadline - now : 0;
+	delta = min(delta, UINT64_MAX / apic_clock);
+	counter = min(delta * apic_clock / tsc_hz, (uint64_t)UINT32_MAX);
+
+	/* A zero count stops the timer */
+	apic_write(APIC_TIMER_INIT_CNT, max(counter, (uint64_t)1));
+}
+
 /*
  * Inter-Processor Interrupts
  */
 
 /* NOTE! This function is implicitly called by panic
  * code: it should not include any asserts or panics. */
-static void __apic_send_ipi(int dst_apic_id, int delivery_mode,
+static void __apic_send_ipi(uint32_t dst_apic_id, int delivery_mode,
 			    int vector, enum irq_dest dest)
 {
 	union apic_icr icr = { .value = 0 };
@@ -338,13 +418,20 @@ static void __apic_send_ipi(int dst_apic_id, int delivery_mode,
 	icr.level = APIC_LEVEL_ASSERT;
 	icr.trigger = APIC_TRIGGER_EDGE;
 
+	/* x2APIC: one MSR write, with a 32-bit destination */
+	if (apic_x2mode) {
+		icr.value_high = (dest == IRQ_SINGLE) ? dst_apic_id : 0;
+		write_msr(X2APIC_MSR(APIC_ICRL), icr.value);
+		return;
+	}
+
 	/* Writing the low doubleword of the ICR causes
 	 * the IPI to be sent: prepare high-word first. */
 	apic_write(APIC_ICRH, icr.value_high);
 	apic_write(APIC_ICRL, icr.value_low);
 }
 
-void apic_send_ipi(int dst_apic_id, int delivery_mode, int vector)
+void apic_send_ipi(uint32_t dst_apic_id, int delivery_mode, int vector)
 {
 	__apic_send_ipi(dst_apic_id, delivery_mode, vector, IRQ_SINGLE);
 }
@@ -361,19 +448,25 @@ void apic_broadcast_ipi(int delivery_mode, int vector)
  *
  * Return 'true' in case of delivery success.
  * FIXME: fine-grained timeouts using micro-seconds.
+ *
+ * The x2APIC ICR has no delivery status bit: it's not needed
+ * since a new IPI can always be sent right away.
  */
 bool apic_ipi_acked(void)
 {
 	union apic_icr icr = { .value = 0 };
 	int timeout = 100;
 
+	if (apic_x2mode)
+		return true;
+
 	while (timeout--) {
 		icr.value_low = apic_read(APIC_ICRL);
 
 		if (icr.delivery_status == APIC_DELSTATE_IDLE)
 			return true;
 
-		pit_mdelay(1);
+		mdelay(1);
 	}
 
 	return false;
@@ -383,11 +476,11 @@ bool apic_ipi_acked(void)
  * Basic state accessors
  */
 
-uint8_t apic_bootstrap_id(void)
+uint32_t apic_bootstrap_id(void)
 {
 	assert(bootstrap_apic_id_saved == true);
 
-	return bootstrap_apic_id.id;
+	return bootstrap_apic_id;
 }
 
 void *apic_vrbase(void)
@@ -397,11 +490,12 @@ void *apic_vrbase(void)
 	return apic_virt_base;
 }
 
+
 #if	APIC_TESTS
 
 #include <vectors.h>
 #include <idt.h>
-#include <pit.h>
+#include <irq.h>
 
 /*
  * Give the observer some time ..
@@ -461,10 +555,13 @@ static void apic_test_delay(void)
  * Increase the counter for each periodic timer tick.
  */
 static volatile int ticks_count;
+static volatile uint64_t last_tick_tsc;
 
-void __apic_timer_handler(void)
+static enum irqreturn apic_timer_handler(__unused void *data)
 {
+	last_tick_tsc = read_tsc();
 	ticks_count++;
+	return IRQ_HANDLED;
 }
 
 /*
@@ -478,16 +575,14 @@ static uint64_t ticks[DELAY_TESTS];
  * Test the APIC periodic timer against equivalent-time
  * PIT-programmed delays.
  */
-extern void apic_timer_handler(void);
 static void apic_test_periodic_mode(void)
 {
 	int i, ms, vector;
 
 	printk("APIC: Testing periodic interrupts\n\n");
 
-	/* FIXME: We should have an IRQ model soon */
 	vector = APIC_TESTS_VECTOR;
-	set_intr_gate(vector, apic_timer_handler);
+	irq_register(vector, apic_timer_handler, NULL, "apic-tests");
 
 	/* Testing showed that big delay values catches
 	 * more periodic timer accuracy errors .. */
@@ -497,7 +592,7 @@ static void apic_test_periodic_mode(void)
 	/* After each delay, store ticks triggered so far */
 	local_irq_enable();
 	for (i = 0; i < DELAY_TESTS; i++) {
-		pit_mdelay(ms);
+		mdelay(ms);
 		ticks[i] = ticks_count;
 	}
 
@@ -508,9 +603,42 @@ static void apic_test_periodic_mode(void)
 	printk("\n\n");
 }
 
+/*
+ * A one-shot timer must fire exactly once, and never
+ * before its deadline. Run after the periodic test: it
+ * registers our handler.
+ */
+static void apic_test_oneshot(void)
+{
+	uint64_t deadline = 0;
+	int count;
+
+	apic_oneshot(APIC_TESTS_VECTOR);
+	mdelay(1);
+
+	for (int i = 0; i < 100; i++) {
+		count = ticks_count;
+		deadline = read_tsc() + tsc_hz / 1000;
+		apic_set_deadline(deadline);
+		mdelay(3);
+
+		if (ticks_count != count + 1)
+			panic("APIC: FAIL: One-shot timer fired %d times",
+			      ticks_count - count);
+		if (last_tick_tsc < deadline)
+			panic("APIC: FAIL: One-shot timer fired %lu cycles "
+			      "early", deadline - last_tick_tsc);
+	}
+
+	printk("APIC: %s one-shot timer, last fired %lu cycles after "
+	       "its deadline: Success\n\n", apic_tsc_deadline ?
+	       "TSC-deadline" : "Bus clock", last_tick_tsc - deadline);
+}
+
 void apic_run_tests(void)
 {
 	apic_test_periodic_mode();
+	apic_test_oneshot();
 	apic_test_delay();
 }
 
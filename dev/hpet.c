@@ -0,0 +1,105 @@
+/*
+ * High Precision Event Timer (HPET)
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Check Intel's "IA-PC HPET (High Precision Event Timers) Specification"
+ * revision 1.0a for more details.
+ *
+ * The HPET main counter is a free-running up-counter of at least 10MHz,
+ * read with one memory-mapped load. The PIT, in comparison, needs a
+ * latch command and two 8-bit port reads -- each costing around one
+ * µ-second -- and ticks at 1.19MHz only.
+ *
+ * We only use the main counter: as a calibration reference, for busy-
+ * wait delays, and as a fallback monotonic clock. Comparators are left
+ * disabled, and the legacy replacement routing is kept off: the PIT
+ * still drives IRQ0, our scheduler ticks source.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <errno.h>
+#include <mmio.h>
+#include <vm.h>
+#include <acpi.h>
+#include <hpet.h>
+
+uint64_t hpet_hz;
+bool hpet_counter_64bit;
+
+static void *hpet_base;
+
+static inline uint64_t hpet_readq(uint32_t reg)
+{
+	return readq((char *)hpet_base + reg);
+}
+
+static inline void hpet_writeq(uint64_t val, uint32_t reg)
+{
+	writeq(val, (char *)hpet_base + reg);
+}
+
+uint64_t hpet_read(void)
+{
+	if (hpet_counter_64bit)
+		return hpet_readq(HPET_MAIN_CNT);
+
+	return readl((char *)hpet_base + HPET_MAIN_CNT);
+}
+
+/*
+ * Busy-wait @us µ-seconds. Counter differences are taken
+ * modulo its width: a 32-bit counter may wrap meanwhile.
+ */
+void hpet_udelay(uint64_t us)
+{
+	uint64_t start, ticks, mask;
+
+	assert(hpet_hz != 0);
+
+	mask = hpet_counter_64bit ? UINT64_MAX : UINT32_MAX;
+	ticks = us * hpet_hz / 1000000;
+	start = hpet_read();
+	while (((hpet_read() - start) & mask) < ticks)
+		cpu_pause();
+}
+
+/*
+ * Discover the HPET through ACPI, and start its main counter.
+ * Return 0, or -ENODEV if there's no usable HPET.
+ */
+int hpet_init(void)
+{
+	uint64_t phys, cap, conf, period;
+
+	if (acpi_get_hpet(&phys) != 0)
+		return -ENODEV;
+
+	hpet_base = vm_kmap(phys, HPET_MMIO_SPACE);
+	cap = hpet_readq(HPET_GCAP_ID);
+	period = HPET_GCAP_PERIOD(cap);
+	if (period == 0 || period > HPET_MAX_PERIOD) {
+		printk("HPET: Invalid tick period of %lu fs\n", period);
+		return -ENODEV;
+	}
+
+	hpet_counter_64bit = (cap & HPET_GCAP_COUNT_64BIT) != 0;
+
+	/* Counting starts from zero, and only at enable time */
+	conf = hpet_readq(HPET_GEN_CONF);
+	conf &= ~(HPET_CONF_ENABLE | HPET_CONF_LEGACY);
+	hpet_writeq(conf, HPET_GEN_CONF);
+	hpet_writeq(0, HPET_MAIN_CNT);
+	hpet_writeq(conf | HPET_CONF_ENABLE, HPET_GEN_CONF);
+
+	hpet_hz = FSEC_PER_SEC / period;
+	printk("HPET: %lu.%lu MHz, %d-bit counter at 0x%lx\n",
+	       hpet_hz / 1000000, (hpet_hz % 1000000) / 100000,
+	       hpet_counter_64bit ? 64 : 32, phys);
+	return 0;
+}
@@ -11,6 +11,9 @@
 #include <mptables.h>
 #include <apic.h>
 #include <ioapic.h>
+#include <errno.h>
+#include <spinlock.h>
+#include <smpboot.h>
 
 /*
  * I/O APICs descriptors. The number of i/o apics and their
@@ -25,6 +28,24 @@ static struct ioapic_pin i8259_pin = {
 	.pin  = -1,
 };
 
+/*
+ * Routed IRQs, in setup order. Each is delivered to one CPU
+ * of its affinity mask, or broadcasted to all. Changing a
+ * destination rewrites the entry: serialize the ioapic index
+ * and data registers accesses.
+ */
+int nr_ioapic_routes;
+struct ioapic_route ioapic_routes[IOAPIC_ROUTES_MAX];
+static spinlock_t routes_lock = SPIN_UNLOCKED();
+
+/*
+ * IDT vector -> route index + 1, or zero if not routed
+ */
+static uint8_t vector_route[256];
+
+static void route_add(struct ioapic_pin pin, union ioapic_irqentry entry,
+		      enum irq_dest dest);
+
 /*
  * Find where the 8259 INTR pin is connected to the ioapics
  * by scanning all the IOAPICs for a BIOS set unmasked routing
@@ -114,20 +135,205 @@ void ioapic_setup_isairq(uint8_t irq, uint8_t vector, enum irq_dest dest)
 	entry.trigger = IOAPIC_TRIGGER_EDGE;
 	entry.mask = IOAPIC_UNMASK;
 
+	route_add(pin, entry, dest);
+}
+
+/*
+ * Setup the I/O APIC routing entry for PCI device @dev's interrupt
+ * @pin (1 = INTA#, .. 4 = INTD#) on the root PCI bus. PCI interrupts
+ * are level-triggered and active-low. Return 0, or -ENODEV if the MP
+ * tables do not describe that device's pin wiring.
+ */
+int ioapic_setup_pciirq(uint8_t dev, uint8_t pin, uint8_t vector,
+			enum irq_dest dest)
+{
+	struct ioapic_pin ipin = { .apic = -1, .pin = -1 };
+	union ioapic_irqentry entry = { .value = 0 };
+	int irq, busirq;
+
+	assert(pin >= 1 && pin <= 4);
+	if (mp_pci_busid == -1)
+		return -ENODEV;
+
+	/* MP spec: PCI source bus IRQ = device# << 2 | (pin - 1) */
+	busirq = (dev << 2) | (pin - 1);
+	for (irq = 0; irq < nr_mpcirqs; irq++) {
+		if ((mp_irqs[irq].src_busid == mp_pci_busid) &&
+		    (mp_irqs[irq].src_busirq == busirq) &&
+		    (mp_irqs[irq].type == MP_INT))
+			break;
+	}
+	if (irq >= nr_mpcirqs)
+		return -ENODEV;
+
+	for (int apic = 0; apic < nr_ioapics; apic++) {
+		if (mp_irqs[irq].dst_ioapicid == ioapic_descs[apic].id) {
+			ipin.apic = apic;
+			ipin.pin = mp_irqs[irq].dst_ioapicpin;
+			break;
+		}
+	}
+	if (ipin.apic == -1)
+		return -ENODEV;
+
+	printk("IOAPIC[%d]: PCI device %d INT%c# is assigned to pin %d\n",
+	       ipin.apic, dev, 'A' + pin - 1, ipin.pin);
+
+	entry.vector = vector;
+	entry.delivery_mode = IOAPIC_DELMOD_FIXED;
+	entry.polarity = IOAPIC_POLARITY_LOW;
+	entry.trigger = IOAPIC_TRIGGER_LEVEL;
+	entry.mask = IOAPIC_UNMASK;
+
+	route_add(ipin, entry, dest);
+	return 0;
+}
+
+/*
+ * IRQ affinity
+ */
+
+/*
+ * NOTE! Only x2APIC cluster 0 cores 0-7 are reachable by the
+ * broadcast in x2APIC mode; check apic.c x2apic_usable().
+ */
+static void route_program(struct ioapic_route *route)
+{
+	union ioapic_irqentry entry = route->entry;
+
+	if (route->cpu == -1) {
+		entry.dest_mode = IOAPIC_DESTMOD_LOGICAL;
+		entry.dest = IOAPIC_DEST_BROADCAST;
+	} else {
+		entry.dest_mode = IOAPIC_DESTMOD_PHYSICAL;
+		entry.dest = cpus[route->cpu]->apic_id;
+	}
+
+	ioapic_write_irqentry(route->pin.apic, route->pin.pin, entry);
+}
+
+/*
+ * Return the index of the route already set for @pin, or -1
+ */
+static int route_find(struct ioapic_pin pin)
+{
+	for (int i = 0; i < nr_ioapic_routes; i++)
+		if (ioapic_routes[i].pin.apic == pin.apic &&
+		    ioapic_routes[i].pin.pin == pin.pin)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Write the @pin routing @entry, and track it for affinity
+ * changes. Bootstrap-routed IRQs may move to any CPU. An
+ * already routed pin gets its route replaced in place: its
+ * old vector no longer owns the pin.
+ */
+static void route_add(struct ioapic_pin pin, union ioapic_irqentry entry,
+		      enum irq_dest dest)
+{
+	struct ioapic_route *route;
+	int idx;
+
+	spin_lock(&routes_lock);
+	idx = route_find(pin);
+	if (idx != -1) {
+		route = &ioapic_routes[idx];
+		if (vector_route[route->entry.vector] == idx + 1)
+			vector_route[route->entry.vector] = 0;
+	} else {
+		if (nr_ioapic_routes >= IOAPIC_ROUTES_MAX)
+			panic("IOAPIC: Only %d routed IRQs supported",
+			      IOAPIC_ROUTES_MAX);
+		idx = nr_ioapic_routes;
+		route = &ioapic_routes[idx];
+	}
+
+	route->pin = pin;
+	route->entry = entry;
+	cpumask_clear(&route->affinity);
 	switch (dest) {
 	case IRQ_BOOTSTRAP:
-		entry.dest_mode = IOAPIC_DESTMOD_PHYSICAL;
-		entry.dest = apic_bootstrap_id();
+		route->cpu = 0;
+		for (int cpu = 0; cpu < mptables_get_nr_cpus(); cpu++)
+			cpumask_set_cpu(cpu, &route->affinity);
 		break;
 	case IRQ_BROADCAST:
-		entry.dest_mode = IOAPIC_DESTMOD_LOGICAL;
-		entry.dest = IOAPIC_DEST_BROADCAST;
+		route->cpu = -1;
 		break;
 	default:
 		assert(false);
 	}
 
-	ioapic_write_irqentry(pin.apic, pin.pin, entry);
+	route_program(route);
+	vector_route[entry.vector] = idx + 1;
+	if (idx == nr_ioapic_routes)
+		nr_ioapic_routes++;
+	spin_unlock(&routes_lock);
+}
+
+/*
+ * Deliver @vector's IRQ to one running CPU of @mask. The
+ * physical destination mode only addresses one CPU; take
+ * the first. Return 0, -ENOENT if @vector is not routed
+ * through the I/O APICs, or -EINVAL if no @mask CPU runs.
+ */
+int ioapic_set_affinity(uint8_t vector, const struct cpumask *mask)
+{
+	struct ioapic_route *route;
+	int cpu;
+
+	if (vector_route[vector] == 0)
+		return -ENOENT;
+	route = &ioapic_routes[vector_route[vector] - 1];
+
+	for_each_cpu(cpu, mask)
+		if (smpboot_cpu_alive(cpu))
+			break;
+	if (cpu == mptables_get_nr_cpus())
+		return -EINVAL;
+
+	spin_lock(&routes_lock);
+	route->affinity = *mask;
+	route->cpu = cpu;
+	route_program(route);
+	spin_unlock(&routes_lock);
+	return 0;
+}
+
+/*
+ * Move @route's IRQ to @cpu, one of its affinity mask CPUs
+ */
+void ioapic_route_set_cpu(int route, int cpu)
+{
+	assert(route >= 0 && route < nr_ioapic_routes);
+	assert(cpumask_test_cpu(cpu, &ioapic_routes[route].affinity));
+
+	spin_lock(&routes_lock);
+	ioapic_routes[route].cpu = cpu;
+	route_program(&ioapic_routes[route]);
+	spin_unlock(&routes_lock);
+}
+
+/*
+ * Stop @vector's IRQs at their I/O APIC pin. Return 0, or
+ * -ENOENT if @vector is not routed through the I/O APICs.
+ */
+int ioapic_mask_vector(uint8_t vector)
+{
+	struct ioapic_route *route;
+
+	if (vector_route[vector] == 0)
+		return -ENOENT;
+	route = &ioapic_routes[vector_route[vector] - 1];
+
+	spin_lock(&routes_lock);
+	route->entry.mask = IOAPIC_MASK;
+	route_program(route);
+	spin_unlock(&routes_lock);
+	return 0;
 }
 
 void ioapic_init(void)
@@ -14,6 +14,7 @@
 #include <ioapic.h>
 #include <io.h>
 #include <idt.h>
+#include <irq.h>
 #include <keyboard.h>
 #include <apic.h>
 #include <vectors.h>
@@ -197,7 +198,7 @@ static void kbd_flush_buffer(void)
  * The real handler
  */
 static int shifted;		/* Shift keys pressed? */
-void __kb_handler(void) {
+static enum irqreturn kb_handler(__unused void *data) {
 	uint8_t code, ascii;
 
 	/* Implicit ACK: reading the scan code empties the
@@ -218,19 +219,19 @@ void __kb_handler(void) {
 	};
 
 	if (code >= ARRAY_SIZE(scancodes))
-		return;
+		return IRQ_HANDLED;
 
 	ascii = scancodes[code][shifted];
 	if (ascii)
 		putc(ascii);
+	return IRQ_HANDLED;
 }
 
 void keyboard_init(void) {
-	extern void kb_handler(void);
 	uint8_t vector;
 
 	vector = KEYBOARD_IRQ_VECTOR;
-	set_intr_gate(vector, kb_handler);
+	irq_register(vector, kb_handler, NULL, "keyboard");
 	ioapic_setup_isairq(1, vector, IRQ_BOOTSTRAP);
 
 	/*
@@ -0,0 +1,284 @@
+/*
+ * PCI bus enumeration and configuration space access
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Configuration space is reached through the 0xcf8/0xcfc port pair
+ * ("Configuration Mechanism #1"), available on all PC chipsets. The
+ * address and data accesses form one transaction: serialize them.
+ *
+ * Devices are discovered once at boot by a brute-force scan of all
+ * bus/device slots, and kept in a small static table.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <errno.h>
+#include <io.h>
+#include <mmio.h>
+#include <vm.h>
+#include <spinlock.h>
+#include <pci.h>
+
+#define PCI_DEVS_MAX	32		/* Arbitrary */
+
+static struct pci_dev pci_devs[PCI_DEVS_MAX];
+static int nr_pci_devs;
+static spinlock_t pci_config_lock = SPIN_UNLOCKED();
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t dev, uint8_t func,
+				   uint8_t offset)
+{
+	return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) |
+		(offset & 0xfc);
+}
+
+static uint32_t __pci_read32(uint8_t bus, uint8_t dev, uint8_t func,
+			     uint8_t offset)
+{
+	uint32_t val;
+
+	spin_lock(&pci_config_lock);
+	outl(pci_config_address(bus, dev, func, offset), PCI_CONFIG_ADDRESS);
+	val = inl(PCI_CONFIG_DATA);
+	spin_unlock(&pci_config_lock);
+
+	return val;
+}
+
+uint32_t pci_read32(struct pci_dev *pdev, uint8_t offset)
+{
+	assert(is_aligned(offset, 4));
+	return __pci_read32(pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+uint16_t pci_read16(struct pci_dev *pdev, uint8_t offset)
+{
+	assert(is_aligned(offset, 2));
+	return pci_read32(pdev, offset & ~3) >> ((offset & 3) * 8);
+}
+
+uint8_t pci_read8(struct pci_dev *pdev, uint8_t offset)
+{
+	return pci_read32(pdev, offset & ~3) >> ((offset & 3) * 8);
+}
+
+void pci_write32(struct pci_dev *pdev, uint8_t offset, uint32_t val)
+{
+	assert(is_aligned(offset, 4));
+
+	spin_lock(&pci_config_lock);
+	outl(pci_config_address(pdev->bus, pdev->dev, pdev->func, offset),
+	     PCI_CONFIG_ADDRESS);
+	outl(val, PCI_CONFIG_DATA);
+	spin_unlock(&pci_config_lock);
+}
+
+/*
+ * Sub-dword writes go through the data port's matching byte lanes;
+ * a read-modify-write of the whole dword could clear RW1C bits.
+ */
+void pci_write16(struct pci_dev *pdev, uint8_t offset, uint16_t val)
+{
+	assert(is_aligned(offset, 2));
+
+	spin_lock(&pci_config_lock);
+	outl(pci_config_address(pdev->bus, pdev->dev, pdev->func, offset),
+	     PCI_CONFIG_ADDRESS);
+	outw(val, PCI_CONFIG_DATA + (offset & 2));
+	spin_unlock(&pci_config_lock);
+}
+
+struct pci_dev *pci_find_device(uint16_t vendor, uint16_t device)
+{
+	for (int i = 0; i < nr_pci_devs; i++)
+		if (pci_devs[i].vendor == vendor &&
+		    pci_devs[i].device == device)
+			return &pci_devs[i];
+
+	return NULL;
+}
+
+/*
+ * Return the config space offset of the first capability of type
+ * @cap_id found after the one at @start (0: list head), or zero.
+ */
+uint8_t pci_find_cap(struct pci_dev *pdev, uint8_t cap_id, uint8_t start)
+{
+	uint8_t pos;
+	int ttl = 48;			/* Guard against looping lists */
+
+	if (!(pci_read16(pdev, PCI_STATUS) & PCI_STATUS_CAP_LIST))
+		return 0;
+
+	pos = start ? pci_read8(pdev, start + 1) :
+		pci_read8(pdev, PCI_CAPABILITY_LIST);
+	while (pos >= 0x40 && ttl--) {
+		pos &= ~3;
+		if (pci_read8(pdev, pos) == cap_id)
+			return pos;
+		pos = pci_read8(pdev, pos + 1);
+	}
+
+	return 0;
+}
+
+/*
+ * Physical address of memory BAR #@bar
+ */
+uint64_t pci_bar_phys(struct pci_dev *pdev, int bar)
+{
+	uint32_t low;
+	uint64_t addr;
+
+	assert(bar >= 0 && bar < 6);
+	low = pci_read32(pdev, PCI_BAR0 + bar * 4);
+	if (low & PCI_BAR_IO)
+		panic("PCI %02x:%02x.%d: BAR%d is an I/O BAR", pdev->bus,
+		      pdev->dev, pdev->func, bar);
+
+	addr = low & ~0xfULL;
+	if ((low & PCI_BAR_MEM_TYPE_MASK) == PCI_BAR_MEM_TYPE_64) {
+		assert(bar < 5);
+		addr |= (uint64_t)pci_read32(pdev, PCI_BAR0 + (bar+1)*4) << 32;
+	}
+
+	return addr;
+}
+
+/*
+ * Map the @len bytes at @offset within memory BAR #@bar
+ */
+void *pci_bar_map(struct pci_dev *pdev, int bar, uint64_t offset,
+		  uint64_t len)
+{
+	uint64_t addr;
+
+	addr = pci_bar_phys(pdev, bar);
+	if (addr == 0)
+		panic("PCI %02x:%02x.%d: BAR%d is not assigned", pdev->bus,
+		      pdev->dev, pdev->func, bar);
+
+	return vm_kmap(addr + offset, len);
+}
+
+/*
+ * Enable memory-space decoding and bus mastering (DMA)
+ */
+void pci_enable(struct pci_dev *pdev)
+{
+	uint16_t cmd;
+
+	cmd = pci_read16(pdev, PCI_COMMAND);
+	cmd |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+	pci_write16(pdev, PCI_COMMAND, cmd);
+}
+
+/*
+ * Map the device's MSI-X table, mask all of its entries, then switch
+ * the device from INTx# to MSI-X signalling. Return the number of
+ * table entries, or -ENODEV if MSI-X is not supported.
+ */
+int pci_msix_enable(struct pci_dev *pdev)
+{
+	uint8_t cap;
+	uint16_t flags;
+	uint32_t table;
+	int nr_entries;
+
+	cap = pci_find_cap(pdev, PCI_CAP_ID_MSIX, 0);
+	if (cap == 0)
+		return -ENODEV;
+
+	flags = pci_read16(pdev, cap + PCI_MSIX_FLAGS);
+	table = pci_read32(pdev, cap + PCI_MSIX_TABLE);
+	nr_entries = (flags & PCI_MSIX_FLAGS_QSIZE) + 1;
+
+	pdev->msix_table = pci_bar_map(pdev, table & PCI_MSIX_TABLE_BIR,
+				       table & ~PCI_MSIX_TABLE_BIR,
+				       nr_entries * PCI_MSIX_ENTRY_SIZE);
+	for (int i = 0; i < nr_entries; i++)
+		writel(1, (char *)pdev->msix_table + i * PCI_MSIX_ENTRY_SIZE +
+		       PCI_MSIX_ENTRY_CTRL);
+
+	flags |= PCI_MSIX_FLAGS_ENABLE;
+	flags &= ~PCI_MSIX_FLAGS_MASKALL;
+	pci_write16(pdev, cap + PCI_MSIX_FLAGS, flags);
+	pci_write16(pdev, PCI_COMMAND, pci_read16(pdev, PCI_COMMAND) |
+		    PCI_COMMAND_INTX_DISABLE);
+
+	return nr_entries;
+}
+
+/*
+ * Point MSI-X table @entry to the IDT @vector of CPU @apic_id, then
+ * unmask it. Fixed delivery, edge-triggered, physical destination.
+ */
+void pci_msix_set_entry(struct pci_dev *pdev, int entry, uint8_t apic_id,
+			uint8_t vector)
+{
+	char *ent;
+
+	assert(pdev->msix_table != NULL);
+	ent = (char *)pdev->msix_table + entry * PCI_MSIX_ENTRY_SIZE;
+
+	writel(MSI_ADDR_BASE | (apic_id << MSI_ADDR_DEST_SHIFT),
+	       ent + PCI_MSIX_ENTRY_ADDR_LO);
+	writel(0, ent + PCI_MSIX_ENTRY_ADDR_HI);
+	writel(vector, ent + PCI_MSIX_ENTRY_DATA);
+	writel(0, ent + PCI_MSIX_ENTRY_CTRL);
+}
+
+static void pci_add_device(uint8_t bus, uint8_t dev, uint8_t func)
+{
+	struct pci_dev *pdev;
+	uint32_t id;
+
+	if (nr_pci_devs == PCI_DEVS_MAX) {
+		printk("PCI: Ignoring device %02x:%02x.%d; table full\n",
+		       bus, dev, func);
+		return;
+	}
+
+	pdev = &pci_devs[nr_pci_devs++];
+	pdev->bus = bus;
+	pdev->dev = dev;
+	pdev->func = func;
+	id = pci_read32(pdev, PCI_VENDOR_ID);
+	pdev->vendor = id & 0xffff;
+	pdev->device = id >> 16;
+	pdev->class = pci_read32(pdev, PCI_CLASS_REVISION) >> 8;
+	pdev->irq_pin = pci_read8(pdev, PCI_INTERRUPT_PIN);
+
+	printk("PCI: %02x:%02x.%d: [%04x:%04x] class 0x%06x\n", bus, dev,
+	       func, pdev->vendor, pdev->device, pdev->class);
+}
+
+void pci_init(void)
+{
+	uint8_t nr_funcs, header;
+
+	for (int bus = 0; bus < 256; bus++) {
+		for (int dev = 0; dev < 32; dev++) {
+			if ((__pci_read32(bus, dev, 0, PCI_VENDOR_ID) &
+			     0xffff) == 0xffff)
+				continue;
+
+			header = __pci_read32(bus, dev, 0, PCI_HEADER_TYPE & ~3)
+				>> ((PCI_HEADER_TYPE & 3) * 8);
+			nr_funcs = (header & PCI_HEADER_MULTIFUNC) ? 8 : 1;
+			for (int func = 0; func < nr_funcs; func++) {
+				if ((__pci_read32(bus, dev, func, PCI_VENDOR_ID)
+				     & 0xffff) == 0xffff)
+					continue;
+				pci_add_device(bus, dev, func);
+			}
+		}
+	}
+
+	printk("PCI: %d device(s) found\n", nr_pci_devs);
+}
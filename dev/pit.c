@@ -227,6 +227,7 @@ void pit_monotonic(int ms)
 
 #include <vectors.h>
 #include <idt.h>
+#include <irq.h>
 #include <ioapic.h>
 
 /*
@@ -280,9 +281,10 @@ static void pit_test_mdelay(void)
  */
 static volatile int ticks_count;
 
-void __pit_periodic_handler(void)
+static enum irqreturn pit_periodic_handler(__unused void *data)
 {
 	ticks_count++;
+	return IRQ_HANDLED;
 }
 
 /*
@@ -298,16 +300,14 @@ static uint64_t ticks[DELAY_TESTS];
  *
  * Delay intervals code is assumed to be correct.
  */
-extern void pit_periodic_handler(void);
 static void pit_test_periodic_irq(void)
 {
 	int i, ms, vector;
 
 	printk("PIT: Testing periodic interrupts\n\n");
 
-	/* FIXME: We should have an IRQ model soon */
 	vector = PIT_TESTS_VECTOR;
-	set_intr_gate(vector, pit_periodic_handler);
+	irq_register(vector, pit_periodic_handler, NULL, "pit-tests");
 	ioapic_setup_isairq(0, vector, IRQ_BOOTSTRAP);
 
 	/* Testing showed that big delay values catches
@@ -14,6 +14,16 @@
  * NOTE! My laptop is void of serial ports, making that state the only
  * real use-case tested. Transmitting bytes was only tested using Qemu
  * and Bochs virtual ports.
+ *
+ * Once the IRQ layer is up, output is interrupt-driven: writers copy
+ * their bytes to a per-CPU TX ring and leave; the UART 'transmitter
+ * holding register empty' IRQ then refills its 16-byte FIFO from the
+ * rings. At 115200 baud, a 80-char line costs ~7ms of line time, which
+ * the old polling loop burnt with interrupts disabled.
+ *
+ * Each ring has one producer, its CPU with local interrupts disabled,
+ * and one consumer, whoever holds @tx_lock: writers never wait on
+ * each other. Before the IRQ is set up, and after a panic, we poll.
  */
 
 #include <kernel.h>
@@ -21,6 +31,12 @@
 #include <paging.h>
 #include <spinlock.h>
 #include <serial.h>
+#include <percpu.h>
+#include <kmalloc.h>
+#include <mptables.h>
+#include <vectors.h>
+#include <irq.h>
+#include <ioapic.h>
 #include <io.h>
 #include <x86.h>
 
@@ -70,17 +86,65 @@
 
 /*
  * When DLAB=0, a serial port can be configured to operate on
- * an interrupt basis using this reg. Nonetheless, we want to
- * use serial output in regions where interrupts are disabled,
- * thus the use of polling instead.
+ * an interrupt basis using this reg. We only ask for the TX
+ * holding register empty IRQ, to refill the TX FIFO.
  */
 #define UART_INTERRUPT_ENABLE	1
+union interrupt_enable_reg {
+	uint8_t raw;
+	struct {
+		uint8_t rx_avail:1,	/* Received data available */
+			tx_empty:1,	/* TX holding register empty */
+			line_status:1,	/* RX errors or break */
+			modem_status:1,	/* RS-232 lines changed */
+			unused:4;	/* Unused */
+	} __packed;
+};
 
 /*
  * When DLAB=0, this is used to provide a FIFO queueing
- * discipline, buffering up to 16-bytes of received data.
+ * discipline, buffering up to 16-bytes of received, and
+ * 16-bytes of transmitted, data.
  */
 #define UART_FIFO_CTRL		2
+union fifo_control_reg {
+	uint8_t raw;
+	struct {
+		uint8_t enable:1,	/* Enable both FIFOs */
+			clear_rx:1,	/* Flush the RX FIFO */
+			clear_tx:1,	/* Flush the TX FIFO */
+			dma_mode:1,	/* Unused */
+			unused:2,	/* Unused */
+			rx_trigger:2;	/* RX IRQ threshold; unused */
+	} __packed;
+};
+
+#define UART_FIFO_SIZE		16
+
+/*
+ * On reads, the FIFO control reg port returns the highest
+ * priority pending interrupt source. Reading it clears a
+ * pending TX holding register empty IRQ.
+ */
+#define UART_INTERRUPT_ID	2
+union interrupt_id_reg {
+	uint8_t raw;
+	struct {
+		uint8_t none_pending:1,	/* Zero if an IRQ is pending */
+			id:3,		/* Interrupt source, see below */
+			unused:2,	/* Unused */
+			fifo_state:2;	/* FIFO_STATE_* */
+	} __packed;
+};
+
+enum {
+	IID_TX_EMPTY =	0x1,		/* TX holding register empty */
+};
+
+enum {
+	FIFO_STATE_NONE =	0x0,	/* 8250 / 16450: no FIFOs */
+	FIFO_STATE_OK =		0x3,	/* 16550A: working FIFOs */
+};
 
 /*
  * Line control register, controls DLAB and send mode
@@ -123,7 +187,8 @@ union modem_control_reg {
 	struct {
 		uint8_t dt_ready:1,	/* RS-232 Data Termainal Ready */
 			req_send:1,	/* RS-232 Request To Send */
-			unused0:2,	/* Unused */
+			out1:1,		/* Unused */
+			out2:1,		/* PCs: gates the UART IRQ line */
 			loopback:1,	/* Loopback between tx and rx */
 			unused1:3;	/* Unused */
 	} __packed;
@@ -169,7 +234,9 @@ union modem_status_reg {
  * serial port attached, and thus no data can be sent.
  */
 #define BDA_COM1_ENTRY	0x400
+#define COM1_IRQ	4
 static uint16_t port_base;
+static int tx_fifo_size = 1;
 
 static void reset_port_set_8n1_mode(void)
 {
@@ -202,6 +269,8 @@ static void disable_DLAB(void)
 void serial_init(void)
 {
 	union modem_control_reg reg;
+	union fifo_control_reg fcr;
+	union interrupt_id_reg iir;
 	uint16_t divisor;
 
 	divisor = MAX_BAUD / DESIRED_BAUD;
@@ -223,8 +292,15 @@ void serial_init(void)
 	outb(divisor >> 8, port_base + UART_DIVISOR_LATCH_HIGH);
 	disable_DLAB();
 
-	outb(0x00, port_base + UART_FIFO_CTRL);
-	reg.raw = 0, reg.dt_ready = 1, reg.req_send = 1;
+	fcr.raw = 0, fcr.enable = 1, fcr.clear_rx = 1, fcr.clear_tx = 1;
+	outb(fcr.raw, port_base + UART_FIFO_CTRL);
+	iir.raw = inb(port_base + UART_INTERRUPT_ID);
+	if (iir.fifo_state == FIFO_STATE_OK)
+		tx_fifo_size = UART_FIFO_SIZE;
+	else
+		outb(0x00, port_base + UART_FIFO_CTRL);
+
+	reg.raw = 0, reg.dt_ready = 1, reg.req_send = 1, reg.out2 = 1;
 	outb(reg.raw, port_base + UART_MODEM_CTRL);
 }
 
@@ -251,47 +327,270 @@ static bool remote_ready(void)
 static int port_is_broken;
 spinlock_t port_lock = SPIN_UNLOCKED();
 
-static int __putc(uint8_t byte)
+/*
+ * Wait for the TX FIFO to drain. Mark the port as broken,
+ * and return false, if it never did.
+ */
+static bool tx_wait_empty(void)
 {
 	int timeout;
 
-	/* Next byte may have a better luck */
-	if (!remote_ready())
-		return 0;
-
 	timeout = 0xfffff;
 	while (!tx_buffer_empty() && timeout--)
 		cpu_pause();
 
 	if (__unlikely(timeout == -1)) {
 		port_is_broken = 1;
-		return 1;
+		return false;
 	}
 
+	return true;
+}
+
+static int __putc(uint8_t byte)
+{
+	/* Next byte may have a better luck */
+	if (!remote_ready())
+		return 0;
+
+	if (!tx_wait_empty())
+		return 1;
+
 	outb(byte, port_base + UART_TRANSMIT_BUF);
 	return 0;
 }
 
-void serial_write(const char *buf, int len)
+static void serial_write_polled(const char *buf, int len)
 {
 	int ret;
 
-	if (port_base == 0)
-		return;
-
 	spin_lock(&port_lock);
 
 	if (port_is_broken)
 		goto out;
 
 	ret = 0;
-	while (*buf && len-- && ret == 0)
+	while (len-- > 0 && *buf && ret == 0)
 		ret = __putc(*buf++);
 
 out:	spin_unlock(&port_lock);
 }
 
+/*
+ * Per-CPU TX rings
+ *
+ * Indices are free-running: @tail - @head is the number of
+ * queued bytes. Only the ring's CPU moves @tail, and only
+ * the @tx_lock holder moves @head.
+ */
+#define TX_RING_SIZE	MAXALLOC_SZ	/* Power of 2 */
+
+struct tx_ring {
+	volatile uint32_t head;		/* Next byte to transmit */
+	volatile uint32_t tail;		/* Next free slot */
+	char *buf;
+};
+
+static volatile bool tx_irq_mode;	/* Rings and IRQ are set up */
+static spinlock_t tx_lock = SPIN_UNLOCKED();
+static int tx_next;			/* Ring being drained; @tx_lock */
+static int nr_rings;
+
+static struct tx_ring *cpu_tx_ring(int cpu)
+{
+	return (struct tx_ring *)cpus[cpu]->serial_tx;
+}
+
+static bool tx_pending(void)
+{
+	struct tx_ring *ring;
+
+	for (int cpu = 0; cpu < nr_rings; cpu++) {
+		ring = cpu_tx_ring(cpu);
+		if (ring->head != ring->tail)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * If the UART TX FIFO is empty, refill it from the rings. A
+ * ring is drained before moving to the next one, keeping each
+ * CPU's output in one piece as far as possible. Call with the
+ * @tx_lock held. Return number of bytes sent.
+ */
+static int tx_fill(void)
+{
+	struct tx_ring *ring;
+	int count, idle;
+	char byte;
+
+	if (!tx_buffer_empty())
+		return 0;
+
+	/* Next bytes may have a better luck */
+	if (!remote_ready())
+		return 0;
+
+	count = 0, idle = 0;
+	while (count < tx_fifo_size && idle < nr_rings) {
+		ring = cpu_tx_ring(tx_next);
+		if (ring->head == ring->tail) {
+			tx_next = (tx_next + 1) % nr_rings;
+			idle++;
+			continue;
+		}
+
+		byte = ring->buf[ring->head % TX_RING_SIZE];
+		barrier();
+		ring->head++;
+
+		outb(byte, port_base + UART_TRANSMIT_BUF);
+		count++, idle = 0;
+	}
+
+	return count;
+}
+
+/*
+ * Start transmission if the UART is idle; otherwise, the
+ * next TX-empty IRQ will do. If the lock is contended, its
+ * holder re-checks the rings after release: it cannot miss
+ * our bytes, and we need not wait.
+ */
+static void tx_kick(void)
+{
+	do {
+		if (!spin_trylock(&tx_lock))
+			return;
+		tx_fill();
+		spin_unlock(&tx_lock);
+
+		/* Order the unlock before reading the rings tails */
+		mb();
+	} while (tx_pending() && tx_buffer_empty());
+}
+
+/*
+ * Our ring is full: the UART cannot keep up. Rather than
+ * losing log messages, drain the rings by polling.
+ */
+static void tx_drain_polled(struct tx_ring *ring)
+{
+	spin_lock(&tx_lock);
+	while (ring->tail - ring->head == TX_RING_SIZE) {
+		if (port_is_broken || !tx_wait_empty())
+			break;
+		if (tx_fill() == 0)
+			break;
+	}
+	spin_unlock(&tx_lock);
+}
+
+static enum irqreturn serial_irq_handler(__unused void *data)
+{
+	union interrupt_id_reg iir;
+
+	iir.raw = inb(port_base + UART_INTERRUPT_ID);
+	if (iir.none_pending)
+		return IRQ_NONE;
+
+	if (iir.id == IID_TX_EMPTY)
+		tx_kick();
+
+	return IRQ_HANDLED;
+}
+
+void serial_write(const char *buf, int len)
+{
+	union x86_rflags flags;
+	struct tx_ring *ring;
+	uint32_t tail;
+
+	if (port_base == 0)
+		return;
+
+	if (!tx_irq_mode) {
+		serial_write_polled(buf, len);
+		return;
+	}
+
+	/* Stay on this CPU, and keep its IRQ handlers out */
+	flags = local_irq_disable_save();
+	ring = (struct tx_ring *)percpu_get(serial_tx);
+
+	tail = ring->tail;
+	while (len-- > 0 && *buf) {
+		if (tail - ring->head == TX_RING_SIZE) {
+			ring->tail = tail;
+			tx_drain_polled(ring);
+			if (tail - ring->head == TX_RING_SIZE)
+				break;
+		}
+
+		ring->buf[tail % TX_RING_SIZE] = *buf++;
+		tail++;
+	}
+
+	/* Publish the bytes only after they're written */
+	barrier();
+	ring->tail = tail;
+
+	local_irq_restore(flags);
+	tx_kick();
+}
+
 void serial_putc(char ch)
 {
 	serial_write(&ch, 1);
 }
+
+/*
+ * Switch output to the TX rings, drained by the UART IRQ.
+ * Call after the IRQ layer and the IOAPICs are set up.
+ */
+void serial_irq_init(void)
+{
+	union interrupt_enable_reg ier;
+	struct tx_ring *ring;
+
+	if (port_base == 0 || port_is_broken)
+		return;
+
+	nr_rings = mptables_get_nr_cpus();
+	for (int cpu = 0; cpu < nr_rings; cpu++) {
+		ring = kmalloc(sizeof(*ring));
+		ring->head = ring->tail = 0;
+		ring->buf = kmalloc(TX_RING_SIZE);
+		cpus[cpu]->serial_tx = (uintptr_t)ring;
+	}
+
+	irq_register(SERIAL_IRQ_VECTOR, serial_irq_handler, NULL, "serial");
+	ioapic_setup_isairq(COM1_IRQ, SERIAL_IRQ_VECTOR, IRQ_BOOTSTRAP);
+
+	ier.raw = 0, ier.tx_empty = 1;
+	outb(ier.raw, port_base + UART_INTERRUPT_ENABLE);
+	tx_irq_mode = true;
+
+	printk("COM1: IRQ-driven output, %d-byte TX FIFO\n", tx_fifo_size);
+}
+
+/*
+ * For panic(): flush whatever is left in the TX rings, then
+ * poll from now on. Other cores are stopped, or about to be;
+ * don't wait for @tx_lock, as its holder may never return.
+ */
+void serial_bust_locks(void)
+{
+	if (!tx_irq_mode)
+		return;
+
+	tx_irq_mode = false;
+	outb(0x00, port_base + UART_INTERRUPT_ENABLE);
+
+	while (!port_is_broken && tx_pending()) {
+		if (!tx_wait_empty() || tx_fill() == 0)
+			break;
+	}
+}
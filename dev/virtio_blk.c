@@ -0,0 +1,732 @@
+/*
+ * Virtio block device driver - multi-queue, over PCI
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * One virtqueue per CPU, up to what the device offers: CPU #i submits
+ * to queue #(i % nr_queues), and, with MSI-X, queue #i completions
+ * interrupt CPU #i. Queues thus share no cache lines or locks in the
+ * common case, and a request completes on the core that issued it.
+ *
+ * Each request is a chain of descriptors: the request header, one
+ * data buffer per merged bio, and the device-written status byte.
+ * Descriptor runs of the maximum chain length are statically assigned
+ * to request slots; requests beyond the free slots wait in a per-queue
+ * software list. The block layer holds back requests beyond about one
+ * queue worth of slots, to get them sorted and merged meanwhile.
+ *
+ * Batching: submissions only fill the available ring, the block
+ * layer's ->commit() writes the doorbell, once per batch. With the
+ * EVENT_IDX feature, the device also tells us when it really needs
+ * a doorbell, and we tell it to interrupt us only once all of the
+ * in-flight requests of a queue have completed (coalescing).
+ *
+ * Only the virtio 1.0 PCI interface is supported; QEMU transitional
+ * devices provide it by default. Test with something like:
+ *
+ *	qemu-system-x86_64 -smp 4 -drive file=build/hd-image,format=raw \
+ *	    -drive file=disk.img,if=none,id=vd0,format=raw \
+ *	    -device virtio-blk-pci,drive=vd0,num-queues=4
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <list.h>
+#include <mmio.h>
+#include <paging.h>
+#include <mm.h>
+#include <kmalloc.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <mptables.h>
+#include <idt.h>
+#include <irq.h>
+#include <vectors.h>
+#include <ioapic.h>
+#include <pci.h>
+#include <blkdev.h>
+#include <virtio.h>
+
+#define VBLK_QUEUES_MAX		16	/* Arbitrary */
+#define VBLK_QUEUE_SIZE		128	/* Max ring entries we use */
+#define VBLK_SEGS_MAX		8	/* Data buffers per request */
+#define VBLK_REQ_DESCS		(VBLK_SEGS_MAX + 2)	/* + header, status */
+#define VBLK_REQS		(VBLK_QUEUE_SIZE / VBLK_REQ_DESCS)
+
+#define VRING_USED_F_NO_NOTIFY	1
+
+/*
+ * In-flight request slot, using descriptors [VBLK_REQ_DESCS * i, ..]. Slots
+ * live in the direct physical mapping: the device DMAs to them.
+ */
+struct vblk_req {
+	struct virtio_blk_req_hdr hdr;
+	struct bio *bio;
+	uint8_t status;
+};
+
+struct vblk_queue {
+	spinlock_t lock;
+	uint16_t index;			/* Virtqueue number */
+	uint16_t size;			/* Ring entries count */
+	volatile struct vring_desc *desc;
+	volatile struct vring_avail *avail;
+	volatile struct vring_used *used;
+	volatile uint16_t *used_event;	/* Avail ring tail */
+	volatile uint16_t *avail_event;	/* Used ring tail */
+	uint16_t *notify;		/* Doorbell register */
+
+	uint16_t avail_idx;		/* Our copy of avail->idx */
+	uint16_t kicked_idx;		/* avail_idx at last doorbell */
+	uint16_t last_used;		/* Next used entry to reap */
+	uint16_t nr_inflight;
+
+	struct vblk_req *reqs;
+	uint16_t free_reqs[VBLK_REQS];
+	int nr_free;
+	struct list_node pending;	/* Bios waiting for a free slot */
+
+	uint64_t nr_kicks;		/* Statistics */
+	uint64_t nr_irqs;
+	uint64_t nr_completed;
+} __aligned(CACHE_LINE_SIZE);
+
+static struct vblk_device {
+	struct pci_dev *pdev;
+	struct virtio_pci_common_cfg *common;
+	uint8_t *isr;
+	char *devcfg;
+	char *notify_base;
+	uint32_t notify_mult;
+	bool event_idx;			/* VIRTIO_RING_F_EVENT_IDX? */
+	bool read_only;
+	bool msix;			/* Else, shared INTx# to the BSC */
+	int nr_queues;
+	struct vblk_queue *queues[VBLK_QUEUES_MAX];
+	struct block_device bdev;
+} vblk;
+
+static uintptr_t buf_phys(void *buf)
+{
+	if ((uintptr_t)buf >= KTEXT_PAGE_OFFSET)
+		return KTEXT_PHYS(buf);
+	return PHYS(buf);
+}
+
+static int this_cpu_index(void)
+{
+	return percpu_get(id);
+}
+
+static struct vblk_queue *this_cpu_queue(void)
+{
+	return vblk.queues[this_cpu_index() % vblk.nr_queues];
+}
+
+/*
+ * Fill given request's descriptors chain and expose it to the device.
+ * The doorbell is left to __vblk_kick(). Queue lock must be held.
+ */
+static void __vblk_queue_bio(struct vblk_queue *q, struct bio *rq)
+{
+	volatile struct vring_desc *desc;
+	struct vblk_req *req;
+	struct bio *bio;
+	uint16_t slot, head, i;
+
+	assert(q->nr_free > 0);
+	assert(rq->rq_segments <= VBLK_SEGS_MAX);
+	slot = q->free_reqs[--q->nr_free];
+	req = &q->reqs[slot];
+	req->hdr.type = (rq->op == BIO_READ) ?
+		VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+	req->hdr.reserved = 0;
+	req->hdr.sector = rq->sector;
+	req->status = 0xff;
+	req->bio = rq;
+
+	head = slot * VBLK_REQ_DESCS;
+	desc = &q->desc[head];
+	desc[0].addr = PHYS(&req->hdr);
+	desc[0].len = sizeof(req->hdr);
+	desc[0].flags = VRING_DESC_F_NEXT;
+	desc[0].next = head + 1;
+
+	i = 1;
+	rq_for_each_bio(bio, rq) {
+		desc[i].addr = buf_phys(bio->buf);
+		desc[i].len = bio->nr_sectors << SECTOR_SHIFT;
+		desc[i].flags = VRING_DESC_F_NEXT |
+			((rq->op == BIO_READ) ? VRING_DESC_F_WRITE : 0);
+		desc[i].next = head + i + 1;
+		i++;
+	}
+
+	desc[i].addr = PHYS(&req->status);
+	desc[i].len = sizeof(req->status);
+	desc[i].flags = VRING_DESC_F_WRITE;
+	desc[i].next = 0;
+
+	q->avail->ring[q->avail_idx % q->size] = head;
+	q->avail_idx++;
+	q->nr_inflight++;
+
+	/* x86 keeps stores in order: the compiler shouldn't reorder
+	 * them either, so the device never sees a half-made entry */
+	barrier();
+	q->avail->idx = q->avail_idx;
+}
+
+/*
+ * Ring the doorbell for entries added since the last one, if the
+ * device asked for it. Queue lock must be held.
+ */
+static void __vblk_kick(struct vblk_queue *q)
+{
+	uint16_t old, new;
+
+	old = q->kicked_idx;
+	new = q->avail_idx;
+	if (old == new)
+		return;
+	q->kicked_idx = new;
+
+	/* Publish avail->idx before reading the device's event index */
+	mb();
+	if (vblk.event_idx) {
+		if (!vring_need_event(*q->avail_event, new, old))
+			return;
+	} else if (q->used->flags & VRING_USED_F_NO_NOTIFY) {
+		return;
+	}
+
+	writew(q->index, q->notify);
+	q->nr_kicks++;
+}
+
+/*
+ * Move finished requests to the @done list, start pending ones in
+ * the freed slots, then re-arm the queue interrupt. With EVENT_IDX,
+ * ask for it only after the last in-flight request completes.
+ * Queue lock must be held.
+ */
+static void __vblk_reap(struct vblk_queue *q, struct list_node *done)
+{
+	struct vring_used_elem elem;
+	struct vblk_req *req;
+	struct bio *bio;
+	uint16_t slot, event;
+
+	do {
+		while (q->last_used != q->used->idx) {
+			barrier();
+			elem = q->used->ring[q->last_used % q->size];
+			slot = elem.id / VBLK_REQ_DESCS;
+			assert(slot < VBLK_REQS);
+
+			req = &q->reqs[slot];
+			bio = req->bio;
+			bio->status = (req->status == VIRTIO_BLK_S_OK) ?
+				0 : -EIO;
+			list_add_tail(done, &bio->node);
+
+			req->bio = NULL;
+			q->free_reqs[q->nr_free++] = slot;
+			q->last_used++;
+			q->nr_inflight--;
+			q->nr_completed++;
+		}
+
+		while (q->nr_free > 0 && !list_empty(&q->pending)) {
+			bio = list_entry(q->pending.next, struct bio, node);
+			list_del(&bio->node);
+			__vblk_queue_bio(q, bio);
+		}
+
+		if (!vblk.event_idx)
+			break;
+		event = q->last_used;
+		if (q->nr_inflight > 1)
+			event += q->nr_inflight - 1;
+		*q->used_event = event;
+
+		/* Did the device finish more while we were re-arming? */
+		mb();
+	} while (q->last_used != q->used->idx);
+
+	__vblk_kick(q);
+}
+
+/*
+ * Reap given queue, then complete the reaped requests outside of
+ * the queue lock: their end_io() hooks may submit new ones.
+ */
+static void vblk_complete(struct vblk_queue *q, bool irq)
+{
+	struct list_node done;
+	struct bio *bio, *spare;
+
+	list_init(&done);
+	spin_lock(&q->lock);
+	if (irq)
+		q->nr_irqs++;
+	__vblk_reap(q, &done);
+	spin_unlock(&q->lock);
+
+	list_for_each_safe(&done, bio, spare, node) {
+		list_del(&bio->node);
+		bio_endio(bio, bio->status);
+	}
+}
+
+static enum irqreturn vblk_irq(__unused void *data)
+{
+	int cpu;
+
+	/* MSI-X: queue #i interrupts CPU #i only */
+	if (vblk.msix) {
+		cpu = this_cpu_index();
+		if (cpu < vblk.nr_queues)
+			vblk_complete(vblk.queues[cpu], true);
+		return IRQ_HANDLED;
+	}
+
+	/* INTx#: reading the ISR de-asserts the line. Zero
+	 * means another device on a shared line raised it. */
+	if (readb(vblk.isr) == 0)
+		return IRQ_NONE;
+	for (int i = 0; i < vblk.nr_queues; i++)
+		vblk_complete(vblk.queues[i], true);
+	return IRQ_HANDLED;
+}
+
+static void vblk_submit(__unused struct block_device *bdev, struct bio *bio)
+{
+	struct vblk_queue *q;
+
+	if (bio->op == BIO_WRITE && vblk.read_only) {
+		bio_endio(bio, -EROFS);
+		return;
+	}
+
+	q = this_cpu_queue();
+	spin_lock(&q->lock);
+	if (q->nr_free == 0 || !list_empty(&q->pending))
+		list_add_tail(&q->pending, &bio->node);
+	else
+		__vblk_queue_bio(q, bio);
+	spin_unlock(&q->lock);
+}
+
+static void vblk_commit(__unused struct block_device *bdev)
+{
+	struct vblk_queue *q;
+
+	q = this_cpu_queue();
+	spin_lock(&q->lock);
+	__vblk_kick(q);
+	spin_unlock(&q->lock);
+}
+
+/*
+ * Reap all queues, not just ours: the awaited request may be held
+ * by the block layer till requests of other CPUs complete.
+ */
+static void vblk_poll(__unused struct block_device *bdev)
+{
+	for (int i = 0; i < vblk.nr_queues; i++)
+		vblk_complete(vblk.queues[i], false);
+}
+
+static struct block_device_ops vblk_ops = {
+	.submit = vblk_submit,
+	.commit = vblk_commit,
+	.poll = vblk_poll,
+};
+
+/*
+ * Locate the virtio config structures through the device's vendor
+ * specific PCI capabilities, and map them.
+ */
+static int vblk_map_cfgs(struct pci_dev *pdev)
+{
+	struct virtio_pci_cap cap;
+	uint8_t pos = 0;
+	void *addr;
+
+	while ((pos = pci_find_cap(pdev, PCI_CAP_ID_VNDR, pos)) != 0) {
+		cap.cfg_type = pci_read8(pdev, pos + 3);
+		cap.bar = pci_read8(pdev, pos + 4);
+		cap.offset = pci_read32(pdev, pos + 8);
+		cap.length = pci_read32(pdev, pos + 12);
+		if (cap.bar > 5 || cap.length == 0)
+			continue;
+
+		addr = NULL;
+		switch (cap.cfg_type) {
+		case VIRTIO_PCI_CAP_COMMON_CFG:
+		case VIRTIO_PCI_CAP_NOTIFY_CFG:
+		case VIRTIO_PCI_CAP_ISR_CFG:
+		case VIRTIO_PCI_CAP_DEVICE_CFG:
+			addr = pci_bar_map(pdev, cap.bar, cap.offset,
+					   cap.length);
+			break;
+		}
+
+		switch (cap.cfg_type) {
+		case VIRTIO_PCI_CAP_COMMON_CFG:
+			vblk.common = addr;
+			break;
+		case VIRTIO_PCI_CAP_NOTIFY_CFG:
+			vblk.notify_base = addr;
+			vblk.notify_mult = pci_read32(pdev, pos +
+					VIRTIO_PCI_NOTIFY_MULTIPLIER);
+			break;
+		case VIRTIO_PCI_CAP_ISR_CFG:
+			vblk.isr = addr;
+			break;
+		case VIRTIO_PCI_CAP_DEVICE_CFG:
+			vblk.devcfg = addr;
+			break;
+		}
+	}
+
+	if (!vblk.common || !vblk.notify_base || !vblk.isr || !vblk.devcfg)
+		return -ENODEV;
+	return 0;
+}
+
+static uint64_t vblk_features(void)
+{
+	struct virtio_pci_common_cfg *cfg = vblk.common;
+	uint64_t features;
+
+	writel(0, &cfg->device_feature_select);
+	features = readl(&cfg->device_feature);
+	writel(1, &cfg->device_feature_select);
+	features |= (uint64_t)readl(&cfg->device_feature) << 32;
+
+	return features;
+}
+
+static void vblk_set_features(uint64_t features)
+{
+	struct virtio_pci_common_cfg *cfg = vblk.common;
+
+	writel(0, &cfg->driver_feature_select);
+	writel(features & 0xffffffff, &cfg->driver_feature);
+	writel(1, &cfg->driver_feature_select);
+	writel(features >> 32, &cfg->driver_feature);
+}
+
+/*
+ * Rings layout, for a 128-entry queue, all in one zeroed page:
+ * descriptors at 0 (2048 bytes), the available ring right after
+ * (262 bytes), then the 4-byte aligned used ring (1030 bytes).
+ */
+#define VRING_AVAIL_OFFSET(n)	((n) * sizeof(struct vring_desc))
+#define VRING_USED_OFFSET(n)	round_up(VRING_AVAIL_OFFSET(n) +	\
+				 sizeof(struct vring_avail) +		\
+				 ((n) + 1) * sizeof(uint16_t), 4)
+#define VRING_SIZE(n)		(VRING_USED_OFFSET(n) +			\
+				 sizeof(struct vring_used) +		\
+				 (n) * sizeof(struct vring_used_elem) +	\
+				 sizeof(uint16_t))
+
+static int vblk_setup_queue(int index)
+{
+	struct virtio_pci_common_cfg *cfg = vblk.common;
+	struct vblk_queue *q;
+	char *ring;
+	uintptr_t phys;
+	uint16_t size;
+
+	compiler_assert(VRING_SIZE(VBLK_QUEUE_SIZE) <= PAGE_SIZE);
+	compiler_assert(VBLK_REQS * sizeof(struct vblk_req) <= PAGE_SIZE);
+	compiler_assert(sizeof(struct vblk_queue) <= MAXALLOC_SZ);
+
+	writew(index, &cfg->queue_select);
+	size = readw(&cfg->queue_size);
+	if (size == 0)
+		return -ENODEV;
+	size = min(size, (uint16_t)VBLK_QUEUE_SIZE);
+	if (size < VBLK_REQ_DESCS)
+		return -ENODEV;
+
+	q = kmalloc(sizeof(*q));
+	memset(q, 0, sizeof(*q));
+	spin_init(&q->lock);
+	list_init(&q->pending);
+	q->index = index;
+	q->size = size;
+
+	ring = page_address(get_zeroed_page(ZONE_ANY));
+	q->desc = (void *)ring;
+	q->avail = (void *)(ring + VRING_AVAIL_OFFSET(size));
+	q->used = (void *)(ring + VRING_USED_OFFSET(size));
+	q->used_event = (void *)(ring + VRING_AVAIL_OFFSET(size) +
+				 sizeof(struct vring_avail) +
+				 size * sizeof(uint16_t));
+	q->avail_event = (void *)(ring + VRING_USED_OFFSET(size) +
+				  sizeof(struct vring_used) +
+				  size * sizeof(struct vring_used_elem));
+
+	q->reqs = page_address(get_zeroed_page(ZONE_ANY));
+	q->nr_free = size / VBLK_REQ_DESCS;
+	for (int i = 0; i < q->nr_free; i++)
+		q->free_reqs[i] = q->nr_free - 1 - i;
+
+	writew(size, &cfg->queue_size);
+	phys = PHYS(ring);
+	writel(phys, &cfg->queue_desc);
+	writel(phys >> 32, (char *)&cfg->queue_desc + 4);
+	phys = PHYS(ring + VRING_AVAIL_OFFSET(size));
+	writel(phys, &cfg->queue_driver);
+	writel(phys >> 32, (char *)&cfg->queue_driver + 4);
+	phys = PHYS(ring + VRING_USED_OFFSET(size));
+	writel(phys, &cfg->queue_device);
+	writel(phys >> 32, (char *)&cfg->queue_device + 4);
+
+	if (vblk.msix) {
+		writew(index, &cfg->queue_msix_vector);
+		if (readw(&cfg->queue_msix_vector) != index)
+			panic("Virtio-blk: Queue %d MSI-X setup failed", index);
+		pci_msix_set_entry(vblk.pdev, index, cpus[index]->apic_id,
+				   VIRTIO_BLK_VECTOR);
+	}
+
+	q->notify = (uint16_t *)(vblk.notify_base +
+				 readw(&cfg->queue_notify_off) *
+				 vblk.notify_mult);
+	writew(1, &cfg->queue_enable);
+
+	vblk.queues[index] = q;
+	return 0;
+}
+
+/*
+ * Route completion interrupts: per-queue MSI-X messages to each
+ * queue's own CPU if possible, else the shared INTx# line to the
+ * bootstrap core. Return the MSI-X table size, or zero.
+ */
+static int vblk_setup_irqs(struct pci_dev *pdev)
+{
+	int nr_entries, ret;
+
+	irq_register(VIRTIO_BLK_VECTOR, vblk_irq, NULL, "virtio-blk");
+
+	nr_entries = pci_msix_enable(pdev);
+	if (nr_entries > 0) {
+		vblk.msix = true;
+		writew(VIRTIO_MSI_NO_VECTOR, &vblk.common->msix_config);
+		return nr_entries;
+	}
+
+	vblk.msix = false;
+	ret = ioapic_setup_pciirq(pdev->dev, pdev->irq_pin,
+				  VIRTIO_BLK_VECTOR, IRQ_BOOTSTRAP);
+	if (ret < 0)
+		printk("Virtio-blk: No INTx# routing; using polled I/O\n");
+	return 0;
+}
+
+void virtio_blk_init(void)
+{
+	struct virtio_pci_common_cfg *cfg;
+	struct pci_dev *pdev;
+	uint64_t features, wanted;
+	int nr_queues, nr_msix;
+
+	pdev = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_BLK_MODERN);
+	if (pdev == NULL)
+		pdev = pci_find_device(VIRTIO_PCI_VENDOR,
+				       VIRTIO_PCI_BLK_LEGACY);
+	if (pdev == NULL)
+		return;
+
+	vblk.pdev = pdev;
+	pci_enable(pdev);
+	if (vblk_map_cfgs(pdev) < 0) {
+		printk("Virtio-blk: Legacy-only device; not supported\n");
+		return;
+	}
+
+	cfg = vblk.common;
+	writeb(0, &cfg->device_status);
+	while (readb(&cfg->device_status) != 0)
+		cpu_pause();
+	writeb(VIRTIO_STATUS_ACKNOWLEDGE, &cfg->device_status);
+	writeb(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER,
+	       &cfg->device_status);
+
+	features = vblk_features();
+	if (!(features & (1ULL << VIRTIO_F_VERSION_1)))
+		goto fail;
+	wanted = (1ULL << VIRTIO_F_VERSION_1) | (1ULL << VIRTIO_BLK_F_MQ) |
+		(1ULL << VIRTIO_RING_F_EVENT_IDX) | (1ULL << VIRTIO_BLK_F_RO);
+	features &= wanted;
+	vblk_set_features(features);
+	writeb(readb(&cfg->device_status) | VIRTIO_STATUS_FEATURES_OK,
+	       &cfg->device_status);
+	if (!(readb(&cfg->device_status) & VIRTIO_STATUS_FEATURES_OK))
+		goto fail;
+
+	vblk.event_idx = features & (1ULL << VIRTIO_RING_F_EVENT_IDX);
+	vblk.read_only = features & (1ULL << VIRTIO_BLK_F_RO);
+
+	nr_queues = 1;
+	if (features & (1ULL << VIRTIO_BLK_F_MQ))
+		nr_queues = readw(vblk.devcfg + VIRTIO_BLK_CFG_NUM_QUEUES);
+	nr_queues = min(nr_queues, (int)readw(&cfg->num_queues));
+	nr_queues = min(nr_queues, mptables_get_nr_cpus());
+	nr_queues = min(nr_queues, VBLK_QUEUES_MAX);
+
+	nr_msix = vblk_setup_irqs(pdev);
+	if (vblk.msix && nr_msix < nr_queues)
+		nr_queues = nr_msix;
+
+	for (int i = 0; i < nr_queues; i++) {
+		if (vblk_setup_queue(i) < 0)
+			goto fail;
+		vblk.nr_queues++;
+	}
+
+	writeb(readb(&cfg->device_status) | VIRTIO_STATUS_DRIVER_OK,
+	       &cfg->device_status);
+
+	vblk.bdev.name = "vda";
+	vblk.bdev.nr_sectors = readl(vblk.devcfg + VIRTIO_BLK_CFG_CAPACITY) |
+		(uint64_t)readl(vblk.devcfg + VIRTIO_BLK_CFG_CAPACITY + 4) << 32;
+	vblk.bdev.ops = &vblk_ops;
+	vblk.bdev.max_segments = VBLK_SEGS_MAX;
+	vblk.bdev.queue_depth = VBLK_REQS;
+	printk("Virtio-blk: %d queue(s), %s interrupts%s%s\n", vblk.nr_queues,
+	       vblk.msix ? "MSI-X" : "INTx#",
+	       vblk.event_idx ? ", event index" : "",
+	       vblk.read_only ? ", read-only" : "");
+	blkdev_register(&vblk.bdev);
+	return;
+
+fail:
+	writeb(readb(&cfg->device_status) | VIRTIO_STATUS_FAILED,
+	       &cfg->device_status);
+	printk("Virtio-blk: Device initialization failed\n");
+}
+
+#if	VIRTIO_BLK_TESTS
+
+/*
+ * NOTE! These tests overwrite the disk contents
+ */
+
+#define TEST_BATCH	64		/* > VBLK_REQS: exercise queueing */
+
+static void fill_pattern(char *buf, uint64_t sector, int len)
+{
+	for (int i = 0; i < len; i++)
+		buf[i] = (char)(sector * 31 + i);
+}
+
+static void check_pattern(char *buf, uint64_t sector, int len)
+{
+	for (int i = 0; i < len; i++)
+		if (buf[i] != (char)(sector * 31 + i))
+			panic("Virtio-blk: Sector %lu, byte %d: got 0x%x",
+			      sector, i, buf[i]);
+}
+
+/*
+ * Synchronous transfers of all sizes, 1 to 8 sectors
+ */
+static void test_sync_rw(struct block_device *bdev)
+{
+	char *buf;
+	uint64_t sector;
+	int ret;
+
+	buf = kmalloc(PAGE_SIZE);
+	for (int n = 1; n <= 8; n++) {
+		sector = n * 64;
+		fill_pattern(buf, sector, n * SECTOR_SIZE);
+		ret = blkdev_rw(bdev, BIO_WRITE, sector, buf, n);
+		if (ret < 0)
+			panic("Virtio-blk: Writing sector %lu returned %s",
+			      sector, errno(ret));
+		memset(buf, 0, PAGE_SIZE);
+		ret = blkdev_rw(bdev, BIO_READ, sector, buf, n);
+		if (ret < 0)
+			panic("Virtio-blk: Reading sector %lu returned %s",
+			      sector, errno(ret));
+		check_pattern(buf, sector, n * SECTOR_SIZE);
+	}
+	kfree(buf);
+	printk("Virtio-blk: Synchronous transfers: success\n");
+}
+
+/*
+ * Submit more requests than the queue slots in one batch
+ */
+static void test_batch_rw(struct block_device *bdev, enum bio_op op)
+{
+	struct bio *bios[TEST_BATCH];
+	uint64_t sector;
+	int ret;
+
+	for (int i = 0; i < TEST_BATCH; i++) {
+		sector = 4096 + i * 8;
+		bios[i] = kmalloc(sizeof(struct bio));
+		bio_init(bios[i], bdev, op, sector, kmalloc(PAGE_SIZE), 8);
+		if (op == BIO_WRITE)
+			fill_pattern(bios[i]->buf, sector, PAGE_SIZE);
+	}
+
+	submit_bio_batch(bios, TEST_BATCH);
+
+	for (int i = 0; i < TEST_BATCH; i++) {
+		ret = bio_wait(bios[i]);
+		if (ret < 0)
+			panic("Virtio-blk: Batch bio %d returned %s", i,
+			      errno(ret));
+		if (op == BIO_READ)
+			check_pattern(bios[i]->buf, bios[i]->sector,
+				      PAGE_SIZE);
+		kfree(bios[i]->buf);
+		kfree(bios[i]);
+	}
+}
+
+void virtio_blk_run_tests(void)
+{
+	struct block_device *bdev;
+	struct vblk_queue *q;
+
+	bdev = blkdev_find("vda");
+	if (bdev == NULL) {
+		printk("Virtio-blk: No device; skipping tests\n");
+		return;
+	}
+	if (vblk.read_only || bdev->nr_sectors < 8192) {
+		printk("Virtio-blk: Need a writable >= 4MB disk for tests\n");
+		return;
+	}
+
+	test_sync_rw(bdev);
+	test_batch_rw(bdev, BIO_WRITE);
+	test_batch_rw(bdev, BIO_READ);
+	printk("Virtio-blk: Batched transfers: success\n");
+
+	for (int i = 0; i < vblk.nr_queues; i++) {
+		q = vblk.queues[i];
+		printk("Virtio-blk: queue %d: %lu requests, %lu doorbells, "
+		       "%lu interrupts\n", i, q->nr_completed, q->nr_kicks,
+		       q->nr_irqs);
+	}
+}
+
+#endif	/* VIRTIO_BLK_TESTS */
@@ -99,10 +99,13 @@
 #include <stdint.h>
 #include <percpu.h>
 #include <errno.h>
-#include <ramdisk.h>
+#include <blkdev.h>
+#include <bcache.h>
 #include <ext2.h>
 #include <string.h>
 #include <kmalloc.h>
+#include <mm.h>
+#include <paging.h>
 #include <hash.h>
 #include <bitmap.h>
 
@@ -113,9 +116,9 @@
  * by having a lock on each hash collision linked-list instead.
  */
 struct {
-	union super_block	*sb;		/* On-disk Superblock */
-	struct group_descriptor *bgd;		/* On-disk Group Desc Table */
-	char			*buf;		/* Ramdisk buffer */
+	union super_block	*sb;		/* In-core Superblock */
+	struct group_descriptor **bgd_pages;	/* In-core Group Desc Table */
+	struct block_device	*bdev;		/* Volume's device */
 	uint64_t		block_size;	/* 1, 2, or 4K */
 	uint64_t		frag_size;	/* 1, 2, or 4K */
 	uint64_t		blockgroups_count;
@@ -124,16 +127,87 @@ struct {
 	spinlock_t		block_allocation_lock;
 	struct hash		*inodes_hash;
 	spinlock_t		inodes_hash_lock;
+	uint64_t		bgd_offset;	/* Group Desc Table location */
+	spinlock_t		sb_lock;	/* Superblock & GDT writeback */
 } isb;
 
 /*
- * Return a pointer to the on-disk image of inode #inum.
+ * The in-core Group Descriptor Table is kept in separate pages: a
+ * single kmalloc() buffer would limit us to 128 block groups.
  */
-static void *inode_diskimage(uint64_t inum)
+#define BGDS_PER_PAGE	(PAGE_SIZE / sizeof(struct group_descriptor))
+
+static struct group_descriptor *bgd_get(uint64_t group)
+{
+	assert(group < isb.blockgroups_count);
+	return &isb.bgd_pages[group / BGDS_PER_PAGE][group % BGDS_PER_PAGE];
+}
+
+/*
+ * Transfer given block range through the block devices page cache
+ */
+static void __block_read_write(uint64_t block, char *buf, uint blk_offset,
+			       uint len, enum block_op operation)
+{
+	uint64_t offset, blocks_count;
+	int ret;
+
+	blocks_count = isb.sb->blocks_count;
+	if (block >= blocks_count)
+		panic("EXT2: Block %lu is out of volume boundary\n"
+		      "Volume block count = %lu blocks\n", block, blocks_count);
+	if (blk_offset + len > isb.block_size)
+		panic("EXT2: Block-#%lu, blk_offset=%u, len=%u access exceeds "
+		      "block boundaries!", block, blk_offset, len);
+
+	if (len == 0)
+		return;
+
+	offset = (block * isb.block_size) + blk_offset;
+	if (operation == BLOCK_READ)
+		ret = bcache_read(isb.bdev, offset, buf, len);
+	else
+		ret = bcache_write(isb.bdev, offset, buf, len);
+	if (ret < 0)
+		panic("EXT2: %s block #%lu, blk_offset=%u, len=%u returned -%s",
+		      (operation == BLOCK_READ) ? "Reading" : "Writing", block,
+		      blk_offset, len, errno(ret));
+}
+
+/*
+ * Block Read - Read given disk block into buffer
+ * @block       : Disk block to read from
+ * @buf         : Buffer to put the read data into
+ * @blk_offset  : Offset within the block  to start reading from
+ * @len         : Nr of bytes to read, starting from @blk_offset
+ */
+STATIC void block_read(uint64_t block, char *buf, uint blk_offset, uint len)
+{
+	__block_read_write(block, buf, blk_offset, len, BLOCK_READ);
+}
+
+/*
+ * Block Write - Write given buffer into disk block
+ * @block       : Disk block to write to
+ * @buf         : Buffer of data to be written
+ * @blk_offset  : Offset within the block to start writing to
+ * @len         : Nr of bytes to write, starting from @blk_offset
+ */
+STATIC void block_write(uint64_t block, char *buf, uint blk_offset, uint len)
+{
+	__block_read_write(block, buf, blk_offset, len, BLOCK_WRTE);
+}
+
+
+/*
+ * Find the on-disk location of inode #inum: the inode table
+ * block holding it, and its offset within that block.
+ */
+static void inode_location(uint64_t inum, uint64_t *block, uint *blk_offset)
 {
 	union super_block *sb;
 	struct group_descriptor *bgd;
-	uint64_t group, groupi, inodetbl_offset, inode_offset;
+	uint64_t group, groupi, inode_offset;
 
 	sb = isb.sb;
 	assert(inum != 0);
@@ -142,10 +216,61 @@ static void *inode_diskimage(uint64_t inum)
 	if (group >= isb.blockgroups_count || inum > sb->inodes_count)
 		panic("EXT2: Inode %d out of volume range", inum);
 
-	bgd = &isb.bgd[group];
-	inodetbl_offset = bgd->inode_table * isb.block_size;
-	inode_offset = inodetbl_offset + groupi * sb->inode_size;
-	return (void *)&isb.buf[inode_offset];
+	bgd = bgd_get(group);
+	inode_offset = groupi * sb->inode_size;
+	*block = bgd->inode_table + inode_offset / isb.block_size;
+	*blk_offset = inode_offset % isb.block_size;
+}
+
+static void inode_read_disk(uint64_t inum, void *buf)
+{
+	uint64_t block;
+	uint blk_offset;
+
+	inode_location(inum, &block, &blk_offset);
+	block_read(block, buf, blk_offset, dino_len());
+}
+
+static void inode_write_disk(uint64_t inum, void *buf)
+{
+	uint64_t block;
+	uint blk_offset;
+
+	inode_location(inum, &block, &blk_offset);
+	block_write(block, buf, blk_offset, dino_len());
+}
+
+/*
+ * Write the in-core Superblock, and the Descriptor of @group unless
+ * it's NO_GROUP, back to the page cache. Call after modifying their
+ * counters.
+ *
+ * Writes are serialized: the last writer, thus the disk, always sees
+ * all modifications done before its own.
+ */
+#define NO_GROUP	UINT64_MAX
+
+static void sb_bgd_sync(uint64_t group)
+{
+	struct group_descriptor *bgd;
+	uint64_t offset;
+	int ret;
+
+	spin_lock(&isb.sb_lock);
+	ret = bcache_write(isb.bdev, EXT2_SUPERBLOCK_OFFSET, isb.sb,
+			   sizeof(*isb.sb));
+	if (ret < 0)
+		panic("EXT2: Writing superblock returned -%s", errno(ret));
+
+	if (group != NO_GROUP) {
+		bgd = bgd_get(group);
+		offset = isb.bgd_offset + group * sizeof(*bgd);
+		ret = bcache_write(isb.bdev, offset, bgd, sizeof(*bgd));
+		if (ret < 0)
+			panic("EXT2: Writing group descriptor %lu returned "
+			      "-%s", group, errno(ret));
+	}
+	spin_unlock(&isb.sb_lock);
 }
 
 /*
@@ -165,7 +290,7 @@ struct inode *inode_get(uint64_t inum)
 	if (inode == NULL) {
 		inode = kmalloc(sizeof(*inode));
 		inode_init(inode, inum);
-		memcpy(dino_off(inode), inode_diskimage(inum), dino_len());
+		inode_read_disk(inum, dino_off(inode));
 		hash_insert(isb.inodes_hash, inode);
 	} else {
 		assert(inode->refcount >= 1);
@@ -195,7 +320,7 @@ void inode_put(struct inode *inode)
 	 */
 
 	if (inode->dirty == true)
-		memcpy(inode_diskimage(inode->inum), dino_off(inode), dino_len());
+		inode_write_disk(inode->inum, dino_off(inode));
 
 	spin_lock(&isb.inodes_hash_lock);
 	assert(inode->refcount > 0);
@@ -218,48 +343,39 @@ void inode_put(struct inode *inode)
 	spin_unlock(&isb.inodes_hash_lock);
 }
 
-static void __block_read_write(uint64_t block, char *buf, uint blk_offset,
-			       uint len, enum block_op operation)
+/*
+ * Set given inode's full 64-bit file size. Mark the volume as having
+ * large files once a file reaches 2-GBytes, as done by Linux: older
+ * drivers will then only mount the volume as read-only.
+ */
+static void inode_set_size(struct inode *inode, uint64_t size)
 {
-	uint64_t final_offset, blocks_count;
+	if (!S_ISREG(inode->mode))
+		assert(size <= UINT32_MAX);
 
-	blocks_count = isb.sb->blocks_count;
-	if (block >= blocks_count)
-		panic("EXT2: Block %lu is out of volume boundary\n"
-		      "Volume block count = %lu blocks\n", block, blocks_count);
-	if (blk_offset + len > isb.block_size)
-		panic("EXT2: Block-#%lu, blk_offset=%u, len=%u access exceeds "
-		      "block boundaries!", block, blk_offset, len);
+	inode->size_low = size & UINT32_MAX;
+	inode->size_high = size >> 32;
+	inode->dirty = true;
 
-	final_offset = (block * isb.block_size) + blk_offset;
-	switch (operation) {
-	case BLOCK_READ: memcpy(buf, &isb.buf[final_offset], len); break;
-	case BLOCK_WRTE: memcpy(&isb.buf[final_offset], buf, len); break;
-	};
+	if (size > INT32_MAX && !(isb.sb->features_ro_compat &
+				  EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+		isb.sb->features_ro_compat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+		sb_bgd_sync(NO_GROUP);
+	}
 }
 
 /*
- * Block Read - Read given disk block into buffer
- * @block       : Disk block to read from
- * @buf         : Buffer to put the read data into
- * @blk_offset  : Offset within the block  to start reading from
- * @len         : Nr of bytes to read, starting from @blk_offset
+ * Max file size, in bytes, mappable by the inode's blocks tree
  */
-STATIC void block_read(uint64_t block, char *buf, uint blk_offset, uint len)
+static uint64_t file_max_size(void)
 {
-	__block_read_write(block, buf, blk_offset, len, BLOCK_READ);
-}
+	uint64_t entries_count, nblocks;
 
-/*
- * Block Write - Write given buffer into disk block
- * @block       : Disk block to write to
- * @buf         : Buffer of data to be written
- * @blk_offset  : Offset within the block to start writing to
- * @len         : Nr of bytes to write, starting from @blk_offset
- */
-STATIC void block_write(uint64_t block, char *buf, uint blk_offset, uint len)
-{
-	__block_read_write(block, buf, blk_offset, len, BLOCK_WRTE);
+	entries_count = isb.block_size / sizeof(uint32_t);
+	nblocks = EXT2_INO_NR_DIRECT_BLKS + entries_count +
+		entries_count * entries_count +
+		entries_count * entries_count * entries_count;
+	return nblocks * isb.block_size;
 }
 
 /*
@@ -282,10 +398,10 @@ STATIC struct inode *inode_alloc(enum file_type type)
 	int first_zero_bit;
 	uint64_t inum;
 
-	bgd = isb.bgd;
 	buf = kmalloc(isb.block_size);
 
-	for (uint i = 0; i < isb.blockgroups_count; i++, bgd++) {
+	for (uint i = 0; i < isb.blockgroups_count; i++) {
+		bgd = bgd_get(i);
 		spin_lock(&isb.inode_allocation_lock);
 		block_read(bgd->inode_bitmap, buf, 0, isb.block_size);
 		first_zero_bit = bitmap_first_zero_bit(buf, isb.block_size);
@@ -306,6 +422,7 @@ STATIC struct inode *inode_alloc(enum file_type type)
 		bgd->free_inodes_count--;
 		if (type == EXT2_FT_DIR)
 			bgd->used_dirs_count++;
+		sb_bgd_sync(i);
 
 		bitmap_set_bit(buf, first_zero_bit, isb.block_size);
 		block_write(bgd->inode_bitmap, buf, 0, isb.block_size);
@@ -356,7 +473,7 @@ static void __inode_dealloc(struct inode *inode)
 
 	group  = (inode->inum - 1) / isb.sb->inodes_per_group;
 	groupi = (inode->inum - 1) % isb.sb->inodes_per_group;
-	bgd = &isb.bgd[group];
+	bgd = bgd_get(group);
 	buf = kmalloc(isb.block_size);
 
 	spin_lock(&isb.inode_allocation_lock);
@@ -364,13 +481,15 @@ static void __inode_dealloc(struct inode *inode)
 	bgd->free_inodes_count++;
 	if (S_ISDIR(inode->mode))
 		bgd->used_dirs_count--;
+	sb_bgd_sync(group);
 	block_read(bgd->inode_bitmap, buf, 0, isb.block_size);
 	assert(bitmap_bit_is_set(buf, groupi, isb.block_size));
 	bitmap_clear_bit(buf, groupi, isb.block_size);
 	block_write(bgd->inode_bitmap, buf, 0, isb.block_size);
 	spin_unlock(&isb.inode_allocation_lock);
 
-	memset(inode_diskimage(inode->inum), 0, dino_len());
+	memset(buf, 0, dino_len());
+	inode_write_disk(inode->inum, buf);
 	kfree(buf);
 }
 
@@ -387,10 +506,10 @@ STATIC uint64_t block_alloc(void)
 	char *buf;
 
 	sb = isb.sb;
-	bgd = isb.bgd;
 	buf = kmalloc(isb.block_size);
 
-	for (uint i = 0; i < isb.blockgroups_count; i++, bgd++) {
+	for (uint i = 0; i < isb.blockgroups_count; i++) {
+		bgd = bgd_get(i);
 		spin_lock(&isb.block_allocation_lock);
 		block_read(bgd->block_bitmap, buf, 0, isb.block_size);
 		first_zero_bit = bitmap_first_zero_bit(buf, isb.block_size);
@@ -413,6 +532,7 @@ STATIC uint64_t block_alloc(void)
 		assert(bgd->free_blocks_count > 0);
 		isb.sb->free_blocks_count--;
 		bgd->free_blocks_count--;
+		sb_bgd_sync(i);
 
 		bitmap_set_bit(buf, first_zero_bit, isb.block_size);
 		block_write(bgd->block_bitmap, buf, 0, isb.block_size);
@@ -425,6 +545,78 @@ out:
 	return block;
 }
 
+/*
+ * Block Alloc Run - Reserve a run of contiguous free data blocks
+ * @want        : Desired run length, in blocks
+ * @count       : Return val, nr of blocks actually reserved (<= @want)
+ * Return val   : First block of the reserved run, or 0 if disk is full
+ *
+ * A whole run is reserved under a single allocation-lock acquisition
+ * per group: the group's first free run of @want blocks is taken, or
+ * its longest free run if no such run exists.  Callers loop on us to
+ * reserve big areas with few bitmap round trips and less fragmentation.
+ */
+STATIC uint64_t block_alloc_run(uint64_t want, uint64_t *count)
+{
+	union super_block *sb;
+	struct group_descriptor *bgd;
+	uint64_t first_blk, last_blk, nbits, start, len, best, best_len;
+	char *buf;
+
+	assert(want > 0);
+	sb = isb.sb;
+	buf = kmalloc(isb.block_size);
+
+	for (uint i = 0; i < isb.blockgroups_count; i++) {
+		bgd = bgd_get(i);
+		first_blk = i * sb->blocks_per_group + sb->first_data_block;
+		last_blk = (i != isb.last_blockgroup) ?
+			first_blk + sb->blocks_per_group - 1 :
+			sb->blocks_count - 1;
+		nbits = last_blk - first_blk + 1;
+
+		spin_lock(&isb.block_allocation_lock);
+		if (bgd->free_blocks_count == 0) {
+			spin_unlock(&isb.block_allocation_lock);
+			continue;
+		}
+		block_read(bgd->block_bitmap, buf, 0, isb.block_size);
+		best = best_len = 0;
+		for (start = 0; start < nbits && best_len < want; start += len) {
+			len = 0;
+			while (start + len < nbits && len < want &&
+			       bitmap_bit_is_clear(buf, start+len, isb.block_size))
+				len++;
+			if (len > best_len)
+				best = start, best_len = len;
+			if (len == 0)
+				len = 1;
+		}
+		if (best_len == 0) {
+			spin_unlock(&isb.block_allocation_lock);
+			continue;
+		}
+
+		assert(sb->free_blocks_count >= best_len);
+		assert(bgd->free_blocks_count >= best_len);
+		sb->free_blocks_count -= best_len;
+		bgd->free_blocks_count -= best_len;
+		sb_bgd_sync(i);
+		for (uint64_t bit = best; bit < best + best_len; bit++)
+			bitmap_set_bit(buf, bit, isb.block_size);
+		block_write(bgd->block_bitmap, buf, 0, isb.block_size);
+		spin_unlock(&isb.block_allocation_lock);
+
+		kfree(buf);
+		*count = best_len;
+		return first_blk + best;
+	}
+
+	kfree(buf);
+	*count = 0;
+	return 0;
+}
+
 /*
  * Block Dealloc - Mark given block as free on-disk
  * @block       : Block number to deallocate
@@ -444,13 +636,14 @@ STATIC void block_dealloc(uint block)
 
 	group  = (block - sb->first_data_block) / sb->blocks_per_group;
 	groupi = (block - sb->first_data_block) % sb->blocks_per_group;
-	bgd = &isb.bgd[group];
+	bgd = bgd_get(group);
 	buf = kmalloc(isb.block_size);
 
 	spin_lock(&isb.block_allocation_lock);
 	sb->free_blocks_count++;
 	bgd->free_blocks_count++;
 	assert(sb->free_blocks_count <= sb->blocks_count);
+	sb_bgd_sync(group);
 	block_read(bgd->block_bitmap, buf, 0, isb.block_size);
 	assert(bitmap_bit_is_set(buf, groupi, isb.block_size));
 	bitmap_clear_bit(buf, groupi, isb.block_size);
@@ -460,6 +653,263 @@ STATIC void block_dealloc(uint block)
 	kfree(buf);
 }
 
+/*
+ * Block Zero - Fill given disk block with zeroes
+ */
+static void block_zero(uint64_t block)
+{
+	char *zeroes;
+
+	zeroes = kmalloc(isb.block_size);
+	memset(zeroes, 0, isb.block_size);
+	block_write(block, zeroes, 0, isb.block_size);
+	kfree(zeroes);
+}
+
+/*
+ * Translate file block number @fblock to its path in the inode blocks
+ * tree: @offsets[0] is the slot in the inode's blocks[] table, while
+ * @offsets[1..level] are entry indices in each indirect block level.
+ * Return val   : Level of indirection, or -EFBIG if @fblock is unmappable
+ */
+static int block_map_path(uint64_t fblock, uint64_t *offsets)
+{
+	uint64_t entries_count, span;
+
+	if (fblock < EXT2_INO_NR_DIRECT_BLKS) {
+		offsets[0] = fblock;
+		return ZERO_INDIR;
+	}
+
+	fblock -= EXT2_INO_NR_DIRECT_BLKS;
+	entries_count = isb.block_size / sizeof(uint32_t);
+	span = entries_count;
+	for (int level = SINGLE_INDIR; level < INDIRECTION_LEVEL_MAX; level++) {
+		if (fblock < span) {
+			offsets[0] = EXT2_INO_INDIRECT + level - SINGLE_INDIR;
+			for (int i = level; i > 0; i--) {
+				offsets[i] = fblock % entries_count;
+				fblock /= entries_count;
+			}
+			return level;
+		}
+		fblock -= span;
+		span *= entries_count;
+	}
+	return -EFBIG;
+}
+
+/*
+ * Nr of file blocks in the hole starting at the one having given block
+ * tree @offsets, knowing that the tree has a null entry at depth @i: a
+ * null entry in an indirect block of level L is a hole spanning all of
+ * the data blocks this entry would've mapped.
+ */
+static uint64_t block_map_hole_len(uint64_t *offsets, int level, int i)
+{
+	uint64_t entries_count, span, pos;
+
+	entries_count = isb.block_size / sizeof(uint32_t);
+	span = 1, pos = 0;
+	for (int j = level; j > i; j--) {
+		pos += offsets[j] * span;
+		span *= entries_count;
+	}
+	assert(pos < span);
+	return span - pos;
+}
+
+/*
+ * Block Map - Get the disk block mapping given file block
+ * @inode       : File's inode, which will map us to the data blocks
+ * @fblock      : File block number; the file's first block is zero
+ * @new         : If non-zero, and @fblock is a hole, map it to @new.
+ *                Missing indirect blocks on the way get allocated.
+ * @hole_len    : If non-NULL, and @fblock is a hole, return the nr of
+ *                blocks known to be unmapped starting from @fblock.
+ * Return val   : Disk block number, zero for holes, or an errno
+ *
+ * NOTE! If @fblock was already mapped, its original disk block is
+ * returned: @new is not consumed, and it's up to the caller to free it.
+ */
+static int64_t __file_block_map(struct inode *inode, uint64_t fblock,
+				uint64_t new, uint64_t *hole_len)
+{
+	uint64_t offsets[INDIRECTION_LEVEL_MAX], parent;
+	uint32_t entry;
+	int level;
+
+	level = block_map_path(fblock, offsets);
+	if (level < 0)
+		return level;
+
+	parent = 0;
+	for (int i = 0; i <= level; i++) {
+		if (i == 0)
+			entry = inode->blocks[offsets[0]];
+		else
+			block_read(parent, (char *)&entry,
+				   offsets[i] * sizeof(entry), sizeof(entry));
+		if (entry == 0) {
+			if (new == 0) {
+				if (hole_len != NULL)
+					*hole_len = block_map_hole_len(offsets,
+								       level, i);
+				return 0;
+			}
+			if (i == level) {
+				entry = new;
+			} else {
+				if ((entry = block_alloc()) == 0)
+					return -ENOSPC;
+				block_zero(entry);
+			}
+			if (i == 0)
+				inode->blocks[offsets[0]] = entry;
+			else
+				block_write(parent, (char *)&entry,
+					    offsets[i] * sizeof(entry),
+					    sizeof(entry));
+			inode->i512_blocks += isb.block_size / 512;
+			inode->dirty = true;
+		}
+		parent = entry;
+	}
+
+	return entry;
+}
+
+STATIC int64_t file_block_map(struct inode *inode, uint64_t fblock,
+			      uint64_t new)
+{
+	return __file_block_map(inode, fblock, new, NULL);
+}
+
+/*
+ * Like __file_block_map() for lookups, but never wait for the disk:
+ * if a needed indirect block is not cached, start reading it ahead
+ * and return -EAGAIN.
+ */
+static int64_t file_block_map_nowait(struct inode *inode, uint64_t fblock)
+{
+	uint64_t offsets[INDIRECTION_LEVEL_MAX], parent;
+	uint32_t entry;
+	int level, ret;
+
+	level = block_map_path(fblock, offsets);
+	if (level < 0)
+		return level;
+
+	parent = 0;
+	for (int i = 0; i <= level; i++) {
+		if (i == 0) {
+			entry = inode->blocks[offsets[0]];
+		} else {
+			if (parent >= isb.sb->blocks_count)
+				return -EIO;
+			ret = bcache_read_nowait(isb.bdev, parent * isb.block_size
+						 + offsets[i] * sizeof(entry),
+						 &entry, sizeof(entry));
+			if (ret < 0)
+				return ret;
+		}
+		if (entry == 0)
+			return 0;
+		parent = entry;
+	}
+
+	return entry;
+}
+
+/*
+ * Start reading file blocks [@start, @start+@len) ahead, merging
+ * blocks contiguous on disk into single requests. Stop at the first
+ * uncached indirect block: its own readahead is started instead, and
+ * the next window will be able to map past it.
+ */
+static void file_readahead_blocks(struct inode *inode, uint64_t start,
+				  uint64_t len)
+{
+	uint64_t run_start = 0, run_len = 0;
+	int64_t dblock;
+
+	for (uint64_t fblock = start; fblock < start + len; fblock++) {
+		dblock = file_block_map_nowait(inode, fblock);
+		if (dblock < 0)
+			break;
+		if (dblock == 0)
+			continue;
+		if (run_len != 0 && (uint64_t)dblock == run_start + run_len) {
+			run_len++;
+			continue;
+		}
+		if (run_len != 0)
+			bcache_readahead(isb.bdev, run_start * isb.block_size,
+					 run_len * isb.block_size);
+		run_start = dblock;
+		run_len = 1;
+	}
+	if (run_len != 0)
+		bcache_readahead(isb.bdev, run_start * isb.block_size,
+				 run_len * isb.block_size);
+}
+
+#define RA_MIN_BYTES	(16 * 1024)
+#define RA_MAX_BYTES	(128 * 1024)
+
+/*
+ * File Readahead - Detect sequential reads, and prefetch ahead of them
+ * @inode	: File's inode, holding the readahead state
+ * @offset	: Offset of the read request about to be serviced
+ * @len		: Request length, non-zero and within file boundaries
+ *
+ * A read starting at the file head, or right after the previous one,
+ * is sequential. The first sequential read starts a readahead window
+ * right after itself; once the reader enters that window, the next,
+ * doubled, window gets started. Data is thus always being fetched one
+ * window ahead of the reader, asynchronously, while windows grow up
+ * to RA_MAX_BYTES. Any non-sequential read turns readahead off, till
+ * the next sequential one.
+ *
+ * NOTE! Concurrent readers of one inode may clobber each other's state
+ * updates: that only costs prefetching accuracy, never correctness.
+ */
+static void file_readahead(struct inode *inode, uint64_t offset, uint64_t len)
+{
+	struct file_ra_state ra;
+	uint64_t first, last, min_blocks, max_blocks, nr_blocks;
+	uint64_t start = 0, size = 0;
+
+	first = offset / isb.block_size;
+	last = (offset + len - 1) / isb.block_size;
+	min_blocks = RA_MIN_BYTES / isb.block_size;
+	max_blocks = RA_MAX_BYTES / isb.block_size;
+
+	ra = inode->ra;
+	if (first != 0 && first != ra.next) {
+		ra.size = 0;
+	} else if (ra.size == 0) {
+		ra.size = 2 * (last - first + 1);
+		ra.size = max(ra.size, min_blocks);
+		ra.size = min(ra.size, max_blocks);
+		ra.start = last + 1;
+		ra.trigger = ra.start;
+		start = ra.start, size = ra.size;
+	} else if (last >= ra.trigger) {
+		ra.start = max(ra.start + ra.size, last + 1);
+		ra.size = min(2 * ra.size, max_blocks);
+		ra.trigger = ra.start;
+		start = ra.start, size = ra.size;
+	}
+	ra.next = last + 1;
+	inode->ra = ra;
+
+	nr_blocks = ceil_div(inode_size(inode), isb.block_size);
+	if (size == 0 || start >= nr_blocks)
+		return;
+	file_readahead_blocks(inode, start, min(size, nr_blocks - start));
+}
+
 /*
  * File Read - Read given file into buffer
  * @inode	: File's inode, which will map us to the data blocks
@@ -473,42 +923,90 @@ STATIC void block_dealloc(uint block)
  */
 uint64_t file_read(struct inode *inode, char *buf, uint64_t offset, uint64_t len)
 {
-	uint64_t supported_area, block, blk_offset;
-	uint64_t read_len, ret_len;
+	uint64_t block, blk_offset, read_len, ret_len, hole_len, size;
+	int64_t dblock;
 
 	if (!S_ISREG(inode->mode) && !S_ISDIR(inode->mode))
 		return 0;
 
-	supported_area = isb.block_size * EXT2_INO_NR_DIRECT_BLKS;
-	if (offset >= inode->size_low)
+	size = inode_size(inode);
+	if (offset >= size)
 		return 0;
-	if (offset + len > inode->size_low)
-		len = inode->size_low - offset;
-	if (offset + len > supported_area)
-		len = supported_area  - offset;
+	if (len > size - offset)
+		len = size - offset;
+	if (len != 0 && S_ISREG(inode->mode))
+		file_readahead(inode, offset, len);
 
 	ret_len = len;
 	while (len != 0) {
 		block = offset / isb.block_size;
 		blk_offset = offset % isb.block_size;
 		read_len = isb.block_size - blk_offset;
-		read_len = min(read_len, len);
 
-		assert(block < EXT2_INO_NR_DIRECT_BLKS);
-		block_read(inode->blocks[block], buf, blk_offset, read_len);
+		/* Sparse files: a hole is read as zeroes, and a null
+		 * indirect entry makes a hole span many blocks at once */
+		dblock = __file_block_map(inode, block, 0, &hole_len);
+		assert(dblock >= 0);
+		if (dblock == 0) {
+			assert(hole_len > 0);
+			read_len += (hole_len - 1) * isb.block_size;
+			read_len = min(read_len, len);
+			memset(buf, 0, read_len);
+		} else {
+			read_len = min(read_len, len);
+			block_read(dblock, buf, blk_offset, read_len);
+		}
 
 		assert(len >= read_len);
 		len -= read_len;
 		buf += read_len;
 		offset += read_len;
-		assert(offset <= inode->size_low);
-		if (offset == inode->size_low)
+		assert(offset <= size);
+		if (offset == size)
 			assert(len == 0);
 	}
 
 	return ret_len;
 }
 
+/*
+ * File Seek Hole/Data - Find the next file hole, or data, area
+ * @inode	: File's inode, which will map us to the data blocks
+ * @offset	: File offset to start searching from
+ * @hole	: Search for a hole if true, or for data otherwise
+ * Return val	: Offset of the found area, or -ENXIO if @offset is beyond
+ *		  EOF or, for data, if only a hole exists till EOF.
+ *
+ * Following Solaris and Linux, the area past EOF is an implicit hole:
+ * searching for a hole always succeeds for an in-file @offset.  Holes
+ * are skipped using the block map, without touching any data blocks.
+ */
+int64_t file_seek_hole_data(struct inode *inode, uint64_t offset, bool hole)
+{
+	uint64_t block, hole_len, size;
+	int64_t dblock;
+
+	size = inode_size(inode);
+	if (offset >= size)
+		return -ENXIO;
+
+	while (offset < size) {
+		block = offset / isb.block_size;
+		dblock = __file_block_map(inode, block, 0, &hole_len);
+		assert(dblock >= 0);
+		if ((dblock == 0) == hole)
+			return offset;
+		if (dblock == 0)
+			offset = (block + hole_len) * isb.block_size;
+		else
+			offset = (block + 1) * isb.block_size;
+	}
+
+	if (hole)
+		return size;
+	return -ENXIO;
+}
+
 /*
  * File Write - Write given buffer into file
  * @inode       : File's inode, which will map us to the data blocks
@@ -519,19 +1017,18 @@ uint64_t file_read(struct inode *inode, char *buf, uint64_t offset, uint64_t len
  */
 int64_t file_write(struct inode *inode, char *buf, uint64_t offset, uint64_t len)
 {
-	uint64_t supported_area, blk_offset, last_offset;
-	uint64_t write_len, ret_len, block, new;
+	uint64_t blk_offset, last_offset, write_len, ret_len, block, new;
+	uint64_t max_size;
+	int64_t dblock;
 
 	if (!S_ISREG(inode->mode) && !S_ISDIR(inode->mode))
 		return -EBADF;
 
-	supported_area = isb.block_size * EXT2_INO_NR_DIRECT_BLKS;
-	if (offset >= supported_area || offset >= UINT32_MAX)
+	max_size = S_ISREG(inode->mode) ? file_max_size() : UINT32_MAX;
+	if (offset >= max_size)
 		return -EFBIG;
-	if (offset + len > supported_area)
-		len = supported_area  - offset;
-	if (offset + len > UINT32_MAX)
-		len = UINT32_MAX  - offset;
+	if (len > max_size - offset)
+		len = max_size - offset;
 
 	ret_len = len;
 	last_offset = offset + ret_len;
@@ -541,14 +1038,17 @@ int64_t file_write(struct inode *inode, char *buf, uint64_t offset, uint64_t len
 		write_len = isb.block_size - blk_offset;
 		write_len = min(write_len, len);
 
-		assert(block < EXT2_INO_NR_DIRECT_BLKS);
-		if (inode->blocks[block] == 0) {
+		dblock = file_block_map(inode, block, 0);
+		if (dblock == 0) {
 			if ((new = block_alloc()) == 0)
 				return -ENOSPC;
-			inode->blocks[block] = new;
-			inode->dirty = true;
+			dblock = file_block_map(inode, block, new);
+			if (dblock != (int64_t)new)
+				block_dealloc(new);
 		}
-		block_write(inode->blocks[block], buf, blk_offset, write_len);
+		if (dblock < 0)
+			return dblock;
+		block_write(dblock, buf, blk_offset, write_len);
 
 		assert(len >= write_len);
 		len -= write_len;
@@ -558,12 +1058,8 @@ int64_t file_write(struct inode *inode, char *buf, uint64_t offset, uint64_t len
 		if (offset == last_offset)
 			assert(len == 0);
 
-		if (offset > inode->size_low) {
-			inode->size_low = offset;
-			block = ceil_div(offset, isb.block_size);
-			inode->i512_blocks = (block * isb.block_size) / 512;
-			inode->dirty = true;
-		}
+		if (offset > inode_size(inode))
+			inode_set_size(inode, offset);
 	}
 
 	return ret_len;
@@ -628,10 +1124,10 @@ STATIC bool dir_entry_valid(struct inode *dir, struct dir_entry *dentry,
 		       dentry->record_len);
 		return false;
 	}
-	if (dentry->record_len + offset > dir->size_low) {
+	if (dentry->record_len + offset > inode_size(dir)) {
 		printk("EXT2: Dir entry (ino %lu, offset %lu) goes beyond "
 		       "the dir EOF (entry len = %lu, dir len = %lu)\n", inum,
-		       offset, dentry->record_len, dir->size_low);
+		       offset, dentry->record_len, inode_size(dir));
 		return false;
 	}
 	if (dentry->inode_num > isb.sb->inodes_count) {
@@ -744,7 +1240,7 @@ int file_delete(struct inode *parent, const char *name)
 	inode = inode_get(entry_inum);
 	assert(S_ISREG(inode->mode));
 	if (inode->links_count == 0) {
-		file_truncate(inode);
+		file_truncate(inode, 0);
 		inode_mark_delete(inode);
 	}
 	inode_put(inode);
@@ -956,66 +1452,232 @@ dealloc_inode:
  *
  * @block       : indirect, double, or triple indir block to deallocate
  * @level       : "Single", "Double", or "Triple" level of indirection
+ * Return val   : Nr of deallocated blocks, including @block itself
  */
-static void indirect_block_dealloc(uint64_t block, enum indirection_level level)
+static uint64_t indirect_block_dealloc(uint64_t block,
+				       enum indirection_level level)
 {
 	char *buf;
 	uint32_t *entry;
 	int entries_count;
+	uint64_t count;
 
 	if (block == 0)
-		return;
+		return 0;
 
 	assert(level >= 0);
 	assert(level < INDIRECTION_LEVEL_MAX);
 	if (level == 0) {
 		block_dealloc(block);
-		return;
+		return 1;
 	}
 
 	buf = kmalloc(isb.block_size);
 	entries_count = isb.block_size / sizeof(*entry);
 	block_read(block, buf, 0, isb.block_size);
 
+	count = 0;
 	for (entry = (uint32_t *)buf; entries_count--; entry++) {
 		if (*entry != 0)
-			indirect_block_dealloc(*entry, level - 1);
+			count += indirect_block_dealloc(*entry, level - 1);
 	}
 	assert((char *)entry == buf + isb.block_size);
 
 	block_dealloc(block);
 	kfree(buf);
+	return count + 1;
 }
 
 /*
- * File Truncate - Truncate given file to zero (0) bytes
+ * Nr of file data blocks mapped by one entry of given indirection level
+ * block; i.e. 1 for an indirect block, and 'entries count' for a double.
+ */
+static uint64_t indirect_entry_span(enum indirection_level level)
+{
+	uint64_t span, entries_count;
+
+	entries_count = isb.block_size / sizeof(uint32_t);
+	span = 1;
+	while (--level > 0)
+		span *= entries_count;
+	return span;
+}
+
+/*
+ * Partially deallocate given indirect block tree: only the data blocks
+ * at, or after, the tree-relative file block @first get freed.  Entries
+ * whose entire subtree lies beyond @first are deallocated in one shot.
+ * The indirect block itself is kept since @first is never zero.
+ *
+ * @block       : indirect, double, or triple indir block to trim
+ * @level       : "Single", "Double", or "Triple" level of indirection
+ * @first       : First data block to free, relative to the tree start
+ * Return val   : Nr of deallocated blocks
+ */
+static uint64_t indirect_block_trim(uint64_t block, enum indirection_level level,
+				    uint64_t first)
+{
+	uint32_t *entries;
+	uint64_t span, entries_count, count;
+
+	assert(block != 0);
+	assert(first != 0);
+	assert(level > 0);
+	assert(level < INDIRECTION_LEVEL_MAX);
+
+	entries = kmalloc(isb.block_size);
+	entries_count = isb.block_size / sizeof(*entries);
+	span = indirect_entry_span(level);
+	block_read(block, (char *)entries, 0, isb.block_size);
+
+	count = 0;
+	for (uint64_t i = first / span; i < entries_count; i++) {
+		if (entries[i] == 0)
+			continue;
+		if (i * span >= first) {
+			count += indirect_block_dealloc(entries[i], level - 1);
+			entries[i] = 0;
+		} else {
+			count += indirect_block_trim(entries[i], level - 1,
+						     first - i * span);
+		}
+	}
+
+	block_write(block, (char *)entries, 0, isb.block_size);
+	kfree(entries);
+	return count;
+}
+
+/*
+ * File Truncate - Truncate, or extend, given file to @len bytes
  * @inode	: File's inode, which will map us to the data blocks
+ * @len		: New file size, in bytes
+ * Return val	: Zero on success, or an errno
+ *
+ * Only the data blocks beyond the new EOF, and the indirect subtrees
+ * mapping them, are deallocated.  Extending a file does not allocate
+ * anything: the new area is just a hole.
  */
-void file_truncate(struct inode *inode)
+int file_truncate(struct inode *inode, uint64_t len)
 {
+	uint64_t first, base, span, blk_offset, count;
+	enum indirection_level level;
+	int64_t dblock;
+	char *zeroes;
+
 	assert(S_ISREG(inode->mode));
 	assert(inode->inum != 0);
 	assert(inode->inum >= isb.sb->first_inode);
 	assert(inode->inum <= isb.sb->inodes_count);
 
-	inode->dirty = true;
-	inode->size_low = 0;
-	inode->i512_blocks = 0;
-	for (int i = 0; i < EXT2_INO_NR_DIRECT_BLKS; i++) {
+	if (len > file_max_size())
+		return -EFBIG;
+
+	/* Zero the last block's tail; a later extension must read 0s */
+	blk_offset = len % isb.block_size;
+	if (len < inode_size(inode) && blk_offset != 0) {
+		dblock = file_block_map(inode, len / isb.block_size, 0);
+		assert(dblock >= 0);
+		if (dblock != 0) {
+			zeroes = kmalloc(isb.block_size);
+			memset(zeroes, 0, isb.block_size);
+			block_write(dblock, zeroes, blk_offset,
+				    isb.block_size - blk_offset);
+			kfree(zeroes);
+		}
+	}
+
+	inode_set_size(inode, len);
+	first = ceil_div(len, isb.block_size);
+	count = 0;
+
+	for (uint64_t i = first; i < EXT2_INO_NR_DIRECT_BLKS; i++) {
 		if (inode->blocks[i] == 0)
 			continue;
 		block_dealloc(inode->blocks[i]);
 		inode->blocks[i] = 0;
+		count++;
 	}
 
-	indirect_block_dealloc(inode->blocks[EXT2_INO_INDIRECT], SINGLE_INDIR);
-	inode->blocks[EXT2_INO_INDIRECT] = 0;
+	base = EXT2_INO_NR_DIRECT_BLKS;
+	for (level = SINGLE_INDIR; level < INDIRECTION_LEVEL_MAX; level++) {
+		int slot = EXT2_INO_INDIRECT + level - SINGLE_INDIR;
+
+		span = indirect_entry_span(level + 1);
+		if (inode->blocks[slot] != 0 && first < base + span) {
+			if (first <= base) {
+				count += indirect_block_dealloc(inode->blocks[slot],
+								level);
+				inode->blocks[slot] = 0;
+			} else {
+				count += indirect_block_trim(inode->blocks[slot],
+							     level, first - base);
+			}
+		}
+		base += span;
+	}
 
-	indirect_block_dealloc(inode->blocks[EXT2_INO_DOUBLEIN], DOUBLE_INDIR);
-	inode->blocks[EXT2_INO_DOUBLEIN] = 0;
+	assert(inode->i512_blocks >= count * (isb.block_size / 512));
+	inode->i512_blocks -= count * (isb.block_size / 512);
+	return 0;
+}
 
-	indirect_block_dealloc(inode->blocks[EXT2_INO_TRIPLEIN], TRIPLE_INDIR);
-	inode->blocks[EXT2_INO_TRIPLEIN] = 0;
+/*
+ * File Fallocate - Reserve disk blocks for given file area
+ * @inode	: File's inode, which will map us to the data blocks
+ * @offset	: Start of the area to reserve, in bytes
+ * @len		: Area length, in bytes
+ * @keep_size	: Don't extend the file size beyond its current EOF
+ * Return val	: Zero on success, or an errno
+ *
+ * Each hole in the area is filled by contiguous block runs, reserved in
+ * bulk through block_alloc_run(), instead of one block_alloc() call per
+ * block. Ext2 has no notion of 'unwritten' blocks, so the reserved ones
+ * get zeroed: stale data of deleted files must never leak.
+ */
+int file_fallocate(struct inode *inode, uint64_t offset, uint64_t len,
+		   bool keep_size)
+{
+	uint64_t fblock, last, want, run, count;
+	int64_t dblock;
+
+	assert(S_ISREG(inode->mode));
+	if (len == 0)
+		return -EINVAL;
+	if (offset + len < offset || offset + len > file_max_size())
+		return -EFBIG;
+
+	fblock = offset / isb.block_size;
+	last = ceil_div(offset + len, isb.block_size);
+	while (fblock < last) {
+		dblock = file_block_map(inode, fblock, 0);
+		if (dblock < 0)
+			return dblock;
+		if (dblock != 0) {
+			fblock++;
+			continue;
+		}
+
+		for (want = 1; fblock + want < last; want++)
+			if (file_block_map(inode, fblock + want, 0) != 0)
+				break;
+		if ((run = block_alloc_run(want, &count)) == 0)
+			return -ENOSPC;
+
+		for (uint64_t i = 0; i < count; i++, fblock++) {
+			block_zero(run + i);
+			dblock = file_block_map(inode, fblock, run + i);
+			if (dblock == (int64_t)(run + i))
+				continue;
+			while (i < count)
+				block_dealloc(run + i++);
+			return (dblock < 0) ? dblock : -EIO;
+		}
+	}
+
+	if (!keep_size && offset + len > inode_size(inode))
+		inode_set_size(inode, offset + len);
+	return 0;
 }
 
 /*
@@ -1070,42 +1732,68 @@ int64_t name_i(const char *path)
 }
 
 /*
- * Mount the ramdisk File System
+ * Write given file's inode and data back to disk. Page cache pages
+ * are not tracked per file: all of the volume's dirty pages, thus
+ * the metadata this file depends on, get written back along.
+ * Return val	: Zero on success, or an errno
+ */
+int file_fsync(struct inode *inode)
+{
+	if (inode->dirty == true)
+		inode_write_disk(inode->inum, dino_off(inode));
+
+	return bcache_sync(isb.bdev);
+}
+
+/*
+ * Write all of the volume's dirty data and metadata back to disk.
+ */
+int ext2_sync(void)
+{
+	return bcache_sync(isb.bdev);
+}
+
+/*
+ * Mount the File System on the ramdisk block device
  */
 void ext2_init(void)
 {
 	union super_block *sb;
 	struct group_descriptor *bgd;
 	struct inode *rooti;
-	int bits_per_byte;
-	uint64_t first, last, ramdisk_len, bgd_start;
+	int bits_per_byte, ret;
+	uint64_t first, last, disk_len, bgd_start, bgd_len, nr_pages, len;
 	uint64_t inodetbl_size, inodetbl_blocks, inodetbl_last_block;
 
-	/* Ramdisk sanity checks */
-	ramdisk_len = ramdisk_get_len();
-	if (ramdisk_len == 0)
+	/* Block device sanity checks */
+	isb.bdev = blkdev_find("ram0");
+	if (isb.bdev == NULL)
 		return;
-	if (ramdisk_len < EXT2_MIN_FS_SIZE) {
+	disk_len = isb.bdev->nr_sectors << SECTOR_SHIFT;
+	if (disk_len < EXT2_MIN_FS_SIZE) {
 		printk("FS: Loaded ramdisk is too small for an EXT2 volume!\n");
+		isb.bdev = NULL;
 		return;
 	}
 
 	ext2_debug_init(&serial_char_dumper);
 	spin_init(&isb.inode_allocation_lock);
 	spin_init(&isb.block_allocation_lock);
+	spin_init(&isb.sb_lock);
 
 	/* In-Memory Super Block init */
-	isb.buf = ramdisk_get_buf();
-	isb.sb  = (void *)&isb.buf[EXT2_SUPERBLOCK_OFFSET];
+	isb.sb = kmalloc(sizeof(*sb));
+	ret = bcache_read(isb.bdev, EXT2_SUPERBLOCK_OFFSET, isb.sb, sizeof(*sb));
+	if (ret < 0)
+		panic("FS: Reading superblock returned -%s", errno(ret));
 	isb.block_size = 1024U << isb.sb->log_block_size;
 	isb.frag_size  = 1024U << isb.sb->log_fragment_size;
 	bgd_start = ceil_div(EXT2_SUPERBLOCK_OFFSET+sizeof(*sb),isb.block_size);
-	isb.bgd = (void *)&isb.buf[bgd_start * isb.block_size];
+	isb.bgd_offset = bgd_start * isb.block_size;
 
 	sb = isb.sb;
-	bgd = isb.bgd;
 	bits_per_byte = 8;
-	if (sb->blocks_count * isb.block_size > ramdisk_len)
+	if (sb->blocks_count * isb.block_size > disk_len)
 		panic("FS: Truncated EXT2 volume image!");
 
 	/* Superblock sanity checks */
@@ -1141,6 +1829,24 @@ void ext2_init(void)
 	inodetbl_size = sb->inodes_per_group * sb->inode_size;
 	inodetbl_blocks = ceil_div(inodetbl_size, isb.block_size);
 
+	/* In-Memory Group Descriptor Table init */
+	bgd_len = isb.blockgroups_count * sizeof(*bgd);
+	nr_pages = ceil_div(bgd_len, PAGE_SIZE);
+	if (nr_pages * sizeof(*isb.bgd_pages) > MAXALLOC_SZ)
+		panic("Ext2: %lu block groups; can't support > %lu groups",
+		      isb.blockgroups_count, (MAXALLOC_SZ /
+		      sizeof(*isb.bgd_pages)) * BGDS_PER_PAGE);
+	isb.bgd_pages = kmalloc(nr_pages * sizeof(*isb.bgd_pages));
+	for (uint64_t i = 0; i < nr_pages; i++) {
+		isb.bgd_pages[i] = page_address(get_free_page(ZONE_ANY));
+		len = min(bgd_len - i * PAGE_SIZE, (uint64_t)PAGE_SIZE);
+		ret = bcache_read(isb.bdev, isb.bgd_offset + i * PAGE_SIZE,
+				  isb.bgd_pages[i], len);
+		if (ret < 0)
+			panic("FS: Reading group descriptors returned -%s",
+			      errno(ret));
+	}
+
 	/* Block Group Descriptor Table sanity checks */
 	if (isb.blockgroups_count > 1 &&	// Last group special case
 	    sb->blocks_per_group > sb->blocks_count)
@@ -1148,6 +1854,7 @@ void ext2_init(void)
 	if (sb->inodes_per_group > sb->inodes_count)
 		panic("Ext2: Block Groups num of inodes > all disk ones!");
 	for (uint i = 0; i < isb.blockgroups_count; i++) {
+		bgd = bgd_get(i);
 		first = i * sb->blocks_per_group + sb->first_data_block;
 		if (i == isb.last_blockgroup)
 			last = sb->blocks_count - 1;
@@ -1169,7 +1876,6 @@ void ext2_init(void)
 		if (bgd->used_dirs_count > sb->inodes_per_group)
 			panic("EXT2: Group %d used dirs count out of range", i);
 		blockgroup_dump(i, bgd, first, last, inodetbl_blocks);
-		bgd++;
 	}
 
 	/* Prepare the In-core Inodes hash repository */
@@ -1180,7 +1886,7 @@ void ext2_init(void)
 	rooti = inode_get(EXT2_ROOT_INODE);
 	if (!S_ISDIR(rooti->mode))
 		panic("EXT2: Root inode ('/') is not a directory!");
-	if (rooti->i512_blocks == 0 || rooti->size_low == 0)
+	if (rooti->i512_blocks == 0 || inode_size(rooti) == 0)
 		panic("EXT2: Root inode ('/') size = 0 bytes!");
 	if (name_i("/.") != EXT2_ROOT_INODE)
 		panic("EXT2: Corrupt root directory '.'  entry!");
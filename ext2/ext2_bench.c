@@ -0,0 +1,445 @@
+/*
+ * The Second Extended File System - Benchmarks
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Data throughput, metadata operations rate, path-lookup cost over
+ * directory depth, and multi-core scaling, all timed by the TSC.
+ *
+ * Each result is printed to the serial port as one line:
+ *
+ *	BENCH name=<test> arg=<n> cpus=<n> ops=<n> bytes=<n> cycles=<n>
+ *	      tsc_hz=<n>
+ *
+ * where @arg is the I/O size for data tests, and the directory depth
+ * for path-lookup ones. Capture the serial output of two kernel
+ * builds, then compare them using tools/bench-compare.py.
+ *
+ * NOTE! Don't enable any other test cases along these ones: the
+ * extra threads and serial output will skew measured timings.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <ext2.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <errno.h>
+#include <stat.h>
+#include <percpu.h>
+#include <smpboot.h>
+#include <atomic.h>
+#include <apic.h>
+#include <tsc.h>
+#include <ktime.h>
+
+#if	EXT2_BENCHMARKS
+
+enum {
+	BENCH_FILE_LEN		= 512 * 1024,	/* Data set per file (max) */
+	BENCH_IO_MAX		= 4096,		/* Largest I/O size */
+	BENCH_NR_FILES		= 256,		/* Files per metadata test */
+	BENCH_MAX_DEPTH		= 8,		/* Deepest lookup test */
+	BENCH_LOOKUPS		= 1024,		/* name_i() calls per depth */
+	BENCH_PATH_LEN		= 64,
+};
+
+/* I/O sizes: kmalloc() can't give us more than a page */
+static const uint64_t io_sizes[] = { 64, 512, 1024, BENCH_IO_MAX };
+
+enum bench_io {
+	SEQ_WRITE,
+	SEQ_READ,
+	RAND_READ,
+	RAND_WRITE,
+};
+
+static const char *io_names[] = {
+	[SEQ_WRITE]	= "seq_write",
+	[SEQ_READ]	= "seq_read",
+	[RAND_READ]	= "rand_read",
+	[RAND_WRITE]	= "rand_write",
+};
+
+static void bench_report(const char *name, uint64_t arg, int cpus,
+			 uint64_t ops, uint64_t bytes, uint64_t cycles)
+{
+	prints("BENCH name=%s arg=%lu cpus=%d ops=%lu bytes=%lu cycles=%lu "
+	       "tsc_hz=%lu\n", name, arg, cpus, ops, bytes, cycles,
+	       tsc_hz);
+}
+
+static void bench_sprintf(char *buf, int size, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(buf, size, fmt, args);
+	va_end(args);
+}
+
+/*
+ * Marsaglia's xorshift: cheap enough not to disturb the timings
+ */
+static uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/*
+ * Do @len / @iosize I/O operations of type @type on given file,
+ * covering the file range [0, @len). Return consumed TSC cycles.
+ */
+static uint64_t bench_io(struct inode *inode, enum bench_io type, char *buf,
+			 uint64_t iosize, uint64_t len, uint64_t *seed)
+{
+	uint64_t start, offset, nr_ops, ret;
+
+	nr_ops = len / iosize;
+	start = read_tsc();
+	for (uint64_t i = 0; i < nr_ops; i++) {
+		offset = i * iosize;
+		if (type == RAND_READ || type == RAND_WRITE)
+			offset = (xorshift(seed) % nr_ops) * iosize;
+
+		if (type == SEQ_READ || type == RAND_READ)
+			ret = file_read(inode, buf, offset, iosize);
+		else
+			ret = file_write(inode, buf, offset, iosize);
+
+		if (ret != iosize)
+			panic("Bench: %s inode #%lu, offset %lu: returned %ld",
+			      io_names[type], inode->inum, offset, ret);
+	}
+	return read_tsc() - start;
+}
+
+/*
+ * Reserve [0, @len) for each of the given files; halve @len
+ * till all of them fit in the volume. Return final length.
+ */
+static uint64_t bench_reserve(struct inode **files, int nr_files,
+			      uint64_t len)
+{
+	int i, ret;
+
+again:
+	for (i = 0; i < nr_files; i++) {
+		ret = file_fallocate(files[i], 0, len, false);
+		if (ret == -ENOSPC)
+			break;
+		if (ret < 0)
+			panic("Bench: Reserving %lu bytes returned -%s", len,
+			      errno(ret));
+	}
+	if (i == nr_files)
+		return len;
+
+	for (i = 0; i < nr_files; i++)
+		assert(file_truncate(files[i], 0) == 0);
+	len /= 2;
+	if (len < BENCH_IO_MAX)
+		panic("Bench: No space left for benchmark data files");
+	goto again;
+}
+
+static struct inode *bench_new_file(struct inode *dir, const char *name,
+				    enum file_type type)
+{
+	int64_t inum;
+
+	inum = file_new(dir, name, type);
+	if (inum < 0)
+		panic("Bench: Creating file '%s' returned -%s", name,
+		      errno(inum));
+	return inode_get(inum);
+}
+
+/*
+ * Single-core data throughput, for each supported I/O size. Sequential
+ * writes start from an empty file: block allocation is accounted for.
+ */
+static void bench_throughput(struct inode *dir)
+{
+	struct inode *inode;
+	uint64_t len, seed, cycles;
+	enum bench_io type;
+	char *buf;
+
+	inode = bench_new_file(dir, "data", EXT2_FT_REG_FILE);
+	len = bench_reserve(&inode, 1, BENCH_FILE_LEN);
+	buf = kmalloc(BENCH_IO_MAX);
+	memset(buf, 0xa5, BENCH_IO_MAX);
+	seed = 0x2545f4914f6cdd1d;
+
+	for (uint i = 0; i < ARRAY_SIZE(io_sizes); i++) {
+		assert(file_truncate(inode, 0) == 0);
+		for (type = SEQ_WRITE; type <= RAND_WRITE; type++) {
+			cycles = bench_io(inode, type, buf, io_sizes[i], len,
+					  &seed);
+			bench_report(io_names[type], io_sizes[i], 1,
+				     len / io_sizes[i], len, cycles);
+		}
+	}
+
+	kfree(buf);
+	inode_put(inode);
+	assert(file_delete(dir, "data") == 0);
+}
+
+/*
+ * Create, stat, open, and unlink rates over a flat directory
+ */
+static char names[BENCH_NR_FILES][16];
+static char paths[BENCH_NR_FILES][BENCH_PATH_LEN];
+static struct inode *opened[BENCH_NR_FILES];
+
+static void bench_metadata(struct inode *dir, const char *dir_path)
+{
+	struct stat stat;
+	uint64_t start;
+	int64_t inum;
+
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		bench_sprintf(names[i], sizeof(names[i]), "f%d", i);
+		bench_sprintf(paths[i], sizeof(paths[i]), "%s/f%d", dir_path, i);
+	}
+
+	start = read_tsc();
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		inum = file_new(dir, names[i], EXT2_FT_REG_FILE);
+		if (inum < 0)
+			panic("Bench: Creating '%s' returned -%s", paths[i],
+			      errno(inum));
+	}
+	bench_report("create", 0, 1, BENCH_NR_FILES, 0, read_tsc() - start);
+
+	start = read_tsc();
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		inum = name_i(paths[i]);
+		assert(inum > 0);
+		opened[i] = inode_get(inum);
+		stat.st_ino = inum;
+		stat.st_mode = opened[i]->mode;
+		stat.st_nlink = opened[i]->links_count;
+		stat.st_uid = opened[i]->uid;
+		stat.st_gid = opened[i]->gid_low;
+		stat.st_size = inode_size(opened[i]);
+		stat.st_atime = opened[i]->atime;
+		stat.st_mtime = opened[i]->mtime;
+		stat.st_ctime = opened[i]->ctime;
+		inode_put(opened[i]);
+		assert(S_ISREG(stat.st_mode));
+	}
+	bench_report("stat", 0, 1, BENCH_NR_FILES, 0, read_tsc() - start);
+
+	/* Hold all the references: no inode cache hits from neighbours */
+	start = read_tsc();
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		inum = name_i(paths[i]);
+		assert(inum > 0);
+		opened[i] = inode_get(inum);
+	}
+	bench_report("open", 0, 1, BENCH_NR_FILES, 0, read_tsc() - start);
+	for (int i = 0; i < BENCH_NR_FILES; i++)
+		inode_put(opened[i]);
+
+	start = read_tsc();
+	for (int i = 0; i < BENCH_NR_FILES; i++)
+		assert(file_delete(dir, names[i]) == 0);
+	bench_report("unlink", 0, 1, BENCH_NR_FILES, 0, read_tsc() - start);
+}
+
+/*
+ * Path-lookup cost as a function of directory depth: resolve
+ * "@dir_path/d/d/../f", with 1 to BENCH_MAX_DEPTH 'd' components.
+ */
+static void bench_lookup(struct inode *dir, const char *dir_path)
+{
+	struct inode *parent, *child;
+	char path[BENCH_PATH_LEN];
+	uint64_t start;
+	int len;
+
+	parent = inode_get(dir->inum);
+	strncpy(path, dir_path, BENCH_PATH_LEN);
+	for (int depth = 1; depth <= BENCH_MAX_DEPTH; depth++) {
+		child = bench_new_file(parent, "d", EXT2_FT_DIR);
+		inode_put(bench_new_file(child, "f", EXT2_FT_REG_FILE));
+		inode_put(parent);
+		parent = child;
+
+		len = strlen(path);
+		bench_sprintf(path + len, BENCH_PATH_LEN - len, "/d");
+		len = strlen(path);
+		bench_sprintf(path + len, BENCH_PATH_LEN - len, "/f");
+
+		start = read_tsc();
+		for (int i = 0; i < BENCH_LOOKUPS; i++)
+			assert(name_i(path) > 0);
+		bench_report("lookup", depth, 1, BENCH_LOOKUPS, 0,
+			     read_tsc() - start);
+
+		path[len] = '\0';
+	}
+	inode_put(parent);
+}
+
+/*
+ * Multi-core scaling: for n = 1 .. nr-of-cpus, run the same workload
+ * concurrently on n cores, each over its own data file. The bootstrap
+ * core coordinates the rounds and reports the aggregate.
+ *
+ * Only reads and in-place overwrites are done: inode locks are not
+ * yet implemented, so concurrent directory writers are not safe.
+ */
+static struct inode *smp_files[CPUS_MAX];
+static uint64_t smp_cycles[CPUS_MAX];
+static uint64_t smp_len;
+static enum bench_io smp_type;
+static int smp_round;			/* Incremented on each new round */
+static int smp_round_cpus;		/* Participants in current round */
+static bool smp_ready, smp_finished;
+static uint64_t smp_joined, smp_done;
+
+enum {
+	SMP_IO_SIZE		= BENCH_IO_MAX,
+};
+
+static void smp_run_share(int id, char *buf, uint64_t *seed)
+{
+	smp_cycles[id] = bench_io(smp_files[id], smp_type, buf, SMP_IO_SIZE,
+				  smp_len, seed);
+	atomic_inc(&smp_done);
+}
+
+static void smp_prepare(struct inode *dir, int nr_cpus)
+{
+	char name[16];
+
+	for (int i = 0; i < nr_cpus; i++) {
+		bench_sprintf(name, sizeof(name), "cpu%d", i);
+		smp_files[i] = bench_new_file(dir, name, EXT2_FT_REG_FILE);
+	}
+	smp_len = bench_reserve(smp_files, nr_cpus, BENCH_FILE_LEN);
+
+	barrier();
+	smp_ready = true;
+}
+
+static void smp_coordinate(int nr_cpus)
+{
+	enum bench_io types[] = { SEQ_READ, RAND_READ, RAND_WRITE };
+	uint64_t seed, cycles;
+	char *buf;
+
+	buf = kmalloc(SMP_IO_SIZE);
+	seed = 0x9e3779b97f4a7c15;
+
+	/* Bootstrap core has id 0; wait for the rest */
+	while (smp_joined != (uint64_t)nr_cpus - 1) {
+		barrier();
+		cpu_pause();
+	}
+
+	for (uint t = 0; t < ARRAY_SIZE(types); t++) {
+		for (int n = 1; n <= nr_cpus; n++) {
+			smp_type = types[t];
+			smp_round_cpus = n;
+			smp_done = 0;
+			barrier();
+			smp_round++;
+
+			smp_run_share(0, buf, &seed);
+			while (smp_done != (uint64_t)n) {
+				barrier();
+				cpu_pause();
+			}
+
+			/* Aggregate throughput is bound by the slowest core */
+			cycles = 0;
+			for (int i = 0; i < n; i++)
+				cycles = max(cycles, smp_cycles[i]);
+			bench_report(io_names[types[t]], SMP_IO_SIZE, n,
+				     n * (smp_len / SMP_IO_SIZE), n * smp_len,
+				     cycles);
+		}
+	}
+
+	barrier();
+	smp_finished = true;
+	kfree(buf);
+}
+
+/*
+ * Secondary cores participate in the scaling rounds from here
+ */
+void ext2_run_smp_benchmarks(void)
+{
+	uint64_t seed;
+	int id, round;
+	char *buf;
+
+	if ((uint32_t)percpu_get(apic_id) == apic_bootstrap_id())
+		return;
+
+	while (smp_ready == false) {
+		barrier();
+		cpu_pause();
+	}
+
+	id = atomic_inc(&smp_joined) + 1;
+	assert(id < CPUS_MAX);
+	buf = kmalloc(SMP_IO_SIZE);
+	seed = 0x9e3779b97f4a7c15 + id;
+
+	round = 0;
+	while (true) {
+		barrier();
+		if (smp_finished)
+			break;
+		if (smp_round == round) {
+			cpu_pause();
+			continue;
+		}
+
+		round = smp_round;
+		if (id < smp_round_cpus)
+			smp_run_share(id, buf, &seed);
+	}
+
+	kfree(buf);
+}
+
+void ext2_run_benchmarks(void)
+{
+	struct inode *root, *dir;
+	int nr_cpus;
+
+	root = inode_get(EXT2_ROOT_INODE);
+	dir = bench_new_file(root, "bench", EXT2_FT_DIR);
+	inode_put(root);
+
+	bench_throughput(dir);
+	bench_metadata(dir, "/bench");
+	bench_lookup(dir, "/bench");
+
+	nr_cpus = smpboot_get_nr_alive_cpus();
+	smp_prepare(dir, nr_cpus);
+	smp_coordinate(nr_cpus);
+
+	prints("BENCH done\n");
+	inode_put(dir);
+}
+
+#endif	/* EXT2_BENCHMARKS */
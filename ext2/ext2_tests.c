@@ -22,6 +22,7 @@
 #include <buffer_dumper.h>
 #include <percpu.h>
 #include <sched.h>
+#include <bcache.h>
 
 void ext2_debug_init(struct buffer_dumper *g_dumper)
 {
@@ -95,7 +96,7 @@ void inode_dump(struct inode *inode, const char *path)
 	bd->pr(".. Last time this inode was modified = 0x%x\n", inode->mtime);
 	bd->pr(".. Time when this inode was deleted = 0x%x\n", inode->dtime);
 	bd->pr(".. Links count = %d links\n", inode->links_count);
-	bd->pr(".. File size = %d bytes\n", inode->size_low);
+	bd->pr(".. File size = %lu bytes\n", inode_size(inode));
 	bd->pr(".. 512-byte Blocks count = %u blocks\n", inode->i512_blocks);
 	bd->pr(".. Block number for ACL file = #%u\n", inode->file_acl);
 	bd->pr(".. Data Blocks:\n");
@@ -182,6 +183,9 @@ static __unused void path_get_parent(const char *path, char *parent, char *child
 #define TEST_FILE_EXISTENCE		0
 #define TEST_FILE_CREATION		0
 #define TEST_FILE_TRUNCATE		0
+#define TEST_FILE_FALLOCATE		0
+#define TEST_FILE_HOLES			0
+#define TEST_FILE_LARGE			0
 #define TEST_FILE_DELETION		0
 
 #if	(TEST_INODE_ALLOC_DEALLOC == 1) && (EXT2_SMP_TESTS == 1)
@@ -193,9 +197,9 @@ static __unused void path_get_parent(const char *path, char *parent, char *child
 #endif
 
 extern struct {
-	union super_block	*sb;		/* On-disk Superblock */
-	struct group_descriptor *bgd;		/* On-disk Group Desc Table */
-	char			*buf;		/* Ramdisk buffer */
+	union super_block	*sb;		/* In-core Superblock */
+	struct group_descriptor **bgd_pages;	/* In-core Group Desc Table */
+	struct block_device	*bdev;		/* Volume's device */
 	uint64_t		block_size;	/* 1, 2, or 4K */
 	uint64_t		frag_size;	/* 1, 2, or 4K */
 	uint64_t		blockgroups_count;
@@ -609,8 +613,10 @@ void ext2_run_tests()
 	ext2_debug_init(&null_null_dumper);
 	struct buffer_dumper *bd = (void *)percpu_get(dumper);
 
-	/* Extract the modified ext2 volume out of the virtual machine: */
-	prints("Ramdisk start at: 0x%lx, with len = %ld\n", isb.buf,
+	/* Extract the modified ext2 volume out of the virtual machine;
+	 * the ramdisk must first hold everything the page cache has: */
+	bcache_sync(NULL);
+	prints("Ramdisk start at: 0x%lx, with len = %ld\n", ramdisk_get_buf(),
 	      ramdisk_get_len());
 
 	test_inodes();
@@ -737,7 +743,7 @@ bagain:	unrolled_init(&head, 64);
 				inode_put(inode);
 				continue;
 			}
-			nblocks = ceil_div(inode->size_low, isb.block_size);
+			nblocks = ceil_div(inode_size(inode), isb.block_size);
 			nblocks = min(nblocks, (uint64_t)EXT2_INO_NR_BLOCKS);
 			for (uint ino_blk = 0; ino_blk < nblocks; ino_blk++) {
 				if (inode->blocks[ino_blk] == 0)
@@ -815,10 +821,10 @@ bagain:	unrolled_init(&head, 64);
 				continue;
 			}
 			assert(ilen == BUF_LEN);
-			assert(inode->size_low >= offset+ilen);
+			assert(inode_size(inode) >= offset+ilen);
 			memset32(buf, ++inum, BUF_LEN);
 		}
-		assert(inode->size_low >= BUF_LEN*2);
+		assert(inode_size(inode) >= BUF_LEN*2);
 		inode_put(inode);
 		bd->pr("Done!\n");
 	}
@@ -879,9 +885,9 @@ out1:
 		}
 
 		inode_dump(inode, file->path);
-		file_truncate(inode);
+		file_truncate(inode, 0);
 
-		assert(inode->size_low == 0);
+		assert(inode_size(inode) == 0);
 		assert(inode->i512_blocks == 0);
 		for (int i = 0; i < EXT2_INO_NR_BLOCKS; i++)
 			assert(inode->blocks[i] == 0);
@@ -890,6 +896,137 @@ out1:
 	}
 #endif
 
+/*
+ * Reserve a big file area in bulk, then truncate it in stages: assure
+ * no block leaks and that only the blocks beyond EOF were deallocated.
+ */
+#if TEST_FILE_FALLOCATE
+	nfree = isb.sb->free_blocks_count;
+	nblocks = EXT2_INO_NR_DIRECT_BLKS + isb.block_size / sizeof(uint32_t) + 8;
+	inode = inode_get(EXT2_ROOT_INODE);
+	inum = file_new(inode, "fallocate_test", EXT2_FT_REG_FILE);
+	assert(inum > 0);
+	inode_put(inode);
+
+	inode = inode_get(inum);
+	ilen = file_fallocate(inode, 0, nblocks * isb.block_size, false);
+	if (ilen < 0)
+		panic("Fallocating %lu blocks returned %s", nblocks,
+		      errno_to_str(ilen));
+	assert(inode_size(inode) == nblocks * isb.block_size);
+	for (block = 0; block < nblocks; block++)
+		assert(file_block_map(inode, block, 0) > 0);
+	for (len = 0; len < inode_size(inode); len += BUF_LEN) {
+		memset(buf, 0xff, BUF_LEN);
+		memset(buf2, 0, BUF_LEN);
+		ilen = file_read(inode, buf, len, BUF_LEN);
+		assert(memcmp(buf, buf2, ilen) == 0);
+	}
+	bd->pr("Fallocated %lu blocks, %lu free blocks left\n", nblocks,
+	       isb.sb->free_blocks_count);
+
+	count = EXT2_INO_NR_DIRECT_BLKS + 3;
+	assert(file_truncate(inode, count * isb.block_size - 1) == 0);
+	for (block = 0; block < nblocks; block++)
+		assert((file_block_map(inode, block, 0) > 0) == (block < (uint64_t)count));
+	assert(file_truncate(inode, 3) == 0);
+	assert(file_block_map(inode, 0, 0) > 0);
+	assert(file_block_map(inode, 1, 0) == 0);
+	assert(inode->blocks[EXT2_INO_INDIRECT] == 0);
+	assert(file_truncate(inode, 0) == 0);
+	assert(inode->i512_blocks == 0);
+	inode_put(inode);
+
+	inode = inode_get(EXT2_ROOT_INODE);
+	assert(file_delete(inode, "fallocate_test") == 0);
+	inode_put(inode);
+	if (isb.sb->free_blocks_count != nfree)
+		panic("Fallocate & truncate leaked %ld blocks",
+		      (int64_t)nfree - isb.sb->free_blocks_count);
+	bd->pr("Fallocate & truncate-to-size: Success!\n");
+#endif
+
+/*
+ * Sparse files: write a single block far away from file start, then
+ * assure the holes before it are read as zeroes & found by seek.
+ */
+#if TEST_FILE_HOLES
+	nblocks = EXT2_INO_NR_DIRECT_BLKS + isb.block_size / sizeof(uint32_t) + 8;
+	inode = inode_get(EXT2_ROOT_INODE);
+	inum = file_new(inode, "holes_test", EXT2_FT_REG_FILE);
+	assert(inum > 0);
+	inode_put(inode);
+
+	inode = inode_get(inum);
+	memset(buf, 0xaa, BUF_LEN);
+	ilen = file_write(inode, buf, nblocks * isb.block_size, isb.block_size);
+	assert(ilen == (int64_t)isb.block_size);
+	assert(inode_size(inode) == (nblocks + 1) * isb.block_size);
+	assert(inode->blocks[0] == 0);
+	assert(inode->blocks[EXT2_INO_INDIRECT] == 0);
+
+	memset(buf2, 0, BUF_LEN);
+	for (block = 0; block < nblocks; block++) {
+		memset(buf, 0xff, BUF_LEN);
+		len = file_read(inode, buf, block * isb.block_size,
+				isb.block_size);
+		assert(len == isb.block_size);
+		if (memcmp(buf, buf2, len) != 0)
+			panic("File hole at block %lu is not read as zeroes",
+			      block);
+	}
+	assert(file_seek_hole_data(inode, 0, true) == 0);
+	assert(file_seek_hole_data(inode, 0, false) ==
+	       (int64_t)(nblocks * isb.block_size));
+	assert(file_seek_hole_data(inode, nblocks * isb.block_size, true) ==
+	       (int64_t)inode_size(inode));
+	assert(file_seek_hole_data(inode, inode_size(inode), false) == -ENXIO);
+	inode_put(inode);
+
+	inode = inode_get(EXT2_ROOT_INODE);
+	assert(file_delete(inode, "holes_test") == 0);
+	inode_put(inode);
+	bd->pr("Sparse files holes: Success!\n");
+#endif
+
+/*
+ * Large files: write beyond the 4-GB mark, and assure the 64-bit
+ * file size is kept and the volume is flagged with 'large_file'.
+ */
+#if TEST_FILE_LARGE
+	inode = inode_get(EXT2_ROOT_INODE);
+	inum = file_new(inode, "large_test", EXT2_FT_REG_FILE);
+	assert(inum > 0);
+	inode_put(inode);
+
+	inode = inode_get(inum);
+	len = 5ULL * 1024 * 1024 * 1024;	/* 5-GBytes */
+	memset32(buf, inum, BUF_LEN);
+	ilen = file_write(inode, buf, len, BUF_LEN);
+	if (ilen < 0)
+		panic("Writing at offset %lu returned %s", len,
+		      errno_to_str(ilen));
+	assert(ilen == BUF_LEN);
+	assert(inode_size(inode) == len + BUF_LEN);
+	assert(inode->size_high == (len + BUF_LEN) >> 32);
+	assert(sb->features_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE);
+
+	memset(buf2, 0, BUF_LEN);
+	assert(file_read(inode, buf2, len, BUF_LEN) == BUF_LEN);
+	assert(memcmp(buf, buf2, BUF_LEN) == 0);
+	assert(file_read(inode, buf2, len + BUF_LEN, BUF_LEN) == 0);
+	assert(file_truncate(inode, len / 2) == 0);
+	assert(inode_size(inode) == len / 2);
+	assert(file_truncate(inode, 0) == 0);
+	assert(inode->size_high == 0 && inode->i512_blocks == 0);
+	inode_put(inode);
+
+	inode = inode_get(EXT2_ROOT_INODE);
+	assert(file_delete(inode, "large_test") == 0);
+	inode_put(inode);
+	bd->pr("Large files: Success!\n");
+#endif
+
 #if TEST_FILE_DELETION
 	parent = kmalloc(4096);
 	child = kmalloc(EXT2_FILENAME_LEN + 1);
@@ -996,10 +1133,13 @@ void ext2_run_smp_tests(void)
 	 * halt at the end */
 	percpu_set(halt_thread_at_end, true);
 
-	/* Extract the modified ext2 volume out of the virtual machine: */
-	if (percpu_get(apic_id) == 0)
-		prints("Ramdisk start at: 0x%lx, with len = %ld\n", isb.buf,
+	/* Extract the modified ext2 volume out of the virtual machine;
+	 * the ramdisk must first hold everything the page cache has: */
+	if (percpu_get(apic_id) == 0) {
+		bcache_sync(NULL);
+		prints("Ramdisk start at: 0x%lx, with len = %ld\n", ramdisk_get_buf(),
 		       ramdisk_get_len());
+	}
 
 	for (int i = 0; i < 200; i++)
 		kthread_create(test_alloc_dealloc);
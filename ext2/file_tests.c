@@ -19,6 +19,7 @@
 #include <unrolled_list.h>
 #include <percpu.h>
 #include <ramdisk.h>
+#include <bcache.h>
 
 #if	FILE_TESTS
 
@@ -252,9 +253,9 @@ static void __unused _test_write(void)
 				continue;
 			}
 			assert(ilen == BUF_LEN);
-			assert(inode->size_low == offset + ilen);
+			assert(inode_size(inode) == offset + ilen);
 		}
-		assert(inode->size_low == BUF_LEN*3);
+		assert(inode_size(inode) == BUF_LEN*3);
 		(*pr)("Done!\n", inum);
 	}
 out1:
@@ -324,7 +325,7 @@ out1:
 /* Break some Software Engineering rules to minimize code duplication: */
 #define _test_lseek_state(SEEK_WHENCE, EXPECTED_VALUE)			\
 sys_lseek(p->fd, 0, SEEK_SET);						\
-for (uint64_t i = 0; i < inode_get(file->inum)->size_low; i++) {	\
+for (uint64_t i = 0; i < inode_size(inode_get(file->inum)); i++) {	\
 	prints("seek(%d, %lu, " #SEEK_WHENCE "): ", p->fd, i);		\
 	uint64_t old_offset = file->offset;				\
 	if ((ret = sys_lseek(p->fd, i, SEEK_WHENCE)) < 0)		\
@@ -367,7 +368,7 @@ static void __unused _test_lseek(void)
 
 		_test_lseek_state(SEEK_SET, i);
 		_test_lseek_state(SEEK_CUR, i + old_offset);
-		_test_lseek_state(SEEK_END, i + inode->size_low);
+		_test_lseek_state(SEEK_END, i + inode_size(inode));
 	}
 }
 
@@ -382,7 +383,7 @@ static void __validate_statbuf(int64_t inum, struct stat *statbuf)
 	assert(inode->links_count == statbuf->st_nlink);
 	assert(inode->uid == statbuf->st_uid);
 	assert(inode->gid_low == statbuf->st_gid);
-	assert(inode->size_low == statbuf->st_size);
+	assert((int64_t)inode_size(inode) == statbuf->st_size);
 	assert(inode->atime == statbuf->st_atime);
 	assert(inode->ctime == statbuf->st_ctime);
 	assert(inode->mtime == statbuf->st_mtime);
@@ -668,6 +669,9 @@ void file_run_tests(void)
 	file_test_hard_links();
 #endif
 
+	/* Push the delayed writes to the ramdisk, for extraction */
+	assert(bcache_sync(NULL) == 0);
+
 	prints("%s: Sucess!", __func__);
 	printk("%s: Sucess!", __func__);
 }
@@ -0,0 +1,167 @@
+#ifndef _ACPI_H
+#define _ACPI_H
+
+/*
+ * ACPI tables: only what's needed for CPUs, IRQs, and timers discovery
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * NOTE! ACPI strings are coded in ASCII, but are not NULL-terminated.
+ */
+
+#include <stdint.h>
+#include <kernel.h>
+
+/*
+ * Root System Description Pointer
+ *
+ * Found on a 16-byte boundary, either in the first KB of the EBDA
+ * or in the BIOS ROM area 0xe0000-0xfffff. The checksum covers
+ * the first 20 bytes (ACPI 1.0); the extended one covers all of
+ * @length bytes, for revision 2+ structures.
+ */
+
+#define RSDP_SIGNATURE	"RSD PTR "
+
+struct acpi_rsdp {
+	char signature[8];		/* "RSD PTR " */
+	uint8_t checksum;		/* Sum of first 20 bytes */
+	char oem[6];			/* OEM ID */
+	uint8_t revision;		/* 0 = ACPI 1.0, 2 = ACPI 2.0+ */
+	uint32_t rsdt_physaddr;		/* 32-bit RSDT pointer */
+	uint32_t length;		/* Whole structure length */
+	uint64_t xsdt_physaddr;		/* 64-bit XSDT pointer */
+	uint8_t ext_checksum;		/* Sum of the whole structure */
+	uint8_t reserved[3];
+} __packed;
+
+#define RSDP_V1_LEN	20
+
+/*
+ * System Description Tables common header
+ */
+struct acpi_sdt {
+	char signature[4];		/* "RSDT", "XSDT", "APIC", .. */
+	uint32_t length;		/* Table length, including header */
+	uint8_t revision;
+	uint8_t checksum;		/* Sum of all of @length bytes */
+	char oem[6];			/* OEM ID */
+	char oem_table[8];		/* OEM table ID */
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __packed;
+
+/*
+ * Multiple APIC Description Table (signature "APIC")
+ */
+struct acpi_madt {
+	struct acpi_sdt header;
+	uint32_t lapic_base;		/* Obsolete as in MP: use MSRs */
+	uint32_t flags;			/* Bit0: 8259 PICs installed */
+} __packed;
+
+/*
+ * MADT variable-length entries; all start with type and length
+ */
+
+enum madt_entry {
+	MADT_LAPIC = 0,
+	MADT_IOAPIC = 1,
+	MADT_INT_OVERRIDE = 2,
+	MADT_NMI = 3,
+	MADT_LAPIC_NMI = 4,
+	MADT_X2APIC = 9,
+};
+
+struct madt_header {
+	uint8_t type;
+	uint8_t length;
+} __packed;
+
+struct madt_lapic {
+	struct madt_header h;
+	uint8_t acpi_id;		/* ACPI processor UID */
+	uint8_t apic_id;		/* This processor's lapic ID */
+	uint32_t enabled:1,		/* Set if this processor is usable */
+		reserved:31;
+} __packed;
+
+struct madt_ioapic {
+	struct madt_header h;
+	uint8_t id;			/* The ID of this I/O APIC */
+	uint8_t reserved;
+	uint32_t base;			/* This I/O APIC base address */
+	uint32_t gsi_base;		/* GSI of this I/O APIC pin 0 */
+} __packed;
+
+/*
+ * Interrupt Source Override: ISA IRQ @source is wired to
+ * @gsi, instead of the identity-mapped default. Polarity
+ * and trigger are coded identically to MP tables entries.
+ */
+struct madt_int_override {
+	struct madt_header h;
+	uint8_t bus;			/* Always 0: ISA */
+	uint8_t source;			/* Source bus irq */
+	uint32_t gsi;			/* Global System Interrupt */
+	uint16_t polarity:2,		/* Polarity of APIC I/O input signal */
+		trigger:2,		/* Trigger mode */
+		reserved:12;
+} __packed;
+
+struct madt_x2apic {
+	struct madt_header h;
+	uint16_t reserved;
+	uint32_t x2apic_id;		/* This processor's 32-bit lapic ID */
+	uint32_t enabled:1,		/* Set if this processor is usable */
+		flags_reserved:31;
+	uint32_t acpi_uid;		/* ACPI processor UID */
+} __packed;
+
+/*
+ * Generic Address Structure: a register location
+ */
+struct acpi_gas {
+	uint8_t space_id;		/* 0 = system memory, 1 = I/O */
+	uint8_t bit_width;		/* Register size in bits */
+	uint8_t bit_offset;		/* Register offset in bits */
+	uint8_t access_size;
+	uint64_t address;
+} __packed;
+
+#define ACPI_SPACE_MEMORY	0
+
+/*
+ * HPET Description Table (signature "HPET")
+ */
+struct acpi_hpet {
+	struct acpi_sdt header;
+	uint32_t block_id;		/* Copy of GCAP_ID bits 0-31 */
+	struct acpi_gas address;	/* Event timer block base */
+	uint8_t number;			/* HPET sequence number */
+	uint16_t min_tick;		/* Periodic mode minimum ticks */
+	uint8_t page_protection;
+} __packed;
+
+/* Compile-time ACPI tables sizes sanity checks */
+static inline void acpi_check(void) {
+	compiler_assert(sizeof(struct acpi_rsdp) == 36);
+	compiler_assert(sizeof(struct acpi_sdt) == 36);
+	compiler_assert(sizeof(struct acpi_madt) == 44);
+	compiler_assert(sizeof(struct madt_lapic) == 8);
+	compiler_assert(sizeof(struct madt_ioapic) == 12);
+	compiler_assert(sizeof(struct madt_int_override) == 10);
+	compiler_assert(sizeof(struct madt_x2apic) == 16);
+	compiler_assert(sizeof(struct acpi_gas) == 12);
+	compiler_assert(sizeof(struct acpi_hpet) == 56);
+}
+
+int acpi_init(void);
+int acpi_get_hpet(uint64_t *phys);
+
+#endif /* _ACPI_H */
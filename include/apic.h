@@ -27,9 +27,13 @@
  */
 #define MSR_APICBASE		0x0000001b
 #define MSR_APICBASE_ENABLE	(1UL << 11)
+#define MSR_APICBASE_X2ENABLE	(1UL << 10)
 #define MSR_APICBASE_BSC	(1UL << 8)
 #define MSR_APICBASE_ADDRMASK	0x000ffffffffff000ULL
 
+/* TSC-deadline timer mode: arms the timer when written */
+#define MSR_TSC_DEADLINE	0x000006e0
+
 static inline uint64_t msr_apicbase_getaddr(void)
 {
 	uint64_t msr = read_msr(MSR_APICBASE);
@@ -54,6 +58,26 @@ static inline void msr_apicbase_enable(void)
 	write_msr(MSR_APICBASE, tmp);
 }
 
+/*
+ * x2APIC mode can only be entered from an enabled xAPIC, and
+ * can't be left without disabling the local APIC altogether.
+ */
+static inline void msr_apicbase_x2enable(void)
+{
+	uint64_t tmp;
+
+	tmp = read_msr(MSR_APICBASE);
+	tmp |= MSR_APICBASE_ENABLE;
+	write_msr(MSR_APICBASE, tmp);
+	tmp |= MSR_APICBASE_X2ENABLE;
+	write_msr(MSR_APICBASE, tmp);
+}
+
+static inline bool msr_apicbase_x2enabled(void)
+{
+	return read_msr(MSR_APICBASE) & MSR_APICBASE_X2ENABLE;
+}
+
 /*
  * APIC mempory-mapped registers. Offsets are relative to the
  * the Apic Base Address and are aligned on 128-bit boundary.
@@ -141,8 +165,8 @@ union apic_lvt_timer {
 			delivery_status:1,	/* read-only */
 			reserved1:3,
 			mask:1,
-			timer_mode:1,
-			reserved2:14;
+			timer_mode:2,
+			reserved2:13;
 	} __packed;
 	uint32_t value;
 };
@@ -280,6 +304,7 @@ enum {
 enum {
 	APIC_TIMER_ONESHOT  = 0x0,	/* Trigger timer as one shot */
 	APIC_TIMER_PERIODIC = 0x1,	/* Trigger timer monotonically */
+	APIC_TIMER_TSC_DEADLINE = 0x2,	/* Trigger at an absolute TSC value */
 };
 
 /* APIC entries hardware-reset values, Intel-defined */
@@ -293,16 +318,30 @@ enum {
 
 /*
  * APIC register accessors
+ *
+ * In x2APIC mode, the registers are accessed through MSRs, one
+ * per each MMIO register offset. The DFR and the ICR high-word
+ * are gone: the ICR is one 64-bit MSR, with a 32-bit APIC ID
+ * destination, and the LDR is read-only.
  */
 
 #define APIC_PHBASE	0xfee00000	/* Physical */
 #define APIC_MMIO_SPACE	PAGE_SIZE	/* 4-KBytes */
 void *apic_vrbase(void);		/* Virtual */
 
+#define X2APIC_MSR(reg)	(0x800 + ((reg) >> 4))
+extern bool apic_x2mode;		/* Are we in x2APIC mode? */
+extern bool apic_tsc_deadline;		/* TSC-deadline timer usable? */
+
 static inline void apic_write(uint32_t reg, uint32_t val)
 {
 	void *vaddr;
 
+	if (apic_x2mode) {
+		write_msr(X2APIC_MSR(reg), val);
+		return;
+	}
+
 	vaddr = apic_vrbase();
 	vaddr = (char *)vaddr + reg;
 	writel(val, vaddr);
@@ -312,11 +351,26 @@ static inline uint32_t apic_read(uint32_t reg)
 {
 	void *vaddr;
 
+	if (apic_x2mode)
+		return read_msr(X2APIC_MSR(reg));
+
 	vaddr = apic_vrbase();
 	vaddr = (char *)vaddr + reg;
 	return readl(vaddr);
 }
 
+/*
+ * Calling CPU's local APIC ID: 8-bit in xAPIC mode, and 32-bit
+ * in x2APIC mode
+ */
+static inline uint32_t apic_get_id(void)
+{
+	union apic_id id;
+
+	id.raw = apic_read(APIC_ID);
+	return apic_x2mode ? id.raw : id.id;
+}
+
 enum irq_dest {
 	IRQ_BROADCAST,			/* Interrupt all cores */
 	IRQ_BOOTSTRAP,			/* Interrupt BSC only */
@@ -326,13 +380,15 @@ enum irq_dest {
 void apic_init(void);
 void apic_local_regs_init(void);
 
-uint8_t apic_bootstrap_id(void);
+uint32_t apic_bootstrap_id(void);
 
 void apic_udelay(uint64_t us);
 void apic_mdelay(int ms);
 void apic_monotonic(int ms, uint8_t vector);
+void apic_oneshot(uint8_t vector);
+void apic_set_deadline(uint64_t deadline);
 
-void apic_send_ipi(int dst_id, int del_mode, int vector);
+void apic_send_ipi(uint32_t dst_id, int del_mode, int vector);
 void apic_broadcast_ipi(int del_mode, int vector);
 bool apic_ipi_acked(void);
 
@@ -349,7 +405,9 @@ static void __unused apic_run_tests(void) { }
 #else
 
 #define APIC_PHBASE	0xfee00000	/* Physical */
+#define APIC_ID		0x20		/* APIC ID Register */
 #define APIC_EOI	0xb0		/* End of Interrupt Register */
+#define X2APIC_EOI_MSR	0x80b		/* Its x2APIC-mode MSR */
 
 #endif /* !__ASSEMBLY__ */
 
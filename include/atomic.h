@@ -5,7 +5,11 @@
 #include <tests.h>
 
 uint8_t atomic_bit_test_and_set(uint32_t *val);
+void atomic_bit_set(uint32_t *bitmap, uint32_t bit);
 uint64_t atomic_inc(uint64_t *val);
+uint64_t atomic_dec(uint64_t *val);
+uint64_t atomic_xchg(uint64_t *val, uint64_t new);
+uint64_t atomic_cmpxchg(uint64_t *val, uint64_t cmp, uint64_t new);
 
 #if    ATOMIC_TESTS
 void atomic_run_tests(void);
@@ -0,0 +1,34 @@
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+/*
+ * Block devices page cache
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <blkdev.h>
+
+int bcache_read(struct block_device *bdev, uint64_t offset, void *buf,
+		uint64_t len);
+int bcache_write(struct block_device *bdev, uint64_t offset, void *buf,
+		 uint64_t len);
+void bcache_readahead(struct block_device *bdev, uint64_t offset,
+		      uint64_t len);
+int bcache_read_nowait(struct block_device *bdev, uint64_t offset, void *buf,
+		       uint64_t len);
+int bcache_writeback(struct block_device *bdev, uint64_t seq, int max_pages);
+uint64_t bcache_dirty_seq(void);
+bool bcache_dirty_exceeded(void);
+int bcache_sync(struct block_device *bdev);
+void bcache_invalidate(struct block_device *bdev);
+
+void bcache_init(void);
+
+#endif /* _BCACHE_H */
@@ -0,0 +1,160 @@
+#ifndef _BLKDEV_H
+#define _BLKDEV_H
+
+/*
+ * Block devices and block I/O requests
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <list.h>
+#include <spinlock.h>
+#include <x86.h>
+
+#define SECTOR_SHIFT	9
+#define SECTOR_SIZE	(1 << SECTOR_SHIFT)	/* 512 bytes */
+
+enum bio_op {
+	BIO_READ,
+	BIO_WRITE,
+};
+
+struct block_device;
+struct io_scheduler;
+
+/*
+ * Block I/O request, on a contiguous run of device sectors
+ *
+ * Completion is asynchronous: once the driver has fully transferred
+ * the data (or failed), bio_endio() marks the request as done and
+ * calls its @end_io hook, possibly from IRQ context.
+ *
+ * The I/O scheduler merges bios of adjacent sectors: drivers then
+ * get a request, a chain of bios, through its first bio. Fields
+ * below @next are only meaningful for such a first bio.
+ */
+struct bio {
+	struct block_device *bdev;	/* Target device */
+	enum bio_op op;			/* Read or write? */
+	uint64_t sector;		/* First device sector */
+	uint64_t nr_sectors;		/* Transfer length, in sectors */
+	char *buf;			/* Memory buffer, nr_sectors long */
+
+	void (*end_io)(struct bio *);	/* Completion hook (optional) */
+	void *private;			/* Owner's completion data */
+
+	int status;			/* 0, or a negative errno */
+	bool done;			/* Set at completion */
+
+	struct list_node node;		/* For driver and scheduler queues */
+	struct bio *next;		/* Next bio of the request, or NULL */
+
+	struct bio *rq_tail;		/* Last bio of the request */
+	uint64_t rq_sectors;		/* Request length, in sectors */
+	int rq_segments;		/* Nr of bios in the request */
+	uint64_t rq_deadline;		/* Scheduler-defined expiry */
+	struct list_node rq_fifo;	/* Scheduler's arrival order */
+};
+
+#define rq_for_each_bio(bio, rq)				\
+	for (bio = (rq); bio != NULL; bio = bio->next)
+
+static inline uint64_t rq_end(struct bio *rq)
+{
+	return rq->sector + rq->rq_sectors;
+}
+
+static inline void bio_init(struct bio *bio, struct block_device *bdev,
+			    enum bio_op op, uint64_t sector, char *buf,
+			    uint64_t nr_sectors)
+{
+	memset(bio, 0, sizeof(*bio));
+	bio->bdev = bdev;
+	bio->op = op;
+	bio->sector = sector;
+	bio->buf = buf;
+	bio->nr_sectors = nr_sectors;
+	list_init(&bio->node);
+	list_init(&bio->rq_fifo);
+}
+
+/*
+ * Driver methods
+ *
+ * @submit	: Start executing given request, a chain of up to
+ *		  @max_segments bios on adjacent sectors; complete it,
+ *		  now or later, using bio_endio() on its first bio.
+ *		  Never called with a bio out of the device boundaries.
+ * @commit	: Optional. Called after a batch of submissions: the
+ *		  driver may defer notifying the hardware till then,
+ *		  paying one doorbell write per batch.
+ * @poll	: Optional. Reap finished requests without waiting for
+ *		  an interrupt; bio_wait() spins on it. This keeps sync
+ *		  I/O working from code holding IRQ-disabling spinlocks.
+ *		  With a @queue_depth, the awaited request might still
+ *		  be queued behind requests submitted by other CPUs:
+ *		  reap those too.
+ */
+struct block_device_ops {
+	void (*submit)(struct block_device *bdev, struct bio *bio);
+	void (*commit)(struct block_device *bdev);
+	void (*poll)(struct block_device *bdev);
+};
+
+/*
+ * @max_segments	: Bios per request the driver accepts; 0 = 1
+ * @queue_depth		: Requests handed to the driver at once; 0 =
+ *			  unlimited. Requests past it wait in the I/O
+ *			  scheduler, to get sorted and merged.
+ * @iosched		: I/O scheduler; NULL = deadline
+ */
+struct block_device {
+	const char *name;		/* "ram0", ... */
+	uint64_t nr_sectors;		/* Device capacity */
+	struct block_device_ops *ops;
+	void *private;			/* Driver's own state */
+
+	int max_segments;
+	int queue_depth;
+	struct io_scheduler *iosched;
+
+	/* Block layer request queue; see blkdev.c */
+	void *iosched_data;
+	spinlock_t queue_lock;
+	int nr_dispatched;		/* Requests now at the driver */
+	bool queue_running;
+	bool queue_rerun;
+};
+
+/*
+ * Per-CPU plug: while plugged, submitted bios are held back, to get
+ * merged and sorted as a whole at unplug. IRQs, and thus preemption,
+ * are kept disabled all along.
+ */
+struct blk_plug {
+	struct list_node bios;
+	union x86_rflags flags;		/* IRQs state before plugging */
+	bool nested;			/* Inside another plug? */
+};
+
+void blkdev_register(struct block_device *bdev);
+struct block_device *blkdev_find(const char *name);
+struct block_device *blkdev_get(int i);
+
+void blk_start_plug(struct blk_plug *plug);
+void blk_finish_plug(struct blk_plug *plug);
+void submit_bio(struct bio *bio);
+void submit_bio_batch(struct bio **bios, int nr);
+void bio_endio(struct bio *bio, int status);
+int bio_wait(struct bio *bio);
+int blkdev_rw(struct block_device *bdev, enum bio_op op, uint64_t sector,
+	      char *buf, uint64_t nr_sectors);
+
+#endif /* _BLKDEV_H */
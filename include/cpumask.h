@@ -0,0 +1,55 @@
+#ifndef _CPUMASK_H
+#define _CPUMASK_H
+
+/*
+ * CPU sets
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * CPUs are identified by their per-CPU area id: the cpus[] index,
+ * with the BSC as CPU 0. Bits can get set atomically through the
+ * atomic_bit_set() accessor on @bits.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <percpu.h>
+#include <mptables.h>
+
+struct cpumask {
+	uint32_t bits[CPUS_MAX / 32];
+};
+
+static inline void cpumask_clear(struct cpumask *mask)
+{
+	for (int i = 0; i < ARRAY_SIZE(mask->bits); i++)
+		mask->bits[i] = 0;
+}
+
+static inline void cpumask_set_cpu(int cpu, struct cpumask *mask)
+{
+	mask->bits[cpu / 32] |= 1U << (cpu % 32);
+}
+
+static inline void cpumask_clear_cpu(int cpu, struct cpumask *mask)
+{
+	mask->bits[cpu / 32] &= ~(1U << (cpu % 32));
+}
+
+static inline bool cpumask_test_cpu(int cpu, const struct cpumask *mask)
+{
+	return mask->bits[cpu / 32] & (1U << (cpu % 32));
+}
+
+/*
+ * @cpu: int iterator, over all usable CPUs set in @mask
+ */
+#define for_each_cpu(cpu, mask)						\
+	for ((cpu) = 0; (cpu) < mptables_get_nr_cpus(); (cpu)++)	\
+		if (!cpumask_test_cpu((cpu), (mask))) { } else
+
+#endif /* _CPUMASK_H */
@@ -62,6 +62,14 @@ enum {
 	EXT2_DYNAMIC_REVISION	= 1,
 };
 
+/*
+ * Superblock feature sets - only the ones we recognize
+ */
+enum {
+	EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER = 0x0001,	/* Sparse superblocks */
+	EXT2_FEATURE_RO_COMPAT_LARGE_FILE   = 0x0002,	/* Files >= 2-GBytes */
+};
+
 /*
  * Superblock `state' field
  */
@@ -247,6 +255,21 @@ struct group_descriptor {
 	uint16_t	reserved[7];
 } __packed;
 
+/*
+ * Sequential readahead state, in file blocks
+ *
+ * @next              : Block expected next if reading sequentially
+ * @start             : First block of the last readahead window
+ * @size              : Last window size; zero if readahead is off
+ * @trigger           : Reading this block starts the next window
+ */
+struct file_ra_state {
+	uint64_t	next;
+	uint64_t	start;
+	uint64_t	size;
+	uint64_t	trigger;
+};
+
 /*
  * In-core Inode Image:
  *
@@ -266,6 +289,7 @@ struct group_descriptor {
  * @refcount          : Reference count (CHECK `ext2.c' notes before usage)
  * @lock              : For protecting internal inode fields (`ext2.c')
  * @dirty             : Does the buffered inode image now differ from disk?
+ * @ra                : File readahead state (`ext2.c' file_readahead())
  *
  * @@ Below fields are mirrored from the Ext2 On-Disk inode image:
  * @mode              : File type and access rights
@@ -288,7 +312,8 @@ struct group_descriptor {
  *                      0 value indicates that such part of file isn't mapped.
  * @generation        : File version, only used by NFS
  * @file_acl          : Block number containing file's extended attributes
- * @size_high         : Higher 32-bits of file size, in bytes
+ * @size_high         : Higher 32-bits of file size, in bytes. For directories,
+ *                      this is the old 'dir_acl' field: always 0 for us.
  * @blocks_count_high : Higher 32-bits of total number of 512-byte blocks
  */
 struct inode {
@@ -298,6 +323,7 @@ struct inode {
 	spinlock_t	lock;
 	bool		dirty;
 	bool		delete_on_last_use;
+	struct file_ra_state ra;
 
 	// Start of On-disk inode fields:
 	uint16_t	mode;
@@ -332,6 +358,8 @@ static inline void inode_init(struct inode *inode, uint64_t inum)
 	spin_init(&inode->lock);
 	inode->dirty = false;
 	inode->delete_on_last_use = false;
+	inode->ra.next = 0;
+	inode->ra.size = 0;
 }
 
 static inline void *dino_off(struct inode *inode)
@@ -344,6 +372,18 @@ static inline uint64_t dino_len(void)
 	return sizeof(struct inode) - offsetof(struct inode, mode);
 }
 
+/*
+ * Full 64-bit file size. Directory sizes are 32-bit only (check
+ * the @size_high notes above.)
+ */
+static inline uint64_t inode_size(struct inode *inode)
+{
+	if (!S_ISREG(inode->mode))
+		return inode->size_low;
+
+	return (uint64_t)inode->size_high << 32 | inode->size_low;
+}
+
 struct inode *inode_get(uint64_t inum);
 void inode_put(struct inode *inode);
 
@@ -398,11 +438,16 @@ struct dir_entry {
 void ext2_init(void);
 uint64_t file_read(struct inode *, char *buf, uint64_t offset, uint64_t len);
 int64_t file_write(struct inode *, char *buf, uint64_t offset, uint64_t len);
+int64_t file_seek_hole_data(struct inode *, uint64_t offset, bool hole);
 int64_t ext2_new_dir_entry(struct inode *parent, struct inode *entry_ino,
 			   const char *name, enum file_type type);
 int64_t file_new(struct inode *, const char *name, enum file_type type);
 int file_delete(struct inode *parent, const char *name);
-void file_truncate(struct inode *inode);
+int file_truncate(struct inode *inode, uint64_t len);
+int file_fallocate(struct inode *inode, uint64_t offset, uint64_t len,
+		   bool keep_size);
+int file_fsync(struct inode *inode);
+int ext2_sync(void);
 int64_t name_i(const char *path);
 
 enum block_op {
@@ -429,9 +474,9 @@ struct path_translation {
 
 /*
  * Globally export some internal methods if the test-cases
- * driver was enabled.
+ * driver was enabled, or for the userspace build (tools/ext2-host)
  */
-#if EXT2_TESTS || EXT2_SMP_TESTS
+#if EXT2_TESTS || EXT2_SMP_TESTS || defined(EXT2_HOST)
 
 #define STATIC	extern
 void block_read(uint64_t block, char *buf, uint blk_offset, uint len);
@@ -440,12 +485,14 @@ void block_dealloc(uint block);
 struct inode *inode_alloc(enum file_type type);
 STATIC void inode_mark_delete(struct inode *inode);
 uint64_t block_alloc(void);
+uint64_t block_alloc_run(uint64_t want, uint64_t *count);
+int64_t file_block_map(struct inode *inode, uint64_t fblock, uint64_t new);
 bool dir_entry_valid(struct inode *, struct dir_entry *, uint64_t off, uint64_t len);
 int64_t find_dir_entry(struct inode *inode, const char *name,uint name_len,
 		       struct dir_entry **dentry, int64_t *offset);
 #else
 #define STATIC	static
-#endif	/* EXT2_TESTS || EXT2_SMP_TESTS */
+#endif	/* EXT2_TESTS || EXT2_SMP_TESTS || EXT2_HOST */
 
 #if EXT2_TESTS
 void ext2_run_tests(void);
@@ -459,6 +506,14 @@ void ext2_run_smp_tests(void);
 static void __unused ext2_run_smp_tests(void) { }
 #endif	/* EXT2_SMP_TESTS */
 
+#if EXT2_BENCHMARKS
+void ext2_run_benchmarks(void);
+void ext2_run_smp_benchmarks(void);
+#else
+static void __unused ext2_run_benchmarks(void) { }
+static void __unused ext2_run_smp_benchmarks(void) { }
+#endif	/* EXT2_BENCHMARKS */
+
 /*
  * Dump file system On-Disk structures;  useful for testing.
  */
@@ -0,0 +1,6 @@
+#ifndef _FLUSHER_H
+#define _FLUSHER_H
+
+void flusher_init(void);
+
+#endif /* _FLUSHER_H */
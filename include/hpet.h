@@ -0,0 +1,51 @@
+#ifndef _HPET_H
+#define _HPET_H
+
+/*
+ * High Precision Event Timer (HPET)
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+
+/*
+ * Memory-mapped registers, relative to the block base
+ */
+#define HPET_GCAP_ID		0x000	/* General capabilities and ID */
+#define HPET_GEN_CONF		0x010	/* General configuration */
+#define HPET_MAIN_CNT		0x0f0	/* Main counter value */
+#define HPET_MMIO_SPACE		0x400
+
+/* General capabilities */
+#define HPET_GCAP_COUNT_64BIT	(1UL << 13)
+#define HPET_GCAP_PERIOD(cap)	((cap) >> 32)	/* Femtoseconds per tick */
+#define HPET_MAX_PERIOD		100000000	/* 100ns: spec upper bound */
+
+/* General configuration */
+#define HPET_CONF_ENABLE	(1UL << 0)	/* Main counter runs */
+#define HPET_CONF_LEGACY	(1UL << 1)	/* Timers 0/1 replace PIT/RTC */
+
+#define FSEC_PER_SEC		1000000000000000ul
+
+/*
+ * Main counter ticks per second; zero if there's no HPET
+ */
+extern uint64_t hpet_hz;
+
+/*
+ * 32-bit counters wrap-around in a few minutes: good for
+ * delays and calibration, but not as a monotonic clock
+ */
+extern bool hpet_counter_64bit;
+
+int hpet_init(void);
+uint64_t hpet_read(void);
+void hpet_udelay(uint64_t us);
+
+#endif /* _HPET_H */
@@ -13,6 +13,8 @@
 
 #define IDT_GATES	(0xFF + 1)
 #define EXCEPTION_GATES (0x1F + 1)
+#define IRQ_GATES	(IDT_GATES - EXCEPTION_GATES)
+#define IRQ_STUB_SIZE	16
 
 #define GATE_INTERRUPT	0xe
 #define GATE_TRAP	0xf
@@ -57,11 +59,13 @@ struct idt_descriptor {
  * the compiler automatically calculate an entry index for us.
  *
  * @IDT_STUB_SIZE: exception stub _code_ size.
+ * @IRQ_STUB_SIZE: IRQ stub size, padding included.
  */
 extern const struct idt_descriptor idtdesc;
 extern struct idt_gate idt[IDT_GATES];
 #define IDT_STUB_SIZE 12
 extern const char idt_exception_stubs[EXCEPTION_GATES][IDT_STUB_SIZE];
+extern const char idt_irq_stubs[IRQ_GATES][IRQ_STUB_SIZE];
 extern void default_irq_handler(void);
 
 static inline void pack_idt_gate(struct idt_gate *gate, uint8_t type, void *addr)
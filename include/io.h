@@ -34,6 +34,46 @@ static inline void outb(uint8_t val, uint16_t port)
 
 }
 
+static inline uint16_t inw(uint16_t port)
+{
+	uint16_t val;
+
+	asm volatile (
+		"inw %[port], %[val]"
+		: [val] "=a" (val)
+		: [port] "Nd" (port));
+
+	return val;
+}
+
+static inline void outw(uint16_t val, uint16_t port)
+{
+	asm volatile (
+		"outw %[val], %[port]"
+		:
+		: [val] "a" (val), [port] "Nd" (port));
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+	uint32_t val;
+
+	asm volatile (
+		"inl %[port], %[val]"
+		: [val] "=a" (val)
+		: [port] "Nd" (port));
+
+	return val;
+}
+
+static inline void outl(uint32_t val, uint16_t port)
+{
+	asm volatile (
+		"outl %[val], %[port]"
+		:
+		: [val] "a" (val), [port] "Nd" (port));
+}
+
 /*
  * A (hopefully) free port for I/O delay. Port 0x80 causes
  * problems on HP Pavilion laptops.
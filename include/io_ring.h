@@ -0,0 +1,101 @@
+#ifndef _IO_RING_H
+#define _IO_RING_H
+
+/*
+ * Asynchronous file I/O rings
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <spinlock.h>
+#include <list.h>
+#include <tests.h>
+
+enum io_op {
+	IO_OP_NOP,
+	IO_OP_OPEN,			/* @buf: path; result: inode# */
+	IO_OP_READ,			/* Result: bytes read */
+	IO_OP_WRITE,			/* Result: bytes written */
+	IO_OP_FSYNC,			/* Result: zero */
+};
+
+/*
+ * Submission queue entry
+ */
+struct io_sqe {
+	enum io_op op;
+	uint64_t inum;			/* Target file, if not OPEN */
+	uint64_t offset;		/* File offset, in bytes */
+	char *buf;
+	uint64_t len;
+	uint64_t user_data;		/* Copied to the completion */
+};
+
+/*
+ * Completion queue entry
+ */
+struct io_cqe {
+	uint64_t user_data;
+	int64_t res;			/* Op result, or a negative errno */
+	volatile uint32_t seq;		/* Completion# + 1, once posted */
+};
+
+/*
+ * Ring pair, owned by one client thread
+ *
+ * The client produces submissions at @sq_tail, and consumes
+ * completions at @cq_head; both are written by the client only.
+ * Completions may come out of submission order.
+ *
+ * Producers reserve completion entries at @cq_tail, then post each
+ * by setting its @seq, as their very last access to the ring.
+ */
+struct io_ring {
+	struct io_sqe *sqes;
+	uint32_t sq_entries;		/* Power of 2 */
+	uint32_t sq_local;		/* Filled, but not yet submitted */
+	volatile uint32_t sq_tail;
+	volatile uint32_t sq_head;	/* Protected by @sq_lock */
+	spinlock_t sq_lock;
+
+	struct io_cqe *cqes;
+	uint32_t cq_entries;		/* 2 * @sq_entries */
+	uint32_t cq_tail;		/* Reserved; protected by @cq_lock */
+	volatile uint32_t cq_head;
+	spinlock_t cq_lock;
+
+	bool workers;			/* Served by the I/O workers? */
+	struct list_node node;		/* Workers' rings list */
+};
+
+#define IO_RING_ENTRIES_MAX	64
+
+struct io_ring *io_ring_setup(uint32_t entries, bool workers);
+void io_ring_destroy(struct io_ring *ring);
+struct io_sqe *io_ring_get_sqe(struct io_ring *ring);
+void io_ring_submit(struct io_ring *ring);
+struct io_cqe *io_ring_peek_cqe(struct io_ring *ring);
+void io_ring_cqe_seen(struct io_ring *ring);
+int io_ring_poll(struct io_ring *ring, int max);
+
+/*
+ * Test cases
+ */
+
+#if	IO_RING_TESTS
+
+void io_ring_run_tests(void);
+
+#else
+
+static void __unused io_ring_run_tests(void) { }
+
+#endif	/* IO_RING_TESTS */
+
+#endif /* _IO_RING_H */
@@ -17,6 +17,7 @@
 #include <mptables.h>
 #include <mmio.h>
 #include <vm.h>
+#include <cpumask.h>
 
 /*
  * System-wide I/O APIC descriptors for each I/O APIC reported
@@ -28,6 +29,7 @@ struct ioapic_desc {
 	uint8_t version;		/* Chip version: 0x11, 0x20, .. */
 	uint32_t base;			/* This IOAPIC physical base address */
 	uint8_t max_irq;		/* IRQs = (0 - max_irq) inclusive */
+	uint32_t gsi_base;		/* ACPI: GSI of pin 0; MP: unused */
 };
 
 extern int nr_ioapics;			/* (MP, ACPI) usable I/O APICs count */
@@ -198,7 +200,27 @@ struct ioapic_pin {
 	int pin;			/* which pin in this ioapic */
 };
 
+/*
+ * A routed IRQ, and where it's currently delivered
+ */
+struct ioapic_route {
+	struct ioapic_pin pin;
+	union ioapic_irqentry entry;	/* Without the destination */
+	struct cpumask affinity;	/* CPUs allowed to handle it */
+	int cpu;			/* Current target, -1 = broadcast */
+};
+
+#define IOAPIC_ROUTES_MAX	16
+
+extern int nr_ioapic_routes;
+extern struct ioapic_route ioapic_routes[IOAPIC_ROUTES_MAX];
+
 void ioapic_setup_isairq(uint8_t irq, uint8_t vector, enum irq_dest);
+int ioapic_setup_pciirq(uint8_t dev, uint8_t pin, uint8_t vector,
+			enum irq_dest dest);
+int ioapic_set_affinity(uint8_t vector, const struct cpumask *mask);
+void ioapic_route_set_cpu(int route, int cpu);
+int ioapic_mask_vector(uint8_t vector);
 void ioapic_init(void);
 
 #endif /* _IOAPIC_H */
@@ -0,0 +1,36 @@
+#ifndef _IOSCHED_H
+#define _IOSCHED_H
+
+/*
+ * I/O schedulers
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <blkdev.h>
+
+/*
+ * Scheduler methods; all but @init are called with the device's
+ * queue_lock held.
+ *
+ * @init	: Return the scheduler's private data for given device
+ * @add		: Merge given bio into a queued request, or queue it
+ *		  as a new request
+ * @dispatch	: Dequeue the next request for the driver, or NULL
+ */
+struct io_scheduler {
+	const char *name;
+	void *(*init)(struct block_device *bdev);
+	void (*add)(struct block_device *bdev, struct bio *bio);
+	struct bio *(*dispatch)(struct block_device *bdev);
+};
+
+extern struct io_scheduler noop_iosched;
+extern struct io_scheduler deadline_iosched;
+
+#endif /* _IOSCHED_H */
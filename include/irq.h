@@ -0,0 +1,83 @@
+#ifndef _IRQ_H
+#define _IRQ_H
+
+/*
+ * Generic IRQ handling
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <idt.h>
+#include <spinlock.h>
+#include <tests.h>
+
+/*
+ * Handlers sharing a vector are called in turn; each
+ * returns whether its device was the IRQ source.
+ */
+enum irqreturn {
+	IRQ_NONE = 0,			/* Not ours */
+	IRQ_HANDLED = 1,		/* Ours, and now serviced */
+};
+
+typedef enum irqreturn (*irq_handler_t)(void *data);
+
+struct irq_action {
+	irq_handler_t handler;
+	void *data;			/* Handler's parameter */
+	const char *name;		/* Owner device, for the logs */
+	struct irq_action *next;	/* Next handler on this vector */
+};
+
+/*
+ * IDT vector descriptor
+ */
+struct irq_desc {
+	struct irq_action *actions;	/* Handlers, in registration order */
+	spinlock_t lock;		/* Handlers list and storm tracking */
+	clock_t storm_start;		/* Current unhandled IRQs window */
+	uint32_t storm_count;		/* Unhandled IRQs in this window */
+	uint64_t nr_unhandled;		/* Unhandled IRQs, overall */
+	bool disabled;			/* Nobody cared: ignore it */
+};
+
+/*
+ * Per-CPU statistics: IRQs taken, and TSC cycles spent in
+ * their handlers, for each vector
+ */
+struct irq_cpustat {
+	uint64_t count[IDT_GATES];
+	uint64_t cycles[IDT_GATES];
+};
+
+int irq_register(uint8_t vector, irq_handler_t handler, void *data,
+		 const char *name);
+uint64_t irq_count(uint8_t vector, int cpu);
+uint64_t irq_cycles(uint8_t vector, int cpu);
+uint64_t irq_unhandled(uint8_t vector);
+void irq_print_stats(void);
+
+void irq_init(void);
+void irq_dispatch(uint8_t vector);	/* IRQ entry, from idt.S */
+
+/*
+ * Test cases
+ */
+
+#if	IRQ_TESTS
+
+void irq_run_tests(void);
+
+#else
+
+static void __unused irq_run_tests(void) { }
+
+#endif	/* IRQ_TESTS */
+
+#endif /* _IRQ_H */
@@ -0,0 +1,6 @@
+#ifndef _IRQBALANCE_H
+#define _IRQBALANCE_H
+
+void irqbalance_init(void);
+
+#endif /* _IRQBALANCE_H */
@@ -159,6 +159,16 @@ extern void halt_cpu_ipi_handler(void);
 #define barrier()						\
 	asm volatile ("":::"memory");
 
+/*
+ * Full CPU memory barrier
+ *
+ * x86 may reorder a store after a later load to a different
+ * location. Shared-memory protocols with devices (e.g. ring
+ * event indices) need this ordering; barrier() alone won't do.
+ */
+#define mb()							\
+	asm volatile ("mfence":::"memory");
+
 /*
  * For spin-loops, use x86 'pause' and a memory barrier to:
  * - force gcc to reload any values from memory over the busy
@@ -1,7 +1,6 @@
 #ifndef _I8042_H
 #define _I8042_H
 
-void __kb_handler(void);
 void keyboard_init(void);
 
 #endif /* _I8042_H */
@@ -0,0 +1,56 @@
+#ifndef _KTIME_H
+#define _KTIME_H
+
+/*
+ * Kernel monotonic time
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <tests.h>
+
+#define NSEC_PER_USEC	1000ul
+#define NSEC_PER_MSEC	1000000ul
+#define NSEC_PER_SEC	1000000000ul
+
+/*
+ * TSC ticks per second, calibrated once at boot
+ */
+extern uint64_t tsc_hz;
+
+/*
+ * Does the TSC tick at a constant rate, in all power states? Our
+ * monotonic clock is then TSC-based; otherwise, it falls back to
+ * a 64-bit HPET, or to the bootstrap core ticks.
+ */
+extern bool tsc_reliable;
+
+uint64_t ktime_get_ns(void);
+uint64_t tsc_to_ns(uint64_t cycles);
+void udelay(uint64_t us);
+void mdelay(int ms);
+
+void ktime_init(void);
+void ktime_sync_cpus(void);
+
+/*
+ * Test cases
+ */
+
+#if	KTIME_TESTS
+
+void ktime_run_tests(void);
+
+#else
+
+static void __unused ktime_run_tests(void) { }
+
+#endif	/* KTIME_TESTS */
+
+#endif /* _KTIME_H */
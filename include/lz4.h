@@ -0,0 +1,10 @@
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include <kernel.h>
+#include <stdint.h>
+
+int64_t lz4_decompress(const void *src, uint64_t src_len, void *dst,
+		       uint64_t dst_len);
+
+#endif /* _LZ4_H */
@@ -44,6 +44,7 @@
 #include <kernel.h>
 #include <stdint.h>
 #include <paging.h>
+#include <list.h>
 #include <tests.h>
 
 /*
@@ -171,6 +172,23 @@ struct page *addr_to_page(void *addr);
 
 void pagealloc_init(void);
 
+/*
+ * Shrinkers: subsystems caching reclaimable pages register one.
+ * Once the page allocator runs dry, it asks them to give some
+ * pages back before declaring an out-of-memory panic.
+ *
+ * @scan	: Free up to @nr_pages pages, returning the number of
+ *		  pages actually freed. Called from the allocating
+ *		  thread, possibly with its spinlocks held: never
+ *		  allocate memory or spin on a lock; use trylocks.
+ */
+struct shrinker {
+	uint64_t (*scan)(uint64_t nr_pages);
+	struct list_node node;		/* For the shrinkers list */
+};
+
+void register_shrinker(struct shrinker *shrinker);
+
 /*
  * Test cases driver
  */
@@ -160,14 +160,21 @@ enum mp_irqtype {
 
 /*
  * Parsed MP tables data exported to the rest of
- * of the system
+ * of the system. The ACPI MADT parser, if found,
+ * fills these tables instead.
  */
 
 extern int mp_isa_busid;
+extern int mp_pci_busid;
 
 extern int nr_mpcirqs;
 extern struct mpc_irq mp_irqs[];
 
+void mp_add_cpu(int apic_id, bool bootstrap);
+bool mp_bootstrap_found(void);
+void mp_add_ioapic(uint8_t id, uint32_t base, uint32_t gsi_base);
+void mp_add_irq(struct mpc_irq *irq);
+
 void mptables_init(void);
 int __pure_const mptables_get_nr_cpus(void);
 
@@ -0,0 +1,101 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+/*
+ * PCI bus enumeration and configuration space access
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+
+/*
+ * Configuration Mechanism #1 I/O ports
+ */
+#define PCI_CONFIG_ADDRESS	0xcf8
+#define PCI_CONFIG_DATA		0xcfc
+
+/*
+ * Type-0 configuration space header offsets
+ */
+#define PCI_VENDOR_ID		0x00	/* 16-bit; 0xffff = no device */
+#define PCI_DEVICE_ID		0x02
+#define PCI_COMMAND		0x04
+#define PCI_STATUS		0x06
+#define PCI_CLASS_REVISION	0x08	/* Class << 8 | revision */
+#define PCI_HEADER_TYPE		0x0e
+#define PCI_BAR0		0x10
+#define PCI_CAPABILITY_LIST	0x34
+#define PCI_INTERRUPT_PIN	0x3d	/* 0 = none, 1 = INTA#, .. */
+
+#define PCI_COMMAND_IO		0x0001	/* I/O space decoding */
+#define PCI_COMMAND_MEMORY	0x0002	/* Memory space decoding */
+#define PCI_COMMAND_MASTER	0x0004	/* Bus mastering (DMA) */
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_STATUS_CAP_LIST	0x0010	/* Capabilities list present */
+#define PCI_HEADER_MULTIFUNC	0x80
+
+#define PCI_BAR_IO		0x01
+#define PCI_BAR_MEM_TYPE_MASK	0x06
+#define PCI_BAR_MEM_TYPE_64	0x04
+
+/*
+ * Capability IDs, and the MSI-X capability layout
+ */
+#define PCI_CAP_ID_VNDR		0x09	/* Vendor specific */
+#define PCI_CAP_ID_MSIX		0x11
+
+#define PCI_MSIX_FLAGS		2	/* 16-bit Message Control */
+#define PCI_MSIX_TABLE		4	/* Table offset | BAR indicator */
+#define PCI_MSIX_FLAGS_QSIZE	0x07ff	/* Table size - 1 */
+#define PCI_MSIX_FLAGS_MASKALL	0x4000
+#define PCI_MSIX_FLAGS_ENABLE	0x8000
+#define PCI_MSIX_TABLE_BIR	0x7
+
+#define PCI_MSIX_ENTRY_SIZE	16
+#define PCI_MSIX_ENTRY_ADDR_LO	0x0
+#define PCI_MSIX_ENTRY_ADDR_HI	0x4
+#define PCI_MSIX_ENTRY_DATA	0x8
+#define PCI_MSIX_ENTRY_CTRL	0xc	/* Bit 0: entry masked */
+
+/*
+ * MSI messages are memory writes to the local APICs address
+ * window; the destination APIC ID is encoded in the address.
+ */
+#define MSI_ADDR_BASE		0xfee00000
+#define MSI_ADDR_DEST_SHIFT	12
+
+struct pci_dev {
+	uint8_t bus, dev, func;		/* Geographical address */
+	uint16_t vendor, device;
+	uint32_t class;			/* Class, subclass, prog-if */
+	uint8_t irq_pin;		/* Legacy INTx# pin, if any */
+	void *msix_table;		/* Mapped MSI-X table, if enabled */
+};
+
+uint8_t pci_read8(struct pci_dev *pdev, uint8_t offset);
+uint16_t pci_read16(struct pci_dev *pdev, uint8_t offset);
+uint32_t pci_read32(struct pci_dev *pdev, uint8_t offset);
+void pci_write16(struct pci_dev *pdev, uint8_t offset, uint16_t val);
+void pci_write32(struct pci_dev *pdev, uint8_t offset, uint32_t val);
+
+struct pci_dev *pci_find_device(uint16_t vendor, uint16_t device);
+uint8_t pci_find_cap(struct pci_dev *pdev, uint8_t cap_id, uint8_t start);
+uint64_t pci_bar_phys(struct pci_dev *pdev, int bar);
+void *pci_bar_map(struct pci_dev *pdev, int bar, uint64_t offset,
+		  uint64_t len);
+void pci_enable(struct pci_dev *pdev);
+
+int pci_msix_enable(struct pci_dev *pdev);
+void pci_msix_set_entry(struct pci_dev *pdev, int entry, uint8_t apic_id,
+			uint8_t vector);
+
+void pci_init(void);
+
+#endif /* _PCI_H */
@@ -86,7 +86,7 @@
 #include <proc.h>
 #include <tests.h>
 
-#define CPUS_MAX		64	/* Arbitrary */
+#define CPUS_MAX		256	/* All 8-bit xAPIC IDs */
 
 /*
  * “Beware of false sharing within a cache line (64 bytes on Intel Pentium
@@ -119,6 +119,7 @@
 struct percpu {
 	struct proc *__current;		/* Descriptor of the ON_CPU thread */
 	int apic_id;			/* Local APIC ID */
+	int id;				/* Index in cpus[]; BSC = 0 */
 	uintptr_t self;			/* Address of this per-CPU area */
 	struct percpu_sched sched;
 #if PERCPU_TESTS
@@ -128,17 +129,25 @@ struct percpu {
 	uint8_t x8;			/* An 8-bit value (testing) */
 #endif
 	uintptr_t dumper;		/* How are the testing messages printed */
+	uintptr_t plug;			/* Block I/O plug, if plugged */
+	uintptr_t call_queue;		/* Cross-CPU calls (smp.c) */
+	uintptr_t irq_stats;		/* IRQ statistics (irq.c) */
+	int64_t tsc_offset;		/* TSC minus bootstrap TSC */
+	uintptr_t serial_tx;		/* Serial TX ring (serial.c) */
 #if EXT2_TESTS || EXT2_SMP_TESTS
 	bool halt_thread_at_end;	/* We're running SMP version of tests? */
 #endif
 } __aligned(CACHE_LINE_SIZE);
 
 /*
- * To make '__current' available to early boot code, it's statically
- * allocated in the first slot. Thus, slot 0 is reserved for the BSC.
+ * Per-CPU areas of all usable cores, allocated on discovery.
+ *
+ * To make '__current' available to early boot code, the BSC area
+ * is statically allocated, and is always put in the first slot.
  */
-extern struct percpu cpus[CPUS_MAX];
-#define BOOTSTRAP_PERCPU_AREA	((uintptr_t)&cpus[0])
+extern struct percpu bootstrap_percpu;
+extern struct percpu *cpus[CPUS_MAX];
+#define BOOTSTRAP_PERCPU_AREA	((uintptr_t)&bootstrap_percpu)
 
 /*
  * Per-CPU data accessors
@@ -113,6 +113,8 @@ struct proc {
 	uint64_t pid;
 	struct pcb pcb;			/* Hardware state (for ctxt switch) */
 	int state;			/* Current process state */
+	int cpu;			/* Queued on; threads don't migrate */
+	volatile bool unparked;		/* sched_unpark() got called */
 	struct list_node pnode;		/* for the runqueue lists */
 	clock_t runtime;		/* # ticks running on the CPU */
 	clock_t enter_runqueue_ts;	/* Timestamp runqueue entrance */
@@ -133,6 +135,7 @@ struct proc {
 enum proc_state {
 	TD_RUNNABLE,			/* In the runqueues, to be dispatched */
 	TD_ONCPU,			/* Currently runnning on the CPU */
+	TD_PARKED,			/* Off the runqueues till unparked */
 	TD_INVALID,			/* NULL mark */
 };
 
@@ -1,10 +1,41 @@
 #ifndef _RAMDISK_H
 #define _RAMDISK_H
 
+#include <kernel.h>
+#include <stdint.h>
+#include <paging.h>
+#include <tests.h>
+
 int ramdisk_get_len(void);
 char *ramdisk_get_buf(void);
 void *ramdisk_memory_area_end(void);
 
 void ramdisk_init(void);
+void ramdisk_inflate(void);
+
+/*
+ * Copy-on-write snapshots
+ */
+
+#define RAMDISK_BLOCK_SIZE	PAGE_SIZE	/* Snapshots granularity */
+
+struct ramdisk_snapshot;
+struct ramdisk_snapshot *ramdisk_snapshot_create(void);
+void ramdisk_snapshot_destroy(struct ramdisk_snapshot *snap);
+int ramdisk_snapshot_read(struct ramdisk_snapshot *snap, uint64_t offset,
+			  void *buf, uint64_t len);
+int64_t ramdisk_snapshot_next_changed(struct ramdisk_snapshot *snap,
+				      uint64_t block);
+uint64_t ramdisk_snapshot_nr_changed(struct ramdisk_snapshot *snap);
+
+#if	RAMDISK_TESTS
+
+void ramdisk_run_tests(void);
+
+#else
+
+static void __unused ramdisk_run_tests(void) { }
+
+#endif	/* RAMDISK_TESTS */
 
 #endif /* _RAMDISK_H */
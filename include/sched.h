@@ -101,6 +101,10 @@ void sched_init(void);
 
 void sched_enqueue(struct proc *);
 struct proc *sched_tick(void);	/* Avoid GCC warning */
+struct proc *sched_yield_tick(void);
+void sched_yield(void);
+void sched_park(void);
+void sched_unpark(struct proc *);
 
 void kthread_create(void (* func)(void));
 uint64_t kthread_alloc_pid(void);
@@ -17,4 +17,8 @@ void serial_write(const char *buf, int len);
 
 void serial_putc(char ch);
 
+void serial_irq_init(void);
+
+void serial_bust_locks(void);
+
 #endif /* _SERIAL_H */
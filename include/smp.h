@@ -0,0 +1,40 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+/*
+ * Cross-CPU function calls
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <kernel.h>
+#include <cpumask.h>
+#include <tests.h>
+
+int smp_call_function_single(int cpu, void (*func)(void *), void *arg,
+			     bool wait);
+int smp_call_function_many(const struct cpumask *mask, void (*func)(void *),
+			   void *arg, bool wait);
+int smp_call_function(void (*func)(void *), void *arg, bool wait);
+
+void smp_init(void);
+
+/*
+ * Test cases
+ */
+
+#if	SMP_CALL_TESTS
+
+void smp_run_tests(void);
+
+#else
+
+static void __unused smp_run_tests(void) { }
+
+#endif	/* SMP_CALL_TESTS */
+
+#endif /* _SMP_H */
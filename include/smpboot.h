@@ -14,9 +14,22 @@
 
 #define SMPBOOT_START		0x10000	/* Trampoline start; 4k-aligned */
 
+/*
+ * Trampoline identity-mapping page tables, directly after its
+ * code page. Shared by all AP cores: zeroed once by the BSC.
+ */
+
+#define SMPBOOT_PML4		(SMPBOOT_START + 0x1000)
+#define SMPBOOT_PML3		(SMPBOOT_PML4 + 0x1000)
+#define SMPBOOT_PGTABLES_END	(SMPBOOT_PML3 + 0x1000)
+
 /*
  * AP cores parameters base and their offsets. To be used
  * in trampoline assembly code.
+ *
+ * All AP cores get started at once. Each finds its unique
+ * stack and per-CPU area in the parameters slot indexed by
+ * its local APIC ID.
  */
 
 #define SMPBOOT_PARAMS		0x20000	/* AP parameters base */
@@ -28,10 +41,15 @@
 #define SMPBOOT_GDTR		(SMPBOOT_IDTR + 10)
 #define SMPBOOT_GDTR_LIMIT	(SMPBOOT_GDTR)
 #define SMPBOOT_GDTR_BASE	(SMPBOOT_GDTR_LIMIT + 2)
-#define SMPBOOT_STACK_PTR	(SMPBOOT_GDTR + 10)
-#define SMPBOOT_PERCPU_PTR	(SMPBOOT_STACK_PTR + 8)
+#define SMPBOOT_CPUS		(SMPBOOT_GDTR + 10)
+
+#define SMPBOOT_APIC_IDS	256	/* xAPIC IDs are 8-bit */
+#define SMPBOOT_CPU_STACK_PTR	(0)	/* Offsets within a CPU slot */
+#define SMPBOOT_CPU_PERCPU_PTR	(SMPBOOT_CPU_STACK_PTR + 8)
+#define SMPBOOT_CPU_SIZE	(SMPBOOT_CPU_PERCPU_PTR + 8)
 
-#define SMPBOOT_PARAMS_END	(SMPBOOT_PARAMS + SMPBOOT_PERCPU_PTR + 8)
+#define SMPBOOT_PARAMS_END	(SMPBOOT_PARAMS + SMPBOOT_CPUS +	\
+				 SMPBOOT_APIC_IDS * SMPBOOT_CPU_SIZE)
 #define SMPBOOT_PARAMS_SIZE	(SMPBOOT_PARAMS_END - SMPBOOT_PARAMS)
 
 #ifndef __ASSEMBLY__
@@ -45,6 +63,7 @@
 
 void __no_return secondary_start(void);	/* Silence-out GCC */
 int smpboot_get_nr_alive_cpus(void);
+bool smpboot_cpu_alive(int cpu);
 void smpboot_init(void);
 void smpboot_trigger_secondary_cores_testcases(void);
 
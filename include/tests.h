@@ -25,10 +25,17 @@
 #define		APIC_TESTS		0	/* Local APIC timer and IPI */
 #define		PERCPU_TESTS		0	/* Per-CPU Data Area tests */
 #define		ATOMIC_TESTS		0	/* Atomic-accessors */
+#define		SMP_CALL_TESTS		0	/* Cross-CPU function calls */
+#define		IRQ_TESTS		0	/* Generic IRQ handling */
+#define		KTIME_TESTS		0	/* TSC clocksource */
 #define		SCHED_TESTS		0	/* Scheduler tests */
 #define		EXT2_TESTS		0	/* File System tests */
 #define		EXT2_SMP_TESTS		0	/* SMP file system tests */
 #define		FILE_TESTS		0	/* Unix file operations */
+#define		EXT2_BENCHMARKS		0	/* File System benchmarks */
+#define		VIRTIO_BLK_TESTS	0	/* Virtio disk; overwrites it! */
+#define		IO_RING_TESTS		0	/* Asynchronous file I/O rings */
+#define		RAMDISK_TESTS		0	/* Ramdisk snapshots */
 
 #if	(SCHED_TESTS == 1) && (PIT_TESTS == 1)
 #error	Cannot run scheduler test cases with the PIT ones:\
@@ -36,6 +43,12 @@
 #endif
 
 
+#if	(EXT2_BENCHMARKS == 1) && (EXT2_SMP_TESTS == 1)
+#error	Cannot run file system benchmarks with the SMP tests:\
+	concurrent test threads skew the measured timings.
+#endif
+
+
 #if	(PRINTK_TESTS == 1) && (PRINTS_TESTS == 1)
 #error	Cannot simultaneously run printk() VGA tests\
 	with the serial-port ones.
@@ -37,6 +37,8 @@
 // Priority 0xf - Highest priority
 #define TICKS_IRQ_VECTOR	0xf0
 #define HALT_CPU_IPI_VECTOR	0xf1
+#define SMP_CALL_IPI_VECTOR	0xf2
+#define SCHED_YIELD_VECTOR	0xf3	// Software `int', not an IRQ
 #define APIC_SPURIOUS_VECTOR	0xff	// Intel-defined default
 
 // Priority 0x4 - APIC vectors
@@ -50,6 +52,10 @@
 #define KEYBOARD_IRQ_VECTOR	0x30
 #define PIT_TESTS_VECTOR	0x31
 #define APIC_TESTS_VECTOR	0x32
+#define VIRTIO_BLK_VECTOR	0x33
+#define IRQ_TESTS_VECTOR	0x34
+#define IRQ_TESTS_SPURIOUS_VECTOR 0x35
+#define SERIAL_IRQ_VECTOR	0x36
 
 // Priority 0x2 - Lowest possible priority (PIC spurious IRQs)
 #define PIC_IRQ0_VECTOR		0x20
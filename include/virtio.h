@@ -0,0 +1,163 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+/*
+ * Virtio 1.0 over PCI: split virtqueues and the block device
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Check the OASIS "Virtual I/O Device (VIRTIO) Version 1.0" spec,
+ * sections 2.4 (split virtqueues), 4.1 (PCI transport), and 5.2
+ * (block device). All fields are little-endian, like us.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <tests.h>
+
+#define VIRTIO_PCI_VENDOR		0x1af4
+#define VIRTIO_PCI_BLK_LEGACY		0x1001	/* Transitional device */
+#define VIRTIO_PCI_BLK_MODERN		0x1042	/* 0x1040 + device type 2 */
+
+/*
+ * Device status bits
+ */
+#define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FEATURES_OK	0x08
+#define VIRTIO_STATUS_FAILED		0x80
+
+/*
+ * Feature bits
+ */
+#define VIRTIO_BLK_F_RO			5	/* Read-only disk */
+#define VIRTIO_BLK_F_MQ			12	/* Multiple queues */
+#define VIRTIO_RING_F_EVENT_IDX		29	/* used/avail_event */
+#define VIRTIO_F_VERSION_1		32	/* Not a legacy device */
+
+/*
+ * PCI vendor-specific capability, locating each config structure
+ */
+struct virtio_pci_cap {
+	uint8_t cap_vndr;		/* PCI_CAP_ID_VNDR */
+	uint8_t cap_next;
+	uint8_t cap_len;
+	uint8_t cfg_type;		/* VIRTIO_PCI_CAP_* */
+	uint8_t bar;			/* BAR holding the structure */
+	uint8_t padding[3];
+	uint32_t offset;		/* Offset within the BAR */
+	uint32_t length;
+} __packed;
+
+#define VIRTIO_PCI_CAP_COMMON_CFG	1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG	2
+#define VIRTIO_PCI_CAP_ISR_CFG		3
+#define VIRTIO_PCI_CAP_DEVICE_CFG	4
+
+/* Notify capability trailer, after a struct virtio_pci_cap */
+#define VIRTIO_PCI_NOTIFY_MULTIPLIER	16
+
+struct virtio_pci_common_cfg {
+	uint32_t device_feature_select;
+	uint32_t device_feature;
+	uint32_t driver_feature_select;
+	uint32_t driver_feature;
+	uint16_t msix_config;
+	uint16_t num_queues;
+	uint8_t device_status;
+	uint8_t config_generation;
+
+	/* About the queue selected by @queue_select */
+	uint16_t queue_select;
+	uint16_t queue_size;
+	uint16_t queue_msix_vector;
+	uint16_t queue_enable;
+	uint16_t queue_notify_off;
+	uint64_t queue_desc;
+	uint64_t queue_driver;		/* Available ring */
+	uint64_t queue_device;		/* Used ring */
+} __packed;
+
+#define VIRTIO_MSI_NO_VECTOR		0xffff
+
+/*
+ * Split virtqueue layout
+ */
+struct vring_desc {
+	uint64_t addr;			/* Buffer physical address */
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;			/* If VRING_DESC_F_NEXT */
+} __packed;
+
+#define VRING_DESC_F_NEXT		1
+#define VRING_DESC_F_WRITE		2	/* Device writes, we read */
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;			/* Where we put the next entry */
+	uint16_t ring[];		/* Then, a uint16_t used_event */
+} __packed;
+
+struct vring_used_elem {
+	uint32_t id;			/* Head of the descriptor chain */
+	uint32_t len;			/* Bytes written by the device */
+} __packed;
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;			/* Where device puts next entry */
+	struct vring_used_elem ring[];	/* Then, a uint16_t avail_event */
+} __packed;
+
+/*
+ * With VIRTIO_RING_F_EVENT_IDX, each side tells the other at which
+ * ring index it wants to get notified. Did moving our index from
+ * @old to @new pass the other side's @event index?
+ */
+static inline bool vring_need_event(uint16_t event, uint16_t new, uint16_t old)
+{
+	return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+/*
+ * Block device configuration and requests
+ */
+#define VIRTIO_BLK_CFG_CAPACITY		0	/* 64-bit, in sectors */
+#define VIRTIO_BLK_CFG_NUM_QUEUES	34	/* 16-bit, if F_MQ */
+
+struct virtio_blk_req_hdr {
+	uint32_t type;			/* VIRTIO_BLK_T_* */
+	uint32_t reserved;
+	uint64_t sector;
+} __packed;
+
+#define VIRTIO_BLK_T_IN			0
+#define VIRTIO_BLK_T_OUT		1
+
+#define VIRTIO_BLK_S_OK			0
+#define VIRTIO_BLK_S_IOERR		1
+#define VIRTIO_BLK_S_UNSUPP		2
+
+void virtio_blk_init(void);
+
+/*
+ * Test cases
+ */
+
+#if	VIRTIO_BLK_TESTS
+
+void virtio_blk_run_tests(void);
+
+#else
+
+static void __unused virtio_blk_run_tests(void) { }
+
+#endif	/* VIRTIO_BLK_TESTS */
+
+#endif /* _VIRTIO_H */
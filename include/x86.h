@@ -111,5 +111,25 @@ static inline uint64_t get_gs(void)
 	return read_msr(MSR_GS_BASE);
 }
 
+/*
+ * CPU identification: return the @leaf registers output
+ */
+
+struct cpuid_regs {
+	uint32_t eax, ebx, ecx, edx;
+};
+
+static inline struct cpuid_regs cpuid(uint32_t leaf)
+{
+	struct cpuid_regs regs;
+
+	asm volatile (
+		"cpuid"
+		: "=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+		: "a"(leaf), "c"(0));
+
+	return regs;
+}
+
 #endif /* !__ASSEMBLY__ */
 #endif /* _X86_H */
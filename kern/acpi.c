@@ -0,0 +1,348 @@
+/*
+ * ACPI tables parsing: CPUs, IRQs, and HPET discovery
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Modern x86-64 boards describe their cores and interrupt wiring in
+ * ACPI, and many no longer bother with the MP tables: the latter also
+ * has 8-bit APIC IDs, and no way of describing x2APIC cores.
+ *
+ * Only the MADT is parsed: local APIC entries fill the CPU descriptors
+ * table, I/O APIC entries the I/O APICs one, and ISA IRQs are added
+ * to the MP IRQs table, identity-mapped to the Global System Interrupt
+ * (GSI) space unless overridden. This lets the I/O APIC code handle
+ * both sources of discovery the same way.
+ *
+ * PCI INTx# routing is described only by the AML _PRT methods, which
+ * we don't interpret. Devices thus use MSI-X, or polled I/O.
+ *
+ * The HPET table, if any, only gives us the HPET registers address.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <paging.h>
+#include <vm.h>
+#include <x86.h>
+#include <acpi.h>
+#include <mptables.h>
+#include <ioapic.h>
+#include <smpboot.h>
+#include <bitmap.h>
+
+#define ISA_IRQS	16
+
+/*
+ * ISA IRQs wiring, as gathered from the MADT overrides
+ */
+static struct {
+	uint32_t gsi;
+	uint16_t polarity, trigger;	/* MP-tables encoding */
+} isa_irqs[ISA_IRQS];
+
+/*
+ * HPET event timer block physical address, if any
+ */
+static uint64_t hpet_phys;
+
+static uint8_t acpi_checksum(void *table, uint32_t len)
+{
+	uint8_t sum = 0;
+	uint8_t *buf = table;
+
+	while (len--)
+		sum += *buf++;
+
+	return sum;
+}
+
+static struct acpi_rsdp *search_for_rsdp(char *base, uint32_t len)
+{
+	struct acpi_rsdp *rsdp;
+
+	for (; len >= sizeof(*rsdp); base += 16, len -= 16) {
+		rsdp = (struct acpi_rsdp *)base;
+		if (memcmp(rsdp->signature, RSDP_SIGNATURE, 8) != 0)
+			continue;
+		if (acpi_checksum(rsdp, RSDP_V1_LEN) != 0)
+			continue;
+		if (rsdp->revision >= 2 &&
+		    acpi_checksum(rsdp, rsdp->length) != 0)
+			continue;
+
+		printk("ACPI: Found an RSDP at 0x%lx, revision %d\n",
+		       PHYS(rsdp), rsdp->revision);
+		return rsdp;
+	}
+
+	return NULL;
+}
+
+/*
+ * Search for the RSDP in:
+ * - first KB of the extended bios data area (EBDA)
+ * - BIOS ROM address space 0xe0000-0xfffff
+ */
+static struct acpi_rsdp *get_rsdp(void)
+{
+	uintptr_t ebda;
+	struct acpi_rsdp *rsdp;
+
+	ebda = (*(uint16_t *)VIRTUAL(0x40e)) << 4;
+	if (ebda != 0) {
+		rsdp = search_for_rsdp(VIRTUAL(ebda), 0x400);
+		if (rsdp != NULL)
+			return rsdp;
+	}
+
+	return search_for_rsdp(VIRTUAL(0xe0000), 0x20000);
+}
+
+/*
+ * Map the whole system description table at @phys, which
+ * gets validated. Return NULL if it's not a sane table.
+ */
+static struct acpi_sdt *sdt_map(uintptr_t phys)
+{
+	struct acpi_sdt *sdt;
+
+	sdt = vm_kmap(phys, sizeof(*sdt));
+	if (sdt->length < sizeof(*sdt))
+		return NULL;
+
+	sdt = vm_kmap(phys, sdt->length);
+	if (acpi_checksum(sdt, sdt->length) != 0) {
+		printk("ACPI: buggy %c%c%c%c table checksum\n",
+		       sdt->signature[0], sdt->signature[1],
+		       sdt->signature[2], sdt->signature[3]);
+		return NULL;
+	}
+
+	return sdt;
+}
+
+/*
+ * Look for @signature table through the XSDT, or through the
+ * RSDT for ACPI 1.0 firmware. Return NULL if not found.
+ */
+static struct acpi_sdt *get_sdt(struct acpi_rsdp *rsdp, const char *signature)
+{
+	struct acpi_sdt *root, *sdt;
+	uint64_t phys;
+	int entry_len, nr_entries;
+	char *entries;
+
+	if (rsdp->revision >= 2 && rsdp->xsdt_physaddr != 0) {
+		root = sdt_map(rsdp->xsdt_physaddr);
+		entry_len = sizeof(uint64_t);
+	} else {
+		root = sdt_map(rsdp->rsdt_physaddr);
+		entry_len = sizeof(uint32_t);
+	}
+	if (root == NULL)
+		return NULL;
+
+	entries = (char *)(root + 1);
+	nr_entries = (root->length - sizeof(*root)) / entry_len;
+	for (int i = 0; i < nr_entries; i++) {
+		phys = 0;
+		memcpy(&phys, entries + i * entry_len, entry_len);
+
+		sdt = sdt_map(phys);
+		if (sdt != NULL && memcmp(sdt->signature, signature, 4) == 0)
+			return sdt;
+	}
+
+	return NULL;
+}
+
+/*
+ * The MADT has no bootstrap flag: it's the core we're on. Our
+ * local APIC is not yet mapped; ask CPUID for its initial ID.
+ */
+static uint32_t this_cpu_apic_id(void)
+{
+	return cpuid(1).ebx >> 24;
+}
+
+/*
+ * Firmware may list a core twice: in both a local APIC and an
+ * x2APIC entry. Only add the first one.
+ */
+static char cpus_seen[SMPBOOT_APIC_IDS / 8];
+
+static void parse_cpu(uint32_t apic_id, bool enabled)
+{
+	if (!enabled)
+		return;
+
+	/* FIXME: The trampoline parameters have slots for 8-bit
+	 * APIC IDs only; bigger IDs also need interrupt remapping */
+	if (apic_id >= SMPBOOT_APIC_IDS) {
+		printk("ACPI: Ignoring CPU with apic_id=%d\n", apic_id);
+		return;
+	}
+
+	if (bitmap_bit_is_set(cpus_seen, apic_id, sizeof(cpus_seen)))
+		return;
+	bitmap_set_bit(cpus_seen, apic_id, sizeof(cpus_seen));
+
+	mp_add_cpu(apic_id, apic_id == this_cpu_apic_id());
+}
+
+static void parse_ioapic(struct madt_ioapic *ioapic)
+{
+	mp_add_ioapic(ioapic->id, ioapic->base, ioapic->gsi_base);
+}
+
+static void parse_override(struct madt_int_override *override)
+{
+	if (override->bus != 0 || override->source >= ISA_IRQS) {
+		printk("ACPI: Ignoring IRQ override for bus %d irq %d\n",
+		       override->bus, override->source);
+		return;
+	}
+
+	isa_irqs[override->source].gsi = override->gsi;
+	isa_irqs[override->source].polarity = override->polarity;
+	isa_irqs[override->source].trigger = override->trigger;
+}
+
+/*
+ * Export the ISA IRQs wiring as MP IRQ entries. A GSI belongs
+ * to the I/O APIC with the biggest GSI base below it.
+ */
+static void add_isa_irqs(void)
+{
+	struct mpc_irq irq = { .entry = MP_IOINTERRUPT, .type = MP_INT };
+	struct ioapic_desc *ioapic, *dst;
+	uint32_t gsi;
+
+	mp_isa_busid = 0;
+	for (int i = 0; i < ISA_IRQS; i++) {
+		gsi = isa_irqs[i].gsi;
+		dst = NULL;
+		for (int apic = 0; apic < nr_ioapics; apic++) {
+			ioapic = &ioapic_descs[apic];
+			if (ioapic->gsi_base <= gsi &&
+			    (dst == NULL || ioapic->gsi_base > dst->gsi_base))
+				dst = ioapic;
+		}
+		if (dst == NULL || gsi - dst->gsi_base > 0xff)
+			continue;
+
+		irq.polarity = isa_irqs[i].polarity;
+		irq.trigger = isa_irqs[i].trigger;
+		irq.src_busid = mp_isa_busid;
+		irq.src_busirq = i;
+		irq.dst_ioapicid = dst->id;
+		irq.dst_ioapicpin = gsi - dst->gsi_base;
+		mp_add_irq(&irq);
+	}
+}
+
+static void parse_madt(struct acpi_madt *madt)
+{
+	struct madt_header *entry;
+	char *p, *end;
+
+	for (int i = 0; i < ISA_IRQS; i++)
+		isa_irqs[i].gsi = i;
+
+	p = (char *)(madt + 1);
+	end = (char *)madt + madt->header.length;
+	while (p + sizeof(*entry) <= end) {
+		entry = (struct madt_header *)p;
+		if (entry->length < sizeof(*entry) || p + entry->length > end)
+			break;
+
+		switch (entry->type) {
+		case MADT_LAPIC:
+			parse_cpu(((struct madt_lapic *)p)->apic_id,
+				  ((struct madt_lapic *)p)->enabled);
+			break;
+		case MADT_X2APIC:
+			parse_cpu(((struct madt_x2apic *)p)->x2apic_id,
+				  ((struct madt_x2apic *)p)->enabled);
+			break;
+		case MADT_IOAPIC:
+			parse_ioapic((struct madt_ioapic *)p);
+			break;
+		case MADT_INT_OVERRIDE:
+			parse_override((struct madt_int_override *)p);
+			break;
+		default:
+			break;
+		}
+
+		p += entry->length;
+	}
+
+	add_isa_irqs();
+}
+
+static void parse_hpet(struct acpi_hpet *hpet)
+{
+	if (hpet->address.space_id != ACPI_SPACE_MEMORY) {
+		printk("ACPI: Ignoring HPET in address space %d\n",
+		       hpet->address.space_id);
+		return;
+	}
+
+	hpet_phys = hpet->address.address;
+}
+
+/*
+ * Discover the CPUs and the IRQs layout through the ACPI
+ * MADT. Return -ENODEV if there's none; the caller then
+ * falls back to the MP tables.
+ */
+int acpi_init(void)
+{
+	struct acpi_rsdp *rsdp;
+	struct acpi_madt *madt;
+	struct acpi_hpet *hpet;
+
+	acpi_check();
+
+	rsdp = get_rsdp();
+	if (rsdp == NULL)
+		return -ENODEV;
+
+	hpet = (struct acpi_hpet *)get_sdt(rsdp, "HPET");
+	if (hpet != NULL)
+		parse_hpet(hpet);
+
+	madt = (struct acpi_madt *)get_sdt(rsdp, "APIC");
+	if (madt == NULL) {
+		printk("ACPI: No MADT found\n");
+		return -ENODEV;
+	}
+
+	parse_madt(madt);
+	if (!mp_bootstrap_found())
+		panic("ACPI: Bootstrap core apic_id=%d not in the MADT",
+		      this_cpu_apic_id());
+
+	printk("ACPI: MADT lists %d CPU(s), %d I/O APIC(s)\n",
+	       mptables_get_nr_cpus(), nr_ioapics);
+	return 0;
+}
+
+/*
+ * Return 0 and the HPET base address in @phys, or -ENODEV
+ */
+int acpi_get_hpet(uint64_t *phys)
+{
+	if (hpet_phys == 0)
+		return -ENODEV;
+
+	*phys = hpet_phys;
+	return 0;
+}
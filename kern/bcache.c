@@ -0,0 +1,783 @@
+/*
+ * Block devices page cache
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Device contents are cached in 4-KByte pages, indexed by the pair
+ * (device, byte offset / PAGE_SIZE). File systems read and write any
+ * byte range through the cache: partial-sector accesses become plain
+ * memory copies, and only whole sectors ever reach the driver.
+ *
+ * Writes are delayed: each page tracks its modified sectors in a
+ * dirty mask, and these sectors are written back when the page gets
+ * evicted, or upon an explicit bcache_sync(). Dirty pages are listed
+ * in the order they got dirtied, each tagged with a sequence number:
+ * the flusher threads write back those older than a few seconds, and
+ * adjacent dirty pages always go to the driver as one batch. Past a
+ * dirty pages limit, writers get throttled: they write back the
+ * oldest pages themselves.
+ *
+ * Reads may also be started ahead of use, asynchronously: the page
+ * then holds an extra reference, owned by the in-flight 'readahead'
+ * request. That reference is reaped, by the cache lock holder, once
+ * the driver is done with the request. Users needing such a page
+ * just wait for its request to complete.
+ *
+ * Replacement is CLOCK (second chance): all cached pages form a ring,
+ * and each access sets the page 'referenced' flag. The eviction hand
+ * clears that flag on its way, evicting the first unused page found
+ * without it. On memory pressure, the page allocator shrinker reclaims
+ * clean, unused, pages outright.
+ *
+ * Locking:
+ * - bcache_lock protects the hash table, the CLOCK ring, the unused
+ *   and dirty lists, and each page identity, refcount, and CLOCK flag
+ * - A page lock protects its data, up-to-date flag, and dirty mask; it
+ *   is held during the page disk I/O. A page's bcache_lock-protected
+ *   state is stable only while the page is referenced.
+ * - Order: page->lock, then bcache_lock. Several page locks are
+ *   only held by write-back, in ascending device index order.
+ *
+ * A page with a zero refcount is neither locked nor modified by any
+ * thread: bcache_lock alone is enough to reclaim it.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <list.h>
+#include <spinlock.h>
+#include <kmalloc.h>
+#include <mm.h>
+#include <blkdev.h>
+#include <bcache.h>
+
+#define BCACHE_PAGES_MAX	2048		/* 8 MBytes; arbitrary */
+#define BCACHE_HASH_SIZE	1024		/* Power of 2 */
+#define PAGE_SECTORS		(PAGE_SIZE >> SECTOR_SHIFT)
+
+#define WB_CLUSTER_MAX		16		/* Pages per write-back batch */
+#define DIRTY_LIMIT		(BCACHE_PAGES_MAX / 4)	/* Throttle writers */
+#define DIRTY_BACKGROUND	(BCACHE_PAGES_MAX / 8)	/* Wake flushers */
+
+struct bcache_page {
+	struct block_device *bdev;	/* NULL if unused */
+	uint64_t index;			/* Device offset / PAGE_SIZE */
+	char *data;			/* Page contents, or NULL */
+	int refcount;			/* Current users */
+	bool referenced;		/* Accessed since last CLOCK pass? */
+	bool uptodate;			/* Data read from disk? */
+	uint8_t dirty;			/* Mask of sectors to write back */
+	uint64_t dirty_seq;		/* dirty_seq when first dirtied */
+	bool ra_pending;		/* Readahead @bio holds a reference? */
+	struct bio bio;			/* Readahead request */
+	spinlock_t lock;
+	struct list_node hash_node;	/* Hash bucket, if bdev != NULL */
+	struct list_node lru_node;	/* CLOCK ring, or unused list */
+	struct list_node dirty_node;	/* Dirty list, if dirty != 0 */
+};
+
+static struct list_node bcache_hash[BCACHE_HASH_SIZE];
+static struct list_node clock_ring;
+static struct list_node unused_list;
+static struct list_node dirty_list;
+static int nr_pages;			/* Allocated page descriptors */
+static int nr_dirty;
+static uint64_t dirty_seq;		/* Dirtying events counter */
+static spinlock_t bcache_lock = SPIN_UNLOCKED();
+
+/*
+ * Held from marking pages as under readahead till their requests
+ * are submitted. Being a spinlock, it also keeps us from getting
+ * preempted meanwhile: a waiter for such page on this CPU would
+ * otherwise spin forever, with IRQs disabled, on an unsubmitted
+ * request. Order: ra_lock, then page->lock, then bcache_lock.
+ */
+static spinlock_t ra_lock = SPIN_UNLOCKED();
+
+#define RA_BATCH_MAX		32		/* Requests per submission */
+
+static inline struct list_node *hash_bucket(struct block_device *bdev,
+					    uint64_t index)
+{
+	uint64_t key;
+
+	key = index ^ ((uintptr_t)bdev >> 4);
+	return &bcache_hash[(key * 0x9e37fffffffc0001UL) >> 54];
+}
+
+/*
+ * Nr of device sectors covered by given page: the device's
+ * last page may be a partial one.
+ */
+static uint64_t bpage_sectors(struct bcache_page *page)
+{
+	uint64_t first = page->index * PAGE_SECTORS;
+
+	return min(page->bdev->nr_sectors - first, (uint64_t)PAGE_SECTORS);
+}
+
+static struct bcache_page *bpage_new(void)
+{
+	struct bcache_page *page;
+
+	page = kmalloc(sizeof(*page));
+	memset(page, 0, sizeof(*page));
+	spin_init(&page->lock);
+	list_init(&page->hash_node);
+	list_init(&page->lru_node);
+	list_init(&page->dirty_node);
+	return page;
+}
+
+/*
+ * If the driver is done with the page's readahead request, drop the
+ * reference it held. Drivers set @done last: once it's seen, the
+ * request is entirely ours. Call with bcache_lock held.
+ */
+static void bpage_reap_ra(struct bcache_page *page)
+{
+	if (!page->ra_pending || !page->bio.done)
+		return;
+
+	barrier();
+	if (page->bio.status == 0)
+		page->uptodate = true;
+	page->ra_pending = false;
+	assert(page->refcount > 0);
+	page->refcount--;
+}
+
+/*
+ * CLOCK: sweep the ring for an unused page that was not referenced
+ * since the last pass, giving referenced ones a second chance.
+ * The hand is the ring head; passed pages rotate to its tail.
+ * Call with bcache_lock held.
+ */
+static struct bcache_page *bpage_victim(void)
+{
+	struct bcache_page *page;
+
+	for (int i = 0; i < 2 * nr_pages && !list_empty(&clock_ring); i++) {
+		page = list_entry(clock_ring.next, struct bcache_page,
+				  lru_node);
+		list_del(&page->lru_node);
+		list_add_tail(&clock_ring, &page->lru_node);
+
+		bpage_reap_ra(page);
+		if (page->refcount > 0)
+			continue;
+		if (page->referenced) {
+			page->referenced = false;
+			continue;
+		}
+		return page;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remove given unused page from the cache. Its data, if still
+ * kept, is reused for the next cached device page.
+ * Call with bcache_lock held.
+ */
+static void bpage_unhash(struct bcache_page *page)
+{
+	assert(page->refcount == 0);
+	assert(page->bdev != NULL);
+	assert(!page->ra_pending);
+
+	list_del(&page->hash_node);
+	list_del(&page->lru_node);
+	if (page->dirty != 0) {
+		list_del(&page->dirty_node);
+		nr_dirty--;
+	}
+	page->bdev = NULL;
+	page->uptodate = false;
+	page->dirty = 0;
+}
+
+static void bpage_put(struct bcache_page *page)
+{
+	spin_lock(&bcache_lock);
+	assert(page->refcount > 0);
+	page->refcount--;
+	spin_unlock(&bcache_lock);
+}
+
+/*
+ * Find page #index of @bdev in the cache, or return NULL.
+ * Call with bcache_lock held.
+ */
+static struct bcache_page *bpage_lookup(struct block_device *bdev,
+					uint64_t index)
+{
+	struct bcache_page *page;
+
+	list_for_each(hash_bucket(bdev, index), page, hash_node)
+		if (page->bdev == bdev && page->index == index)
+			return page;
+
+	return NULL;
+}
+
+/*
+ * Write back the dirty sectors of given page, along with the dirty
+ * pages directly following it on disk, as one batch of requests:
+ * the driver then gets a whole cluster per doorbell. Each page is
+ * written as one run, from its first to its last dirty sector; the
+ * clean sectors in-between are up to date anyway.
+ *
+ * Call with @first referenced, but not locked. Pages get locked in
+ * ascending index order, as no other path holds two page locks.
+ * Return the nr of pages written, or a negative errno.
+ */
+static int bpage_writeback_cluster(struct bcache_page *first)
+{
+	struct bcache_page *pages[WB_CLUSTER_MAX], *page;
+	struct bio *bios, *batch[WB_CLUSTER_MAX];
+	uint start, end;
+	int nr, nr_bios = 0, written = 0, ret = 0;
+
+	bios = kmalloc(WB_CLUSTER_MAX * sizeof(*bios));
+
+	/* Dirty masks are only peeked at here; recheck under page locks */
+	pages[0] = first;
+	spin_lock(&bcache_lock);
+	for (nr = 1; nr < WB_CLUSTER_MAX; nr++) {
+		page = bpage_lookup(first->bdev, first->index + nr);
+		if (page == NULL || page->dirty == 0)
+			break;
+		page->refcount++;
+		pages[nr] = page;
+	}
+	spin_unlock(&bcache_lock);
+
+	for (int i = 0; i < nr; i++) {
+		page = pages[i];
+		spin_lock(&page->lock);
+		if (page->dirty == 0)
+			continue;
+
+		start = (uint)__builtin_ctz(page->dirty);
+		end = 32 - (uint)__builtin_clz(page->dirty);
+		bio_init(&bios[nr_bios], page->bdev, BIO_WRITE,
+			 page->index * PAGE_SECTORS + start,
+			 page->data + (start << SECTOR_SHIFT), end - start);
+		bios[nr_bios].private = page;
+		batch[nr_bios] = &bios[nr_bios];
+		nr_bios++;
+	}
+
+	if (nr_bios > 0)
+		submit_bio_batch(batch, nr_bios);
+
+	for (int i = 0; i < nr_bios; i++) {
+		if (bio_wait(&bios[i]) < 0) {
+			if (ret == 0)
+				ret = bios[i].status;
+			continue;
+		}
+
+		page = bios[i].private;
+		page->dirty = 0;
+		spin_lock(&bcache_lock);
+		list_del(&page->dirty_node);
+		nr_dirty--;
+		spin_unlock(&bcache_lock);
+		written++;
+	}
+
+	for (int i = nr - 1; i >= 0; i--)
+		spin_unlock(&pages[i]->lock);
+	for (int i = 1; i < nr; i++)
+		bpage_put(pages[i]);
+
+	kfree(bios);
+	return ret < 0 ? ret : written;
+}
+
+/*
+ * Return a referenced cache page for page #index of @bdev. If
+ * the page was not cached, it's returned without valid data.
+ */
+static struct bcache_page *bpage_get(struct block_device *bdev,
+				     uint64_t index)
+{
+	struct bcache_page *page, *new = NULL;
+	int ret;
+
+again:
+	spin_lock(&bcache_lock);
+	if (new != NULL) {
+		list_add_tail(&unused_list, &new->lru_node);
+		nr_pages++;
+		new = NULL;
+	}
+
+	page = bpage_lookup(bdev, index);
+	if (page != NULL)
+		goto found;
+
+	/* Miss: grow the cache first, then recycle cached pages */
+	if (list_empty(&unused_list) && nr_pages < BCACHE_PAGES_MAX) {
+		spin_unlock(&bcache_lock);
+		new = bpage_new();
+		goto again;
+	}
+
+	if (!list_empty(&unused_list)) {
+		page = list_entry(unused_list.next, struct bcache_page,
+				  lru_node);
+		list_del(&page->lru_node);
+	} else {
+		page = bpage_victim();
+		if (page == NULL)
+			panic("Bcache: All %d cache pages are in use", nr_pages);
+
+		if (page->dirty != 0) {
+			page->refcount++;
+			spin_unlock(&bcache_lock);
+
+			ret = bpage_writeback_cluster(page);
+			if (ret < 0)
+				panic("Bcache: %s: Writing back page %lu "
+				      "returned -%s", page->bdev->name,
+				      page->index, errno(ret));
+
+			bpage_put(page);
+			goto again;
+		}
+		bpage_unhash(page);
+	}
+
+	page->bdev = bdev;
+	page->index = index;
+	list_add(hash_bucket(bdev, index), &page->hash_node);
+	list_add_tail(&clock_ring, &page->lru_node);
+
+found:
+	page->refcount++;
+	page->referenced = true;
+	spin_unlock(&bcache_lock);
+	return page;
+}
+
+/*
+ * Make the page ready for access. If @overwrite, the caller is
+ * going to overwrite all of its sectors: don't read them from disk.
+ * Call with page->lock held.
+ */
+static int bpage_fill(struct bcache_page *page, bool overwrite)
+{
+	int ret;
+
+	if (page->uptodate)
+		return 0;
+
+	/* Readahead in flight: wait for it, even if overwriting */
+	if (page->ra_pending && bio_wait(&page->bio) == 0) {
+		page->uptodate = true;
+		return 0;
+	}
+
+	if (page->data == NULL)
+		page->data = page_address(get_free_page(ZONE_ANY));
+
+	if (!overwrite) {
+		ret = blkdev_rw(page->bdev, BIO_READ, page->index * PAGE_SECTORS,
+				page->data, bpage_sectors(page));
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Data first: cache hits test this flag without the page lock */
+	barrier();
+	page->uptodate = true;
+	return 0;
+}
+
+/*
+ * Fast path: if the page is cached and up to date, copy from it
+ * under bcache_lock only; no page reference or lock is needed
+ * for such a short access. Return false otherwise.
+ */
+static bool bpage_read_hit(struct block_device *bdev, uint64_t index,
+			   char *buf, uint pg_offset, uint pg_len)
+{
+	struct bcache_page *page;
+	bool hit = false;
+
+	spin_lock(&bcache_lock);
+	page = bpage_lookup(bdev, index);
+	if (page != NULL && page->uptodate) {
+		memcpy(buf, page->data + pg_offset, pg_len);
+		page->referenced = true;
+		hit = true;
+	}
+	spin_unlock(&bcache_lock);
+
+	return hit;
+}
+
+/*
+ * Return, referenced, the oldest dirty page of @bdev, or of any
+ * device if @bdev is NULL, if dirtied at or before sequence @seq.
+ * The dirty list is in dirtying order. Call with bcache_lock held.
+ */
+static struct bcache_page *bpage_oldest_dirty(struct block_device *bdev,
+					      uint64_t seq)
+{
+	struct bcache_page *page;
+
+	list_for_each(&dirty_list, page, dirty_node) {
+		if (page->dirty_seq > seq)
+			break;
+		if (bdev == NULL || page->bdev == bdev) {
+			page->refcount++;
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Write back, oldest first and in disk clusters, the pages of @bdev
+ * (or of all devices if NULL) dirtied at or before sequence @seq.
+ * Stop once @max_pages got written. Return the nr of pages written,
+ * or the first error met.
+ *
+ * Pages dirtied meanwhile get later sequences: we always terminate.
+ */
+int bcache_writeback(struct block_device *bdev, uint64_t seq, int max_pages)
+{
+	struct bcache_page *page;
+	int ret, written = 0;
+
+	while (written < max_pages) {
+		spin_lock(&bcache_lock);
+		page = bpage_oldest_dirty(bdev, seq);
+		spin_unlock(&bcache_lock);
+		if (page == NULL)
+			break;
+
+		ret = bpage_writeback_cluster(page);
+		bpage_put(page);
+		if (ret < 0)
+			return ret;
+		written += ret;
+	}
+
+	return written;
+}
+
+/*
+ * Sequence of the most recently dirtied page. Pages dirtied later
+ * get a higher one: this is the write-back 'age' of dirty pages.
+ */
+uint64_t bcache_dirty_seq(void)
+{
+	uint64_t seq;
+
+	spin_lock(&bcache_lock);
+	seq = dirty_seq;
+	spin_unlock(&bcache_lock);
+	return seq;
+}
+
+/*
+ * Are there enough dirty pages to start writing back some,
+ * regardless of their age?
+ */
+bool bcache_dirty_exceeded(void)
+{
+	bool exceeded;
+
+	spin_lock(&bcache_lock);
+	exceeded = nr_dirty > DIRTY_BACKGROUND;
+	spin_unlock(&bcache_lock);
+	return exceeded;
+}
+
+/*
+ * Throttle writers: past the dirty limit, whoever dirties more
+ * pages writes back the oldest ones, till under the limit. Errors
+ * are not the writer's; the pages stay dirty for a sync to report.
+ */
+static void bcache_balance_dirty(void)
+{
+	int dirty;
+
+	for (;;) {
+		spin_lock(&bcache_lock);
+		dirty = nr_dirty;
+		spin_unlock(&bcache_lock);
+		if (dirty <= DIRTY_LIMIT)
+			break;
+		if (bcache_writeback(NULL, UINT64_MAX, WB_CLUSTER_MAX) <= 0)
+			break;
+	}
+}
+
+/*
+ * Mark the sectors covering [@offset, @offset+@len) of given page
+ * as dirty. Call with page->lock held.
+ */
+static void bpage_dirty(struct bcache_page *page, uint offset, uint len)
+{
+	uint first, last;
+	uint8_t mask;
+
+	assert(len > 0);
+	first = offset >> SECTOR_SHIFT;
+	last = (offset + len - 1) >> SECTOR_SHIFT;
+	mask = (uint8_t)(((2U << last) - 1) & ~((1U << first) - 1));
+
+	if (page->dirty == 0) {
+		spin_lock(&bcache_lock);
+		page->dirty_seq = ++dirty_seq;
+		list_add_tail(&dirty_list, &page->dirty_node);
+		nr_dirty++;
+		spin_unlock(&bcache_lock);
+	}
+	page->dirty |= mask;
+}
+
+static int bcache_rw(struct block_device *bdev, uint64_t offset, char *buf,
+		     uint64_t len, enum bio_op op)
+{
+	struct bcache_page *page;
+	uint64_t disk_len;
+	uint pg_offset, pg_len;
+	bool overwrite;
+	int ret;
+
+	assert(bdev != NULL);
+	disk_len = bdev->nr_sectors << SECTOR_SHIFT;
+	if (offset > disk_len || len > disk_len - offset)
+		return -EIO;
+
+	while (len > 0) {
+		pg_offset = offset % PAGE_SIZE;
+		pg_len = min(len, (uint64_t)(PAGE_SIZE - pg_offset));
+
+		if (op == BIO_READ && bpage_read_hit(bdev, offset / PAGE_SIZE,
+						     buf, pg_offset, pg_len))
+			goto next;
+
+		page = bpage_get(bdev, offset / PAGE_SIZE);
+		spin_lock(&page->lock);
+		overwrite = (op == BIO_WRITE && pg_offset == 0 &&
+			     pg_len >= bpage_sectors(page) << SECTOR_SHIFT);
+		ret = bpage_fill(page, overwrite);
+		if (ret == 0) {
+			switch (op) {
+			case BIO_READ:
+				memcpy(buf, page->data + pg_offset, pg_len);
+				break;
+			case BIO_WRITE:
+				memcpy(page->data + pg_offset, buf, pg_len);
+				bpage_dirty(page, pg_offset, pg_len);
+				break;
+			}
+		}
+		spin_unlock(&page->lock);
+		bpage_put(page);
+		if (ret < 0)
+			return ret;
+	next:
+		offset += pg_len;
+		buf += pg_len;
+		len -= pg_len;
+	}
+
+	if (op == BIO_WRITE)
+		bcache_balance_dirty();
+	return 0;
+}
+
+/*
+ * Read @len bytes from @bdev, starting from byte @offset, into
+ * @buf. Return zero, or a negative errno.
+ */
+int bcache_read(struct block_device *bdev, uint64_t offset, void *buf,
+		uint64_t len)
+{
+	return bcache_rw(bdev, offset, buf, len, BIO_READ);
+}
+
+/*
+ * Write @len bytes from @buf to @bdev, starting from byte @offset.
+ * Data reaches the disk later, on eviction or bcache_sync().
+ */
+int bcache_write(struct block_device *bdev, uint64_t offset, void *buf,
+		 uint64_t len)
+{
+	return bcache_rw(bdev, offset, buf, len, BIO_WRITE);
+}
+
+/*
+ * Start reading the uncached pages covering @len bytes at device
+ * byte @offset, without waiting for them. Requests are submitted
+ * in batches, paying one device notification per batch.
+ */
+void bcache_readahead(struct block_device *bdev, uint64_t offset,
+		      uint64_t len)
+{
+	struct bcache_page *page;
+	struct bio *batch[RA_BATCH_MAX];
+	uint64_t disk_len, index, last;
+	int nr = 0;
+
+	disk_len = bdev->nr_sectors << SECTOR_SHIFT;
+	if (len == 0 || offset >= disk_len)
+		return;
+	len = min(len, disk_len - offset);
+
+	last = (offset + len - 1) / PAGE_SIZE;
+	spin_lock(&ra_lock);
+	for (index = offset / PAGE_SIZE; index <= last; index++) {
+		page = bpage_get(bdev, index);
+		spin_lock(&page->lock);
+		if (page->uptodate || page->ra_pending) {
+			spin_unlock(&page->lock);
+			bpage_put(page);
+			continue;
+		}
+
+		if (page->data == NULL)
+			page->data = page_address(get_free_page(ZONE_ANY));
+		bio_init(&page->bio, bdev, BIO_READ, index * PAGE_SECTORS,
+			 page->data, bpage_sectors(page));
+		barrier();
+		page->ra_pending = true;	/* Our reference is now its */
+		spin_unlock(&page->lock);
+
+		batch[nr++] = &page->bio;
+		if (nr == RA_BATCH_MAX) {
+			submit_bio_batch(batch, nr);
+			nr = 0;
+		}
+	}
+	if (nr > 0)
+		submit_bio_batch(batch, nr);
+	spin_unlock(&ra_lock);
+}
+
+/*
+ * Like bcache_read(), within a single page, but never wait for the
+ * disk: if the data is not cached, start reading it ahead and
+ * return -EAGAIN.
+ */
+int bcache_read_nowait(struct block_device *bdev, uint64_t offset, void *buf,
+		       uint64_t len)
+{
+	uint pg_offset = offset % PAGE_SIZE;
+
+	assert(len > 0 && pg_offset + len <= PAGE_SIZE);
+	if (bpage_read_hit(bdev, offset / PAGE_SIZE, buf, pg_offset, len))
+		return 0;
+
+	bcache_readahead(bdev, offset, len);
+	return -EAGAIN;
+}
+
+/*
+ * Write back all pages of @bdev dirtied before this call, or of
+ * all devices if @bdev is NULL. Return the first error met.
+ */
+int bcache_sync(struct block_device *bdev)
+{
+	int ret;
+
+	ret = bcache_writeback(bdev, bcache_dirty_seq(), INT32_MAX);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Drop all cached pages of @bdev, dirty or not; e.g., after the
+ * device contents got replaced underneath us. No page of that
+ * device may be in use, or under readahead.
+ */
+void bcache_invalidate(struct block_device *bdev)
+{
+	struct bcache_page *page, *spare;
+
+	spin_lock(&bcache_lock);
+	list_for_each_safe(&clock_ring, page, spare, lru_node) {
+		if (page->bdev != bdev)
+			continue;
+		bpage_reap_ra(page);
+		bpage_unhash(page);
+		list_add_tail(&unused_list, &page->lru_node);
+	}
+	spin_unlock(&bcache_lock);
+}
+
+/*
+ * Shrinker: give back the data pages of dropped cache pages, then of
+ * clean unused ones, oldest first. Descriptors are kept for reuse.
+ */
+static uint64_t bcache_shrink(uint64_t nr_pages)
+{
+	struct bcache_page *page, *spare;
+	uint64_t freed = 0;
+
+	if (!spin_trylock(&bcache_lock))
+		return 0;
+
+	list_for_each(&unused_list, page, lru_node) {
+		if (freed == nr_pages)
+			break;
+		if (page->data != NULL) {
+			free_page(addr_to_page(page->data));
+			page->data = NULL;
+			freed++;
+		}
+	}
+
+	list_for_each_safe(&clock_ring, page, spare, lru_node) {
+		if (freed == nr_pages)
+			break;
+		bpage_reap_ra(page);
+		if (page->refcount > 0 || page->dirty != 0)
+			continue;
+
+		bpage_unhash(page);
+		list_add_tail(&unused_list, &page->lru_node);
+		if (page->data != NULL) {
+			free_page(addr_to_page(page->data));
+			page->data = NULL;
+			freed++;
+		}
+	}
+
+	spin_unlock(&bcache_lock);
+	return freed;
+}
+
+static struct shrinker bcache_shrinker = {
+	.scan = bcache_shrink,
+};
+
+void bcache_init(void)
+{
+	compiler_assert(PAGE_SECTORS <= 8 * sizeof(uint8_t));
+	compiler_assert(BCACHE_HASH_SIZE == 1 << (64 - 54));
+
+	for (int i = 0; i < BCACHE_HASH_SIZE; i++)
+		list_init(&bcache_hash[i]);
+	list_init(&clock_ring);
+	list_init(&unused_list);
+	list_init(&dirty_list);
+
+	register_shrinker(&bcache_shrinker);
+}
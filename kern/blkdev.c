@@ -0,0 +1,328 @@
+/*
+ * Block devices and block I/O requests
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * File systems describe their I/O as 'bio' requests over 512-byte
+ * device sectors, and hand them to the device driver via submit_bio(),
+ * or submit_bio_batch() for several requests at once.
+ * Drivers complete requests asynchronously through bio_endio(). A
+ * synchronous caller just spins on the request using bio_wait().
+ *
+ * Between the two, each device has a request queue, ordered by its
+ * I/O scheduler (iosched.c), where adjacent bios get merged. Up to
+ * @queue_depth requests are at the driver at any time; the rest wait
+ * in the queue, to be dispatched as requests complete. Code submitting
+ * a series of bios may plug the CPU meanwhile: these bios are queued
+ * together at unplug, merging with each other, and the driver gets
+ * notified once.
+ *
+ * A queue is run, i.e. requests moved to the driver, by one thread at
+ * a time. Others finding it running just ask for another pass: this
+ * keeps drivers completing requests synchronously, from within their
+ * submit method, from recursing back into the queue.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <idt.h>
+#include <blkdev.h>
+#include <iosched.h>
+
+#define BLKDEV_MAX	8		/* Arbitrary */
+#define BLKDEV_NAME_MAX	16
+
+static struct block_device *blkdevs[BLKDEV_MAX];
+static int nr_blkdevs;
+static spinlock_t blkdevs_lock = SPIN_UNLOCKED();
+
+void blkdev_register(struct block_device *bdev)
+{
+	assert(bdev->name != NULL);
+	assert(bdev->ops != NULL && bdev->ops->submit != NULL);
+
+	if (bdev->iosched == NULL)
+		bdev->iosched = &deadline_iosched;
+	bdev->iosched_data = bdev->iosched->init(bdev);
+	spin_init(&bdev->queue_lock);
+	bdev->nr_dispatched = 0;
+
+	spin_lock(&blkdevs_lock);
+	if (nr_blkdevs == BLKDEV_MAX)
+		panic("Block: Can't register more than %d devices", BLKDEV_MAX);
+	blkdevs[nr_blkdevs++] = bdev;
+	spin_unlock(&blkdevs_lock);
+
+	printk("Block: Device %s, capacity = %lu KB, %s scheduler\n",
+	       bdev->name, (bdev->nr_sectors * SECTOR_SIZE) / 1024,
+	       bdev->iosched->name);
+}
+
+struct block_device *blkdev_find(const char *name)
+{
+	struct block_device *bdev = NULL;
+
+	spin_lock(&blkdevs_lock);
+	for (int i = 0; i < nr_blkdevs; i++) {
+		if (!strncmp(blkdevs[i]->name, name, BLKDEV_NAME_MAX)) {
+			bdev = blkdevs[i];
+			break;
+		}
+	}
+	spin_unlock(&blkdevs_lock);
+
+	return bdev;
+}
+
+/*
+ * Return the @i-th registered device, or NULL if there's none;
+ * e.g., to iterate over all devices. Devices never go away.
+ */
+struct block_device *blkdev_get(int i)
+{
+	struct block_device *bdev = NULL;
+
+	spin_lock(&blkdevs_lock);
+	if (i >= 0 && i < nr_blkdevs)
+		bdev = blkdevs[i];
+	spin_unlock(&blkdevs_lock);
+
+	return bdev;
+}
+
+/*
+ * Complete all bios of given request
+ */
+static void rq_complete(struct bio *rq, int status)
+{
+	struct bio *bio, *next;
+
+	for (bio = rq; bio != NULL; bio = next) {
+		next = bio->next;
+		bio->status = status;
+		if (bio->end_io != NULL)
+			bio->end_io(bio);
+		barrier();
+		bio->done = true;
+	}
+}
+
+/*
+ * Move queued requests to the driver, up to the queue depth
+ */
+static void blk_run_queue(struct block_device *bdev)
+{
+	struct bio *rq;
+	bool submitted = false;
+
+	spin_lock(&bdev->queue_lock);
+	if (bdev->queue_running) {
+		bdev->queue_rerun = true;
+		spin_unlock(&bdev->queue_lock);
+		return;
+	}
+	bdev->queue_running = true;
+
+	do {
+		bdev->queue_rerun = false;
+		while (bdev->queue_depth == 0 ||
+		       bdev->nr_dispatched < bdev->queue_depth) {
+			rq = bdev->iosched->dispatch(bdev);
+			if (rq == NULL)
+				break;
+			bdev->nr_dispatched++;
+
+			spin_unlock(&bdev->queue_lock);
+			bdev->ops->submit(bdev, rq);
+			submitted = true;
+			spin_lock(&bdev->queue_lock);
+		}
+	} while (bdev->queue_rerun);
+
+	bdev->queue_running = false;
+	spin_unlock(&bdev->queue_lock);
+
+	if (submitted && bdev->ops->commit != NULL)
+		bdev->ops->commit(bdev);
+}
+
+/*
+ * Queue given request to the device I/O scheduler. Requests beyond
+ * the device boundaries are completed right away, with -EIO. Return
+ * false in that case.
+ */
+static bool blk_queue_bio(struct bio *bio)
+{
+	struct block_device *bdev = bio->bdev;
+
+	assert(bdev != NULL);
+	assert(bio->buf != NULL);
+	bio->done = false;
+	bio->status = 0;
+
+	bio->next = NULL;
+	bio->rq_tail = bio;
+	bio->rq_sectors = bio->nr_sectors;
+	bio->rq_segments = 1;
+	bio->rq_deadline = 0;
+
+	if (bio->nr_sectors == 0 || bio->sector >= bdev->nr_sectors ||
+	    bio->nr_sectors > bdev->nr_sectors - bio->sector) {
+		printk("Block: %s: Access beyond device end, sectors "
+		       "[%lu, +%lu)\n", bdev->name, bio->sector,
+		       bio->nr_sectors);
+		rq_complete(bio, -EIO);
+		return false;
+	}
+
+	spin_lock(&bdev->queue_lock);
+	bdev->iosched->add(bdev, bio);
+	spin_unlock(&bdev->queue_lock);
+	return true;
+}
+
+/*
+ * Queue the bios held by given plug, then run their device queues
+ */
+static void blk_flush_plug(struct blk_plug *plug)
+{
+	struct block_device *bdevs[BLKDEV_MAX];
+	struct bio *bio, *spare;
+	int nr = 0, i;
+
+	list_for_each_safe(&plug->bios, bio, spare, node) {
+		list_del(&bio->node);
+		if (!blk_queue_bio(bio))
+			continue;
+
+		for (i = 0; i < nr && bdevs[i] != bio->bdev; i++)
+			;
+		if (i == nr)
+			bdevs[nr++] = bio->bdev;
+	}
+
+	for (i = 0; i < nr; i++)
+		blk_run_queue(bdevs[i]);
+}
+
+/*
+ * Plug this CPU: hold back submitted bios till blk_finish_plug().
+ * Nested plugs are merged into the outermost one.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	list_init(&plug->bios);
+	plug->nested = (percpu_get(plug) != 0);
+	if (plug->nested)
+		return;
+
+	plug->flags = local_irq_disable_save();
+	percpu_set(plug, (uintptr_t)plug);
+}
+
+void blk_finish_plug(struct blk_plug *plug)
+{
+	if (plug->nested)
+		return;
+
+	assert(percpu_get(plug) == (uintptr_t)plug);
+	percpu_set(plug, 0);
+	blk_flush_plug(plug);
+	local_irq_restore(plug->flags);
+}
+
+void submit_bio(struct bio *bio)
+{
+	struct blk_plug *plug;
+
+	plug = (struct blk_plug *)percpu_get(plug);
+	if (plug != NULL) {
+		list_add_tail(&plug->bios, &bio->node);
+		return;
+	}
+
+	if (blk_queue_bio(bio))
+		blk_run_queue(bio->bdev);
+}
+
+/*
+ * Queue a batch of requests, letting the I/O scheduler merge them,
+ * and the driver notify the hardware only once for the whole batch.
+ */
+void submit_bio_batch(struct bio **bios, int nr)
+{
+	struct blk_plug plug;
+
+	assert(nr > 0);
+	blk_start_plug(&plug);
+	for (int i = 0; i < nr; i++)
+		submit_bio(bios[i]);
+	blk_finish_plug(&plug);
+}
+
+/*
+ * Drivers call this once given request, possibly a chain of merged
+ * bios, has been fully serviced. Each bio is marked done last: its
+ * waiter may free it right after seeing it.
+ */
+void bio_endio(struct bio *rq, int status)
+{
+	struct block_device *bdev = rq->bdev;
+
+	rq_complete(rq, status);
+
+	spin_lock(&bdev->queue_lock);
+	assert(bdev->nr_dispatched > 0);
+	bdev->nr_dispatched--;
+	spin_unlock(&bdev->queue_lock);
+
+	if (bdev->queue_depth != 0)
+		blk_run_queue(bdev);
+}
+
+/*
+ * Spin till given request completes; return its status. If this
+ * CPU is plugged, the request might be held by the plug itself.
+ */
+int bio_wait(struct bio *bio)
+{
+	struct block_device *bdev = bio->bdev;
+	struct blk_plug *plug;
+
+	plug = (struct blk_plug *)percpu_get(plug);
+	if (plug != NULL)
+		blk_flush_plug(plug);
+
+	while (true) {
+		barrier();
+		if (bio->done)
+			break;
+		if (bdev->ops->poll != NULL)
+			bdev->ops->poll(bdev);
+		cpu_pause();
+	}
+
+	return bio->status;
+}
+
+/*
+ * Synchronously read or write @nr_sectors from/to device @bdev,
+ * starting from @sector.
+ */
+int blkdev_rw(struct block_device *bdev, enum bio_op op, uint64_t sector,
+	      char *buf, uint64_t nr_sectors)
+{
+	struct bio bio;
+
+	bio_init(&bio, bdev, op, sector, buf, nr_sectors);
+	submit_bio(&bio);
+	return bio_wait(&bio);
+}
@@ -0,0 +1,86 @@
+/*
+ * Page cache flusher threads
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * One kernel thread per block device writes back, every interval,
+ * the device's pages that stayed dirty for DIRTY_EXPIRE intervals.
+ * Writers thus only pay for memory copies, and the disk sees data
+ * a few seconds later, in large clusters. If too many pages get
+ * dirtied meanwhile, the threads start writing back right away.
+ *
+ * Page ages are the cache dirtying sequence numbers: we sample the
+ * current sequence each interval, and expire pages dirtied at or
+ * before the sample taken DIRTY_EXPIRE intervals ago.
+ *
+ * There's no sleeping yet: idle threads poll the ticks counter, and
+ * yield the CPU between polls.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <errno.h>
+#include <atomic.h>
+#include <percpu.h>
+#include <sched.h>
+#include <blkdev.h>
+#include <bcache.h>
+#include <flusher.h>
+
+#define FLUSH_INTERVAL		HZ		/* Ticks between passes */
+#define DIRTY_EXPIRE		5		/* Intervals; ~5 seconds */
+#define FLUSH_BATCH		64		/* Pages per background pass */
+
+static uint64_t nr_flushers;
+
+static void __no_return flusher(void)
+{
+	struct block_device *bdev;
+	uint64_t marks[DIRTY_EXPIRE] = { 0 };
+	clock_t now, next;
+	uint i = 0;
+	int ret;
+
+	/* Threads are created in device order: claim ours */
+	bdev = blkdev_get((int)atomic_inc(&nr_flushers));
+	assert(bdev != NULL);
+
+	next = PS->sys_ticks + FLUSH_INTERVAL;
+	for (;;) {
+		now = PS->sys_ticks;
+		while (PS->sys_ticks == now)
+			sched_yield();
+
+		ret = 0;
+		if (PS->sys_ticks >= next) {
+			ret = bcache_writeback(bdev, marks[i], INT32_MAX);
+			marks[i] = bcache_dirty_seq();
+			i = (i + 1) % DIRTY_EXPIRE;
+			next = PS->sys_ticks + FLUSH_INTERVAL;
+		}
+
+		while (ret >= 0 && bcache_dirty_exceeded()) {
+			ret = bcache_writeback(bdev, UINT64_MAX, FLUSH_BATCH);
+			if (ret == 0)
+				break;
+		}
+
+		if (ret < 0)
+			printk("Flusher: %s: Write-back returned -%s\n",
+			       bdev->name, errno(ret));
+	}
+}
+
+/*
+ * Start a flusher for each registered block device. Call once
+ * the scheduler is up, after all devices got registered.
+ */
+void flusher_init(void)
+{
+	for (int i = 0; blkdev_get(i) != NULL; i++)
+		kthread_create(flusher);
+}
@@ -0,0 +1,572 @@
+/*
+ * Asynchronous file I/O rings
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * The file system API is synchronous: a thread issuing one file op
+ * at a time gets one I/O in flight. With a ring pair, a client thread
+ * queues many file ops in a submission ring, carries on, and later
+ * reaps their results from a completion ring.
+ *
+ * Submissions are executed either by a small pool of kernel worker
+ * threads, serving all rings set up for them, or, for rings without
+ * workers, by whoever calls io_ring_poll(): the client itself, or a
+ * dedicated polling thread.
+ *
+ * A client never has more ops in flight, i.e. submitted but not yet
+ * reaped, than completion ring entries: completions never overflow.
+ *
+ * Idle workers yield the CPU; once no worker rings remain, they get
+ * parked till the next one is set up.
+ *
+ * The file system has no inode locks: workers never run two ops on
+ * the same inode at once. A ring whose oldest submission targets a
+ * busy inode is skipped, which also keeps each ring's ops on a given
+ * inode in submission order.
+ *
+ * Locking: @sq_lock serializes ring consumers; @cq_lock serializes
+ * completion producers. rings_lock, then @sq_lock.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <list.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <kmalloc.h>
+#include <percpu.h>
+#include <sched.h>
+#include <stat.h>
+#include <ext2.h>
+#include <io_ring.h>
+
+#define IO_WORKERS		4		/* Shared by all rings */
+
+static LIST_NODE(rings);		/* Rings served by the workers */
+static spinlock_t rings_lock = SPIN_UNLOCKED();
+static volatile uint64_t sqes_pending;	/* In worker rings; rings_lock */
+static uint32_t workers_started;
+static struct proc *parked_workers[IO_WORKERS];	/* rings_lock */
+static int nr_parked_workers;			/* rings_lock */
+static uint64_t busy_inums[IO_WORKERS];	/* Per worker; rings_lock */
+static uint64_t nr_workers;
+
+static int64_t io_rw(struct io_sqe *sqe)
+{
+	struct inode *inode;
+	int64_t ret;
+
+	if (sqe->inum == 0)
+		return -EBADF;
+
+	inode = inode_get(sqe->inum);
+	if (S_ISDIR(inode->mode)) {
+		ret = -EISDIR;
+		goto out;
+	}
+	if (!S_ISREG(inode->mode)) {
+		ret = -EBADF;
+		goto out;
+	}
+
+	switch (sqe->op) {
+	case IO_OP_READ:
+		ret = (int64_t)file_read(inode, sqe->buf, sqe->offset,
+					 sqe->len);
+		break;
+	case IO_OP_WRITE:
+		ret = file_write(inode, sqe->buf, sqe->offset, sqe->len);
+		break;
+	case IO_OP_FSYNC:
+		ret = file_fsync(inode);
+		break;
+	default:
+		assert(false);
+	}
+
+out:
+	inode_put(inode);
+	return ret;
+}
+
+/*
+ * Execute given file op synchronously; return its result
+ */
+static int64_t io_execute(struct io_sqe *sqe)
+{
+	switch (sqe->op) {
+	case IO_OP_NOP:
+		return 0;
+	case IO_OP_OPEN:
+		return name_i(sqe->buf);
+	case IO_OP_READ:
+	case IO_OP_WRITE:
+	case IO_OP_FSYNC:
+		return io_rw(sqe);
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Take the oldest submission off the ring, if any. Call with the
+ * ring's @sq_lock held.
+ */
+static bool __io_ring_take(struct io_ring *ring, struct io_sqe *sqe)
+{
+	if (ring->sq_head == ring->sq_tail)
+		return false;
+
+	barrier();
+	*sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+	barrier();
+	ring->sq_head++;
+	return true;
+}
+
+/*
+ * Post a completion. Setting its @seq is the last access to the
+ * ring on behalf of this op: the client may destroy the ring once
+ * it reaped it. Thus reserve the entry under the lock, and fill it
+ * only after releasing the lock.
+ */
+static void io_ring_complete(struct io_ring *ring, uint64_t user_data,
+			     int64_t res)
+{
+	struct io_cqe *cqe;
+	uint32_t tail;
+
+	spin_lock(&ring->cq_lock);
+	assert(ring->cq_tail - ring->cq_head < ring->cq_entries);
+	tail = ring->cq_tail++;
+	spin_unlock(&ring->cq_lock);
+
+	cqe = &ring->cqes[tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	barrier();
+	cqe->seq = tail + 1;
+}
+
+/*
+ * Inode# given op works on, or zero if none
+ */
+static uint64_t io_sqe_inum(struct io_sqe *sqe)
+{
+	switch (sqe->op) {
+	case IO_OP_READ:
+	case IO_OP_WRITE:
+	case IO_OP_FSYNC:
+		return sqe->inum;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Is the oldest submission of given ring for an inode some worker
+ * is now executing an op on? Call with rings_lock and the ring's
+ * @sq_lock held.
+ */
+static bool io_ring_head_busy(struct io_ring *ring)
+{
+	uint64_t inum;
+
+	if (ring->sq_head == ring->sq_tail)
+		return false;
+
+	barrier();
+	inum = io_sqe_inum(&ring->sqes[ring->sq_head & (ring->sq_entries - 1)]);
+	if (inum == 0)
+		return false;
+
+	for (int i = 0; i < IO_WORKERS; i++)
+		if (busy_inums[i] == inum)
+			return true;
+	return false;
+}
+
+/*
+ * Take a submission from the first worker ring having one, with
+ * its inode not busy, and mark that inode as busy by worker @id.
+ * Rotate that ring to the list tail: busy rings don't starve the
+ * others.
+ */
+static struct io_ring *io_worker_take(int id, struct io_sqe *sqe)
+{
+	struct io_ring *ring, *found = NULL;
+
+	spin_lock(&rings_lock);
+	list_for_each(&rings, ring, node) {
+		spin_lock(&ring->sq_lock);
+		if (!io_ring_head_busy(ring) && __io_ring_take(ring, sqe))
+			found = ring;
+		spin_unlock(&ring->sq_lock);
+		if (found != NULL)
+			break;
+	}
+	if (found != NULL) {
+		list_del(&found->node);
+		list_add_tail(&rings, &found->node);
+		assert(sqes_pending > 0);
+		sqes_pending--;
+		busy_inums[id] = io_sqe_inum(sqe);
+	}
+	spin_unlock(&rings_lock);
+
+	return found;
+}
+
+static void io_worker_done(int id)
+{
+	spin_lock(&rings_lock);
+	busy_inums[id] = 0;
+	spin_unlock(&rings_lock);
+}
+
+/*
+ * Nothing to execute: park if no worker rings remain, otherwise
+ * let other threads run till the next check.
+ */
+static void io_worker_idle(void)
+{
+	spin_lock(&rings_lock);
+	if (sqes_pending == 0 && list_empty(&rings)) {
+		assert(nr_parked_workers < IO_WORKERS);
+		parked_workers[nr_parked_workers++] = current;
+		spin_unlock(&rings_lock);
+		sched_park();
+		return;
+	}
+	spin_unlock(&rings_lock);
+
+	sched_yield();
+}
+
+/*
+ * Worker thread: executes submissions of all worker rings. The
+ * count of pending ones is checked without taking any locks.
+ */
+static void __no_return io_worker(void)
+{
+	struct io_ring *ring;
+	struct io_sqe sqe;
+	int64_t res;
+	int id;
+
+	id = (int)atomic_inc(&nr_workers);
+	assert(id < IO_WORKERS);
+
+	for (;;) {
+		if (sqes_pending == 0) {
+			io_worker_idle();
+			continue;
+		}
+
+		/* All pending ones are for busy inodes? */
+		ring = io_worker_take(id, &sqe);
+		if (ring == NULL) {
+			sched_yield();
+			continue;
+		}
+
+		res = io_execute(&sqe);
+		io_worker_done(id);
+		io_ring_complete(ring, sqe.user_data, res);
+	}
+}
+
+/*
+ * Create a ring pair of @entries submissions, a power of two. If
+ * @workers, submissions are executed by the kernel I/O workers;
+ * otherwise, by io_ring_poll() callers.
+ */
+struct io_ring *io_ring_setup(uint32_t entries, bool workers)
+{
+	struct proc *parked[IO_WORKERS];
+	struct io_ring *ring;
+	int nr_parked;
+
+	compiler_assert(IO_RING_ENTRIES_MAX * sizeof(struct io_sqe)
+			<= MAXALLOC_SZ);
+	compiler_assert(2 * IO_RING_ENTRIES_MAX * sizeof(struct io_cqe)
+			<= MAXALLOC_SZ);
+
+	if (entries == 0 || entries > IO_RING_ENTRIES_MAX ||
+	    (entries & (entries - 1)) != 0)
+		return NULL;
+
+	ring = kmalloc(sizeof(*ring));
+	memset(ring, 0, sizeof(*ring));
+	ring->sq_entries = entries;
+	ring->sqes = kmalloc(entries * sizeof(struct io_sqe));
+	spin_init(&ring->sq_lock);
+	ring->cq_entries = 2 * entries;
+	ring->cqes = kmalloc(ring->cq_entries * sizeof(struct io_cqe));
+	memset(ring->cqes, 0, ring->cq_entries * sizeof(struct io_cqe));
+	spin_init(&ring->cq_lock);
+	ring->workers = workers;
+	list_init(&ring->node);
+
+	if (workers) {
+		if (atomic_bit_test_and_set(&workers_started) == 0)
+			for (int i = 0; i < IO_WORKERS; i++)
+				kthread_create(io_worker);
+
+		spin_lock(&rings_lock);
+		list_add_tail(&rings, &ring->node);
+		nr_parked = nr_parked_workers;
+		memcpy(parked, parked_workers, nr_parked * sizeof(*parked));
+		nr_parked_workers = 0;
+		spin_unlock(&rings_lock);
+
+		for (int i = 0; i < nr_parked; i++)
+			sched_unpark(parked[i]);
+	}
+
+	return ring;
+}
+
+/*
+ * Free given ring. All of its submissions must have been reaped,
+ * and no io_ring_poll() caller may still be using it.
+ */
+void io_ring_destroy(struct io_ring *ring)
+{
+	assert(ring->sq_local == ring->sq_tail);
+	assert(ring->cq_head == ring->sq_tail);
+
+	if (ring->workers) {
+		spin_lock(&rings_lock);
+		list_del(&ring->node);
+		spin_unlock(&rings_lock);
+	}
+
+	kfree(ring->sqes);
+	kfree(ring->cqes);
+	kfree(ring);
+}
+
+/*
+ * Return the next free submission entry, to be filled by the client,
+ * or NULL if the ring is full, or too many ops are in flight.
+ */
+struct io_sqe *io_ring_get_sqe(struct io_ring *ring)
+{
+	if (ring->sq_local - ring->sq_head == ring->sq_entries)
+		return NULL;
+	if (ring->sq_local - ring->cq_head == ring->cq_entries)
+		return NULL;
+
+	return &ring->sqes[ring->sq_local++ & (ring->sq_entries - 1)];
+}
+
+/*
+ * Make the entries filled since the last call visible to consumers
+ */
+void io_ring_submit(struct io_ring *ring)
+{
+	uint32_t nr;
+
+	nr = ring->sq_local - ring->sq_tail;
+	if (nr == 0)
+		return;
+
+	barrier();
+	if (!ring->workers) {
+		ring->sq_tail = ring->sq_local;
+		return;
+	}
+
+	spin_lock(&rings_lock);
+	ring->sq_tail = ring->sq_local;
+	sqes_pending += nr;
+	spin_unlock(&rings_lock);
+}
+
+/*
+ * Return the oldest unreaped completion, or NULL. Mark it as reaped
+ * using io_ring_cqe_seen() once done with it.
+ */
+struct io_cqe *io_ring_peek_cqe(struct io_ring *ring)
+{
+	struct io_cqe *cqe;
+
+	cqe = &ring->cqes[ring->cq_head & (ring->cq_entries - 1)];
+	if (cqe->seq != ring->cq_head + 1)
+		return NULL;
+
+	barrier();
+	return cqe;
+}
+
+void io_ring_cqe_seen(struct io_ring *ring)
+{
+	assert(io_ring_peek_cqe(ring) != NULL);
+	barrier();
+	ring->cq_head++;
+}
+
+/*
+ * Execute up to @max submissions of a ring without workers. Return
+ * the nr of ops executed.
+ */
+int io_ring_poll(struct io_ring *ring, int max)
+{
+	struct io_sqe sqe;
+	bool taken;
+	int nr = 0;
+
+	assert(!ring->workers);
+	while (nr < max) {
+		spin_lock(&ring->sq_lock);
+		taken = __io_ring_take(ring, &sqe);
+		spin_unlock(&ring->sq_lock);
+		if (!taken)
+			break;
+
+		io_ring_complete(ring, sqe.user_data, io_execute(&sqe));
+		nr++;
+	}
+
+	return nr;
+}
+
+#if	IO_RING_TESTS
+
+#define TEST_OPS	48		/* > Ring entries: reuse them */
+#define TEST_LEN	1000		/* Unaligned on purpose */
+
+static void fill_pattern(char *buf, uint64_t offset, int len)
+{
+	for (int i = 0; i < len; i++)
+		buf[i] = (char)((offset + i) * 7);
+}
+
+static void check_pattern(char *buf, uint64_t offset, int len)
+{
+	for (int i = 0; i < len; i++)
+		if (buf[i] != (char)((offset + i) * 7))
+			panic("_IO_RING: Offset %lu: got 0x%x", offset + i,
+			      buf[i]);
+}
+
+/*
+ * Submit a stream of @op over @inum, keeping the ring as full as
+ * possible, and check each completion.
+ */
+static void test_stream(struct io_ring *ring, uint64_t inum, enum io_op op,
+			char **bufs)
+{
+	struct io_sqe *sqe;
+	struct io_cqe *cqe;
+	int submitted = 0, completed = 0;
+
+	while (completed < TEST_OPS) {
+		while (submitted < TEST_OPS &&
+		       (sqe = io_ring_get_sqe(ring)) != NULL) {
+			sqe->op = op;
+			sqe->inum = inum;
+			sqe->offset = (uint64_t)submitted * TEST_LEN;
+			sqe->buf = bufs[submitted];
+			sqe->len = TEST_LEN;
+			sqe->user_data = submitted;
+			if (op == IO_OP_WRITE)
+				fill_pattern(sqe->buf, sqe->offset, TEST_LEN);
+			submitted++;
+		}
+		io_ring_submit(ring);
+
+		if (!ring->workers)
+			io_ring_poll(ring, IO_RING_ENTRIES_MAX);
+
+		while ((cqe = io_ring_peek_cqe(ring)) != NULL) {
+			if (cqe->res != TEST_LEN)
+				panic("_IO_RING: Op %lu returned %ld",
+				      cqe->user_data, cqe->res);
+			if (op == IO_OP_READ)
+				check_pattern(bufs[cqe->user_data],
+					      cqe->user_data * TEST_LEN,
+					      TEST_LEN);
+			io_ring_cqe_seen(ring);
+			completed++;
+		}
+	}
+}
+
+/*
+ * Submit a single op and wait for its result
+ */
+static int64_t test_sync_op(struct io_ring *ring, enum io_op op,
+			    uint64_t inum, char *buf)
+{
+	struct io_sqe *sqe;
+	struct io_cqe *cqe;
+	int64_t res;
+
+	sqe = io_ring_get_sqe(ring);
+	assert(sqe != NULL);
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->op = op;
+	sqe->inum = inum;
+	sqe->buf = buf;
+	io_ring_submit(ring);
+
+	while ((cqe = io_ring_peek_cqe(ring)) == NULL)
+		if (!ring->workers)
+			io_ring_poll(ring, 1);
+
+	res = cqe->res;
+	io_ring_cqe_seen(ring);
+	return res;
+}
+
+static void test_ring(bool workers)
+{
+	struct io_ring *ring;
+	struct inode *root;
+	char *bufs[TEST_OPS];
+	char path[] = "/io_ring_test", none[] = "/io_ring_none";
+	int64_t inum;
+
+	root = inode_get(EXT2_ROOT_INODE);
+	inum = file_new(root, "io_ring_test", EXT2_FT_REG_FILE);
+	assert(inum > 0);
+
+	ring = io_ring_setup(16, workers);
+	assert(ring != NULL);
+	assert(test_sync_op(ring, IO_OP_OPEN, 0, path) == inum);
+	assert(test_sync_op(ring, IO_OP_OPEN, 0, none) == -ENOENT);
+	assert(test_sync_op(ring, IO_OP_READ, EXT2_ROOT_INODE, NULL)
+	       == -EISDIR);
+
+	for (int i = 0; i < TEST_OPS; i++)
+		bufs[i] = kmalloc(TEST_LEN);
+	test_stream(ring, inum, IO_OP_WRITE, bufs);
+	assert(test_sync_op(ring, IO_OP_FSYNC, inum, NULL) == 0);
+	for (int i = 0; i < TEST_OPS; i++)
+		memset(bufs[i], 0, TEST_LEN);
+	test_stream(ring, inum, IO_OP_READ, bufs);
+	for (int i = 0; i < TEST_OPS; i++)
+		kfree(bufs[i]);
+
+	io_ring_destroy(ring);
+	assert(file_delete(root, "io_ring_test") == 0);
+	inode_put(root);
+
+	printk("_IO_RING: %s ring: Success!\n", workers ? "Workers" : "Polled");
+}
+
+void io_ring_run_tests(void)
+{
+	test_ring(false);
+	test_ring(true);
+}
+
+#endif	/* IO_RING_TESTS */
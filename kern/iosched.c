@@ -0,0 +1,287 @@
+/*
+ * I/O schedulers: no-op and deadline
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Both schedulers merge a new bio into a queued request of the same
+ * direction when their sectors are adjacent, up to the driver's
+ * segments limit: a stream of 4-KByte page writes then reaches the
+ * device as few large requests.
+ *
+ * No-op: requests are dispatched in arrival order, and a bio only
+ * merges at the end of the last queued request. For devices with no
+ * seek cost, e.g. the ramdisk.
+ *
+ * Deadline: requests are kept sorted by sector, per direction, and
+ * dispatched in ascending sector batches. Reads are preferred, as
+ * someone is usually waiting for them, but a write batch runs after
+ * WRITES_STARVED read batches. Each request also gets an expiry: a
+ * new batch starts at the oldest request instead of the next sector
+ * if that request has expired. There's no global clock to time the
+ * expiries with; they count the requests dispatched meanwhile, which
+ * bounds starvation just as well.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <list.h>
+#include <kmalloc.h>
+#include <blkdev.h>
+#include <iosched.h>
+
+#define RQ_SECTORS_MAX		256		/* 128 KBytes */
+
+/*
+ * Request merging
+ */
+
+static bool rq_mergeable(struct block_device *bdev, struct bio *rq,
+			 enum bio_op op, int segments, uint64_t sectors)
+{
+	int max_segments = max(bdev->max_segments, 1);
+
+	return rq->op == op && rq->rq_segments + segments <= max_segments &&
+		rq->rq_sectors + sectors <= RQ_SECTORS_MAX;
+}
+
+static bool rq_back_mergeable(struct block_device *bdev, struct bio *rq,
+			      struct bio *bio)
+{
+	return rq_end(rq) == bio->sector &&
+		rq_mergeable(bdev, rq, bio->op, bio->rq_segments,
+			     bio->rq_sectors);
+}
+
+static bool rq_front_mergeable(struct block_device *bdev, struct bio *rq,
+			       struct bio *bio)
+{
+	return rq_end(bio) == rq->sector &&
+		rq_mergeable(bdev, rq, bio->op, bio->rq_segments,
+			     bio->rq_sectors);
+}
+
+/*
+ * Append request @bio, a single bio or a whole request, to @rq
+ */
+static void rq_back_merge(struct bio *rq, struct bio *bio)
+{
+	rq->rq_tail->next = bio;
+	rq->rq_tail = bio->rq_tail;
+	rq->rq_sectors += bio->rq_sectors;
+	rq->rq_segments += bio->rq_segments;
+	rq->rq_deadline = min(rq->rq_deadline, bio->rq_deadline);
+}
+
+/*
+ * Prepend single bio @bio to @rq: @bio becomes the request head,
+ * taking @rq's place in the scheduler queues.
+ */
+static void rq_front_merge(struct bio *rq, struct bio *bio)
+{
+	bio->next = rq;
+	bio->rq_tail = rq->rq_tail;
+	bio->rq_sectors += rq->rq_sectors;
+	bio->rq_segments += rq->rq_segments;
+	bio->rq_deadline = rq->rq_deadline;
+
+	list_add(&rq->node, &bio->node);
+	list_del(&rq->node);
+	list_add(&rq->rq_fifo, &bio->rq_fifo);
+	list_del(&rq->rq_fifo);
+}
+
+/*
+ * No-op
+ */
+
+static void *noop_init(__unused struct block_device *bdev)
+{
+	struct list_node *queue;
+
+	queue = kmalloc(sizeof(*queue));
+	list_init(queue);
+	return queue;
+}
+
+static void noop_add(struct block_device *bdev, struct bio *bio)
+{
+	struct list_node *queue = bdev->iosched_data;
+	struct bio *last;
+
+	if (!list_empty(queue)) {
+		last = list_entry(queue->prev, struct bio, node);
+		if (rq_back_mergeable(bdev, last, bio)) {
+			rq_back_merge(last, bio);
+			return;
+		}
+	}
+
+	list_add_tail(queue, &bio->node);
+}
+
+static struct bio *noop_dispatch(struct block_device *bdev)
+{
+	struct list_node *queue = bdev->iosched_data;
+	struct bio *rq;
+
+	if (list_empty(queue))
+		return NULL;
+
+	rq = list_entry(queue->next, struct bio, node);
+	list_del(&rq->node);
+	return rq;
+}
+
+struct io_scheduler noop_iosched = {
+	.name = "noop",
+	.init = noop_init,
+	.add = noop_add,
+	.dispatch = noop_dispatch,
+};
+
+/*
+ * Deadline
+ */
+
+#define READ_EXPIRE		16	/* Requests dispatched ahead, max */
+#define WRITE_EXPIRE		128
+#define WRITES_STARVED		2	/* Read batches before a write one */
+#define FIFO_BATCH		16	/* Requests per sorted batch */
+
+struct deadline_data {
+	struct list_node sorted[2];	/* By sector, per bio_op */
+	struct list_node fifo[2];	/* By arrival, per bio_op */
+	struct bio *next[2];		/* Next in sector order, or NULL */
+	enum bio_op batch_op;		/* Current batch direction */
+	int batching;			/* Requests dispatched in batch */
+	int starved;			/* Read batches while writes wait */
+	uint64_t seq;			/* Dispatched requests count */
+};
+
+static const uint64_t deadline_expire[2] = {
+	[BIO_READ] = READ_EXPIRE,
+	[BIO_WRITE] = WRITE_EXPIRE,
+};
+
+static void *deadline_init(__unused struct block_device *bdev)
+{
+	struct deadline_data *dd;
+
+	dd = kmalloc(sizeof(*dd));
+	memset(dd, 0, sizeof(*dd));
+	for (int i = 0; i < 2; i++) {
+		list_init(&dd->sorted[i]);
+		list_init(&dd->fifo[i]);
+	}
+	return dd;
+}
+
+static struct bio *deadline_next(struct deadline_data *dd, struct bio *rq)
+{
+	if (rq->node.next == &dd->sorted[rq->op])
+		return NULL;
+	return list_entry(rq->node.next, struct bio, node);
+}
+
+static void deadline_remove(struct deadline_data *dd, struct bio *rq)
+{
+	if (dd->next[rq->op] == rq)
+		dd->next[rq->op] = deadline_next(dd, rq);
+	list_del(&rq->node);
+	list_del(&rq->rq_fifo);
+}
+
+static void deadline_add(struct block_device *bdev, struct bio *bio)
+{
+	struct deadline_data *dd = bdev->iosched_data;
+	struct list_node *sorted = &dd->sorted[bio->op];
+	struct bio *rq, *prev = NULL, *succ = NULL;
+
+	list_for_each(sorted, rq, node) {
+		if (rq->sector > bio->sector) {
+			succ = rq;
+			break;
+		}
+		prev = rq;
+	}
+
+	bio->rq_deadline = dd->seq + deadline_expire[bio->op];
+
+	/* Back merge; the bigger request may now touch its successor */
+	if (prev != NULL && rq_back_mergeable(bdev, prev, bio)) {
+		rq_back_merge(prev, bio);
+		if (succ != NULL && rq_back_mergeable(bdev, prev, succ)) {
+			deadline_remove(dd, succ);
+			rq_back_merge(prev, succ);
+		}
+		return;
+	}
+
+	if (succ != NULL && rq_front_mergeable(bdev, succ, bio)) {
+		rq_front_merge(succ, bio);
+		if (dd->next[bio->op] == succ)
+			dd->next[bio->op] = bio;
+		return;
+	}
+
+	if (succ != NULL)
+		list_add_tail(&succ->node, &bio->node);
+	else
+		list_add_tail(sorted, &bio->node);
+	list_add_tail(&dd->fifo[bio->op], &bio->rq_fifo);
+}
+
+static struct bio *deadline_dispatch(struct block_device *bdev)
+{
+	struct deadline_data *dd = bdev->iosched_data;
+	struct bio *rq, *oldest;
+	bool reads, writes;
+	enum bio_op op;
+
+	/* Continue the current batch, in ascending sectors order */
+	op = dd->batch_op;
+	rq = dd->next[op];
+	if (rq != NULL && dd->batching < FIFO_BATCH)
+		goto dispatch;
+
+	reads = !list_empty(&dd->fifo[BIO_READ]);
+	writes = !list_empty(&dd->fifo[BIO_WRITE]);
+	if (reads && (!writes || dd->starved < WRITES_STARVED)) {
+		op = BIO_READ;
+		if (writes)
+			dd->starved++;
+	} else if (writes) {
+		op = BIO_WRITE;
+		dd->starved = 0;
+	} else {
+		return NULL;
+	}
+
+	/* New batch: restart from the oldest request if it expired */
+	oldest = list_entry(dd->fifo[op].next, struct bio, rq_fifo);
+	rq = dd->next[op];
+	if (rq == NULL || oldest->rq_deadline <= dd->seq)
+		rq = oldest;
+	dd->batch_op = op;
+	dd->batching = 0;
+
+dispatch:
+	dd->next[op] = deadline_next(dd, rq);
+	list_del(&rq->node);
+	list_del(&rq->rq_fifo);
+	dd->batching++;
+	dd->seq++;
+	return rq;
+}
+
+struct io_scheduler deadline_iosched = {
+	.name = "deadline",
+	.init = deadline_init,
+	.add = deadline_add,
+	.dispatch = deadline_dispatch,
+};
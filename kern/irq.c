@@ -0,0 +1,308 @@
+/*
+ * Generic IRQ handling
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Each non-exception vector has a tiny entry stub in idt.S, which
+ * passes its vector number to irq_dispatch(). Devices then register
+ * their handlers per vector, without touching any assembly: several
+ * of them may share one vector, e.g. on a shared PCI INTx# line.
+ *
+ * Each CPU counts its IRQs, and the TSC cycles spent handling them,
+ * in its own statistics block: no cache line bouncing on the hot
+ * path. That's what the IRQ balancer feeds on.
+ *
+ * An IRQ no handler claims is spurious. A stuck line can storm the
+ * CPU with those, so a vector getting too many of them in a short
+ * window gets masked at its I/O APIC, and ignored from then on.
+ *
+ * Some vectors keep their dedicated entry code: the ticks handler
+ * (context switching), the halt IPI, the masked PICs, and the local
+ * APIC spurious vector, which must not get EOIed.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <kmalloc.h>
+#include <spinlock.h>
+#include <percpu.h>
+#include <idt.h>
+#include <vectors.h>
+#include <ioapic.h>
+#include <sched.h>
+#include <tsc.h>
+#include <irq.h>
+
+#define STORM_WINDOW	HZ		/* Ticks */
+#define STORM_MAX	10000		/* Unhandled IRQs per window */
+
+static struct irq_desc irq_descs[IDT_GATES];
+
+static struct irq_cpustat *cpu_irq_stats(int cpu)
+{
+	return (struct irq_cpustat *)cpus[cpu]->irq_stats;
+}
+
+static bool irq_vector_valid(uint8_t vector)
+{
+	return vector >= EXCEPTION_GATES && vector != APIC_SPURIOUS_VECTOR;
+}
+
+static void *irq_stub(uint8_t vector)
+{
+	return (void *)(uintptr_t)idt_irq_stubs[vector - EXCEPTION_GATES];
+}
+
+/*
+ * Add @handler to @vector's handlers. The chain gets walked
+ * from IRQ context, lock-free: link the new node only once
+ * it's complete. Return 0, or -EINVAL for reserved vectors.
+ */
+int irq_register(uint8_t vector, irq_handler_t handler, void *data,
+		 const char *name)
+{
+	struct irq_desc *desc;
+	struct irq_action *action, **tail;
+
+	if (!irq_vector_valid(vector))
+		return -EINVAL;
+
+	action = kmalloc(sizeof(*action));
+	action->handler = handler;
+	action->data = data;
+	action->name = name;
+	action->next = NULL;
+
+	desc = &irq_descs[vector];
+	spin_lock(&desc->lock);
+	for (tail = &desc->actions; *tail != NULL; tail = &(*tail)->next)
+		;
+	barrier();
+	*tail = action;
+	spin_unlock(&desc->lock);
+
+	/* The IDT is shared by all cores */
+	set_intr_gate(vector, irq_stub(vector));
+	return 0;
+}
+
+/*
+ * No handler claimed the IRQ. Mask it if it keeps storming.
+ */
+static void note_unhandled(uint8_t vector, struct irq_desc *desc)
+{
+	bool first, storm;
+	clock_t now;
+
+	spin_lock(&desc->lock);
+	first = (desc->nr_unhandled++ == 0);
+	now = PS->sys_ticks;
+	if (now - desc->storm_start > STORM_WINDOW) {
+		desc->storm_start = now;
+		desc->storm_count = 0;
+	}
+	storm = (++desc->storm_count == STORM_MAX);
+	if (storm)
+		desc->disabled = true;
+	spin_unlock(&desc->lock);
+
+	if (first && desc->actions == NULL)
+		printk("IRQ: Spurious vector 0x%x on CPU#%d\n", vector,
+		       percpu_get(id));
+	if (storm) {
+		printk("IRQ: Vector 0x%x: nobody cared; disabling it\n",
+		       vector);
+		ioapic_mask_vector(vector);
+	}
+}
+
+/*
+ * Run all of @vector's handlers: several devices sharing a
+ * level-triggered line may be asserting it at once.
+ */
+void irq_dispatch(uint8_t vector)
+{
+	struct irq_desc *desc = &irq_descs[vector];
+	struct irq_cpustat *stat;
+	struct irq_action *action;
+	uint64_t start;
+	int ret = IRQ_NONE;
+
+	stat = (struct irq_cpustat *)percpu_get(irq_stats);
+	start = read_tsc();
+
+	if (!desc->disabled)
+		for (action = desc->actions; action; action = action->next)
+			ret |= action->handler(action->data);
+
+	stat->count[vector]++;
+	stat->cycles[vector] += read_tsc() - start;
+
+	if (ret == IRQ_NONE)
+		note_unhandled(vector, desc);
+}
+
+uint64_t irq_count(uint8_t vector, int cpu)
+{
+	return cpu_irq_stats(cpu)->count[vector];
+}
+
+uint64_t irq_cycles(uint8_t vector, int cpu)
+{
+	return cpu_irq_stats(cpu)->cycles[vector];
+}
+
+uint64_t irq_unhandled(uint8_t vector)
+{
+	return irq_descs[vector].nr_unhandled;
+}
+
+/*
+ * For each vector taken so far: the IRQs count on each CPU,
+ * and the average handling time, in TSC cycles.
+ */
+void irq_print_stats(void)
+{
+	struct irq_desc *desc;
+	uint64_t total, cycles;
+	int nr_cpus;
+
+	nr_cpus = mptables_get_nr_cpus();
+	for (int vector = EXCEPTION_GATES; vector < IDT_GATES; vector++) {
+		desc = &irq_descs[vector];
+		total = cycles = 0;
+		for (int cpu = 0; cpu < nr_cpus; cpu++) {
+			total += irq_count(vector, cpu);
+			cycles += irq_cycles(vector, cpu);
+		}
+		if (total == 0)
+			continue;
+
+		printk("IRQ: 0x%x %s: ", vector, desc->actions ?
+		       desc->actions->name : "<none>");
+		for (int cpu = 0; cpu < nr_cpus; cpu++)
+			printk("%lu ", irq_count(vector, cpu));
+		printk("; %lu cycles avg, %lu unhandled\n", cycles / total,
+		       desc->nr_unhandled);
+	}
+}
+
+/*
+ * Route all vectors without a dedicated handler through the
+ * generic entry stubs. Call after the CPUs discovery, before
+ * any IRQ gets enabled or registered.
+ */
+void irq_init(void)
+{
+	struct irq_cpustat *stat;
+
+	compiler_assert(sizeof(*stat) <= MAXALLOC_SZ);
+
+	for (int cpu = 0; cpu < mptables_get_nr_cpus(); cpu++) {
+		stat = kmalloc(sizeof(*stat));
+		memset(stat, 0, sizeof(*stat));
+		cpus[cpu]->irq_stats = (uintptr_t)stat;
+	}
+
+	for (int vector = 0; vector < IDT_GATES; vector++)
+		spin_init(&irq_descs[vector].lock);
+
+	/* Gates set by now (exceptions, PICs, halt IPI) stay */
+	for (int vector = EXCEPTION_GATES; vector < IDT_GATES; vector++) {
+		if (!irq_vector_valid(vector) || idt[vector].p)
+			continue;
+		set_intr_gate(vector, irq_stub(vector));
+	}
+}
+
+#if	IRQ_TESTS
+
+#include <apic.h>
+#include <ktime.h>
+
+static volatile int nr_first, nr_second;
+
+static enum irqreturn first_handler(__unused void *data)
+{
+	nr_first++;
+	return IRQ_NONE;
+}
+
+static enum irqreturn second_handler(__unused void *data)
+{
+	nr_second++;
+	return IRQ_HANDLED;
+}
+
+/*
+ * Send @vector to ourselves, and wait for its handling
+ */
+static void self_ipi(uint8_t vector)
+{
+	uint64_t count;
+	int cpu, timeout = 100;
+
+	cpu = percpu_get(id);
+	count = irq_count(vector, cpu);
+	apic_send_ipi(percpu_get(apic_id), APIC_DELMOD_FIXED, vector);
+	apic_ipi_acked();
+
+	while (timeout-- && irq_count(vector, cpu) == count)
+		mdelay(1);
+	if (irq_count(vector, cpu) == count)
+		panic("_IRQ: FAIL: Vector 0x%x IPI never got handled",
+		      vector);
+}
+
+/*
+ * All handlers of a shared vector run; it's handled if
+ * any of them claims it.
+ */
+static void test_chaining(void)
+{
+	uint8_t vector = IRQ_TESTS_VECTOR;
+
+	assert(irq_register(vector, first_handler, NULL, "first") == 0);
+	assert(irq_register(vector, second_handler, NULL, "second") == 0);
+
+	for (int i = 0; i < 100; i++)
+		self_ipi(vector);
+
+	if (nr_first != 100 || nr_second != 100)
+		panic("_IRQ: FAIL: Handlers called %d and %d times, instead "
+		      "of 100", nr_first, nr_second);
+	if (irq_unhandled(vector) != 0)
+		panic("_IRQ: FAIL: %lu handled IRQs reported as unhandled",
+		      irq_unhandled(vector));
+
+	printk("_IRQ: Shared handlers: Success\n");
+}
+
+static void test_spurious(void)
+{
+	uint8_t vector = IRQ_TESTS_SPURIOUS_VECTOR;
+
+	for (int i = 0; i < 10; i++)
+		self_ipi(vector);
+
+	if (irq_unhandled(vector) != 10)
+		panic("_IRQ: FAIL: %lu spurious IRQs detected, instead of 10",
+		      irq_unhandled(vector));
+
+	printk("_IRQ: Spurious IRQs: Success\n");
+}
+
+void irq_run_tests(void)
+{
+	test_chaining();
+	test_spurious();
+	irq_print_stats();
+}
+
+#endif	/* IRQ_TESTS */
@@ -0,0 +1,141 @@
+/*
+ * I/O APIC IRQs balancing across cores
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Device IRQs are routed to the bootstrap core by default. Under
+ * heavy I/O, that core ends up doing all of the completion work
+ * while others stay idle.
+ *
+ * Each interval, a kernel thread samples the per-CPU IRQ counters
+ * of the routed vectors, and finds the busiest and the idlest cores.
+ * If the gap is big enough, the heaviest IRQ whose move does not
+ * just flip the imbalance over is re-targeted to the idlest core,
+ * within its affinity mask. At most one IRQ moves per interval:
+ * each move costs the handler its warm caches.
+ *
+ * There's no sleeping yet: the thread waits out each interval by
+ * yielding the CPU till the ticks counter reaches its end.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <percpu.h>
+#include <cpumask.h>
+#include <sched.h>
+#include <ioapic.h>
+#include <irq.h>
+#include <smpboot.h>
+#include <irqbalance.h>
+
+#define BALANCE_INTERVAL	(2 * HZ)	/* Ticks between passes */
+#define BALANCE_MIN_HITS	1000		/* Busiest core IRQs per pass */
+
+/* Counter values as of the last pass */
+static uint64_t last_hits[IOAPIC_ROUTES_MAX][CPUS_MAX];
+
+/* IRQs each core took during the current pass */
+static uint64_t cpu_load[CPUS_MAX];
+
+/* ... and for each route, the hits on its current target */
+static uint64_t route_load[IOAPIC_ROUTES_MAX];
+
+static void sample_hits(void)
+{
+	uint64_t hits, delta;
+	uint8_t vector;
+	int nr_cpus, target;
+
+	nr_cpus = mptables_get_nr_cpus();
+	for (int cpu = 0; cpu < nr_cpus; cpu++)
+		cpu_load[cpu] = 0;
+
+	for (int route = 0; route < nr_ioapic_routes; route++) {
+		target = ioapic_routes[route].cpu;
+		vector = ioapic_routes[route].entry.vector;
+		route_load[route] = 0;
+		for (int cpu = 0; cpu < nr_cpus; cpu++) {
+			hits = irq_count(vector, cpu);
+			delta = hits - last_hits[route][cpu];
+			last_hits[route][cpu] = hits;
+
+			cpu_load[cpu] += delta;
+			if (cpu == target)
+				route_load[route] = delta;
+		}
+	}
+}
+
+/*
+ * Move the heaviest IRQ on @busiest that's allowed on @idlest,
+ * and whose load there stays below the current imbalance.
+ */
+static void balance(int busiest, int idlest)
+{
+	struct ioapic_route *route;
+	uint64_t gap, best_load = 0;
+	int best = -1;
+
+	gap = cpu_load[busiest] - cpu_load[idlest];
+	for (int i = 0; i < nr_ioapic_routes; i++) {
+		route = &ioapic_routes[i];
+		if (route->cpu != busiest)
+			continue;
+		if (!cpumask_test_cpu(idlest, &route->affinity))
+			continue;
+		if (route_load[i] >= gap || route_load[i] <= best_load)
+			continue;
+
+		best = i;
+		best_load = route_load[i];
+	}
+
+	if (best == -1)
+		return;
+
+	ioapic_route_set_cpu(best, idlest);
+	printk("IRQ: Moved vector 0x%x from CPU#%d to CPU#%d\n",
+	       ioapic_routes[best].entry.vector, busiest, idlest);
+}
+
+static void __no_return irqbalancer(void)
+{
+	int busiest, idlest;
+	clock_t next;
+
+	next = PS->sys_ticks + BALANCE_INTERVAL;
+	for (;;) {
+		while (PS->sys_ticks < next)
+			sched_yield();
+		next = PS->sys_ticks + BALANCE_INTERVAL;
+
+		sample_hits();
+
+		busiest = idlest = 0;
+		for (int cpu = 1; cpu < mptables_get_nr_cpus(); cpu++) {
+			if (!smpboot_cpu_alive(cpu))
+				continue;
+			if (cpu_load[cpu] > cpu_load[busiest])
+				busiest = cpu;
+			if (cpu_load[cpu] < cpu_load[idlest])
+				idlest = cpu;
+		}
+
+		if (cpu_load[busiest] >= BALANCE_MIN_HITS)
+			balance(busiest, idlest);
+	}
+}
+
+/*
+ * Call once the scheduler is up. Nothing to balance on
+ * uniprocessor machines.
+ */
+void irqbalance_init(void)
+{
+	if (smpboot_get_nr_alive_cpus() > 1)
+		kthread_create(irqbalancer);
+}
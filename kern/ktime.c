@@ -0,0 +1,388 @@
+/*
+ * Kernel monotonic time: the TSC clocksource
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Reading the time-stamp counter costs a few dozen cycles, with no bus
+ * access: the cheapest clock around. It's only usable as a time base
+ * if it's 'invariant' though, i.e. ticking at the same rate in all
+ * P-, C-, and T-states. Its rate is calibrated once, against the HPET
+ * if there's one, or the PIT. Without an invariant TSC, time is read
+ * from a 64-bit HPET, or from the scheduler ticks as a last resort.
+ *
+ * Each core has its own TSC, which is not guaranteed to be in sync
+ * with others: firmware may write it, or cores may get reset at
+ * different times. Once the cores are up, we measure each secondary
+ * core offset against the bootstrap core TSC, NTP-style:
+ *
+ *	core			bootstrap
+ *	t0 = rdtsc  ---------->
+ *		    <----------  t1 = rdtsc
+ *	t2 = rdtsc
+ *
+ * assuming t1 was read halfway through the round trip: the offset is
+ * (t0 + t2) / 2 - t1. Out of several round trips, the shortest one has
+ * the least error.
+ *
+ * Conversion to nanoseconds is a multiply and a shift, through a
+ * 128-bit product: no division, and no overflow for centuries.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <percpu.h>
+#include <sched.h>
+#include <pit.h>
+#include <hpet.h>
+#include <tsc.h>
+#include <x86.h>
+#include <smp.h>
+#include <smpboot.h>
+#include <ktime.h>
+
+#define NS_SHIFT	32
+#define SYNC_ROUNDS	16
+
+uint64_t tsc_hz;
+bool tsc_reliable;
+
+static uint64_t ns_mult;		/* ns = (cycles * mult) >> NS_SHIFT */
+static uint64_t tsc_base;		/* Bootstrap TSC at calibration */
+static uint64_t hpet_ns_mult;		/* Same, for HPET ticks */
+
+/*
+ * Per-CPU TSC offsets handshake area
+ */
+static struct {
+	volatile int request;		/* Round number asked by the core */
+	volatile int reply;		/* Round number answered */
+	volatile uint64_t tsc;		/* Bootstrap TSC in this reply */
+	volatile int64_t offset;	/* Measured offset */
+	volatile bool done;
+} __aligned(CACHE_LINE_SIZE) handshake;
+
+/*
+ * Calculate the processor clock using the PIT and the time-
+ * stamp counter: it's increased by one for each clock cycle.
+ *
+ * There's a possibility of being hit by a massive SMI, we
+ * repeat the calibration to hope this wasn't the case. Some
+ * SMI handlers can take many milliseconds to complete!
+ *
+ * Return cpu clock ticks per second.
+ */
+static uint64_t pit_calibrate_tsc(int repeat)
+{
+	int ms_delay;
+	uint64_t tsc1, tsc2, diff, diff_min;
+
+	ms_delay = 5;
+	diff_min = UINT64_MAX;
+	for (int i = 0; i < repeat; i ++) {
+		tsc1 = read_tsc();
+		pit_mdelay(ms_delay);
+		tsc2 = read_tsc();
+
+		diff = tsc2 - tsc1;
+		if (diff < diff_min)
+			diff_min = diff;
+	}
+
+	/* ticks per second = ticks * (1000 / delay-in-ms) */
+	return diff_min * (1000 / ms_delay);
+}
+
+/*
+ * Sample the TSC at both ends of an HPET-timed window. Each
+ * HPET read is bracketed by two TSC reads: use the midpoint.
+ * One window is enough: an MMIO read error is way below the
+ * PIT's few µ-seconds port accesses.
+ */
+static void hpet_sample(uint64_t *tsc, uint64_t *hpet)
+{
+	uint64_t t0, t1;
+
+	t0 = read_tsc();
+	*hpet = hpet_read();
+	t1 = read_tsc();
+	*tsc = t0 + (t1 - t0) / 2;
+}
+
+static uint64_t hpet_calibrate_tsc(void)
+{
+	uint64_t tsc1, tsc2, hpet1, hpet2;
+
+	hpet_sample(&tsc1, &hpet1);
+	hpet_udelay(10000);
+	hpet_sample(&tsc2, &hpet2);
+
+	if (!hpet_counter_64bit)
+		hpet2 = (uint32_t)(hpet2 - hpet1) + hpet1;
+	return (tsc2 - tsc1) * hpet_hz / (hpet2 - hpet1);
+}
+
+static uint64_t ns_mult_of(uint64_t hz)
+{
+	return (NSEC_PER_SEC << NS_SHIFT) / hz;
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles, uint64_t mult)
+{
+	return ((unsigned __int128)cycles * mult) >> NS_SHIFT;
+}
+
+/*
+ * Invariant TSC: CPUID.80000007H:EDX[8]
+ */
+static bool tsc_invariant(void)
+{
+	if (cpuid(0x80000000).eax < 0x80000007)
+		return false;
+
+	return (cpuid(0x80000007).edx & (1U << 8)) != 0;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles)
+{
+	return cycles_to_ns(cycles, ns_mult);
+}
+
+/*
+ * Nanoseconds since boot, monotonic over all cores. Without
+ * a reliable TSC nor a 64-bit HPET, it has the scheduler
+ * ticks granularity.
+ */
+uint64_t ktime_get_ns(void)
+{
+	union x86_rflags flags;
+	int64_t offset;
+	uint64_t tsc;
+
+	if (!tsc_reliable) {
+		if (hpet_ns_mult != 0)
+			return cycles_to_ns(hpet_read(), hpet_ns_mult);
+		return cpus[0]->sched.sys_ticks * (NSEC_PER_SEC / HZ);
+	}
+
+	/* Both from the same core */
+	flags = local_irq_disable_save();
+	offset = percpu_get(tsc_offset);
+	tsc = read_tsc();
+	local_irq_restore(flags);
+
+	return tsc_to_ns(tsc - offset - tsc_base);
+}
+
+/*
+ * Busy-wait @us µ-seconds on the cheapest calibrated counter:
+ * an invariant TSC, then the HPET. The PIT is the last resort;
+ * it has a milli-second granularity.
+ */
+void udelay(uint64_t us)
+{
+	uint64_t deadline;
+
+	if (tsc_reliable) {
+		deadline = read_tsc() + us * tsc_hz / 1000000;
+		while (read_tsc() < deadline)
+			cpu_pause();
+	} else if (hpet_hz != 0) {
+		hpet_udelay(us);
+	} else {
+		mdelay((us + 999) / 1000);
+	}
+}
+
+/*
+ * PIT delays are limited to ~53ms: split bigger ones
+ */
+void mdelay(int ms)
+{
+	if (tsc_reliable || hpet_hz != 0) {
+		udelay(ms * 1000ul);
+		return;
+	}
+
+	for (; ms > 50; ms -= 50)
+		pit_mdelay(50);
+	if (ms > 0)
+		pit_mdelay(ms);
+}
+
+void ktime_init(void)
+{
+	const char *source;
+
+	if (hpet_hz != 0) {
+		tsc_hz = hpet_calibrate_tsc();
+		source = "HPET";
+	} else {
+		tsc_hz = pit_calibrate_tsc(10);
+		source = "PIT";
+	}
+	ns_mult = ns_mult_of(tsc_hz);
+	tsc_base = read_tsc();
+
+	if (hpet_counter_64bit)
+		hpet_ns_mult = ns_mult_of(hpet_hz);
+
+	tsc_reliable = tsc_invariant();
+	printk("Time: %lu.%lu MHz TSC (%s-calibrated), %s\n",
+	       tsc_hz / 1000000, (tsc_hz % 1000000) / 100000, source,
+	       tsc_reliable ? "invariant" : (hpet_ns_mult != 0) ?
+	       "not invariant; using the HPET" :
+	       "not invariant; using scheduler ticks");
+}
+
+/*
+ * The secondary core side, run with IRQs disabled
+ */
+static void tsc_sync_secondary(__unused void *arg)
+{
+	uint64_t t0, t2, rtt, best = UINT64_MAX;
+	int64_t offset = 0;
+
+	for (int round = 1; round <= SYNC_ROUNDS; round++) {
+		t0 = read_tsc();
+		handshake.request = round;
+		while (handshake.reply != round)
+			cpu_pause();
+		t2 = read_tsc();
+
+		rtt = t2 - t0;
+		if (rtt < best) {
+			best = rtt;
+			offset = (int64_t)(t0 + rtt / 2 - handshake.tsc);
+		}
+	}
+
+	handshake.offset = offset;
+	handshake.done = true;
+}
+
+static void tsc_sync_cpu(int cpu)
+{
+	union x86_rflags flags;
+
+	handshake.request = handshake.reply = 0;
+	handshake.done = false;
+	if (smp_call_function_single(cpu, tsc_sync_secondary, NULL,
+				     false) != 0)
+		panic("Time: CPU#%d is not running", cpu);
+
+	flags = local_irq_disable_save();
+	for (int round = 1; round <= SYNC_ROUNDS; round++) {
+		while (handshake.request != round)
+			cpu_pause();
+		handshake.tsc = read_tsc();
+		handshake.reply = round;
+	}
+	while (!handshake.done)
+		cpu_pause();
+	local_irq_restore(flags);
+
+	cpus[cpu]->tsc_offset = handshake.offset;
+}
+
+/*
+ * Measure each secondary core TSC offset from ours. Call on
+ * the bootstrap core, once all the cores are up.
+ */
+void ktime_sync_cpus(void)
+{
+	int64_t offset, worst = 0;
+
+	if (!tsc_reliable)
+		return;
+
+	for (int cpu = 1; cpu < mptables_get_nr_cpus(); cpu++) {
+		if (!smpboot_cpu_alive(cpu))
+			continue;
+		tsc_sync_cpu(cpu);
+		offset = cpus[cpu]->tsc_offset;
+		worst = max(worst, (offset < 0) ? -offset : offset);
+	}
+
+	printk("Time: Max TSC offset between cores: %ld cycles\n", worst);
+}
+
+#if	KTIME_TESTS
+
+static void test_monotonic(void)
+{
+	uint64_t prev, now;
+
+	prev = ktime_get_ns();
+	for (int i = 0; i < 1000000; i++) {
+		now = ktime_get_ns();
+		if (now < prev)
+			panic("_Time: FAIL: Clock went back from %lu to %lu "
+			      "ns", prev, now);
+		prev = now;
+	}
+
+	printk("_Time: Monotonic: Success\n");
+}
+
+/*
+ * Compare against a PIT-timed 100ms, with a 2% tolerance
+ */
+static void test_rate(void)
+{
+	uint64_t start, elapsed;
+
+	start = ktime_get_ns();
+	for (int i = 0; i < 10; i++)
+		pit_mdelay(10);
+	elapsed = ktime_get_ns() - start;
+
+	if (elapsed < 98 * NSEC_PER_MSEC || elapsed > 102 * NSEC_PER_MSEC)
+		panic("_Time: FAIL: 100ms PIT delay took %lu ns", elapsed);
+
+	printk("_Time: 100ms PIT delay took %lu ns: Success\n", elapsed);
+}
+
+static void read_time(void *arg)
+{
+	*(uint64_t *)arg = ktime_get_ns();
+}
+
+/*
+ * A remote core reading must fall between ours, taken
+ * before the call and after its completion.
+ */
+static void test_cpus(void)
+{
+	uint64_t before, remote, after;
+	int nr_cpus = smpboot_get_nr_alive_cpus();
+
+	for (int cpu = 1; cpu < nr_cpus; cpu++) {
+		before = ktime_get_ns();
+		smp_call_function_single(cpu, read_time, &remote, true);
+		after = ktime_get_ns();
+
+		if (remote < before || remote > after)
+			panic("_Time: FAIL: CPU#%d read %lu ns; outside of "
+			      "[%lu, %lu]", cpu, remote, before, after);
+	}
+
+	printk("_Time: Cross-CPU ordering on %d CPU(s): Success\n", nr_cpus);
+}
+
+void ktime_run_tests(void)
+{
+	if (!tsc_reliable) {
+		printk("_Time: No invariant TSC; skipping tests\n");
+		return;
+	}
+
+	test_monotonic();
+	test_rate();
+	test_cpus();
+}
+
+#endif	/* KTIME_TESTS */
@@ -15,15 +15,25 @@
 #include <sections.h>
 #include <segment.h>
 #include <idt.h>
+#include <irq.h>
+#include <ktime.h>
 #include <vectors.h>
 #include <mptables.h>
+#include <acpi.h>
 #include <serial.h>
 #include <pit.h>
+#include <hpet.h>
 #include <pic.h>
 #include <apic.h>
 #include <ioapic.h>
 #include <keyboard.h>
+#include <pci.h>
+#include <virtio.h>
+#include <bcache.h>
+#include <flusher.h>
+#include <irqbalance.h>
 #include <smpboot.h>
+#include <smp.h>
 #include <ramdisk.h>
 #include <e820.h>
 #include <mm.h>
@@ -35,6 +45,7 @@
 #include <sched.h>
 #include <ext2.h>
 #include <file.h>
+#include <io_ring.h>
 
 static void setup_idt(void)
 {
@@ -86,10 +97,17 @@ static void run_test_cases(void)
 	apic_run_tests();
 	percpu_run_tests();
 	atomic_run_tests();
+	irq_run_tests();
+	ktime_run_tests();
+	smp_run_tests();
 	sched_run_tests();
+	virtio_blk_run_tests();
+	ramdisk_run_tests();
 	ext2_run_tests();
 	ext2_run_smp_tests();
 	file_run_tests();
+	io_ring_run_tests();
+	ext2_run_benchmarks();
 }
 
 /*
@@ -141,23 +159,43 @@ void __no_return kernel_start(void)
 	 */
 
 	/* Discover our secondary-CPUs and system IRQs layout before
-	 * initializing the local APICs */
-	mptables_init();
+	 * initializing the local APICs: through the ACPI MADT, or the
+	 * MP tables for older firmware */
+	if (acpi_init() != 0)
+		mptables_init();
 
 	/* Remap and mask the PIC; it's just a disturbance */
 	serial_init();
 	pic_init();
 
+	/* All other vectors go through the generic IRQ layer */
+	irq_init();
+
+	/* Calibrate the TSC, our monotonic clock, against the HPET
+	 * if the ACPI tables listed one, or against the PIT */
+	hpet_init();
+	ktime_init();
+
 	/* Initialize the APICs (and map their MMIO regs) before enabling
 	 * IRQs, and before firing other cores using Inter-CPU Interrupts */
 	apic_init();
 	ioapic_init();
 
+	/* Serial output is IRQ-driven from now on */
+	serial_irq_init();
+
 	/* SMP infrastructure ready, fire the CPUs! */
+	smp_init();
 	smpboot_init();
+	ktime_sync_cpus();
 
 	keyboard_init();
 
+	/* Discover PCI devices, and bring up their drivers */
+	pci_init();
+	virtio_blk_init();
+	bcache_init();
+
 	/* Startup finished, roll-in the scheduler! */
 	sched_init();
 	local_irq_enable();
@@ -166,6 +204,8 @@ void __no_return kernel_start(void)
 	 * Second part of kernel initialization (Scheduler is now on!)
 	 */
 
+	flusher_init();
+	irqbalance_init();
 	ext2_init();
 
 	// Signal the secondary cores to run their own test-cases code.
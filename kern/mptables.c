@@ -25,6 +25,7 @@
 #include <smpboot.h>
 #include <percpu.h>
 #include <proc.h>
+#include <kmalloc.h>
 
 /*
  * BIOS-reported usable cores count
@@ -41,13 +42,17 @@ static int nr_cpus = 1;
  *
  * To make '__current' available to early boot code, it's statically
  * allocated in the first slot. Thus, slot 0 is reserved for the BSC.
+ * Other cores' areas are allocated as they get discovered: only the
+ * actually usable ones cost memory.
  */
 extern struct proc swapper;
-struct percpu cpus[CPUS_MAX] = {
-	[0] = {
-		.__current = &swapper,
-	},
+struct percpu bootstrap_percpu = {
+	.__current = &swapper,
 };
+struct percpu *cpus[CPUS_MAX] = {
+	[0] = &bootstrap_percpu,
+};
+static bool bsc_entry_filled;
 
 /*
  * Parsed MP configuration table entries data to be exported
@@ -55,6 +60,7 @@ struct percpu cpus[CPUS_MAX] = {
  */
 
 int mp_isa_busid = -1;
+int mp_pci_busid = -1;
 
 int nr_mpcirqs;
 #define MAX_IRQS	(0xff - 0x1f)
@@ -203,20 +209,16 @@ static void mpc_dump(struct mpc_table *mpc)
  * tables again.
  */
 
-static void parse_cpu(void *addr)
+void mp_add_cpu(int apic_id, bool bootstrap)
 {
-	struct mpc_cpu *cpu = addr;
-	static bool bsc_entry_filled;
-
-	if (!cpu->enabled)
-		return;
+	struct percpu *cpu;
 
-	if (cpu->bsc) {
+	if (bootstrap) {
 		if (bsc_entry_filled)
 			panic("Two `bootstrap' cores in the MP tables! "
 			      "Either the BIOS or our parser is buggy.");
 
-		cpus[0].apic_id = cpu->lapic_id;
+		cpus[0]->apic_id = apic_id;
 		bsc_entry_filled = 1;
 		return;
 	}
@@ -224,33 +226,38 @@ static void parse_cpu(void *addr)
 	if (nr_cpus >= CPUS_MAX)
 		panic("Only %d logical CPU cores supported\n", nr_cpus);
 
-	cpus[nr_cpus].apic_id = cpu->lapic_id;
+	/* Power-of-2 kmalloc buffers are naturally aligned */
+	cpu = kmalloc(sizeof(*cpu));
+	assert(is_aligned((uintptr_t)cpu, CACHE_LINE_SIZE));
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->apic_id = apic_id;
+	cpu->id = nr_cpus;
+	cpus[nr_cpus] = cpu;
 
 	++nr_cpus;
 }
 
-static void parse_ioapic(void *addr)
+bool mp_bootstrap_found(void)
 {
-	struct mpc_ioapic *ioapic = addr;
-
-	if (!ioapic->enabled)
-		return;
+	return bsc_entry_filled;
+}
 
+void mp_add_ioapic(uint8_t id, uint32_t base, uint32_t gsi_base)
+{
 	if (nr_ioapics >= IOAPICS_MAX)
 		panic("Only %d IO APICs supported", IOAPICS_MAX);
 
 	/* We read the version from the chip itself instead
 	 * of reading it now from the mptable entries */
-	ioapic_descs[nr_ioapics].id = ioapic->id;
-	ioapic_descs[nr_ioapics].base = ioapic->base;
+	ioapic_descs[nr_ioapics].id = id;
+	ioapic_descs[nr_ioapics].base = base;
+	ioapic_descs[nr_ioapics].gsi_base = gsi_base;
 
 	++nr_ioapics;
 }
 
-static void parse_irq(void *addr)
+void mp_add_irq(struct mpc_irq *irq)
 {
-	struct mpc_irq *irq = addr;
-
 	if (nr_mpcirqs >= MAX_IRQS)
 		panic("Only %d IRQ sources supported", MAX_IRQS);
 
@@ -259,13 +266,41 @@ static void parse_irq(void *addr)
 	++nr_mpcirqs;
 }
 
+static void parse_cpu(void *addr)
+{
+	struct mpc_cpu *cpu = addr;
+
+	if (!cpu->enabled)
+		return;
+
+	mp_add_cpu(cpu->lapic_id, cpu->bsc);
+}
+
+static void parse_ioapic(void *addr)
+{
+	struct mpc_ioapic *ioapic = addr;
+
+	if (!ioapic->enabled)
+		return;
+
+	mp_add_ioapic(ioapic->id, ioapic->base, 0);
+}
+
+static void parse_irq(void *addr)
+{
+	mp_add_irq(addr);
+}
+
 static void parse_bus(void *addr)
 {
 	struct mpc_bus *bus = addr;
 
-	/* Only the ISA bus is needed for now */
+	/* Only the ISA and the root PCI bus are needed for now */
 	if (memcmp("ISA", bus->type, sizeof("ISA") - 1) == 0)
 		mp_isa_busid = bus->id;
+	if (memcmp("PCI", bus->type, sizeof("PCI") - 1) == 0 &&
+	    mp_pci_busid == -1)
+		mp_pci_busid = bus->id;
 
 	return;
 }
@@ -15,6 +15,7 @@
 #include <spinlock.h>
 #include <percpu.h>
 #include <smpboot.h>
+#include <serial.h>
 
 static char buf[256];
 static spinlock_t panic_lock = SPIN_UNLOCKED();
@@ -81,6 +82,9 @@ void __no_return panic(const char *fmt, ...)
 	 * away our message.  Acquire all screen locks, forever. */
 	printk_bust_all_locks();
 
+	/* Don't lose the buffered serial output; poll from now on */
+	serial_bust_locks();
+
 halt:
 	halt();
 }
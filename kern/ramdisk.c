@@ -13,6 +13,15 @@
  * Check the 'build-hdimage.py' script and the early assembly code which
  * loads the ramdisk for details & rationale. Check them NOW as the info
  * stated there will NOT be redundantly repeated here!
+ *
+ * The image can also be LZ4-compressed, in independent fixed-size chunks,
+ * to cut its disk load time. It's then inflated in a separate area after
+ * the compressed one: by secondary cores, in parallel, as soon as they
+ * are up; and by anyone accessing the disk, for still-compressed chunks
+ * covered by the access.
+ *
+ * Copy-on-write snapshots give a consistent point-in-time view of the
+ * ramdisk, for checkpoints, without copying it as a whole; see below.
  */
 
 #include <kernel.h>
@@ -21,6 +30,17 @@
 #include <paging.h>
 #include <sections.h>
 #include <ramdisk.h>
+#include <errno.h>
+#include <list.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <kmalloc.h>
+#include <mm.h>
+#include <lz4.h>
+#include <blkdev.h>
+#include <iosched.h>
+#include <bcache.h>
+#include <tests.h>
 
 /*
  * Ramdisk header format.
@@ -28,6 +48,7 @@
 #define RDSIG_LEN		8
 #define RDSIG_START		"CUTE-STA"
 #define RDSIG_END		"CUTE-END"
+#define RDSIG_LZ4		"CUTE-LZ4"
 
 static struct ramdisk_header {
 	char start_signature[RDSIG_LEN];
@@ -36,9 +57,31 @@ static struct ramdisk_header {
 	char end_signature[RDSIG_LEN];
 } __packed *rdheader;
 
+/*
+ * Compressed image header, at the start of the ramdisk
+ * area. A chunk whose compressed length equals its inflated
+ * length is stored as-is.
+ */
+static struct ramdisk_lz4_header {
+	char signature[RDSIG_LEN];
+	uint32_t chunk_size;		/* Inflated bytes per chunk */
+	uint32_t nr_chunks;
+	uint64_t length;		/* Inflated image length */
+	uint32_t chunk_offset[];	/* @nr_chunks + 1, from hdr start */
+} __packed *lz4header;
+
+struct chunk_state {
+	uint32_t claimed;		/* Bit 0: someone is inflating it */
+	volatile bool done;
+};
+
 static struct ramdisk {
 	char *buf;
 	int len;
+	struct chunk_state *chunks;	/* If compressed, else NULL */
+	uint64_t next_chunk;		/* Next chunk to inflate, in order */
+	uint64_t nr_inflated;
+	volatile bool inflated;		/* No compressed chunks remain */
 } ramdisk;
 
 /*
@@ -49,9 +92,249 @@ static struct ramdisk {
 void *ramdisk_memory_area_end(void)
 {
 	assert(rdheader != NULL);
+	if (ramdisk.chunks != NULL)
+		return ramdisk.chunks + lz4header->nr_chunks;
 	return (char *)ramdisk.buf + ramdisk.len;
 }
 
+/*
+ * Compressed ramdisks
+ */
+
+static void chunk_inflate(uint32_t i)
+{
+	uint32_t start, end;
+	char *src, *dst;
+	uint64_t src_len, dst_len;
+	int64_t ret;
+
+	start = lz4header->chunk_offset[i];
+	end = lz4header->chunk_offset[i + 1];
+	if (end < start || end > rdheader->length)
+		panic("Ramdisk: Corrupt compressed chunk #%d offsets", i);
+	src = (char *)lz4header + start;
+	src_len = end - start;
+	dst = ramdisk.buf + (uint64_t)i * lz4header->chunk_size;
+	dst_len = min((uint64_t)lz4header->chunk_size,
+		      ramdisk.len - (uint64_t)i * lz4header->chunk_size);
+
+	if (src_len == dst_len) {
+		memcpy(dst, src, dst_len);
+	} else {
+		ret = lz4_decompress(src, src_len, dst, dst_len);
+		if (ret != (int64_t)dst_len)
+			panic("Ramdisk: Corrupt compressed chunk #%d", i);
+	}
+
+	barrier();
+	ramdisk.chunks[i].done = true;
+	if (atomic_inc(&ramdisk.nr_inflated) + 1 == lz4header->nr_chunks) {
+		ramdisk.inflated = true;
+		printk("Ramdisk: Inflated %d KB, %d chunks\n",
+		       ramdisk.len / 1024, lz4header->nr_chunks);
+	}
+}
+
+/*
+ * Assure chunk #@i is inflated: do it ourselves, or wait
+ * for whoever claimed it first.
+ */
+static void chunk_get(uint32_t i)
+{
+	struct chunk_state *chunk = &ramdisk.chunks[i];
+
+	if (chunk->done)
+		return;
+
+	if (!atomic_bit_test_and_set(&chunk->claimed)) {
+		chunk_inflate(i);
+		return;
+	}
+
+	while (!chunk->done)
+		cpu_pause();
+}
+
+static void ramdisk_inflate_range(uint64_t offset, uint64_t len)
+{
+	uint32_t first, last;
+
+	first = offset / lz4header->chunk_size;
+	last = (offset + len - 1) / lz4header->chunk_size;
+	for (uint32_t i = first; i <= last; i++)
+		chunk_get(i);
+}
+
+/*
+ * Inflate still-compressed chunks till none remain unclaimed.
+ * Called by each secondary core once up; all cores thus share
+ * the work, picking the next chunk in order.
+ */
+void ramdisk_inflate(void)
+{
+	uint64_t i;
+
+	if (ramdisk.inflated)
+		return;
+
+	while ((i = atomic_inc(&ramdisk.next_chunk)) < lz4header->nr_chunks) {
+		if (!atomic_bit_test_and_set(&ramdisk.chunks[i].claimed))
+			chunk_inflate(i);
+	}
+}
+
+/*
+ * Copy-on-write snapshots
+ *
+ * A snapshot starts empty: its blocks are read from the ramdisk itself.
+ * Before a write first modifies a block after the snapshot was taken,
+ * the block's old contents get copied to a page owned by the snapshot.
+ * A snapshot thus costs memory and time proportional to what changed
+ * since it was taken, not to the ramdisk size; its map of copied blocks
+ * also doubles as the set of blocks changed since then.
+ *
+ * Writes are done, and snapshots taken or read, under @snap_lock: a
+ * snapshot never sees a half-written block.
+ */
+
+#define SNAP_MAP_ENTRIES	(PAGE_SIZE / sizeof(char *))
+
+struct snap_leaf {
+	char *blocks[SNAP_MAP_ENTRIES];	/* Preserved copy, or NULL */
+};
+
+struct ramdisk_snapshot {
+	struct snap_leaf **map;		/* Page of leaves, or NULLs */
+	uint64_t nr_changed;		/* Blocks copied so far */
+	struct list_node node;		/* Active snapshots list */
+};
+
+static LIST_NODE(snapshots);
+static spinlock_t snap_lock = SPIN_UNLOCKED();
+
+static uint64_t snap_nr_blocks(void)
+{
+	return ceil_div(ramdisk.len, RAMDISK_BLOCK_SIZE);
+}
+
+static uint64_t snap_block_len(uint64_t block)
+{
+	return min((uint64_t)RAMDISK_BLOCK_SIZE,
+		   ramdisk.len - block * RAMDISK_BLOCK_SIZE);
+}
+
+/*
+ * Return @snap's map entry for @block. If its leaf does not
+ * exist, allocate it if @alloc is set, or return NULL.
+ */
+static char **snap_entry(struct ramdisk_snapshot *snap, uint64_t block,
+			 bool alloc)
+{
+	struct snap_leaf **leaf;
+
+	leaf = &snap->map[block / SNAP_MAP_ENTRIES];
+	if (*leaf == NULL) {
+		if (!alloc)
+			return NULL;
+		*leaf = page_address(get_zeroed_page(ZONE_ANY));
+	}
+
+	return &(*leaf)->blocks[block % SNAP_MAP_ENTRIES];
+}
+
+/*
+ * Preserve, for all snapshots, the blocks a write of @len bytes
+ * at @offset is about to modify. Called with @snap_lock held.
+ */
+static void snapshots_cow(uint64_t offset, uint64_t len)
+{
+	struct ramdisk_snapshot *snap;
+	uint64_t first, last;
+	char **copy;
+
+	first = offset / RAMDISK_BLOCK_SIZE;
+	last = (offset + len - 1) / RAMDISK_BLOCK_SIZE;
+	list_for_each(&snapshots, snap, node) {
+		for (uint64_t block = first; block <= last; block++) {
+			copy = snap_entry(snap, block, true);
+			if (*copy != NULL)
+				continue;
+
+			*copy = page_address(get_free_page(ZONE_ANY));
+			memcpy(*copy, ramdisk.buf + block * RAMDISK_BLOCK_SIZE,
+			       snap_block_len(block));
+			snap->nr_changed++;
+		}
+	}
+}
+
+/*
+ * The ramdisk as a block device: all requests complete synchronously
+ */
+static void ramdisk_submit(__unused struct block_device *bdev, struct bio *rq)
+{
+	struct bio *bio;
+	uint64_t offset, len;
+	char *addr;
+
+	rq_for_each_bio(bio, rq) {
+		offset = bio->sector << SECTOR_SHIFT;
+		addr = ramdisk.buf + offset;
+		len = bio->nr_sectors << SECTOR_SHIFT;
+		if (!ramdisk.inflated)
+			ramdisk_inflate_range(offset, len);
+		switch (bio->op) {
+		case BIO_READ:
+			memcpy(bio->buf, addr, len);
+			break;
+		case BIO_WRITE:
+			spin_lock(&snap_lock);
+			if (!list_empty(&snapshots))
+				snapshots_cow(offset, len);
+			memcpy(addr, bio->buf, len);
+			spin_unlock(&snap_lock);
+			break;
+		}
+	}
+	bio_endio(rq, 0);
+}
+
+static struct block_device_ops ramdisk_ops = {
+	.submit = ramdisk_submit,
+};
+
+/* No seeks, and nothing to wait for: no reordering or holding back */
+static struct block_device ramdisk_bdev = {
+	.name = "ram0",
+	.ops = &ramdisk_ops,
+	.max_segments = 32,
+	.iosched = &noop_iosched,
+};
+
+/*
+ * Reserve the inflated image area, and its chunks state,
+ * directly after the compressed image.
+ */
+static void ramdisk_lz4_init(void)
+{
+	lz4header = (struct ramdisk_lz4_header *)ramdisk.buf;
+	if (lz4header->length > INT32_MAX || lz4header->chunk_size == 0 ||
+	    lz4header->nr_chunks != ceil_div(lz4header->length,
+					      lz4header->chunk_size))
+		panic("Ramdisk: Invalid compressed image header");
+
+	printk("Ramdisk: LZ4-compressed, %d KB => %d KB\n",
+	       ramdisk.len / 1024, lz4header->length / 1024);
+
+	ramdisk.buf = (char *)round_up((uintptr_t)ramdisk.buf + ramdisk.len,
+				       PAGE_SIZE);
+	ramdisk.len = lz4header->length;
+	ramdisk.chunks = (struct chunk_state *)(ramdisk.buf + ramdisk.len);
+	memset(ramdisk.chunks, 0,
+	       lz4header->nr_chunks * sizeof(ramdisk.chunks[0]));
+	ramdisk.inflated = (lz4header->nr_chunks == 0);
+}
+
 void ramdisk_init(void)
 {
 	/* Ramdisk header is loaded directly after kernel image */
@@ -63,11 +346,135 @@ void ramdisk_init(void)
 
 	ramdisk.buf = (char *)(rdheader + 1);
 	ramdisk.len = rdheader->length;
-	if (ramdisk.len != 0)
-		printk("Ramdisk: start address = 0x%lx, length = %d KB\n",
-		       ramdisk.buf, ramdisk.len / 1024);
-	else
+	ramdisk.inflated = true;
+	if (ramdisk.len == 0) {
 		printk("Ramdisk: No disk image loaded\n");
+		return;
+	}
+
+	if (ramdisk.len > (int)sizeof(*lz4header) &&
+	    !memcmp(ramdisk.buf, RDSIG_LZ4, RDSIG_LEN))
+		ramdisk_lz4_init();
+
+	printk("Ramdisk: start address = 0x%lx, length = %d KB\n",
+	       ramdisk.buf, ramdisk.len / 1024);
+	ramdisk_bdev.nr_sectors = ramdisk.len >> SECTOR_SHIFT;
+	blkdev_register(&ramdisk_bdev);
+}
+
+/*
+ * Take a snapshot of the ramdisk, including the writes still
+ * in the page cache. Snapshots are independent of each other.
+ */
+struct ramdisk_snapshot *ramdisk_snapshot_create(void)
+{
+	struct ramdisk_snapshot *snap;
+
+	assert(snap_nr_blocks() <= SNAP_MAP_ENTRIES * SNAP_MAP_ENTRIES);
+
+	snap = kmalloc(sizeof(*snap));
+	snap->map = page_address(get_zeroed_page(ZONE_ANY));
+	snap->nr_changed = 0;
+
+	bcache_sync(&ramdisk_bdev);
+
+	spin_lock(&snap_lock);
+	list_add_tail(&snapshots, &snap->node);
+	spin_unlock(&snap_lock);
+	return snap;
+}
+
+void ramdisk_snapshot_destroy(struct ramdisk_snapshot *snap)
+{
+	struct snap_leaf *leaf;
+
+	spin_lock(&snap_lock);
+	list_del(&snap->node);
+	spin_unlock(&snap_lock);
+
+	for (uint64_t i = 0; i < SNAP_MAP_ENTRIES; i++) {
+		leaf = snap->map[i];
+		if (leaf == NULL)
+			continue;
+		for (uint64_t j = 0; j < SNAP_MAP_ENTRIES; j++) {
+			if (leaf->blocks[j] != NULL)
+				free_page(addr_to_page(leaf->blocks[j]));
+		}
+		free_page(addr_to_page(leaf));
+	}
+	free_page(addr_to_page(snap->map));
+	kfree(snap);
+}
+
+/*
+ * Stream-out: copy @len bytes of the snapshot, starting from
+ * @offset, to @buf. Return zero, or -EINVAL if out of bounds.
+ */
+int ramdisk_snapshot_read(struct ramdisk_snapshot *snap, uint64_t offset,
+			  void *buf, uint64_t len)
+{
+	uint64_t block, block_offset, n;
+	char *dst = buf, **copy, *src;
+
+	if (offset > (uint64_t)ramdisk.len || len > ramdisk.len - offset)
+		return -EINVAL;
+	if (!ramdisk.inflated && len != 0)
+		ramdisk_inflate_range(offset, len);
+
+	while (len != 0) {
+		block = offset / RAMDISK_BLOCK_SIZE;
+		block_offset = offset % RAMDISK_BLOCK_SIZE;
+		n = min(len, RAMDISK_BLOCK_SIZE - block_offset);
+
+		spin_lock(&snap_lock);
+		copy = snap_entry(snap, block, false);
+		if (copy != NULL && *copy != NULL)
+			src = *copy;
+		else
+			src = ramdisk.buf + block * RAMDISK_BLOCK_SIZE;
+		memcpy(dst, src + block_offset, n);
+		spin_unlock(&snap_lock);
+
+		dst += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Return the first block, starting from @block, changed since
+ * @snap was taken; or -ENOENT. For incremental checkpoints:
+ * only such blocks differ between @snap and the ramdisk.
+ */
+int64_t ramdisk_snapshot_next_changed(struct ramdisk_snapshot *snap,
+				      uint64_t block)
+{
+	struct snap_leaf *leaf;
+	uint64_t nr_blocks;
+
+	nr_blocks = snap_nr_blocks();
+	spin_lock(&snap_lock);
+	for (; block < nr_blocks; block++) {
+		leaf = snap->map[block / SNAP_MAP_ENTRIES];
+		if (leaf == NULL) {
+			block |= SNAP_MAP_ENTRIES - 1;
+			continue;
+		}
+		if (leaf->blocks[block % SNAP_MAP_ENTRIES] != NULL) {
+			spin_unlock(&snap_lock);
+			return block;
+		}
+	}
+	spin_unlock(&snap_lock);
+
+	return -ENOENT;
+}
+
+uint64_t ramdisk_snapshot_nr_changed(struct ramdisk_snapshot *snap)
+{
+	return snap->nr_changed;
 }
 
 /*
@@ -85,3 +492,81 @@ char *ramdisk_get_buf(void)
 	assert(rdheader != NULL);
 	return ramdisk.buf;
 }
+
+/*
+ * Test cases
+ */
+
+#if	RAMDISK_TESTS
+
+/*
+ * Modify the ramdisk's last full block under snapshots, then
+ * restore it. NOTE! This goes directly to the device, behind
+ * the page cache's back: restore the original data on return.
+ */
+void ramdisk_run_tests(void)
+{
+	struct ramdisk_snapshot *snap1, *snap2;
+	uint64_t block, offset, sector, nr_sectors;
+	char *orig, *new, *buf;
+
+	if (ramdisk.len < RAMDISK_BLOCK_SIZE) {
+		printk("_Ramdisk: No disk image; skipping snapshot tests\n");
+		return;
+	}
+
+	block = ramdisk.len / RAMDISK_BLOCK_SIZE - 1;
+	offset = block * RAMDISK_BLOCK_SIZE;
+	sector = offset >> SECTOR_SHIFT;
+	nr_sectors = RAMDISK_BLOCK_SIZE >> SECTOR_SHIFT;
+
+	orig = kmalloc(RAMDISK_BLOCK_SIZE);
+	new = kmalloc(RAMDISK_BLOCK_SIZE);
+	buf = kmalloc(RAMDISK_BLOCK_SIZE);
+
+	assert(!blkdev_rw(&ramdisk_bdev, BIO_READ, sector, orig, nr_sectors));
+	for (int i = 0; i < RAMDISK_BLOCK_SIZE; i++)
+		new[i] = ~orig[i];
+
+	snap1 = ramdisk_snapshot_create();
+	assert(ramdisk_snapshot_next_changed(snap1, 0) == -ENOENT);
+
+	assert(!blkdev_rw(&ramdisk_bdev, BIO_WRITE, sector, new, nr_sectors));
+	snap2 = ramdisk_snapshot_create();
+
+	/* First snapshot has the old data, the second one the new */
+	assert(!ramdisk_snapshot_read(snap1, offset, buf, RAMDISK_BLOCK_SIZE));
+	assert(!memcmp(buf, orig, RAMDISK_BLOCK_SIZE));
+	assert(!ramdisk_snapshot_read(snap2, offset, buf, RAMDISK_BLOCK_SIZE));
+	assert(!memcmp(buf, new, RAMDISK_BLOCK_SIZE));
+	assert(ramdisk_snapshot_next_changed(snap1, 0) == (int64_t)block);
+	assert(ramdisk_snapshot_next_changed(snap1, block + 1) == -ENOENT);
+	assert(ramdisk_snapshot_nr_changed(snap1) == 1);
+	assert(ramdisk_snapshot_next_changed(snap2, 0) == -ENOENT);
+
+	/* Restore: both snapshots must keep their views */
+	assert(!blkdev_rw(&ramdisk_bdev, BIO_WRITE, sector, orig, nr_sectors));
+	assert(ramdisk_snapshot_nr_changed(snap1) == 1);
+	assert(ramdisk_snapshot_next_changed(snap2, 0) == (int64_t)block);
+	assert(!ramdisk_snapshot_read(snap1, offset, buf, RAMDISK_BLOCK_SIZE));
+	assert(!memcmp(buf, orig, RAMDISK_BLOCK_SIZE));
+	assert(!ramdisk_snapshot_read(snap2, offset, buf, RAMDISK_BLOCK_SIZE));
+	assert(!memcmp(buf, new, RAMDISK_BLOCK_SIZE));
+	assert(!blkdev_rw(&ramdisk_bdev, BIO_READ, sector, buf, nr_sectors));
+	assert(!memcmp(buf, orig, RAMDISK_BLOCK_SIZE));
+
+	/* Partial blocks, and bounds */
+	assert(!ramdisk_snapshot_read(snap1, offset + 100, buf, 1000));
+	assert(!memcmp(buf, orig + 100, 1000));
+	assert(ramdisk_snapshot_read(snap1, ramdisk.len, buf, 1) == -EINVAL);
+
+	ramdisk_snapshot_destroy(snap1);
+	ramdisk_snapshot_destroy(snap2);
+	kfree(orig);
+	kfree(new);
+	kfree(buf);
+
+	printk("_Ramdisk: Snapshot tests: Success\n");
+}
+
+#endif	/* RAMDISK_TESTS */
@@ -42,6 +42,7 @@
 #include <proc.h>
 #include <kmalloc.h>
 #include <sched.h>
+#include <smp.h>
 #include <conf_sched.h>
 #include <tests.h>
 
@@ -184,6 +185,7 @@ void sched_enqueue(struct proc *proc)
 	proc->enter_runqueue_ts = PS->sys_ticks;
 	proc->state = TD_RUNNABLE;
 	proc->runtime = 0;
+	proc->cpu = percpu_get(id);
 
 	list_add_tail(&PS->just_queued, &proc->pnode);
 
@@ -329,6 +331,108 @@ struct proc *sched_tick(void)
 	return current;
 }
 
+/*
+ * Voluntary yield, from the `int' handler: give the CPU to the next
+ * runnable thread, if any. Unlike a finished slice, this is no CPU
+ * hog behaviour: keep the thread priority. A parking thread is not
+ * queued back at all.
+ */
+struct proc *sched_yield_tick(void)
+{
+	struct proc *new_proc;
+	int new_prio;
+
+	assert(current->state == TD_ONCPU || current->state == TD_PARKED);
+
+	new_proc = dispatch_runnable_proc(&new_prio);
+	if (new_proc == NULL)
+		return current;
+
+	if (current->state == TD_ONCPU)
+		rq_add_proc(PS->rq_expired, current, PS->current_prio);
+	return preempt(new_proc, new_prio);
+}
+
+static inline void __sched_yield(void)
+{
+	asm volatile ("int %0"
+		      ::"i"(SCHED_YIELD_VECTOR)
+		      :"cc", "memory");
+}
+
+/* `sti' takes effect after `hlt': no wakeup IRQ is lost */
+static inline void __sched_idle(void)
+{
+	asm volatile ("sti; hlt; cli"
+		      ::
+		      :"cc", "memory");
+}
+
+/*
+ * Let other threads run; for polling loops, e.g. waiting for the
+ * ticks counter to advance. If no other thread is runnable, halt
+ * the CPU till the next interrupt instead.
+ */
+void sched_yield(void)
+{
+	union x86_rflags flags;
+
+	flags = local_irq_disable_save();
+
+	if (list_empty(&PS->just_queued) && rq_empty(PS->rq_active) &&
+	    rq_empty(PS->rq_expired))
+		__sched_idle();
+	else
+		__sched_yield();
+
+	local_irq_restore(flags);
+}
+
+/*
+ * Take current thread off the runqueues till sched_unpark() gets
+ * called on it. Return right away if it got called meanwhile: no
+ * wakeup is lost between checking the park condition and parking.
+ */
+void sched_park(void)
+{
+	union x86_rflags flags;
+
+	flags = local_irq_disable_save();
+
+	while (!current->unparked) {
+		current->state = TD_PARKED;
+		__sched_yield();
+
+		/* Nothing else to run? Wait right here */
+		if (current->state == TD_PARKED) {
+			current->state = TD_ONCPU;
+			__sched_idle();
+		}
+	}
+	current->unparked = false;
+
+	local_irq_restore(flags);
+}
+
+/*
+ * Runqueues are per-CPU, and are only touched with IRQs off: queue
+ * the thread back from its own CPU. Its sched_park() either already
+ * switched away, or will see the flag; IRQs are off in between.
+ */
+static void __sched_unpark(void *arg)
+{
+	struct proc *proc = arg;
+
+	proc->unparked = true;
+	if (proc->state == TD_PARKED)
+		sched_enqueue(proc);
+}
+
+void sched_unpark(struct proc *proc)
+{
+	smp_call_function_single(proc->cpu, __sched_unpark, proc, false);
+}
+
 /*
  * Let current CPU-init code path be a schedulable entity.
  *
@@ -362,12 +466,14 @@ void schedulify_this_code_path(enum cpu_type t)
 
 	proc_init(current);
 	current->state = TD_ONCPU;
+	current->cpu = percpu_get(id);
 	PS->current_prio = DEFAULT_PRIO;
 }
 
 void sched_init(void)
 {
 	extern void ticks_handler(void);
+	extern void sched_yield_handler(void);
 	uint8_t vector;
 
 	pcb_validate_offsets();
@@ -384,6 +490,8 @@ void sched_init(void)
 	set_intr_gate(vector, ticks_handler);
 	ioapic_setup_isairq(0, vector, IRQ_BROADCAST);
 
+	set_intr_gate(SCHED_YIELD_VECTOR, sched_yield_handler);
+
 	/*
 	 * We can program the PIT as one-shot and re-arm it in the
 	 * handler, or let it trigger IRQs monotonically. The arm
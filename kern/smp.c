@@ -0,0 +1,329 @@
+/*
+ * Cross-CPU function calls
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Each CPU has a lock-free queue of pending calls: a singly-linked
+ * stack that senders push to using cmpxchg, and which the target CPU
+ * empties at once, using xchg, from its IPI handler.
+ *
+ * An IPI is only sent if the target queue was empty. Otherwise, an
+ * IPI is already on its way, and the target will find our call in the
+ * same queue drain. Calls targeting all other CPUs at once are also
+ * announced with a single broadcast IPI.
+ *
+ * Called functions run in IRQ context with interrupts disabled: they
+ * must be short, and must never wait.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <errno.h>
+#include <atomic.h>
+#include <kmalloc.h>
+#include <percpu.h>
+#include <cpumask.h>
+#include <apic.h>
+#include <idt.h>
+#include <irq.h>
+#include <vectors.h>
+#include <smpboot.h>
+#include <smp.h>
+
+struct call_node;
+
+/*
+ * One cross-CPU call, shared by all of its targets
+ */
+struct smp_call {
+	void (*func)(void *);
+	void *arg;
+	uint64_t pending;		/* Targets yet to run @func */
+	bool wait;			/* Is the sender waiting for us? */
+	struct call_node *nodes;	/* Queue entries, one per target */
+};
+
+struct call_node {
+	struct call_node *next;
+	struct smp_call *call;
+};
+
+static void call_free(struct smp_call *call)
+{
+	kfree(call->nodes);
+	kfree(call);
+}
+
+/*
+ * A waiting sender frees the call itself. Otherwise, it's
+ * freed by the last target: nobody else references it.
+ */
+static void call_complete(struct smp_call *call)
+{
+	bool wait = call->wait;
+
+	if (atomic_dec(&call->pending) == 1 && !wait)
+		call_free(call);
+}
+
+/*
+ * Push @node to @cpu's calls queue. Return true if the queue was
+ * empty: no IPI is pending there, and the caller must send one.
+ */
+static bool call_queue_push(struct percpu *cpu, struct call_node *node)
+{
+	uint64_t head, old;
+
+	head = cpu->call_queue;
+	do {
+		old = head;
+		node->next = (struct call_node *)old;
+		head = atomic_cmpxchg(&cpu->call_queue, old, (uint64_t)node);
+	} while (head != old);
+
+	return old == 0;
+}
+
+static enum irqreturn smp_call_ipi(__unused void *data)
+{
+	struct call_node *node, *next, *fifo = NULL;
+
+	node = (struct call_node *)atomic_xchg(percpu_addr(call_queue), 0);
+
+	/* Pushes are LIFO: restore the calls order */
+	for (; node != NULL; node = next) {
+		next = node->next;
+		node->next = fifo;
+		fifo = node;
+	}
+
+	for (node = fifo; node != NULL; node = next) {
+		next = node->next;
+		node->call->func(node->call->arg);
+		call_complete(node->call);
+	}
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * A broadcast IPI if all other CPUs need one; otherwise one
+ * IPI per CPU. In x2APIC mode, each is a single MSR write.
+ */
+static void send_call_ipis(const struct cpumask *ipi, int nr_ipis)
+{
+	int cpu;
+
+	if (nr_ipis == 0)
+		return;
+
+	if (nr_ipis == smpboot_get_nr_alive_cpus() - 1) {
+		apic_broadcast_ipi(APIC_DELMOD_FIXED, SMP_CALL_IPI_VECTOR);
+		apic_ipi_acked();
+		return;
+	}
+
+	for_each_cpu(cpu, ipi) {
+		apic_send_ipi(cpus[cpu]->apic_id, APIC_DELMOD_FIXED,
+			      SMP_CALL_IPI_VECTOR);
+		apic_ipi_acked();
+	}
+}
+
+/*
+ * Run @func(@arg) on all @mask CPUs, including the calling CPU
+ * if it's in @mask. If @wait, return only once all of them are
+ * done. Return 0, or -ENODEV if a @mask CPU is not running.
+ *
+ * NOTE! Don't wait with interrupts disabled: two CPUs waiting
+ * for each other's calls would deadlock.
+ */
+int smp_call_function_many(const struct cpumask *mask, void (*func)(void *),
+			   void *arg, bool wait)
+{
+	struct smp_call *call = NULL;
+	struct cpumask ipi;
+	union x86_rflags flags;
+	int cpu, self, nr_targets, nr_ipis, n;
+
+	assert(!wait || get_rflags().irqs_enabled);
+
+	nr_targets = 0;
+	for_each_cpu(cpu, mask) {
+		if (!smpboot_cpu_alive(cpu))
+			return -ENODEV;
+		nr_targets++;
+	}
+
+	/* Our own call runs with IRQs off, as on other CPUs */
+	flags = local_irq_disable_save();
+	self = percpu_get(id);
+	if (cpumask_test_cpu(self, mask))
+		nr_targets--;
+
+	if (nr_targets != 0) {
+		call = kmalloc(sizeof(*call));
+		call->nodes = kmalloc(nr_targets * sizeof(*call->nodes));
+		call->func = func;
+		call->arg = arg;
+		call->pending = nr_targets;
+		call->wait = wait;
+
+		/* Once the last node is pushed, an async call can
+		 * get freed under our feet: don't touch it again */
+		cpumask_clear(&ipi);
+		nr_ipis = n = 0;
+		for_each_cpu(cpu, mask) {
+			if (cpu == self)
+				continue;
+			call->nodes[n].call = call;
+			if (call_queue_push(cpus[cpu], &call->nodes[n])) {
+				cpumask_set_cpu(cpu, &ipi);
+				nr_ipis++;
+			}
+			n++;
+		}
+		send_call_ipis(&ipi, nr_ipis);
+	}
+
+	if (cpumask_test_cpu(self, mask))
+		func(arg);
+	local_irq_restore(flags);
+
+	if (call != NULL && wait) {
+		while (call->pending != 0) {
+			barrier();
+			cpu_pause();
+		}
+		call_free(call);
+	}
+
+	return 0;
+}
+
+int smp_call_function_single(int cpu, void (*func)(void *), void *arg,
+			     bool wait)
+{
+	struct cpumask mask;
+
+	assert(cpu >= 0 && cpu < mptables_get_nr_cpus());
+	cpumask_clear(&mask);
+	cpumask_set_cpu(cpu, &mask);
+	return smp_call_function_many(&mask, func, arg, wait);
+}
+
+/*
+ * Run @func(@arg) on all other running CPUs
+ */
+int smp_call_function(void (*func)(void *), void *arg, bool wait)
+{
+	struct cpumask mask;
+	int self;
+
+	cpumask_clear(&mask);
+	self = percpu_get(id);
+	for (int cpu = 0; cpu < mptables_get_nr_cpus(); cpu++)
+		if (cpu != self && smpboot_cpu_alive(cpu))
+			cpumask_set_cpu(cpu, &mask);
+
+	return smp_call_function_many(&mask, func, arg, wait);
+}
+
+/*
+ * Before the secondary cores start: they share our IDT
+ */
+void smp_init(void)
+{
+	irq_register(SMP_CALL_IPI_VECTOR, smp_call_ipi, NULL, "smp-call");
+}
+
+#if	SMP_CALL_TESTS
+
+#include <ktime.h>
+
+static uint64_t calls_count;
+static int call_cpus[CPUS_MAX];
+
+static void record_cpu(void *arg)
+{
+	int *slot = arg;
+
+	*slot = percpu_get(id);
+}
+
+static void count_call(void *arg)
+{
+	atomic_inc(arg);
+}
+
+static void test_single(void)
+{
+	int nr_cpus = smpboot_get_nr_alive_cpus();
+
+	for (int cpu = 0; cpu < nr_cpus; cpu++) {
+		call_cpus[cpu] = -1;
+		if (smp_call_function_single(cpu, record_cpu, &call_cpus[cpu],
+					     true) != 0)
+			panic("_SMP: FAIL: Call on CPU#%d failed", cpu);
+		if (call_cpus[cpu] != cpu)
+			panic("_SMP: FAIL: Call for CPU#%d ran on CPU#%d",
+			      cpu, call_cpus[cpu]);
+	}
+
+	printk("_SMP: Single-CPU calls on %d CPU(s): Success\n", nr_cpus);
+}
+
+static void test_many(void)
+{
+	int nr_cpus = smpboot_get_nr_alive_cpus();
+	struct cpumask mask;
+
+	cpumask_clear(&mask);
+	for (int cpu = 0; cpu < nr_cpus; cpu++)
+		cpumask_set_cpu(cpu, &mask);
+
+	calls_count = 0;
+	for (int i = 0; i < 100; i++)
+		smp_call_function_many(&mask, count_call, &calls_count, true);
+	if (calls_count != 100UL * nr_cpus)
+		panic("_SMP: FAIL: %lu calls done, instead of %lu",
+		      calls_count, 100UL * nr_cpus);
+
+	printk("_SMP: Many-CPUs calls: Success\n");
+}
+
+/*
+ * Async calls coalesce: they're queued way faster than IPIs
+ * get handled. All of them must run nonetheless.
+ */
+static void test_async(void)
+{
+	int nr_others = smpboot_get_nr_alive_cpus() - 1;
+	uint64_t expected = 10000UL * nr_others;
+	int timeout = 1000;
+
+	calls_count = 0;
+	for (int i = 0; i < 10000; i++)
+		smp_call_function(count_call, &calls_count, false);
+
+	while (timeout-- && calls_count != expected)
+		mdelay(1);
+	if (calls_count != expected)
+		panic("_SMP: FAIL: %lu async calls done, instead of %lu",
+		      calls_count, expected);
+
+	printk("_SMP: %lu async calls: Success\n", expected);
+}
+
+void smp_run_tests(void)
+{
+	test_single();
+	test_many();
+	test_async();
+}
+
+#endif	/* SMP_CALL_TESTS */
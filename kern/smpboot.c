@@ -14,12 +14,15 @@
 #include <string.h>
 #include <apic.h>
 #include <idt.h>
-#include <pit.h>
+#include <ktime.h>
 #include <mptables.h>
 #include <proc.h>
 #include <percpu.h>
 #include <kmalloc.h>
 #include <sched.h>
+#include <ramdisk.h>
+#include <atomic.h>
+#include <cpumask.h>
 
 /*
  * Assembly trampoline code start and end pointers
@@ -35,9 +38,11 @@ struct smpboot_params {
 	struct idt_descriptor idtr;
 	struct gdt_descriptor gdtr;
 
-	/* Unique values for each core */
-	char *stack_ptr;
-	void *percpu_area_ptr;
+	/* Unique values for each core, indexed by APIC ID */
+	struct smpboot_cpu_params {
+		char *stack_ptr;
+		void *percpu_area_ptr;
+	} __packed cpus[SMPBOOT_APIC_IDS];
 } __packed;
 
 /*
@@ -71,11 +76,17 @@ static inline void smpboot_params_validate_offsets(void)
 	       offsetof(struct smpboot_params, gdtr) +
 	       offsetof(struct gdt_descriptor, base));
 
-	compiler_assert(SMPBOOT_STACK_PTR ==
-	       offsetof(struct smpboot_params, stack_ptr));
+	compiler_assert(SMPBOOT_CPUS ==
+	       offsetof(struct smpboot_params, cpus));
 
-	compiler_assert(SMPBOOT_PERCPU_PTR ==
-	       offsetof(struct smpboot_params, percpu_area_ptr));
+	compiler_assert(SMPBOOT_CPU_STACK_PTR ==
+	       offsetof(struct smpboot_cpu_params, stack_ptr));
+
+	compiler_assert(SMPBOOT_CPU_PERCPU_PTR ==
+	       offsetof(struct smpboot_cpu_params, percpu_area_ptr));
+
+	compiler_assert(SMPBOOT_CPU_SIZE ==
+	       sizeof(struct smpboot_cpu_params));
 
 	compiler_assert(SMPBOOT_PARAMS_SIZE ==
 	       sizeof(struct smpboot_params));
@@ -84,8 +95,25 @@ static inline void smpboot_params_validate_offsets(void)
 /*
  * Number of active CPUs so far: BSC + SIPI-started AP
  * cores that are now verifiably executing kernel code.
+ * Each core also checks-in its bit, by per-CPU id, in
+ * @alive_cpus: the BSC then knows who's still missing.
  */
-static int nr_alive_cpus = 1;
+static uint64_t nr_alive_cpus = 1;
+static struct cpumask alive_cpus = { .bits = { 0x1 } };
+
+/*
+ * NOTE! Can get called from IRQ context
+ */
+bool smpboot_cpu_alive(int cpu)
+{
+	barrier();
+	return cpumask_test_cpu(cpu, &alive_cpus);
+}
+
+static bool cpu_alive(struct percpu *cpu)
+{
+	return smpboot_cpu_alive(cpu->id);
+}
 
 /*
  * Common Inter-Processor Interrupts
@@ -118,99 +146,102 @@ static inline void send_startup_ipi(int apic_id, uint32_t start_vector)
  */
 #define MAX_SIPI_RETRY	3
 
+/*
+ * @cpu: iterator of type ‘struct percpu *’.
+ */
+#define for_all_cpus_from(cpu, start)				\
+	for (int __i = (start); __i < mptables_get_nr_cpus() &&	\
+		     ((cpu) = cpus[__i], true); __i++)
+#define for_all_cpus(cpu)			\
+	for_all_cpus_from(cpu, 0)
+#define for_all_cpus_except_bootstrap(cpu)	\
+	for_all_cpus_from(cpu, 1)
+
 /*
  * Do not broadcast Intel's INIT-SIPI-SIPI sequence as this
  * may wake-up CPUs marked by the BIOS as faulty, or defeat
  * the user choice of disabing a certain core in BIOS setup.
  *
- * The trampoline code cannot also be executed in parallel.
+ * Rather, send the sequence to each AP core, but to all of
+ * them at once: all cores wait for the same INIT delay, and
+ * run the trampoline in parallel. Each then checks-in using
+ * its own bit in the alive CPUs bitmap.
  *
  * FIXME: 200 micro-second delay between the SIPIs
  * FIXME: fine-grained timeouts using micro-seconds
  */
-static int start_secondary_cpu(struct percpu *cpu, struct smpboot_params *params)
+static int start_secondary_cpus(struct smpboot_params *params)
 {
-	int count, acked, timeout, apic_id;
-
-	barrier();
-	count = nr_alive_cpus;
-	apic_id = cpu->apic_id;
+	struct smpboot_cpu_params *slot;
+	struct percpu *cpu;
+	int nr_cpus, timeout;
 
 	/*
 	 * Personally allocate a 'current' thread descriptor and a stack
-	 * for the given CPU. It can't do this by itself since kmalloc()
+	 * for each CPU. It can't do this by itself since kmalloc()
 	 * uses lots of spinlocks, which need an already allocated
 	 * 'current' thread descriptor (cyclic dependency.)
 	 *
 	 * We've statically allocated such structures for the boot core.
 	 */
+	for_all_cpus_except_bootstrap(cpu) {
+		assert(cpu->apic_id < SMPBOOT_APIC_IDS);
+		slot = &params->cpus[cpu->apic_id];
 
-	/* All cores initialize their own 'current'; dont do it for 'em. */
-	cpu->__current = kmalloc(sizeof(struct proc));
-
-	params->stack_ptr = kmalloc(STACK_SIZE);
-	params->stack_ptr += STACK_SIZE;
-	params->percpu_area_ptr = cpu;
+		/* All cores initialize their own 'current' */
+		cpu->__current = kmalloc(sizeof(struct proc));
 
-	memcpy(TRAMPOLINE_PARAMS, params, sizeof(*params));
+		slot->stack_ptr = kmalloc(STACK_SIZE);
+		slot->stack_ptr += STACK_SIZE;
+		slot->percpu_area_ptr = cpu;
+	}
 
-	/* INIT: wakeup the core from its deep (IF=0)
-	 * halted state and let it wait for the SIPIs */
-	send_init_ipi(apic_id);
-	acked = apic_ipi_acked();
-	if (!acked) {
-		printk("SMP: Failed to deliver INIT to CPU#%d\n", apic_id);
-		goto fail;
+	/* INIT: wakeup the cores from their deep (IF=0)
+	 * halted state and let them wait for the SIPIs */
+	for_all_cpus_except_bootstrap(cpu) {
+		send_init_ipi(cpu->apic_id);
+		if (!apic_ipi_acked()) {
+			printk("SMP: Failed to deliver INIT to CPU#%d\n",
+			       cpu->apic_id);
+			return -1;
+		}
 	}
 
-	pit_mdelay(10);
+	mdelay(10);
 
+	/* A SIPI is ignored by cores already out of the wait-
+	 * for-SIPI state: resend to whoever did not check-in */
 	for (int j = 1; j <= MAX_SIPI_RETRY; j++) {
-		send_startup_ipi(apic_id, SMPBOOT_START);
-		acked = apic_ipi_acked();
-		if (acked)
-			break;
-
-		printk("SMP: Failed to deliver SIPI#%d to CPU#%d\n",
-		       j, apic_id);
-
-		if (j == MAX_SIPI_RETRY) {
-			printk("SMP: Giving-up SIPI delivery\n");
-			goto fail;
+		for_all_cpus_except_bootstrap(cpu) {
+			if (cpu_alive(cpu))
+				continue;
+
+			send_startup_ipi(cpu->apic_id, SMPBOOT_START);
+			if (!apic_ipi_acked())
+				printk("SMP: Failed to deliver SIPI#%d to "
+				       "CPU#%d\n", j, cpu->apic_id);
 		}
-
-		printk("SMP: Retrying SIPI delivery\n");
+		mdelay(1);
 	}
 
-	/* The just-started AP core should now signal us
-	 * by incrementing the active-CPUs counter by one */
+	/* The just-started AP cores should now signal us
+	 * by checking-in to the alive CPUs bitmap */
+	nr_cpus = mptables_get_nr_cpus();
 	timeout = 1000;
-	while (timeout-- && count == nr_alive_cpus) {
-		barrier();
-		pit_mdelay(1);
-	}
+	while (timeout-- && smpboot_get_nr_alive_cpus() != nr_cpus)
+		mdelay(1);
 	if (timeout == -1) {
-		printk("SMP: Timeout waiting for CPU#%d to start\n",
-		       apic_id);
-		goto fail;
+		for_all_cpus_except_bootstrap(cpu) {
+			if (!cpu_alive(cpu))
+				printk("SMP: Timeout waiting for CPU#%d to "
+				       "start\n", cpu->apic_id);
+		}
+		return -1;
 	}
 
 	return 0;
-
-fail:
-	kfree(cpu->__current);
-	kfree(params->stack_ptr - STACK_SIZE);
-	return 1;
 }
 
-/*
- * @cpu: iterator of type ‘struct percpu *’.
- */
-#define for_all_cpus(cpu)			\
-	for (cpu = &cpus[0]; cpu != &cpus[mptables_get_nr_cpus()]; cpu++)
-#define for_all_cpus_except_bootstrap(cpu)	\
-	for (cpu = &cpus[1]; cpu != &cpus[mptables_get_nr_cpus()]; cpu++)
-
 /*
  * Before running any test-cases on secondary cores, wait till
  * the bootstrap CPU informs us (poor secondary cores) that it
@@ -232,19 +263,23 @@ void smpboot_trigger_secondary_cores_testcases(void)
  */
 void __no_return secondary_start(void)
 {
-	union apic_id id;
+	uint32_t id;
 
 	/* Quickly tell the parent we're alive */
-	++nr_alive_cpus;
+	atomic_bit_set(alive_cpus.bits, ((struct percpu *)get_gs())->id);
+	atomic_inc(&nr_alive_cpus);
 
 	schedulify_this_code_path(SECONDARY);
 	apic_local_regs_init();
 
 	/* Assert validity of our per-CPU area */
-	id.raw = apic_read(APIC_ID);
-	assert(id.id == percpu_get(apic_id));
+	id = apic_get_id();
+	assert(id == (uint32_t)percpu_get(apic_id));
+
+	printk("SMP: CPU apic_id=%d started\n", id);
 
-	printk("SMP: CPU apic_id=%d started\n", id.id);
+	/* Nothing to do till the test-cases; inflate the ramdisk */
+	ramdisk_inflate();
 
 	local_irq_enable();
 	while (start_running_testcases == false)
@@ -268,29 +303,26 @@ void smpboot_init(void)
 {
 	int nr_cpus;
 	struct smpboot_params *params;
-	struct percpu *cpu;
 
 	smpboot_params_validate_offsets();
 
-	params = kmalloc(sizeof(*params));
-	params->cr3 = get_cr3();
-	params->idtr = get_idt();
-	params->gdtr = get_gdt();
-
 	nr_cpus = mptables_get_nr_cpus();
 	printk("SMP: %d usable CPU(s) found\n", nr_cpus);
 
 	memcpy(TRAMPOLINE_START, trampoline, trampoline_end - trampoline);
+	memset(VIRTUAL(SMPBOOT_PML4), 0, SMPBOOT_PGTABLES_END - SMPBOOT_PML4);
 
-	for_all_cpus_except_bootstrap(cpu) {
-		if (start_secondary_cpu(cpu, params))
-			panic("SMP: Could not start-up all AP cores\n");
-	}
+	params = TRAMPOLINE_PARAMS;
+	memset(params, 0, sizeof(*params));
+	params->cr3 = get_cr3();
+	params->idtr = get_idt();
+	params->gdtr = get_gdt();
 
-	kfree(params);
+	if (start_secondary_cpus(params))
+		panic("SMP: Could not start-up all AP cores\n");
 
 	barrier();
-	assert(nr_alive_cpus == nr_cpus);
+	assert(smpboot_get_nr_alive_cpus() == nr_cpus);
 }
 
 #include <vga.h>
@@ -323,4 +355,5 @@ static void run_secondary_core_testcases(void)
 #endif
 
 	ext2_run_smp_tests();
+	ext2_run_smp_benchmarks();
 }
@@ -35,6 +35,19 @@ uint8_t atomic_bit_test_and_set(uint32_t *val)
 	return ret;
 }
 
+/*
+ * Atomically set bit #@bit of the @bitmap array; @bit
+ * may point beyond the first element.
+ */
+void atomic_bit_set(uint32_t *bitmap, uint32_t bit)
+{
+	asm volatile (
+		"LOCK btsl %1, %0"
+		: "+m" (*bitmap)
+		: "r" (bit)
+		: "cc", "memory");
+}
+
 /*
  * Atomically execute:
  *	return *val++;
@@ -52,6 +65,57 @@ uint64_t atomic_inc(uint64_t *val)
 	return i;
 }
 
+/*
+ * Atomically execute:
+ *	return *val--;
+ */
+uint64_t atomic_dec(uint64_t *val)
+{
+	uint64_t i = -1;
+
+	asm volatile (
+		"LOCK xaddq %0, %1"
+		: "+r"(i), "+m" (*val)
+		:
+		: "cc", "memory");
+
+	return i;
+}
+
+/*
+ * Atomically execute:
+ *	old = *val; *val = new;
+ *	return old;
+ */
+uint64_t atomic_xchg(uint64_t *val, uint64_t new)
+{
+	asm volatile (
+		"xchgq %0, %1"		/* Implicitly LOCKed */
+		: "+r"(new), "+m" (*val)
+		:
+		: "memory");
+
+	return new;
+}
+
+/*
+ * Atomically execute:
+ *	old = *val; if (old == cmp) *val = new;
+ *	return old;
+ */
+uint64_t atomic_cmpxchg(uint64_t *val, uint64_t cmp, uint64_t new)
+{
+	uint64_t old;
+
+	asm volatile (
+		"LOCK cmpxchgq %2, %1"
+		: "=a"(old), "+m" (*val)
+		: "r"(new), "0"(cmp)
+		: "cc", "memory");
+
+	return old;
+}
+
 
 #if    ATOMIC_TESTS
 
@@ -67,6 +131,17 @@ void atomic_run_tests(void)
 	for (uint64_t i = -0x10; i != 0; atomic_inc(&i))
 		printk("0x%lx ", i);
 	putc('\n');
+
+	uint64_t val = 10;
+	if (atomic_dec(&val) != 10 || val != 9)
+		panic("_Atomic: FAIL: atomic_dec");
+	if (atomic_xchg(&val, 0x55) != 9 || val != 0x55)
+		panic("_Atomic: FAIL: atomic_xchg");
+	if (atomic_cmpxchg(&val, 0x66, 0x77) != 0x55 || val != 0x55)
+		panic("_Atomic: FAIL: atomic_cmpxchg, unmatched value");
+	if (atomic_cmpxchg(&val, 0x55, 0x77) != 0x55 || val != 0x77)
+		panic("_Atomic: FAIL: atomic_cmpxchg, matched value");
+	printk("_Atomic: dec, xchg, cmpxchg: Success\n");
 }
 
 #endif /* ATOMIC_TESTS */
@@ -0,0 +1,108 @@
+/*
+ * LZ4 block format decompression
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * A block is a series of sequences, each of:
+ *
+ *	token | [literals length+] | literals | offset | [match length+]
+ *
+ * Token high nibble is the literals length, and its low nibble is
+ * the match length minus 4; a nibble of 15 is extended by following
+ * bytes, added up till a non-255 byte. The match is then copied from
+ * @offset (little-endian, 2 bytes) bytes back in the output. The last
+ * sequence ends right after its literals.
+ *
+ * Input is not trusted: lengths and offsets are checked against both
+ * buffers bounds, ending with -EINVAL on corrupt input.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <lz4.h>
+
+#define MINMATCH	4
+
+/*
+ * Extend a 15-valued token nibble @len by the bytes at @*ip.
+ * Return false if input ended before the length did.
+ */
+static bool lz4_read_len(const uint8_t **ip, const uint8_t *iend,
+			 uint64_t *len)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		byte = *(*ip)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+/*
+ * Decompress the @src_len-bytes block at @src into @dst, a buffer
+ * of @dst_len bytes. Return the decompressed length, or -EINVAL.
+ */
+int64_t lz4_decompress(const void *src, uint64_t src_len, void *dst,
+		       uint64_t dst_len)
+{
+	const uint8_t *ip = src, *iend = ip + src_len, *match;
+	uint8_t *op = dst, *oend = op + dst_len;
+	uint64_t len, offset;
+	uint8_t token;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literals */
+		len = token >> 4;
+		if (len == 15 && !lz4_read_len(&ip, iend, &len))
+			return -EINVAL;
+		if (len > (uint64_t)(iend - ip) || len > (uint64_t)(oend - op))
+			return -EINVAL;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* Last sequence has no match part */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			return -EINVAL;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (uint64_t)(op - (uint8_t *)dst))
+			return -EINVAL;
+		match = op - offset;
+
+		len = token & 0x0f;
+		if (len == 15 && !lz4_read_len(&ip, iend, &len))
+			return -EINVAL;
+		len += MINMATCH;
+		if (len > (uint64_t)(oend - op))
+			return -EINVAL;
+
+		/* Source and destination overlap if the match is
+		 * longer than its offset: copy byte by byte */
+		if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+
+	return op - (uint8_t *)dst;
+}
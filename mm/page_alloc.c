@@ -65,6 +65,7 @@
 #include <spinlock.h>
 #include <ramdisk.h>
 #include <e820.h>
+#include <list.h>
 #include <mm.h>
 #include <tests.h>
 
@@ -324,11 +325,45 @@ out:
 	return page;
 }
 
-struct page *get_free_page(enum zone_id zid)
+/*
+ * Caches holding reclaimable pages, asked to shrink on memory
+ * pressure. Registered once, and never removed.
+ */
+static LIST_NODE(shrinkers);
+static spinlock_t shrinkers_lock = SPIN_UNLOCKED();
+
+#define SHRINK_BATCH	32		/* Pages asked from each cache */
+
+void register_shrinker(struct shrinker *shrinker)
+{
+	assert(shrinker->scan != NULL);
+
+	spin_lock(&shrinkers_lock);
+	list_add_tail(&shrinkers, &shrinker->node);
+	spin_unlock(&shrinkers_lock);
+}
+
+/*
+ * Ask all registered caches to give back their pages. Return
+ * the number of pages freed.
+ */
+static uint64_t shrink_caches(void)
+{
+	struct shrinker *shrinker;
+	uint64_t freed = 0;
+
+	spin_lock(&shrinkers_lock);
+	list_for_each(&shrinkers, shrinker, node)
+		freed += shrinker->scan(SHRINK_BATCH);
+	spin_unlock(&shrinkers_lock);
+
+	return freed;
+}
+
+static struct page *get_page_from_zones(enum zone_id zid)
 {
 	struct zone *zone;
-	struct page *page;
-	uint64_t start, end;
+	struct page *page = NULL;
 
 	if (zid == ZONE_ANY)
 		ascending_prio_for_each(zone) {
@@ -339,6 +374,19 @@ struct page *get_free_page(enum zone_id zid)
 	else
 		page = __get_free_page(zid);
 
+	return page;
+}
+
+struct page *get_free_page(enum zone_id zid)
+{
+	struct zone *zone;
+	struct page *page;
+	uint64_t start, end;
+
+	page = get_page_from_zones(zid);
+	while (page == NULL && shrink_caches() > 0)
+		page = get_page_from_zones(zid);
+
 	if (page == NULL)
 		panic("Memory - No more free pages available at "
 		      "`%s'", get_zone(zid)->description);
@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+# Python-2.6 _AND_ Python3.0+ compatible
+#
+# Usage: $script BASELINE-SERIAL.txt [NEW-SERIAL.txt]
+#
+# Summarize, or compare, the file system benchmark results found in
+# the kernel's COM1 serial port output (EXT2_BENCHMARKS). Each result
+# line has the form:
+#
+#   BENCH name=<test> arg=<n> cpus=<n> ops=<n> bytes=<n> cycles=<n> tsc_hz=<n>
+#
+# Data tests are reported in MB/s, metadata and lookup tests in ops/s.
+# Given two logs, the relative change of the second against the first
+# is printed too; a positive delta is always an improvement.
+#
+
+import sys, re
+
+def usage():
+    usage = '{0} BASELINE-SERIAL.txt [NEW-SERIAL.txt]\n'
+    sys.stderr.write('Usage: ' + usage.format(sys.argv[0]))
+    sys.exit(-1)
+
+if len(sys.argv) not in [2, 3]:
+    usage()
+
+bench_re = re.compile(r'BENCH name=(\w+) arg=(\d+) cpus=(\d+) ops=(\d+) '
+                      r'bytes=(\d+) cycles=(\d+) tsc_hz=(\d+)')
+
+#
+# Return a {(name, arg, cpus): (rate, unit)} dictionary, along
+# with the results order of appearance in the log.
+#
+def parse(path):
+    results, order = {}, []
+    for line in open(path):
+        match = bench_re.search(line)
+        if match is None:
+            continue
+        name = match.group(1)
+        arg, cpus, ops, nbytes, cycles, hz = \
+            [int(x) for x in match.groups()[1:]]
+        secs = float(max(cycles, 1)) / hz
+        if nbytes:
+            rate, unit = nbytes / secs / (1024 * 1024), 'MB/s'
+        else:
+            rate, unit = ops / secs, 'ops/s'
+        key = (name, arg, cpus)
+        if key not in results:
+            order.append(key)
+        results[key] = (rate, unit)
+    return results, order
+
+base, order = parse(sys.argv[1])
+new = {}
+if len(sys.argv) == 3:
+    new, new_order = parse(sys.argv[2])
+    order += [key for key in new_order if key not in base]
+
+fmt = '{0:<12} {1:>6} {2:>5} {3:>14} {4:>14} {5:>9}  {6}'
+print(fmt.format('test', 'arg', 'cpus', 'base', 'new', 'delta', 'unit'))
+for key in order:
+    name, arg, cpus = key
+    rate1, unit = base.get(key, (None, None))
+    rate2, unit2 = new.get(key, (None, None))
+    unit = unit or unit2
+    col1 = '{0:.1f}'.format(rate1) if rate1 is not None else '-'
+    col2 = '{0:.1f}'.format(rate2) if rate2 is not None else '-'
+    delta = '-'
+    if rate1 and rate2 is not None:
+        delta = '{0:+.1f}%'.format((rate2 - rate1) * 100.0 / rate1)
+    print(fmt.format(name, arg, cpus, col1, col2, delta, unit))
@@ -6,7 +6,7 @@
 #  it under the terms of the GNU General Public License as published by
 #  the Free Software Foundation, version 2.
 #
-# Usage: $script
+# Usage: $script [--lz4]
 #        dd if=data/hd-image of=/dev/disk/by-label/$CUTE-DISK-LABEL
 #
 # Build the Cute kernel final image, which is going to be directly
@@ -27,6 +27,18 @@
 # o in plain bytes (without  header len), for the C code accssing
 #   the ramdisk image directly.
 #
+# With '--lz4', the Ramdisk image is LZ4-compressed in independent
+# 64-KB chunks, so that the kernel can inflate them in parallel, or
+# on-demand. The compressed image, in place of the original, is:
+#  o signature, "CUTE-LZ4", 8-bytes
+#  o chunk size, in inflated bytes, 4-bytes
+#  o number of chunks, 4-bytes
+#  o original ramdisk length in bytes, 8-bytes
+#  o chunks table: offset of each chunk, and of the image end,
+#    from the signature start, 4-bytes each
+#  o the compressed chunks. A chunk that does not compress is
+#    stored as-is; the kernel spots it by its unchanged length.
+#
 # Python-2.7 _AND_ Python-3.0+ compatible
 # NOTE! Always read & write the files in binary mode.
 #
@@ -35,6 +47,84 @@ import sys
 import os.path
 import struct
 
+#
+# LZ4 block format compression
+#
+# Use the python 'lz4' module if available. Otherwise, a simple
+# greedy compressor: a bit slow, but it does its job well on file
+# system images, which are mostly zeroes.
+#
+
+def lz4_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+def lz4_sequence(out, literals, offset, match_len):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if match_len:
+        token |= min(match_len - 4, 15)
+    out.append(token)
+    if lit_len >= 15:
+        lz4_length(out, lit_len - 15)
+    out.extend(literals)
+    if match_len:
+        out.extend(struct.pack('<H', offset))
+        if match_len - 4 >= 15:
+            lz4_length(out, match_len - 4 - 15)
+
+def lz4_compress_greedy(src):
+    src = bytearray(src)
+    out = bytearray()
+    table = {}
+    anchor = i = 0
+    # Last match must start 12 bytes, and end 5 bytes, before the end
+    match_limit = len(src) - 12
+    end_limit = len(src) - 5
+    while i < match_limit:
+        key = bytes(src[i:i + 4])
+        ref = table.get(key, -1)
+        table[key] = i
+        if ref < 0 or i - ref > 0xffff:
+            i += 1
+            continue
+        match_len = 4
+        while i + match_len < end_limit and \
+              src[ref + match_len] == src[i + match_len]:
+            match_len += 1
+        lz4_sequence(out, src[anchor:i], i - ref, match_len)
+        i += match_len
+        anchor = i
+    lz4_sequence(out, src[anchor:], 0, 0)
+    return bytes(out)
+
+try:
+    import lz4.block
+    def lz4_compress(src):
+        return lz4.block.compress(src, store_size=False)
+except ImportError:
+    lz4_compress = lz4_compress_greedy
+
+def lz4_ramdisk(buf):
+    chunk_size = 64 * 1024
+    chunks = []
+    for start in range(0, len(buf), chunk_size):
+        chunk = buf[start:start + chunk_size]
+        compressed = lz4_compress(chunk)
+        if len(compressed) >= len(chunk):
+            compressed = chunk
+        chunks.append(compressed)
+    header_length = 8 + 4 + 4 + 8 + 4 * (len(chunks) + 1)
+    offsets = [header_length]
+    for chunk in chunks:
+        offsets.append(offsets[-1] + len(chunk))
+    header = b'CUTE-LZ4' + struct.pack('=IIQ', chunk_size, len(chunks),
+                                       len(buf))
+    header += struct.pack('=%dI' % len(offsets), *offsets)
+    return header + b''.join(chunks)
+
 kernel_folder = 'kern/'
 build_folder  = 'build/'
 kernel_file   = kernel_folder + 'image'
@@ -57,8 +147,10 @@ with open(final_image, 'wb') as f:
 header_length = 8 + 4 + 4 + 8
 ramdisk_length = header_length
 if os.path.exists(ramdisk_file):
-    ramdisk_length += os.path.getsize(ramdisk_file)
     ramdisk_buffer  = open(ramdisk_file, 'rb').read()
+    if '--lz4' in sys.argv[1:] and ramdisk_buffer:
+        ramdisk_buffer = lz4_ramdisk(ramdisk_buffer)
+    ramdisk_length += len(ramdisk_buffer)
 else:
     ramdisk_buffer  = b''
 ramdisk_sectors = (ramdisk_length - 1)//512 + 1
@@ -0,0 +1,220 @@
+/*
+ * Host (userspace) ext2 driver benchmarks
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Same workloads and output format as the in-kernel EXT2_BENCHMARKS,
+ * with time measured in nanoseconds: 'cycles' are ns, and 'tsc_hz' is
+ * thus 10^9. Compare two runs using tools/bench-compare.py.
+ *
+ * Usage: ext2-bench IMAGE [-v]
+ *
+ * The image is mapped privately; it's left untouched at exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "ext2-host.h"
+
+enum {
+	BENCH_FILE_LEN		= 4 * 1024 * 1024,
+	BENCH_NR_FILES		= 1024,
+	BENCH_MAX_DEPTH		= 8,
+	BENCH_LOOKUPS		= 10000,
+	BENCH_IO_MAX		= 64 * 1024,
+};
+
+static const uint64_t io_sizes[] = { 64, 512, 4096, BENCH_IO_MAX };
+
+enum bench_io { SEQ_WRITE, SEQ_READ, RAND_READ, RAND_WRITE };
+
+static const char *io_names[] = {
+	[SEQ_WRITE]	= "seq_write",
+	[SEQ_READ]	= "seq_read",
+	[RAND_READ]	= "rand_read",
+	[RAND_WRITE]	= "rand_write",
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t arg, uint64_t ops,
+		   uint64_t bytes, uint64_t ns)
+{
+	printf("BENCH name=%s arg=%lu cpus=1 ops=%lu bytes=%lu cycles=%lu "
+	       "tsc_hz=1000000000\n", name, arg, ops, bytes, ns);
+}
+
+static void die(const char *what, int64_t err)
+{
+	fprintf(stderr, "ext2-bench: %s failed: errno %ld\n", what, -err);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static uint64_t bench_io(uint64_t inum, enum bench_io type, char *buf,
+			 uint64_t iosize, uint64_t len, uint64_t *seed)
+{
+	uint64_t start, offset, nr_ops;
+	int64_t ret;
+
+	nr_ops = len / iosize;
+	start = now();
+	for (uint64_t i = 0; i < nr_ops; i++) {
+		offset = i * iosize;
+		if (type == RAND_READ || type == RAND_WRITE)
+			offset = (xorshift(seed) % nr_ops) * iosize;
+
+		if (type == SEQ_READ || type == RAND_READ)
+			ret = host_read(inum, buf, offset, iosize);
+		else
+			ret = host_write(inum, buf, offset, iosize);
+		if (ret != (int64_t)iosize)
+			die(io_names[type], ret < 0 ? ret : -EIO);
+	}
+	return now() - start;
+}
+
+static void bench_throughput(void)
+{
+	uint64_t seed, len;
+	int64_t inum;
+	char *buf;
+	int ret;
+
+	inum = host_create("/bench", "data", 0);
+	if (inum < 0)
+		die("create", inum);
+
+	for (len = BENCH_FILE_LEN; ; len /= 2) {
+		if ((ret = host_fallocate(inum, 0, len)) == 0)
+			break;
+		if (ret != -ENOSPC || len <= BENCH_IO_MAX)
+			die("fallocate", ret);
+		host_truncate(inum, 0);
+	}
+
+	buf = malloc(BENCH_IO_MAX);
+	memset(buf, 0xa5, BENCH_IO_MAX);
+	seed = 0x2545f4914f6cdd1d;
+	for (unsigned i = 0; i < sizeof(io_sizes) / sizeof(io_sizes[0]); i++) {
+		host_truncate(inum, 0);
+		for (int type = SEQ_WRITE; type <= RAND_WRITE; type++)
+			report(io_names[type], io_sizes[i], len / io_sizes[i],
+			       len, bench_io(inum, type, buf, io_sizes[i], len,
+					     &seed));
+	}
+	free(buf);
+
+	if ((ret = host_unlink("/bench", "data")) < 0)
+		die("unlink", ret);
+}
+
+static void bench_metadata(void)
+{
+	static char names[BENCH_NR_FILES][16], paths[BENCH_NR_FILES][32];
+	uint64_t start, size;
+	uint32_t mode;
+	int64_t ret;
+
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "f%d", i);
+		snprintf(paths[i], sizeof(paths[i]), "/bench/f%d", i);
+	}
+
+	start = now();
+	for (int i = 0; i < BENCH_NR_FILES; i++)
+		if ((ret = host_create("/bench", names[i], 0)) < 0)
+			die("create", ret);
+	report("create", 0, BENCH_NR_FILES, 0, now() - start);
+
+	start = now();
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		if ((ret = host_lookup(paths[i])) < 0)
+			die("lookup", ret);
+		host_stat(ret, &mode, &size);
+	}
+	report("stat", 0, BENCH_NR_FILES, 0, now() - start);
+
+	start = now();
+	for (int i = 0; i < BENCH_NR_FILES; i++) {
+		if ((ret = host_lookup(paths[i])) < 0)
+			die("lookup", ret);
+		host_inode_touch(ret);
+	}
+	report("open", 0, BENCH_NR_FILES, 0, now() - start);
+
+	start = now();
+	for (int i = 0; i < BENCH_NR_FILES; i++)
+		if ((ret = host_unlink("/bench", names[i])) < 0)
+			die("unlink", ret);
+	report("unlink", 0, BENCH_NR_FILES, 0, now() - start);
+}
+
+static void bench_lookup(void)
+{
+	char dir[128] = "/bench", path[128];
+	uint64_t start;
+	int64_t ret;
+
+	for (int depth = 1; depth <= BENCH_MAX_DEPTH; depth++) {
+		if ((ret = host_create(dir, "d", 1)) < 0)
+			die("mkdir", ret);
+		strcat(dir, "/d");
+		if ((ret = host_create(dir, "f", 0)) < 0)
+			die("create", ret);
+		snprintf(path, sizeof(path), "%s/f", dir);
+
+		start = now();
+		for (int i = 0; i < BENCH_LOOKUPS; i++)
+			if ((ret = host_lookup(path)) < 0)
+				die("lookup", ret);
+		report("lookup", depth, BENCH_LOOKUPS, 0, now() - start);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t len;
+	void *image;
+	int64_t ret;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s IMAGE [-v]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	host_verbose = (argc > 2 && strcmp(argv[2], "-v") == 0);
+
+	image = host_image_map(argv[1], &len, 0);
+	host_mount(image, len);
+	if ((ret = host_create("/", "bench", 1)) < 0)
+		die("mkdir /bench", ret);
+
+	bench_throughput();
+	bench_metadata();
+	bench_lookup();
+
+	host_image_unmap(image, len);
+	return EXIT_SUCCESS;
+}
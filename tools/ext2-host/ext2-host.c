@@ -0,0 +1,267 @@
+/*
+ * Host (userspace) entry points to the kernel ext2 driver
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Built against the kernel headers: translate the path and inode#
+ * based interface of "ext2-host.h" to in-core inode references.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <errno.h>
+#include <ext2.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <mm.h>
+#include <hash.h>
+#include <bcache.h>
+#include "ext2-host.h"
+
+extern struct {
+	union super_block	*sb;
+	struct group_descriptor **bgd_pages;
+	struct block_device	*bdev;
+	uint64_t		block_size;
+	uint64_t		frag_size;
+	uint64_t		blockgroups_count;
+	uint64_t		last_blockgroup;
+	spinlock_t		inode_allocation_lock;
+	spinlock_t		block_allocation_lock;
+	struct hash		*inodes_hash;
+} isb;
+
+void host_mount(void *image, uint64_t len)
+{
+	host_thread_init(0);
+	host_ramdisk_set(image, len);
+	ext2_init();
+	ext2_debug_init(&null_null_dumper);
+	if (isb.sb == NULL)
+		panic("Host: Given image is too small for an ext2 volume");
+}
+
+/*
+ * Drop all in-core state of the mounted volume: superblock, group
+ * descriptors, and the (by now empty) inodes hash. Dirty cache pages
+ * are dropped, not written, by the next host_mount().
+ */
+void host_umount(void)
+{
+	uint64_t nr_pages;
+
+	nr_pages = ceil_div(isb.blockgroups_count *
+			    sizeof(struct group_descriptor), PAGE_SIZE);
+	for (uint64_t i = 0; i < nr_pages; i++)
+		free_page(addr_to_page(isb.bgd_pages[i]));
+	kfree(isb.bgd_pages);
+	kfree(isb.sb);
+	hash_free(isb.inodes_hash);
+	isb.sb = NULL;
+}
+
+/*
+ * Write all cached volume changes back to the image
+ */
+int host_sync(void)
+{
+	return bcache_sync(isb.bdev);
+}
+
+int64_t host_lookup(const char *path)
+{
+	return name_i(path);
+}
+
+/*
+ * Return a referenced in-core inode for directory @dir_path,
+ * or NULL with an errno in @err.
+ */
+static struct inode *dir_get(const char *dir_path, int64_t *err)
+{
+	struct inode *dir;
+	int64_t inum;
+
+	inum = name_i(dir_path);
+	if (inum < 0) {
+		*err = inum;
+		return NULL;
+	}
+	dir = inode_get(inum);
+	if (!S_ISDIR(dir->mode)) {
+		inode_put(dir);
+		*err = -ENOTDIR;
+		return NULL;
+	}
+	return dir;
+}
+
+int64_t host_create(const char *dir_path, const char *name, int is_dir)
+{
+	struct inode *dir;
+	int64_t ret;
+
+	dir = dir_get(dir_path, &ret);
+	if (dir == NULL)
+		return ret;
+	ret = file_new(dir, name, is_dir ? EXT2_FT_DIR : EXT2_FT_REG_FILE);
+	inode_put(dir);
+	return ret;
+}
+
+int host_unlink(const char *dir_path, const char *name)
+{
+	struct inode *dir;
+	int64_t ret;
+
+	dir = dir_get(dir_path, &ret);
+	if (dir == NULL)
+		return ret;
+	ret = file_delete(dir, name);
+	inode_put(dir);
+	return ret;
+}
+
+int64_t host_read(uint64_t inum, void *buf, uint64_t offset, uint64_t len)
+{
+	struct inode *inode;
+	int64_t ret;
+
+	inode = inode_get(inum);
+	ret = file_read(inode, buf, offset, len);
+	inode_put(inode);
+	return ret;
+}
+
+int64_t host_write(uint64_t inum, void *buf, uint64_t offset, uint64_t len)
+{
+	struct inode *inode;
+	int64_t ret;
+
+	inode = inode_get(inum);
+	ret = file_write(inode, buf, offset, len);
+	inode_put(inode);
+	return ret;
+}
+
+int host_truncate(uint64_t inum, uint64_t len)
+{
+	struct inode *inode;
+	int ret;
+
+	inode = inode_get(inum);
+	ret = file_truncate(inode, len);
+	inode_put(inode);
+	return ret;
+}
+
+int host_fallocate(uint64_t inum, uint64_t offset, uint64_t len)
+{
+	struct inode *inode;
+	int ret;
+
+	inode = inode_get(inum);
+	ret = file_fallocate(inode, offset, len, false);
+	inode_put(inode);
+	return ret;
+}
+
+int host_stat(uint64_t inum, uint32_t *mode, uint64_t *size)
+{
+	struct inode *inode;
+
+	if (inum == 0 || inum > isb.sb->inodes_count)
+		return -EINVAL;
+	inode = inode_get(inum);
+	*mode = inode->mode;
+	*size = inode_size(inode);
+	inode_put(inode);
+	return 0;
+}
+
+void host_inode_touch(uint64_t inum)
+{
+	inode_put(inode_get(inum));
+}
+
+/*
+ * Allocate, then free, @count regular-file inodes. Return the
+ * number of successful allocations.
+ */
+int host_inode_churn(int count)
+{
+	struct inode **inodes;
+	int n;
+
+	assert(count * sizeof(*inodes) <= MAXALLOC_SZ);
+	inodes = kmalloc(count * sizeof(*inodes));
+	for (n = 0; n < count; n++) {
+		inodes[n] = inode_alloc(EXT2_FT_REG_FILE);
+		if (inodes[n] == NULL)
+			break;
+	}
+	for (int i = 0; i < n; i++) {
+		inode_mark_delete(inodes[i]);
+		inode_put(inodes[i]);
+	}
+	kfree(inodes);
+	return n;
+}
+
+uint64_t host_inodes_count(void)
+{
+	return isb.sb->inodes_count;
+}
+
+/*
+ * Replace directory #inum contents by the given raw, possibly
+ * corrupt, directory entries.
+ */
+void host_dir_replace(uint64_t inum, void *data, uint64_t len)
+{
+	struct inode *dir;
+	int64_t ret;
+
+	dir = inode_get(inum);
+	assert(S_ISDIR(dir->mode));
+	ret = file_write(dir, data, 0, len);
+	if (ret != (int64_t)len)
+		panic("Host: Replacing dir #%lu entries returned %ld", inum, ret);
+	dir->size_low = len;
+	dir->dirty = true;
+	inode_put(dir);
+}
+
+/*
+ * Run the directory-parsing paths over directory #inum, located at
+ * @dir_path: entry lookups, a new entry insertion, then its removal.
+ */
+void host_dir_exercise(const char *dir_path, uint64_t inum)
+{
+	static const char *names[] = { ".", "..", "a", "lost+found" };
+	struct dir_entry *dentry;
+	struct inode *dir;
+	char path[128];
+	int64_t offset, ret;
+
+	dir = inode_get(inum);
+	for (uint i = 0; i < ARRAY_SIZE(names); i++) {
+		find_dir_entry(dir, names[i], strlen(names[i]), &dentry,
+			       &offset);
+		kfree(dentry);
+	}
+
+	ret = file_new(dir, "fuzz-entry", EXT2_FT_REG_FILE);
+	if (ret >= 0) {
+		strncpy(path, dir_path, sizeof(path) - 16);
+		path[sizeof(path) - 16] = '\0';
+		strncpy(path + strlen(path), "/fuzz-entry", 16);
+		assert(name_i(path) == ret);
+		assert(file_delete(dir, "fuzz-entry") == 0);
+	}
+	inode_put(dir);
+}
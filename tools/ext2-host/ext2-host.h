@@ -0,0 +1,53 @@
+#ifndef _EXT2_HOST_H
+#define _EXT2_HOST_H
+
+/*
+ * Kernel ext2 driver, as seen by host (userspace) programs
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * This header is shared between code built against the kernel headers,
+ * and host programs built against the C library: only use types which
+ * are identical on both sides.
+ *
+ * Return values follow the kernel conventions: negative errnos on
+ * failure, and panic(), thus abort(), on file system corruption.
+ */
+
+#include <stdint.h>
+
+extern int host_verbose;		/* Print kernel printk() output? */
+
+/* Shim (shim.c) */
+void host_thread_init(int id);
+void host_ramdisk_set(void *buf, uint64_t len);
+
+/* Image helpers (image.c) */
+void *host_image_map(const char *path, uint64_t *len, int writable);
+void host_image_unmap(void *image, uint64_t len);
+
+/* File system entry points (ext2-host.c) */
+void host_mount(void *image, uint64_t len);
+void host_umount(void);
+int host_sync(void);
+int64_t host_lookup(const char *path);
+int64_t host_create(const char *dir_path, const char *name, int is_dir);
+int host_unlink(const char *dir_path, const char *name);
+int64_t host_read(uint64_t inum, void *buf, uint64_t offset, uint64_t len);
+int64_t host_write(uint64_t inum, void *buf, uint64_t offset, uint64_t len);
+int host_truncate(uint64_t inum, uint64_t len);
+int host_fallocate(uint64_t inum, uint64_t offset, uint64_t len);
+int host_stat(uint64_t inum, uint32_t *mode, uint64_t *size);
+void host_inode_touch(uint64_t inum);
+int host_inode_churn(int count);
+uint64_t host_inodes_count(void);
+
+/* Directory parsing, for fuzzers */
+void host_dir_replace(uint64_t inum, void *data, uint64_t len);
+void host_dir_exercise(const char *dir_path, uint64_t inum);
+
+#endif /* _EXT2_HOST_H */
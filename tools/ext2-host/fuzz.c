@@ -0,0 +1,120 @@
+/*
+ * Host (userspace) fuzzer of the ext2 directory parsing code
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Each input becomes the raw contents of directory '/fuzz', which is
+ * then searched, extended by a new entry, and shrunk back. The volume
+ * is restored from a pristine copy, and re-mounted, before every run:
+ * no cached block or in-core metadata may leak from the previous one.
+ *
+ * Corrupt entries must be rejected with an errno; a driver panic()
+ * calls abort(), which is reported by the fuzzer as a crash.
+ *
+ * libFuzzer:	make fuzz-libfuzzer, then run ./ext2-fuzz-libfuzzer
+ * AFL:		make CC=afl-gcc, then afl-fuzz -i in -o out ./ext2-fuzz @@
+ * Replay:	./ext2-fuzz FILE...	(stdin if no files are given)
+ *
+ * The volume image is taken from $EXT2_IMAGE, or 'ext2-host.img'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "ext2-host.h"
+
+enum {
+	MAX_INPUT_LEN	= 4 * 4096,	/* Few blocks are enough */
+};
+
+static void *image, *pristine;
+static uint64_t image_len;
+static int64_t fuzz_dir;
+
+static void fuzz_init(void)
+{
+	const char *path;
+
+	path = getenv("EXT2_IMAGE");
+	if (path == NULL)
+		path = "ext2-host.img";
+
+	image = host_image_map(path, &image_len, 0);
+	host_mount(image, image_len);
+	fuzz_dir = host_create("/", "fuzz", 1);
+	if (fuzz_dir < 0) {
+		fprintf(stderr, "Creating /fuzz returned %ld\n", fuzz_dir);
+		exit(EXIT_FAILURE);
+	}
+
+	if (host_sync() < 0) {
+		fprintf(stderr, "Syncing the volume failed\n");
+		exit(EXIT_FAILURE);
+	}
+	pristine = malloc(image_len);
+	memcpy(pristine, image, image_len);
+}
+
+static void fuzz_one(const uint8_t *data, size_t size)
+{
+	static uint8_t buf[MAX_INPUT_LEN];
+
+	if (size > MAX_INPUT_LEN)
+		size = MAX_INPUT_LEN;
+	memcpy(buf, data, size);
+
+	host_umount();
+	memcpy(image, pristine, image_len);
+	host_mount(image, image_len);
+	host_dir_replace(fuzz_dir, buf, size);
+	host_dir_exercise("/fuzz", fuzz_dir);
+}
+
+#ifdef LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (image == NULL)
+		fuzz_init();
+	fuzz_one(data, size);
+	return 0;
+}
+
+#else
+
+static void fuzz_file(FILE *file)
+{
+	static uint8_t data[MAX_INPUT_LEN];
+	size_t size;
+
+	size = fread(data, 1, sizeof(data), file);
+	fuzz_one(data, size);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *file;
+
+	fuzz_init();
+	if (argc < 2)
+		fuzz_file(stdin);
+
+	for (int i = 1; i < argc; i++) {
+		file = fopen(argv[i], "rb");
+		if (file == NULL) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+		fuzz_file(file);
+		fclose(file);
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif	/* LIBFUZZER */
@@ -0,0 +1,50 @@
+/*
+ * Map an ext2 volume image as the host build "ramdisk"
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ext2-host.h"
+
+/*
+ * Unless @writable, the mapping is private: driver writes are
+ * discarded at exit, and the image can be reused across runs.
+ */
+void *host_image_map(const char *path, uint64_t *len, int writable)
+{
+	struct stat st;
+	void *image;
+	int fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+		     writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (image == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+	*len = st.st_size;
+	return image;
+}
+
+void host_image_unmap(void *image, uint64_t len)
+{
+	munmap(image, len);
+}
@@ -0,0 +1,32 @@
+#ifndef _IDT_H
+#define _IDT_H
+
+/*
+ * Interrupts control - Host (userspace) replacement
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * There's no IF flag to toggle in userspace, and no per-CPU state to
+ * protect from IRQ handlers: the per-CPU area is thread-local. Only
+ * the IRQs disabling API used by the block layer is provided.
+ */
+
+#include <kernel.h>
+#include <x86.h>
+
+static inline union x86_rflags local_irq_disable_save(void)
+{
+	union x86_rflags flags = { .raw = 0 };
+
+	return flags;
+}
+
+static inline void local_irq_restore(__unused union x86_rflags flags)
+{
+}
+
+#endif /* _IDT_H */
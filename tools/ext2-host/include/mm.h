@@ -0,0 +1,51 @@
+#ifndef _MM_H
+#define _MM_H
+
+/*
+ * Page allocator - Host (userspace) replacement
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * There are no page frame descriptors in userspace: a 'struct page'
+ * is the page memory itself, allocated from the C library heap. Only
+ * the API used by the block devices page cache is provided.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <paging.h>
+#include <list.h>
+
+enum zone_id {
+	ZONE_1GB = 0,
+	ZONE_ANY = 1,
+};
+
+struct page;
+
+struct page *get_free_page(enum zone_id zid);
+void free_page(struct page *page);
+
+static inline void *page_address(struct page *page)
+{
+	return page;
+}
+
+static inline struct page *addr_to_page(void *addr)
+{
+	return addr;
+}
+
+/* Memory is plentiful: shrinkers are never called */
+struct shrinker {
+	uint64_t (*scan)(uint64_t nr_pages);
+	struct list_node node;
+};
+
+void register_shrinker(struct shrinker *shrinker);
+
+#endif /* _MM_H */
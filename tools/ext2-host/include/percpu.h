@@ -0,0 +1,39 @@
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+/*
+ * Per-CPU bookkeeping - Host (userspace) replacement
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * The kernel reaches its per-CPU area through %gs, which is unusable
+ * in userspace. Shadow the kernel header by a thread-local area, with
+ * each pthread playing the role of a CPU. Only fields touched by the
+ * file system code and its test cases are provided.
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <proc.h>
+
+struct percpu {
+	int apic_id;			/* pthread index; 0 = main thread */
+	uintptr_t dumper;		/* Buffer dumper for ext2 debugging */
+	bool halt_thread_at_end;	/* Unused: threads always return */
+	struct proc *curproc;		/* Host thread descriptor */
+	uintptr_t plug;			/* Block I/O plug, if plugged */
+};
+
+extern __thread struct percpu host_percpu;
+
+#define percpu_get(var)		(host_percpu.var)
+#define percpu_set(var, val)	(host_percpu.var = (val))
+#define percpu_addr(var)	(&host_percpu.var)
+
+#define current			(host_percpu.curproc)
+
+#endif /* _PERCPU_H */
@@ -0,0 +1,219 @@
+/*
+ * Kernel services for the host (userspace) build of the ext2 driver
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * Kernel code is compiled against the kernel headers only: a libc
+ * header would clash with our own <stdint.h>, <string.h>, <sched.h>,
+ * and friends. Thus, the few C library calls used below are declared
+ * by hand.
+ *
+ * - kmalloc()/kfree() map to malloc()/free(), and pages come from
+ *   aligned_alloc()
+ * - Spinlocks keep their kernel test-and-set semantics, but yield the
+ *   processor on contention instead of masking interrupts: a pthread
+ *   holding a lock can get preempted at any time.
+ * - printk()/prints() write to stderr, and only in verbose mode
+ * - panic() aborts, letting fuzzers and debuggers catch it
+ * - The ramdisk is an ext2 image mapped in memory by the caller,
+ *   exported as block device "ram0"
+ */
+
+#include <kernel.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <kmalloc.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <ramdisk.h>
+#include <blkdev.h>
+#include <iosched.h>
+#include <bcache.h>
+#include <mm.h>
+#include <percpu.h>
+#include "ext2-host.h"
+
+/* C library */
+void *malloc(size_t size);
+void *aligned_alloc(size_t alignment, size_t size);
+void free(void *ptr);
+void __no_return abort(void);
+int fprintf(void *stream, const char *fmt, ...);
+int vfprintf(void *stream, const char *fmt, va_list ap);
+extern void *stderr;
+
+/* The C library sched_yield(2) stands for the kernel's <sched.h> one */
+
+__thread struct percpu host_percpu;
+static __thread struct proc host_proc;
+
+static char *ramdisk_buf;
+static uint64_t ramdisk_len;
+int host_verbose;
+
+void host_thread_init(int id)
+{
+	host_proc.pid = id;
+	host_proc.working_dir = EXT2_ROOT_INODE;
+	host_percpu.apic_id = id;
+	host_percpu.dumper = (uintptr_t)&null_null_dumper;
+	host_percpu.curproc = &host_proc;
+}
+
+static void ramdisk_submit(__unused struct block_device *bdev, struct bio *rq)
+{
+	struct bio *bio;
+	char *addr;
+	uint64_t len;
+
+	rq_for_each_bio(bio, rq) {
+		addr = ramdisk_buf + (bio->sector << SECTOR_SHIFT);
+		len = bio->nr_sectors << SECTOR_SHIFT;
+		switch (bio->op) {
+		case BIO_READ:	memcpy(bio->buf, addr, len); break;
+		case BIO_WRITE:	memcpy(addr, bio->buf, len); break;
+		}
+	}
+	bio_endio(rq, 0);
+}
+
+static struct block_device_ops ramdisk_ops = {
+	.submit = ramdisk_submit,
+};
+
+/* No seeks, and nothing to wait for: no reordering or holding back */
+static struct block_device ramdisk_bdev = {
+	.name = "ram0",
+	.ops = &ramdisk_ops,
+	.max_segments = 32,
+	.iosched = &noop_iosched,
+};
+
+/*
+ * Images may get re-mounted, e.g. once per fuzzer input: register
+ * the device only once, and just update its backing memory later.
+ * The previous image's cached pages are stale by then.
+ */
+void host_ramdisk_set(void *buf, uint64_t len)
+{
+	ramdisk_buf = buf;
+	ramdisk_len = len;
+	ramdisk_bdev.nr_sectors = len >> SECTOR_SHIFT;
+	if (blkdev_find(ramdisk_bdev.name) == NULL) {
+		bcache_init();
+		blkdev_register(&ramdisk_bdev);
+	} else {
+		bcache_invalidate(&ramdisk_bdev);
+	}
+}
+
+char *ramdisk_get_buf(void)
+{
+	return ramdisk_buf;
+}
+
+int ramdisk_get_len(void)
+{
+	return ramdisk_len;
+}
+
+void *__kmalloc(int bucket_idx)
+{
+	void *buf;
+
+	buf = malloc(1UL << bucket_idx);
+	if (buf == NULL)
+		panic("Host: out of memory");
+	return buf;
+}
+
+void kfree(void *addr)
+{
+	free(addr);
+}
+
+struct page *get_free_page(__unused enum zone_id zid)
+{
+	void *page;
+
+	page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	if (page == NULL)
+		panic("Host: out of memory");
+	return page;
+}
+
+void free_page(struct page *page)
+{
+	free(page);
+}
+
+void register_shrinker(__unused struct shrinker *shrinker)
+{
+}
+
+void spin_init(spinlock_t *lock)
+{
+	lock->val = _SPIN_UNLOCKED;
+}
+
+void spin_lock(spinlock_t *lock)
+{
+	while (atomic_bit_test_and_set(&lock->val) == _SPIN_LOCKED) {
+		while (lock->val == _SPIN_LOCKED) {
+			barrier();
+			sched_yield();
+		}
+	}
+}
+
+bool spin_trylock(spinlock_t *lock)
+{
+	return atomic_bit_test_and_set(&lock->val) != _SPIN_LOCKED;
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+	barrier();
+	lock->val = _SPIN_UNLOCKED;
+}
+
+void printk(const char *fmt, ...)
+{
+	va_list args;
+
+	if (host_verbose == false)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void prints(const char *fmt, ...)
+{
+	va_list args;
+
+	if (host_verbose == false)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void __no_return panic(const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "PANIC: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+
+	abort();
+}
@@ -0,0 +1,128 @@
+/*
+ * Host (userspace) SMP stress test of the ext2 driver
+ *
+ * Copyright (C) 2013 Ahmed S. Darwish <darwish.07@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, version 2.
+ *
+ * The pthreads version of the kernel EXT2_SMP_TESTS: concurrent inode
+ * allocation and deallocation, inode fetch-and-put fuzzing, and file
+ * reads verified against their known contents.
+ *
+ * Concurrent directory writers are not run: inode locks are not yet
+ * implemented, and the file system state could get corrupted.
+ *
+ * Usage: ext2-stress IMAGE [nr-threads] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "ext2-host.h"
+
+enum {
+	NR_FILES	= 16,
+	FILE_LEN	= 64 * 1024,
+};
+
+static int64_t files[NR_FILES];
+static int iterations = 100;
+
+/* Each byte of file #i equals (offset + i) % 251 */
+static char file_byte(int i, uint64_t offset)
+{
+	return (offset + i) % 251;
+}
+
+static void *stress_thread(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	char *buf;
+	int64_t ret;
+
+	host_thread_init(id);
+	buf = malloc(FILE_LEN);
+
+	for (int iter = 0; iter < iterations; iter++) {
+		switch ((id + iter) % 3) {
+		case 0:
+			host_inode_churn(64);
+			break;
+		case 1:
+			for (uint64_t ino = 1; ino <= host_inodes_count(); ino++)
+				host_inode_touch(ino);
+			break;
+		case 2:
+			for (int i = 0; i < NR_FILES; i++) {
+				ret = host_read(files[i], buf, 0, FILE_LEN);
+				if (ret != FILE_LEN) {
+					fprintf(stderr, "t%d: file %d read "
+						"returned %ld\n", id, i, ret);
+					abort();
+				}
+				for (uint64_t j = 0; j < FILE_LEN; j++)
+					if (buf[j] != file_byte(i, j)) {
+						fprintf(stderr, "t%d: file %d "
+							"corrupt at %lu\n",
+							id, i, j);
+						abort();
+					}
+			}
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *threads;
+	int nr_threads;
+	char name[16], *buf;
+	uint64_t len;
+	void *image;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s IMAGE [nr-threads] [iterations]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	nr_threads = (argc > 2) ? atoi(argv[2]) : 8;
+	iterations = (argc > 3) ? atoi(argv[3]) : iterations;
+
+	image = host_image_map(argv[1], &len, 0);
+	host_mount(image, len);
+
+	if (host_create("/", "stress", 1) < 0)
+		abort();
+	buf = malloc(FILE_LEN);
+	for (int i = 0; i < NR_FILES; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		files[i] = host_create("/stress", name, 0);
+		for (uint64_t j = 0; j < FILE_LEN; j++)
+			buf[j] = file_byte(i, j);
+		if (files[i] < 0 || host_write(files[i], buf, 0, FILE_LEN) !=
+		    FILE_LEN) {
+			fprintf(stderr, "Creating /stress/%s failed\n", name);
+			return EXIT_FAILURE;
+		}
+	}
+	free(buf);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	for (int i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, stress_thread,
+			       (void *)(intptr_t)(i + 1));
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("ext2-stress: %d threads x %d iterations passed\n",
+	       nr_threads, iterations);
+	host_image_unmap(image, len);
+	return EXIT_SUCCESS;
+}